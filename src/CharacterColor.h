@@ -132,6 +132,32 @@ public:
         return _colorSpace != COLOR_SPACE_UNDEFINED;
     }
 
+    /** Returns the color space of this color, one of the COLOR_SPACE_* values. */
+    int colorSpace() const
+    {
+        return _colorSpace;
+    }
+
+    /**
+     * Returns the number of this color within its color space: 0 for the
+     * default foreground and 1 for the default background color, 0 to 7 for
+     * system colors, 0 to 255 for colors of the 256 color palette and the
+     * 0xRRGGBB value of RGB colors.
+     */
+    int colorNumber() const
+    {
+        if (_colorSpace == COLOR_SPACE_RGB) {
+            return ((_u & 0xff) << 16) | ((_v & 0xff) << 8) | (_w & 0xff);
+        }
+        return _u;
+    }
+
+    /** Returns true if this is an intensive system or default color, see setIntensive() */
+    bool isIntensive() const
+    {
+        return (_colorSpace == COLOR_SPACE_SYSTEM || _colorSpace == COLOR_SPACE_DEFAULT) && _v == 1;
+    }
+
     /**
      * Set this color as an intensive system color.
      *
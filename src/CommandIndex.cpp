@@ -0,0 +1,209 @@
+/*
+    This file is part of Konsole, a terminal emulator for KDE.
+
+    Copyright 2018 by The Konsole Developers
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+
+// Own
+#include "CommandIndex.h"
+
+// System
+#include <algorithm>
+
+using namespace Konsole;
+
+// the number of dropped commands kept at the start of the list before
+// they are removed from it
+static const int COMPACT_THRESHOLD = 256;
+
+CommandIndex::CommandIndex() :
+    _commands(QVector<Command>()),
+    _firstCommand(0),
+    _addedLines(0),
+    _firstLine(0)
+{
+}
+
+void CommandIndex::addMark(Mark mark, int line, int column, int exitCode)
+{
+    // screen lines start after the lines of the history
+    const Position position = {line + _firstLine, column};
+
+    if (mark == PromptStart) {
+        // the lines of later commands have been cleared or are redrawn,
+        // for example by a shell redrawing its prompt
+        const int count = commandCount();
+        int i = count;
+        while (i > 0 && _commands[_firstCommand + i - 1].prompt.line >= position.line) {
+            i--;
+        }
+        _commands.resize(_firstCommand + i);
+
+        const Position unknown = {-1, 0};
+        const Command command = {position, unknown, unknown, unknown, -1};
+        _commands.append(command);
+        return;
+    }
+
+    if (commandCount() == 0) {
+        return;
+    }
+
+    Command &command = _commands.last();
+    if (position.line < command.prompt.line
+        || (position.line == command.prompt.line && position.column < command.prompt.column)) {
+        return;
+    }
+
+    switch (mark) {
+    case CommandStart:
+        command.command = position;
+        break;
+    case OutputStart:
+        command.output = position;
+        break;
+    case CommandEnd:
+        command.end = position;
+        command.exitCode = exitCode;
+        break;
+    case PromptStart:
+        break;
+    }
+}
+
+void CommandIndex::addLine()
+{
+    _addedLines++;
+}
+
+void CommandIndex::setLineCount(int lineCount)
+{
+    _firstLine = _addedLines - lineCount;
+    dropCommands();
+}
+
+void CommandIndex::clear()
+{
+    _commands.clear();
+    _firstCommand = 0;
+    _addedLines = 0;
+    _firstLine = 0;
+}
+
+int CommandIndex::commandCount() const
+{
+    return _commands.count() - _firstCommand;
+}
+
+CommandIndex::Position CommandIndex::toScreen(const Position &position) const
+{
+    if (position.line < 0) {
+        return position;
+    }
+    if (position.line < _firstLine) {
+        const Position start = {0, 0};
+        return start;
+    }
+    const Position screenPosition = {position.line - _firstLine, position.column};
+    return screenPosition;
+}
+
+CommandIndex::Command CommandIndex::command(int index) const
+{
+    Q_ASSERT(index >= 0 && index < commandCount());
+
+    Command command = _commands.at(_firstCommand + index);
+    command.prompt = toScreen(command.prompt);
+    command.command = toScreen(command.command);
+    command.output = toScreen(command.output);
+    command.end = toScreen(command.end);
+    return command;
+}
+
+int CommandIndex::findCommand(int line) const
+{
+    const int position = line + _firstLine;
+    const auto begin = _commands.constBegin() + _firstCommand;
+    const auto next = std::upper_bound(begin, _commands.constEnd(), position,
+                                       [](int value, const Command &command) {
+                                           return value < command.prompt.line;
+                                       });
+    return static_cast<int>(next - begin) - 1;
+}
+
+int CommandIndex::previousPrompt(int line) const
+{
+    // the command at the line may start on the line itself
+    int index = findCommand(line);
+    if (index >= 0 && _commands.at(_firstCommand + index).prompt.line >= line + _firstLine) {
+        index--;
+    }
+    return index >= 0 ? toScreen(_commands.at(_firstCommand + index).prompt).line : -1;
+}
+
+int CommandIndex::nextPrompt(int line) const
+{
+    const int index = findCommand(line) + 1;
+    return index < commandCount() ? toScreen(_commands.at(_firstCommand + index).prompt).line : -1;
+}
+
+bool CommandIndex::commandOutput(int index, Position &start, Position &end) const
+{
+    const Command current = command(index);
+    if (current.output.line < 0) {
+        return false;
+    }
+
+    start = current.output;
+    if (current.end.line >= 0) {
+        end = current.end;
+    } else if (index + 1 < commandCount()) {
+        end = command(index + 1).prompt;
+    } else {
+        end.line = -1;
+        end.column = 0;
+    }
+    return true;
+}
+
+int CommandIndex::lastLine(const Command &command) const
+{
+    return qMax(qMax(command.prompt.line, command.command.line), qMax(command.output.line, command.end.line));
+}
+
+void CommandIndex::dropCommands()
+{
+    // the output of a command runs until its end mark or the next prompt,
+    // a command is dropped once all of its lines have been dropped
+    while (commandCount() > 0) {
+        const Command &first = _commands.at(_firstCommand);
+        const bool dropped = commandCount() > 1
+                             ? _commands.at(_firstCommand + 1).prompt.line <= _firstLine
+                             : first.end.line >= 0 && lastLine(first) < _firstLine;
+        if (!dropped) {
+            break;
+        }
+        _firstCommand++;
+    }
+
+    if (_firstCommand >= COMPACT_THRESHOLD && _firstCommand * 2 >= _commands.size()) {
+        _commands.remove(0, _firstCommand);
+        _firstCommand = 0;
+    }
+}
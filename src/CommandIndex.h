@@ -0,0 +1,148 @@
+/*
+    This file is part of Konsole, a terminal emulator for KDE.
+
+    Copyright 2018 by The Konsole Developers
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+
+#ifndef COMMANDINDEX_H
+#define COMMANDINDEX_H
+
+// Qt
+#include <QVector>
+
+// Konsole
+#include "konsoleprivate_export.h"
+
+namespace Konsole {
+/**
+ * An index of the commands run in a terminal, built from the marks shells
+ * send for their prompts, the commands entered at them and the output of
+ * the commands (OSC 133, first used by FinalTerm):
+ *
+ *     ESC ] 133 ; A ST    the prompt starts
+ *     ESC ] 133 ; B ST    the command line starts, after the prompt
+ *     ESC ] 133 ; C ST    the command was entered, its output starts
+ *     ESC ] 133 ; D [; exit code] ST    the command has finished
+ *
+ * The marks are recorded at the position of the cursor, with the line
+ * numbers of the screen: the lines of the history followed by those of the
+ * screen image.  Like HistoryIndex the index is told about lines moving into
+ * the history with addLine() and about lines dropped from it with
+ * setLineCount(), so that it does not have to be updated for each line.
+ *
+ * Commands are sorted by the lines of their prompts, which makes finding the
+ * command at a line, or the prompts before and after it, a binary search.
+ */
+class KONSOLEPRIVATE_EXPORT CommandIndex
+{
+public:
+    enum Mark {
+        /** The prompt starts */
+        PromptStart,
+        /** The command line starts */
+        CommandStart,
+        /** The output of the command starts */
+        OutputStart,
+        /** The command has finished */
+        CommandEnd
+    };
+
+    /** A position in the lines of the screen, line is -1 if it is not known */
+    struct Position {
+        int line;
+        int column;
+    };
+
+    /** A command and the positions of its marks */
+    struct Command {
+        Position prompt;
+        Position command;
+        Position output;
+        Position end;
+        /** The exit code passed with the CommandEnd mark, or -1 */
+        int exitCode;
+    };
+
+    CommandIndex();
+
+    /**
+     * Records @p mark at @p line and @p column.  A prompt starts a new
+     * command and drops the commands at or after its line, whose lines have
+     * been cleared or overwritten.  Other marks are recorded for the last
+     * command, unless they come before its prompt.
+     */
+    void addMark(Mark mark, int line, int column, int exitCode = -1);
+
+    /** Tells the index that the first line of the screen image moved into the history. */
+    void addLine();
+
+    /**
+     * Tells the index that the history holds @p lineCount lines.  If it is
+     * less than before, the first lines were dropped, if it is more, lines
+     * were inserted before the others, like lines restored from an archive.
+     */
+    void setLineCount(int lineCount);
+
+    /** Removes all commands from the index. */
+    void clear();
+
+    /** Returns the number of commands in the index */
+    int commandCount() const;
+
+    /**
+     * Returns the command at @p index.  Positions which were dropped with
+     * the first lines of the history are returned as the start of line 0.
+     */
+    Command command(int index) const;
+
+    /** Returns the index of the command at @p line, the last one with its prompt at or before @p line, or -1 */
+    int findCommand(int line) const;
+
+    /** Returns the line of the last prompt before @p line, or -1 */
+    int previousPrompt(int line) const;
+
+    /** Returns the line of the first prompt after @p line, or -1 */
+    int nextPrompt(int line) const;
+
+    /**
+     * Gets the output of the command at @p index, which starts at @p start
+     * and ends before @p end: the end mark of the command, or the next
+     * prompt if it has none.  The line of @p end is -1 while the command is
+     * still running.  Returns false if the command has no output mark.
+     */
+    bool commandOutput(int index, Position &start, Position &end) const;
+
+private:
+    Q_DISABLE_COPY(CommandIndex)
+
+    Position toScreen(const Position &position) const;
+    int lastLine(const Command &command) const;
+    void dropCommands();
+
+    // commands from _firstCommand on, line numbers count all lines moved
+    // into the history since the index was created or cleared, so that they
+    // do not change when lines are dropped
+    QVector<Command> _commands;
+    int _firstCommand;
+    int _addedLines;
+    int _firstLine;
+};
+}
+
+#endif // COMMANDINDEX_H
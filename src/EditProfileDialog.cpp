@@ -37,6 +37,7 @@
 #include <QPushButton>
 #include <QRadialGradient>
 #include <QStandardItem>
+#include <QStandardPaths>
 #include <QTextCodec>
 #include <QTimer>
 #include <QUrl>
@@ -1324,9 +1325,32 @@ void EditProfileDialog::setupScrollingPage(const Profile::Ptr profile)
 
     setupRadio(pageamounts, scrollFullPage);
 
+    // session log
+    _ui->sessionLogModeCombo->setCurrentIndex(profile->property<int>(Profile::SessionLogMode));
+    _ui->sessionLogDirEdit->setText(profile->property<QString>(Profile::SessionLogDirectory));
+    _ui->sessionLogDirEdit->setPlaceholderText(QStandardPaths::writableLocation(QStandardPaths::AppDataLocation)
+                                               + QLatin1String("/logs"));
+    _ui->sessionLogDirEdit->setClearButtonEnabled(true);
+    _ui->sessionLogDirSelectButton->setIcon(QIcon::fromTheme(QStringLiteral("folder-open")));
+    _ui->sessionLogMaxSizeSpinner->setValue(profile->property<int>(Profile::SessionLogMaxSize));
+    _ui->sessionLogMaxPartsSpinner->setValue(profile->property<int>(Profile::SessionLogMaxParts));
+    _ui->sessionLogCompressedButton->setChecked(profile->property<bool>(Profile::SessionLogCompressed));
+
     // signals and slots
     connect(_ui->historySizeWidget, &Konsole::HistorySizeWidget::historySizeChanged, this,
             &Konsole::EditProfileDialog::historySizeChanged);
+    connect(_ui->sessionLogModeCombo, static_cast<void (QComboBox::*)(int)>(&QComboBox::activated),
+            this, &Konsole::EditProfileDialog::sessionLogModeChanged);
+    connect(_ui->sessionLogDirEdit, &QLineEdit::textChanged, this,
+            &Konsole::EditProfileDialog::sessionLogDirChanged);
+    connect(_ui->sessionLogDirSelectButton, &QToolButton::clicked, this,
+            &Konsole::EditProfileDialog::selectSessionLogDir);
+    connect(_ui->sessionLogMaxSizeSpinner, static_cast<void (QSpinBox::*)(int)>(&QSpinBox::valueChanged),
+            this, &Konsole::EditProfileDialog::sessionLogMaxSizeChanged);
+    connect(_ui->sessionLogMaxPartsSpinner, static_cast<void (QSpinBox::*)(int)>(&QSpinBox::valueChanged),
+            this, &Konsole::EditProfileDialog::sessionLogMaxPartsChanged);
+    connect(_ui->sessionLogCompressedButton, &QCheckBox::toggled, this,
+            &Konsole::EditProfileDialog::toggleSessionLogCompressed);
 }
 
 void EditProfileDialog::historySizeChanged(int lineCount)
@@ -1364,6 +1388,43 @@ void EditProfileDialog::scrollHalfPage()
     updateTempProfileProperty(Profile::ScrollFullPage, Enum::ScrollPageHalf);
 }
 
+void EditProfileDialog::sessionLogModeChanged(int mode)
+{
+    updateTempProfileProperty(Profile::SessionLogMode, mode);
+}
+
+void EditProfileDialog::sessionLogDirChanged(const QString &dir)
+{
+    updateTempProfileProperty(Profile::SessionLogDirectory, dir);
+}
+
+void EditProfileDialog::selectSessionLogDir()
+{
+    const QUrl url = QFileDialog::getExistingDirectoryUrl(this,
+                                                          i18n("Select Log Directory"),
+                                                          QUrl::fromUserInput(_ui->sessionLogDirEdit->
+                                                                              text()));
+
+    if (!url.isEmpty()) {
+        _ui->sessionLogDirEdit->setText(url.path());
+    }
+}
+
+void EditProfileDialog::sessionLogMaxSizeChanged(int size)
+{
+    updateTempProfileProperty(Profile::SessionLogMaxSize, size);
+}
+
+void EditProfileDialog::sessionLogMaxPartsChanged(int parts)
+{
+    updateTempProfileProperty(Profile::SessionLogMaxParts, parts);
+}
+
+void EditProfileDialog::toggleSessionLogCompressed(bool compressed)
+{
+    updateTempProfileProperty(Profile::SessionLogCompressed, compressed);
+}
+
 void EditProfileDialog::setupMousePage(const Profile::Ptr profile)
 {
     BooleanOption options[] = {
@@ -160,6 +160,13 @@ private Q_SLOTS:
     void scrollFullPage();
     void scrollHalfPage();
 
+    void sessionLogModeChanged(int mode);
+    void sessionLogDirChanged(const QString &dir);
+    void selectSessionLogDir();
+    void sessionLogMaxSizeChanged(int size);
+    void sessionLogMaxPartsChanged(int parts);
+    void toggleSessionLogCompressed(bool compressed);
+
     // keyboard page
     void editKeyBinding();
     void newKeyBinding();
@@ -23,9 +23,13 @@
 #include "Emulation.h"
 
 // Qt
+#include <QFile>
 #include <QKeyEvent>
+#include <QThread>
 
 // Konsole
+#include "HistoryArchive.h"
+#include "HistoryIndex.h"
 #include "KeyboardTranslator.h"
 #include "KeyboardTranslatorManager.h"
 #include "Screen.h"
@@ -138,13 +142,77 @@ void Emulation::clearHistory()
     _screen[0]->setScroll(_screen[0]->getScroll(), false);
 }
 
+void Emulation::archiveHistory(const QString &fileName) const
+{
+    HistoryArchive::writeInBackground(fileName, _screen[0]->createSnapshot());
+}
+
+bool Emulation::restoreHistory(const QString &fileName)
+{
+    QSharedPointer<HistoryArchive> archive = HistoryArchive::open(fileName);
+
+    // the archive stays mapped, the file is not needed any more
+    QFile::remove(fileName);
+
+    if (archive.isNull()) {
+        return false;
+    }
+
+    _screen[0]->restoreHistory(archive);
+    showBulk();
+
+    return true;
+}
+
+void Emulation::setHistoryIndexEnabled(bool enable)
+{
+    // the alternate screen has no history
+    _screen[0]->setHistoryIndexEnabled(enable);
+}
+
+bool Emulation::isHistoryIndexEnabled() const
+{
+    return _screen[0]->historyIndex() != nullptr;
+}
+
+qint64 Emulation::historyIndexMemoryUsage() const
+{
+    const HistoryIndex *index = _screen[0]->historyIndex();
+    return index != nullptr ? index->memoryUsage() : 0;
+}
+
+bool Emulation::findHistoryCandidates(const QRegularExpression &regExp, QVector<QPair<int, int> > &lines) const
+{
+    const HistoryIndex *index = _currentScreen->historyIndex();
+    return index != nullptr && index->findCandidates(regExp, lines);
+}
+
 void Emulation::setHistory(const HistoryType &history)
 {
     _screen[0]->setScroll(history);
 
+    // large histories are converted in a separate thread
+    QThread *migration = _screen[0]->historyMigration();
+    if (migration != nullptr) {
+        connect(migration, &QThread::finished, this, &Konsole::Emulation::finishHistoryMigration);
+        migration->start();
+    }
+
+    showBulk();
+}
+
+void Emulation::finishHistoryMigration()
+{
+    _screen[0]->finishHistoryMigration();
     showBulk();
 }
 
+void Emulation::releaseMemory()
+{
+    _screen[0]->releaseMemory();
+    _screen[1]->releaseMemory();
+}
+
 const HistoryType &Emulation::history() const
 {
     return _screen[0]->getScroll();
@@ -268,6 +336,11 @@ void Emulation::writeToStream(TerminalCharacterDecoder *decoder, int startLine,
     _currentScreen->writeLinesToStream(decoder, startLine, endLine);
 }
 
+ScreenSnapshot *Emulation::createSnapshot() const
+{
+    return _currentScreen->createSnapshot();
+}
+
 int Emulation::lineCount() const
 {
     // sum number of lines currently on _screen plus number of lines in history
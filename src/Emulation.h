@@ -24,19 +24,23 @@
 #define EMULATION_H
 
 // Qt
+#include <QPair>
 #include <QSize>
 #include <QTextCodec>
 #include <QTimer>
+#include <QVector>
 
 // Konsole
 #include "konsoleprivate_export.h"
 
 class QKeyEvent;
+class QRegularExpression;
 
 namespace Konsole {
 class KeyboardTranslator;
 class HistoryType;
 class Screen;
+class ScreenSnapshot;
 class ScreenWindow;
 class TerminalCharacterDecoder;
 
@@ -151,6 +155,35 @@ public:
     /** Clears the history scroll. */
     void clearHistory();
 
+    /**
+     * Writes the output of the primary screen, its history and its screen image,
+     * to the archive @p fileName in the background.  See HistoryArchive
+     */
+    void archiveHistory(const QString &fileName) const;
+    /**
+     * Restores the lines of the archive @p fileName into the history of the
+     * primary screen and removes the file.  Returns false if @p fileName is
+     * not a valid archive.
+     */
+    bool restoreHistory(const QString &fileName);
+
+    /**
+     * Sets whether the lines in the history are indexed to speed up searches.
+     * See HistoryIndex
+     */
+    void setHistoryIndexEnabled(bool enable);
+    /** Returns true if the lines in the history are indexed.  See setHistoryIndexEnabled() */
+    bool isHistoryIndexEnabled() const;
+    /** Returns the number of bytes used by the history index, or 0 if it is disabled */
+    qint64 historyIndexMemoryUsage() const;
+
+    /**
+     * Looks up the lines of the current screen's history which may contain matches
+     * for @p regExp in the history index.  Returns false if the history is not indexed
+     * or the index cannot be used for @p regExp.  See HistoryIndex::findCandidates()
+     */
+    bool findHistoryCandidates(const QRegularExpression &regExp, QVector<QPair<int, int> > &lines) const;
+
     /**
      * Copies the output history from @p startLine to @p endLine
      * into @p stream, using @p decoder to convert the terminal
@@ -164,6 +197,13 @@ public:
      */
     virtual void writeToStream(TerminalCharacterDecoder *decoder, int startLine, int endLine);
 
+    /**
+     * Returns a read-only copy of the output of the current screen, history
+     * included, which the caller takes ownership of.  Unlike writeToStream(),
+     * the snapshot can be read from another thread.  See ScreenSnapshot
+     */
+    ScreenSnapshot *createSnapshot() const;
+
     /** Returns the codec used to decode incoming characters.  See setCodec() */
     const QTextCodec *codec() const
     {
@@ -262,6 +302,12 @@ public Q_SLOTS:
      */
     void receiveData(const char *text, int length);
 
+    /**
+     * Gives back memory held by the screens and their history which is
+     * not needed to keep the output, e.g. when the system is low on memory.
+     */
+    void releaseMemory();
+
     /**
      * Sends information about the focus lost event to the terminal.
      */
@@ -494,6 +540,9 @@ private Q_SLOTS:
 
     void bracketedPasteModeChanged(bool bracketedPasteMode);
 
+    // swaps in the new history once setHistory() has converted the previous one
+    void finishHistoryMigration();
+
 private:
     Q_DISABLE_COPY(Emulation)
 
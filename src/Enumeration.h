@@ -119,6 +119,19 @@ public:
         NoBell = 3
     };
 
+    /**
+     * This enum describes the ways the output of a session can be logged
+     * to files as it is received.
+     */
+    enum SessionLogModeEnum {
+        /** The output is not logged. */
+        NoSessionLog = 0,
+        /** The output is logged as it is received, escape sequences included. */
+        RawSessionLog = 1,
+        /** The output is logged as UTF-8 text, without escape sequences. */
+        TextSessionLog = 2
+    };
+
     /**
      * This enum describes the strategies available for searching
      * through the session's output.
@@ -33,7 +33,8 @@
 using namespace Konsole;
 
 ExtendedCharTable::ExtendedCharTable() :
-    _extendedCharTable(QHash<ushort, ushort *>())
+    _extendedCharTable(QHash<ushort, ushort *>()),
+    _lock()
 {
 }
 
@@ -52,6 +53,8 @@ ExtendedCharTable ExtendedCharTable::instance;
 
 ushort ExtendedCharTable::createExtendedChar(const ushort *unicodePoints, ushort length)
 {
+    QWriteLocker locker(&_lock);
+
     // look for this sequence of points in the table
     ushort hash = extendedCharHash(unicodePoints, length);
     const ushort initialHash = hash;
@@ -114,9 +117,9 @@ ushort ExtendedCharTable::createExtendedChar(const ushort *unicodePoints, ushort
 ushort *ExtendedCharTable::lookupExtendedChar(ushort hash, ushort &length) const
 {
     // look up index in table and if found, set the length
-    // argument and return a pointer to the character sequence
-
-    ushort *buffer = _extendedCharTable[hash];
+    // argument and return a pointer to the character sequence.  Only the
+    // GUI thread changes the table, so it can read it without locking
+    ushort *buffer = _extendedCharTable.value(hash);
     if (buffer != nullptr) {
         length = buffer[0];
         return buffer + 1;
@@ -126,6 +129,20 @@ ushort *ExtendedCharTable::lookupExtendedChar(ushort hash, ushort &length) const
     }
 }
 
+QVector<ushort> ExtendedCharTable::copyExtendedChar(ushort hash) const
+{
+    QReadLocker locker(&_lock);
+
+    const ushort *buffer = _extendedCharTable.value(hash);
+    if (buffer == nullptr) {
+        return QVector<ushort>();
+    }
+
+    QVector<ushort> chars(buffer[0]);
+    std::copy(buffer + 1, buffer + 1 + buffer[0], chars.begin());
+    return chars;
+}
+
 ushort ExtendedCharTable::extendedCharHash(const ushort *unicodePoints, ushort length) const
 {
     ushort hash = 0;
@@ -24,6 +24,8 @@
 
 // Qt
 #include <QHash>
+#include <QReadWriteLock>
+#include <QVector>
 
 namespace Konsole {
 /**
@@ -60,8 +62,19 @@ public:
      * character sequence.
      *
      * @return A unicode character sequence of size @p length.
+     *
+     * The sequence may be removed from the table when a new one is added,
+     * so this must only be called from the GUI thread, which is the one
+     * adding them.  Other threads use copyExtendedChar().
      */
     ushort *lookupExtendedChar(ushort hash, ushort &length) const;
+    /**
+     * Returns a copy of the sequence of unicode characters which was added
+     * to the table using createExtendedChar(), or an empty vector if there
+     * is none for @p hash.  Unlike lookupExtendedChar(), this may be called
+     * from any thread.
+     */
+    QVector<ushort> copyExtendedChar(ushort hash) const;
 
     /** The global ExtendedCharTable instance. */
     static ExtendedCharTable instance;
@@ -75,6 +88,9 @@ private:
     // in each value is the length of the buffer, followed by the ushorts in the buffer
     // themselves.
     QHash<ushort, ushort *> _extendedCharTable;
+    // guards the table against copyExtendedChar() calls from threads
+    // reading history snapshots while the emulation adds new sequences
+    mutable QReadWriteLock _lock;
 };
 }
 #endif  // end of EXTENDEDCHARTABLE_H
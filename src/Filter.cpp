@@ -22,6 +22,9 @@
 
 #include "konsoledebug.h"
 
+// System
+#include <algorithm>
+
 // Qt
 #include <QAction>
 #include <QApplication>
@@ -214,22 +217,20 @@ void Filter::getLineColumn(int position, int &startLine, int &startColumn)
     Q_ASSERT(_linePositions);
     Q_ASSERT(_buffer);
 
-    for (int i = 0; i < _linePositions->count(); i++) {
-        int nextLine = 0;
-
-        if (i == _linePositions->count() - 1) {
-            nextLine = _buffer->length() + 1;
-        } else {
-            nextLine = _linePositions->value(i + 1);
-        }
+    if (position > _buffer->length()) {
+        return;
+    }
 
-        if (_linePositions->value(i) <= position && position < nextLine) {
-            startLine = i;
-            startColumn = string_width(buffer()->mid(_linePositions->value(i),
-                                                     position - _linePositions->value(i)));
-            return;
-        }
+    // the line positions are sorted, find the last line starting at or before 'position'
+    const int i = std::upper_bound(_linePositions->constBegin(), _linePositions->constEnd(), position)
+                  - _linePositions->constBegin() - 1;
+    if (i < 0) {
+        return;
     }
+
+    startLine = i;
+    startColumn = string_width(buffer()->mid(_linePositions->value(i),
+                                             position - _linePositions->value(i)));
 }
 
 const QString *Filter::buffer()
@@ -0,0 +1,306 @@
+/*
+    This file is part of Konsole, a terminal emulator for KDE.
+
+    Copyright 2018 by The Konsole Developers
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+// Own
+#include "GlyphCache.h"
+
+// Qt
+#include <QFontMetrics>
+#include <QPaintDevice>
+
+// Konsole
+#include "Character.h"
+#include "LineBlockCharacters.h"
+
+using namespace Konsole;
+
+// characters which have not been looked at yet
+static const int UNKNOWN_SLOT = -2;
+
+GlyphCache::GlyphCache() :
+    _font(QFont()),
+    _cellSize(QSize()),
+    _baseline(0),
+    _devicePixelRatio(1.0),
+    _atlasCount(0),
+    _useCount(0),
+    _renderedGlyphs(0),
+    _fragments(QVector<QPainter::PixmapFragment>())
+{
+}
+
+GlyphCache::~GlyphCache()
+{
+    clear();
+}
+
+void GlyphCache::setFont(const QFont &font, const QSize &cellSize, int baseline)
+{
+    clear();
+
+    _font = font;
+    _cellSize = cellSize;
+    _baseline = baseline;
+}
+
+void GlyphCache::clear()
+{
+    for (int style = 0; style < STYLE_COUNT; style++) {
+        qDeleteAll(_atlases[style]);
+        _atlases[style].clear();
+    }
+    _atlasCount = 0;
+    _fragments.clear();
+    _fragments.squeeze();
+}
+
+int GlyphCache::glyphCount() const
+{
+    int count = 0;
+    for (int style = 0; style < STYLE_COUNT; style++) {
+        foreach (const Atlas *atlas, _atlases[style]) {
+            count += atlas->usedSlots;
+        }
+    }
+    return count;
+}
+
+int GlyphCache::renderedGlyphCount() const
+{
+    return _renderedGlyphs;
+}
+
+QFont GlyphCache::styleFont(Style style) const
+{
+    QFont font(_font);
+    font.setBold(style.testFlag(Bold));
+    font.setItalic(style.testFlag(Italic));
+    font.setUnderline(style.testFlag(Underline));
+    font.setStrikeOut(style.testFlag(StrikeOut));
+    font.setOverline(style.testFlag(Overline));
+    return font;
+}
+
+QRect GlyphCache::slotRect(int slot) const
+{
+    return QRect((slot % SLOTS_PER_ROW) * _cellSize.width(),
+                 (slot / SLOTS_PER_ROW) * _cellSize.height(),
+                 _cellSize.width(), _cellSize.height());
+}
+
+bool GlyphCache::isCacheable(const QFont &font, QChar character) const
+{
+    // combining and joining characters are shaped together with their
+    // neighbours, right-to-left and directional formatting characters
+    // reorder them
+    if (character.isSurrogate() || character.isMark()
+            || character.joiningType() != QChar::Joining_None) {
+        return false;
+    }
+
+    switch (character.direction()) {
+    case QChar::DirR:
+    case QChar::DirAL:
+    case QChar::DirLRE:
+    case QChar::DirLRO:
+    case QChar::DirRLE:
+    case QChar::DirRLO:
+    case QChar::DirPDF:
+    case QChar::DirLRI:
+    case QChar::DirRLI:
+    case QChar::DirFSI:
+    case QChar::DirPDI:
+        return false;
+    default:
+        break;
+    }
+
+    if (character.category() == QChar::Other_Control || character.category() == QChar::Other_Format) {
+        return false;
+    }
+
+    // glyphs from fallback fonts have metrics of their own, and glyphs which
+    // reach into the neighbouring cells would be cut off
+    const QFontMetrics metrics(font);
+    if (!metrics.inFont(character) || metrics.width(character) != _cellSize.width()) {
+        return false;
+    }
+
+    const QRect bounds = metrics.boundingRect(character).translated(0, _baseline);
+    return bounds.isEmpty() || QRect(QPoint(0, 0), _cellSize).contains(bounds);
+}
+
+GlyphCache::Atlas *GlyphCache::atlas(Style style, const QColor &foreground, const QColor &background)
+{
+    const QRgb foregroundRgb = foreground.rgba();
+    const QRgb backgroundRgb = background.alpha() == 0 ? 0 : background.rgba();
+    const quint64 key = (static_cast<quint64>(foregroundRgb) << 32) | backgroundRgb;
+
+    Atlas *atlas = _atlases[style].value(key);
+    if (atlas == nullptr) {
+        if (_atlasCount == MAX_ATLASES) {
+            dropLeastRecentlyUsedAtlas();
+        }
+
+        // the glyphs are rendered as they are drawn
+        atlas = new Atlas;
+        atlas->usedSlots = 0;
+        atlas->capacity = 0;
+        atlas->foreground = foregroundRgb;
+        atlas->background = backgroundRgb;
+        _atlases[style].insert(key, atlas);
+        _atlasCount++;
+    }
+
+    atlas->lastUse = ++_useCount;
+    return atlas;
+}
+
+void GlyphCache::dropLeastRecentlyUsedAtlas()
+{
+    // atlases are only dropped when a new one is created, with few enough
+    // of them to look at all
+    QHash<quint64, Atlas *>::iterator oldest;
+    int oldestStyle = -1;
+    for (int style = 0; style < STYLE_COUNT; style++) {
+        for (auto iter = _atlases[style].begin(); iter != _atlases[style].end(); ++iter) {
+            if (oldestStyle < 0 || iter.value()->lastUse < oldest.value()->lastUse) {
+                oldest = iter;
+                oldestStyle = style;
+            }
+        }
+    }
+
+    if (oldestStyle >= 0) {
+        delete oldest.value();
+        _atlases[oldestStyle].erase(oldest);
+        _atlasCount--;
+    }
+}
+
+int GlyphCache::addGlyph(Atlas *atlas, Style style, QChar character)
+{
+    const bool lineCharacter = style.testFlag(LineCharacters);
+    const QFont font = styleFont(style);
+
+    if (lineCharacter ? !isSupportedLineChar(character.unicode()) : !isCacheable(font, character)) {
+        atlas->slots.insert(character.unicode(), -1);
+        return -1;
+    }
+
+    if (atlas->usedSlots == atlas->capacity) {
+        if (atlas->capacity == MAX_SLOTS) {
+            return -1;
+        }
+
+        // the atlas starts with a single row and doubles its number of rows
+        // whenever it is full
+        const int rows = atlas->capacity == 0 ? 1 : qMin(2 * atlas->capacity, MAX_SLOTS) / SLOTS_PER_ROW;
+        QPixmap pixmap(qRound(SLOTS_PER_ROW * _cellSize.width() * _devicePixelRatio),
+                       qRound(rows * _cellSize.height() * _devicePixelRatio));
+        pixmap.setDevicePixelRatio(_devicePixelRatio);
+        pixmap.fill(Qt::transparent);
+        if (!atlas->pixmap.isNull()) {
+            QPainter painter(&pixmap);
+            painter.setCompositionMode(QPainter::CompositionMode_Source);
+            painter.drawPixmap(0, 0, atlas->pixmap);
+        }
+        atlas->pixmap = pixmap;
+        atlas->capacity = rows * SLOTS_PER_ROW;
+    }
+
+    const int slot = atlas->usedSlots++;
+    const QRect rect = slotRect(slot);
+
+    QPainter painter(&atlas->pixmap);
+    painter.setCompositionMode(QPainter::CompositionMode_Source);
+    painter.fillRect(rect, QColor::fromRgba(atlas->background));
+    painter.setCompositionMode(QPainter::CompositionMode_SourceOver);
+    painter.setPen(QColor::fromRgba(atlas->foreground));
+    painter.setClipRect(rect);
+    if (lineCharacter) {
+        LineBlockCharacters::draw(painter, rect, character, style.testFlag(Bold));
+    } else {
+        painter.setLayoutDirection(Qt::LeftToRight);
+        painter.setFont(font);
+        painter.drawText(rect.x(), rect.y() + _baseline, QString(character));
+    }
+
+    atlas->slots.insert(character.unicode(), slot);
+    _renderedGlyphs++;
+    return slot;
+}
+
+bool GlyphCache::drawText(QPainter &painter, const QPoint &position, const QString &text,
+                          Style style, const QColor &foreground, const QColor &background)
+{
+    if (_cellSize.isEmpty() || painter.worldTransform().type() > QTransform::TxTranslate) {
+        return false;
+    }
+
+    // with fractional scale factors cells do not start at whole pixels, and
+    // the glyphs would have to be scaled
+    const qreal devicePixelRatio = painter.device()->devicePixelRatioF();
+    if (devicePixelRatio != qRound(devicePixelRatio)) {
+        return false;
+    }
+    if (devicePixelRatio != _devicePixelRatio) {
+        clear();
+        _devicePixelRatio = devicePixelRatio;
+    }
+
+    Atlas *atlas = this->atlas(style, foreground, background);
+
+    // spaces only need to be drawn if they have a background or a line
+    // through them
+    const bool skipSpaces = background.alpha() == 0 && !style.testFlag(Underline)
+                            && !style.testFlag(StrikeOut) && !style.testFlag(Overline);
+
+    _fragments.resize(0);
+    for (int i = 0; i < text.length(); i++) {
+        const QChar character = text.at(i);
+
+        int slot = atlas->slots.value(character.unicode(), UNKNOWN_SLOT);
+        if (slot == UNKNOWN_SLOT) {
+            slot = addGlyph(atlas, style, character);
+        }
+        if (slot < 0) {
+            return false;
+        }
+        if (skipSpaces && character == QLatin1Char(' ')) {
+            continue;
+        }
+
+        const QRect source = slotRect(slot);
+        const QPointF center(position.x() + (i + 0.5) * _cellSize.width(),
+                             position.y() + 0.5 * _cellSize.height());
+        _fragments.append(QPainter::PixmapFragment::create(center,
+                                                          QRectF(source.topLeft() * _devicePixelRatio,
+                                                                 source.size() * _devicePixelRatio),
+                                                          1.0 / _devicePixelRatio,
+                                                          1.0 / _devicePixelRatio));
+    }
+
+    if (!_fragments.isEmpty()) {
+        painter.drawPixmapFragments(_fragments.constData(), _fragments.size(), atlas->pixmap);
+    }
+    return true;
+}
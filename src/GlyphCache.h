@@ -0,0 +1,149 @@
+/*
+    This file is part of Konsole, a terminal emulator for KDE.
+
+    Copyright 2018 by The Konsole Developers
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+#ifndef GLYPHCACHE_H
+#define GLYPHCACHE_H
+
+// Qt
+#include <QColor>
+#include <QFont>
+#include <QHash>
+#include <QPainter>
+#include <QPixmap>
+#include <QVector>
+
+// Konsole
+#include "konsoleprivate_export.h"
+
+namespace Konsole {
+/**
+ * Caches the rendered glyphs of the terminal font, so that text can be drawn
+ * by copying pixels instead of laying it out and rasterising it every time.
+ *
+ * The glyphs are kept in atlases, one pixmap per font style and pair of
+ * colors, in slots of the size of a character cell.  Glyphs are rendered
+ * into an atlas when they are drawn in its style and colors for the first
+ * time.  Once there are MAX_ATLASES atlases, the one which was used least
+ * recently is dropped to make room for a new one.
+ *
+ * Only characters which are drawn the same way on their own as in a run of
+ * text are cached: their glyph has to come from the font itself and fit into
+ * its cell, and they must neither combine with nor change the direction of
+ * the characters around them.  Text containing other characters has to be
+ * drawn with QPainter::drawText(), drawText() returns false for it.
+ *
+ * With the LineCharacters style the glyphs are not taken from the font, they
+ * are the line characters drawn by LineBlockCharacters::draw() instead.
+ */
+class KONSOLEPRIVATE_EXPORT GlyphCache
+{
+public:
+    enum StyleFlag {
+        Bold      = 1 << 0,
+        Italic    = 1 << 1,
+        Underline = 1 << 2,
+        StrikeOut = 1 << 3,
+        Overline  = 1 << 4,
+        // draws the characters accepted by isSupportedLineChar() with
+        // LineBlockCharacters, only Bold can be combined with this
+        LineCharacters = 1 << 5
+    };
+    Q_DECLARE_FLAGS(Style, StyleFlag)
+
+    GlyphCache();
+    ~GlyphCache();
+
+    /**
+     * Sets the font glyphs are rendered with, the size of a character cell
+     * and the distance of the baseline from the top of a cell.  This drops
+     * all cached glyphs.
+     */
+    void setFont(const QFont &font, const QSize &cellSize, int baseline);
+
+    /** Drops all cached glyphs */
+    void clear();
+
+    /** Returns the number of glyphs in the cache */
+    int glyphCount() const;
+    /** Returns the number of glyphs which have been rendered since the cache was constructed */
+    int renderedGlyphCount() const;
+
+    /**
+     * Draws @p text, one character per cell, starting with the cell at
+     * @p position.  The cells are filled with @p background, unless it is
+     * transparent, before the glyphs are drawn over it in @p foreground.
+     *
+     * Returns false without drawing anything if some character of @p text
+     * cannot be drawn from the cache, or if @p painter is transformed in a
+     * way the cached glyphs cannot be drawn with.
+     */
+    bool drawText(QPainter &painter, const QPoint &position, const QString &text,
+                  Style style, const QColor &foreground, const QColor &background);
+
+    /** The number of slots in a row of an atlas */
+    static const int SLOTS_PER_ROW = 32;
+    /** The maximum number of slots in an atlas */
+    static const int MAX_SLOTS = 1024;
+    /** The number of atlases which are kept, the least recently used one is dropped for a new one */
+    static const int MAX_ATLASES = 64;
+
+private:
+    Q_DISABLE_COPY(GlyphCache)
+
+    struct Atlas {
+        QPixmap pixmap;
+        // slots of the characters, -1 for characters which cannot be cached
+        QHash<ushort, int> slots;
+        int usedSlots;
+        int capacity;
+        QRgb foreground;
+        QRgb background;
+        // value of _useCount when the atlas was last drawn from
+        quint64 lastUse;
+    };
+
+    static const int STYLE_COUNT = 1 << 6;
+
+    Atlas *atlas(Style style, const QColor &foreground, const QColor &background);
+    void dropLeastRecentlyUsedAtlas();
+    int addGlyph(Atlas *atlas, Style style, QChar character);
+    bool isCacheable(const QFont &font, QChar character) const;
+    QFont styleFont(Style style) const;
+    QRect slotRect(int slot) const;
+
+    QFont _font;
+    QSize _cellSize;
+    int _baseline;
+    qreal _devicePixelRatio;
+
+    // atlases by style, and by their foreground and background colors
+    QHash<quint64, Atlas *> _atlases[STYLE_COUNT];
+    int _atlasCount;
+    quint64 _useCount;
+    int _renderedGlyphs;
+
+    QVector<QPainter::PixmapFragment> _fragments;
+};
+
+Q_DECLARE_OPERATORS_FOR_FLAGS(GlyphCache::Style)
+}
+
+#endif // GLYPHCACHE_H
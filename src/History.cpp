@@ -23,15 +23,20 @@
 
 #include "konsoledebug.h"
 #include "KonsoleSettings.h"
+#include "konsole_wcwidth.h"
 
 // System
 #include <errno.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
 
 // KDE
 #include <QDir>
+#include <QVarLengthArray>
 #include <qplatformdefs.h>
 #include <QStandardPaths>
 #include <KConfigGroup>
@@ -63,7 +68,10 @@ Q_GLOBAL_STATIC(QString, historyFileLocation)
 HistoryFile::HistoryFile() :
     _length(0),
     _fileMap(nullptr),
-    _readWriteBalance(0)
+    _readWriteBalance(0),
+    _readAhead(QByteArray()),
+    _readAheadStart(0),
+    _lastReadStart(0)
 {
     // Determine the temp directory once
     // This class is called 3 times for each "unlimited" scrollback.
@@ -162,6 +170,15 @@ bool HistoryFile::isMapped() const
     return _fileMap != nullptr;
 }
 
+void HistoryFile::releaseMemory()
+{
+    if (_fileMap != nullptr) {
+        unmap();
+    }
+    _readWriteBalance = 0;
+    _readAhead.clear();
+}
+
 void HistoryFile::add(const char *buffer, qint64 count)
 {
     if (_fileMap != nullptr) {
@@ -205,8 +222,32 @@ void HistoryFile::get(char *buffer, qint64 size, qint64 loc)
         map();
     }
 
+    const bool forwards = loc >= _lastReadStart;
+    _lastReadStart = loc;
+
     if (_fileMap != nullptr) {
         memcpy(buffer, _fileMap + loc, size);
+    } else if (loc >= _readAheadStart && loc + size <= _readAheadStart + _readAhead.size()) {
+        memcpy(buffer, _readAhead.constData() + (loc - _readAheadStart), size);
+    } else if (size < READ_AHEAD_SIZE / 4) {
+        // the file is only ever appended to, the window stays valid
+        qint64 start = forwards ? loc : qMax<qint64>(0, loc + size - READ_AHEAD_SIZE);
+        const qint64 end = qMin(start + READ_AHEAD_SIZE, _length);
+        start = qMax<qint64>(0, qMin(start, end - READ_AHEAD_SIZE));
+
+        _readAhead.resize(end - start);
+        if (!_tmpFile.seek(start)) {
+            perror("HistoryFile::get.seek");
+            _readAhead.clear();
+            return;
+        }
+        if (_tmpFile.read(_readAhead.data(), _readAhead.size()) != _readAhead.size()) {
+            perror("HistoryFile::get.read");
+            _readAhead.clear();
+            return;
+        }
+        _readAheadStart = start;
+        memcpy(buffer, _readAhead.constData() + (loc - start), size);
     } else {
         qint64 rc = 0;
 
@@ -227,10 +268,496 @@ qint64 HistoryFile::len() const
     return _length;
 }
 
+uchar *HistoryFile::mapCopy(qint64 &length)
+{
+    length = _length;
+    if (_length == 0 || !_tmpFile.flush()) {
+        return nullptr;
+    }
+
+    // the file is only ever appended to, so the mapped range stays valid
+    // while more lines are added.  the mapping also keeps the file alive
+    // after the temporary file has been removed
+    void *fileMap = mmap(nullptr, _length, PROT_READ, MAP_SHARED, _tmpFile.handle(), 0);
+    if (fileMap == MAP_FAILED) {
+        qCDebug(KonsoleDebug) << "mmap'ing history snapshot failed.  errno = " << errno;
+        return nullptr;
+    }
+    return static_cast<uchar *>(fileMap);
+}
+
+// History Line Ranges //////////////////////////////////////
+
+HistoryLineRange::HistoryLineRange() :
+    _firstLine(0),
+    _cells(QVector<Character>()),
+    _starts(QVector<int>(1, 0)),
+    _wrapped(QVector<quint8>())
+{
+}
+
+void HistoryLineRange::clear(int firstLine)
+{
+    // resizing keeps the capacity of the buffers
+    _firstLine = firstLine;
+    _cells.resize(0);
+    _starts.resize(1);
+    _wrapped.resize(0);
+}
+
+void HistoryLineRange::reserve(int lineCount, int cellCount)
+{
+    _cells.reserve(_cells.count() + cellCount);
+    _starts.reserve(_starts.count() + lineCount);
+    _wrapped.reserve(_wrapped.count() + lineCount);
+}
+
+Character *HistoryLineRange::addLine(int length, bool wrapped)
+{
+    const int start = _cells.count();
+    _cells.resize(start + length);
+    _starts.append(start + length);
+    _wrapped.append(wrapped ? 1 : 0);
+    return _cells.data() + start;
+}
+
+// reads lines one by one, for histories which have nothing better to offer
+template<typename History>
+static void readLineRange(History *history, int startLine, int count, HistoryLineRange &range)
+{
+    range.clear(startLine);
+
+    for (int line = startLine; line < startLine + count; line++) {
+        const int length = history->getLineLen(line);
+        Character *cells = range.addLine(length, history->isWrappedLine(line));
+        if (length > 0) {
+            history->getCells(line, 0, length, cells);
+        }
+    }
+}
+
+// History Snapshots //////////////////////////////////////
+
+HistorySnapshot::~HistorySnapshot() = default;
+
+const QChar *HistorySnapshot::getLineText(int, int &length) const
+{
+    length = 0;
+    return nullptr;
+}
+
+void HistorySnapshot::getLineRange(int startLine, int count, HistoryLineRange &range) const
+{
+    readLineRange(this, startLine, count, range);
+}
+
+bool HistorySnapshot::readsLineRanges() const
+{
+    // the snapshots read their lines from memory
+    return false;
+}
+
+qint64 HistorySnapshot::getLineTimestamp(int) const
+{
+    return 0;
+}
+
+/*
+   Snapshot holding a copy of every line, used for scrolls
+   which cannot share their storage with a snapshot.
+*/
+class CopiedHistorySnapshot : public HistorySnapshot
+{
+public:
+    explicit CopiedHistorySnapshot(HistoryScroll *scroll) :
+        _lines(QVector<TextLine>(scroll->getLines())),
+        _wrapped(QVector<bool>(scroll->getLines()))
+    {
+        for (int i = 0; i < _lines.count(); i++) {
+            _lines[i].resize(scroll->getLineLen(i));
+            scroll->getCells(i, 0, _lines[i].count(), _lines[i].data());
+            _wrapped[i] = scroll->isWrappedLine(i);
+        }
+    }
+
+    int getLines() const Q_DECL_OVERRIDE
+    {
+        return _lines.count();
+    }
+
+    int getLineLen(int lineno) const Q_DECL_OVERRIDE
+    {
+        return lineno >= 0 && lineno < _lines.count() ? _lines[lineno].count() : 0;
+    }
+
+    void getCells(int lineno, int colno, int count, Character res[]) const Q_DECL_OVERRIDE
+    {
+        Q_ASSERT(colno >= 0 && colno + count <= getLineLen(lineno));
+        qCopy(_lines[lineno].constBegin() + colno, _lines[lineno].constBegin() + colno + count, res);
+    }
+
+    bool isWrappedLine(int lineno) const Q_DECL_OVERRIDE
+    {
+        return lineno >= 0 && lineno < _wrapped.count() && _wrapped[lineno];
+    }
+
+private:
+    QVector<TextLine> _lines;
+    QVector<bool> _wrapped;
+};
+
+/*
+   Snapshot of a HistoryScrollFile, reading read-only maps
+   of the three history files as they were when it was taken.
+*/
+class HistoryFileSnapshot : public HistorySnapshot
+{
+public:
+    HistoryFileSnapshot(HistoryFile &index, HistoryFile &cells, HistoryFile &lineflags,
+                        const LineTimestamps &timestamps) :
+        _index(index.mapCopy(_indexLength)),
+        _cells(cells.mapCopy(_cellsLength)),
+        _lineflags(lineflags.mapCopy(_lineflagsLength)),
+        _timestamps(timestamps)
+    {
+        // without all three maps the snapshot cannot be read, treat it as empty
+        if (_index == nullptr || _cells == nullptr || _lineflags == nullptr) {
+            _indexLength = 0;
+        }
+    }
+
+    ~HistoryFileSnapshot() Q_DECL_OVERRIDE
+    {
+        if (_index != nullptr) {
+            munmap(_index, _indexLength);
+        }
+        if (_cells != nullptr) {
+            munmap(_cells, _cellsLength);
+        }
+        if (_lineflags != nullptr) {
+            munmap(_lineflags, _lineflagsLength);
+        }
+    }
+
+    int getLines() const Q_DECL_OVERRIDE
+    {
+        return _indexLength / sizeof(qint64);
+    }
+
+    int getLineLen(int lineno) const Q_DECL_OVERRIDE
+    {
+        return (startOfLine(lineno + 1) - startOfLine(lineno)) / sizeof(Character);
+    }
+
+    void getCells(int lineno, int colno, int count, Character res[]) const Q_DECL_OVERRIDE
+    {
+        const qint64 loc = startOfLine(lineno) + colno * sizeof(Character);
+        const qint64 size = count * sizeof(Character);
+        if (loc < 0 || size < 0 || loc + size > _cellsLength) {
+            return;
+        }
+        memcpy(res, _cells + loc, size);
+    }
+
+    bool isWrappedLine(int lineno) const Q_DECL_OVERRIDE
+    {
+        return lineno >= 0 && lineno < getLines() && _lineflags[lineno] != 0u;
+    }
+
+    qint64 getLineTimestamp(int lineno) const Q_DECL_OVERRIDE
+    {
+        return lineno >= 0 && lineno < _timestamps.lineCount() ? _timestamps.timestamp(lineno) : 0;
+    }
+
+private:
+    qint64 startOfLine(int lineno) const
+    {
+        if (lineno <= 0) {
+            return 0;
+        }
+        if (lineno <= getLines()) {
+            qint64 res = 0;
+            memcpy(&res, _index + (lineno - 1) * sizeof(qint64), sizeof(qint64));
+            return qMin(res, _cellsLength);
+        }
+        return _cellsLength;
+    }
+
+    qint64 _indexLength;
+    qint64 _cellsLength;
+    qint64 _lineflagsLength;
+    uchar *_index;
+    uchar *_cells;
+    uchar *_lineflags;
+    LineTimestamps _timestamps;
+};
+
+/*
+   Snapshot of a CompactHistoryScroll.  It shares the line
+   pointers and keeps the blocks they live in mapped, and the
+   scroll does not delete lines while a snapshot exists.
+*/
+class CompactHistorySnapshot : public HistorySnapshot
+{
+public:
+    CompactHistorySnapshot(const QList<CompactHistoryLine *> &lines, const QList<CompactHistoryBlockPtr> &blocks,
+                           const LineTimestamps &timestamps,
+                           const QExplicitlySharedDataPointer<QSharedData> &scrollReference) :
+        _lines(lines),
+        _blocks(blocks),
+        _timestamps(timestamps),
+        _scrollReference(scrollReference)
+    {
+    }
+
+    int getLines() const Q_DECL_OVERRIDE
+    {
+        return _lines.size();
+    }
+
+    int getLineLen(int lineno) const Q_DECL_OVERRIDE
+    {
+        return lineno >= 0 && lineno < _lines.size() ? _lines[lineno]->getLength() : 0;
+    }
+
+    void getCells(int lineno, int colno, int count, Character res[]) const Q_DECL_OVERRIDE
+    {
+        if (count == 0) {
+            return;
+        }
+        Q_ASSERT(lineno < _lines.size());
+        _lines[lineno]->getCharacters(res, count, colno);
+    }
+
+    bool isWrappedLine(int lineno) const Q_DECL_OVERRIDE
+    {
+        return lineno >= 0 && lineno < _lines.size() && _lines[lineno]->isWrapped();
+    }
+
+    const QChar *getLineText(int lineno, int &length) const Q_DECL_OVERRIDE
+    {
+        Q_ASSERT(lineno < _lines.size());
+        length = _lines[lineno]->getLength();
+        return _lines[lineno]->plainText();
+    }
+
+    qint64 getLineTimestamp(int lineno) const Q_DECL_OVERRIDE
+    {
+        return lineno >= 0 && lineno < _timestamps.lineCount() ? _timestamps.timestamp(lineno) : 0;
+    }
+
+private:
+    QList<CompactHistoryLine *> _lines;
+    QList<CompactHistoryBlockPtr> _blocks;
+    LineTimestamps _timestamps;
+    // keeps the scroll from deleting the lines, see CompactHistoryScroll::dropLine()
+    QExplicitlySharedDataPointer<QSharedData> _scrollReference;
+};
+
+// Logical Line Index //////////////////////////////////////
+
+LogicalLineIndex::LogicalLineIndex() :
+    _starts(QVector<int>()),
+    _firstStart(0),
+    _addedLines(0),
+    _firstLine(0),
+    _continued(false)
+{
+}
+
+void LogicalLineIndex::addLine(bool wrapped)
+{
+    if (!_continued) {
+        _starts.append(_addedLines);
+    }
+    _addedLines++;
+    _continued = wrapped;
+
+    // the history may have been empty
+    dropLogicalLines();
+}
+
+void LogicalLineIndex::removeLines(int count)
+{
+    _firstLine = qMin(_firstLine + count, _addedLines);
+    dropLogicalLines();
+
+    if (_firstStart >= COMPACT_THRESHOLD && _firstStart * 2 >= _starts.size()) {
+        _starts.remove(0, _firstStart);
+        _firstStart = 0;
+    }
+}
+
+void LogicalLineIndex::dropLogicalLines()
+{
+    // the first logical line left is the last one starting at or before
+    // the first line left
+    while (_firstStart + 1 < _starts.size() && _starts[_firstStart + 1] <= _firstLine) {
+        _firstStart++;
+    }
+}
+
+void LogicalLineIndex::clear()
+{
+    _starts.clear();
+    _firstStart = 0;
+    _addedLines = 0;
+    _firstLine = 0;
+    _continued = false;
+}
+
+int LogicalLineIndex::lineCount() const
+{
+    return _addedLines - _firstLine;
+}
+
+int LogicalLineIndex::logicalLineCount() const
+{
+    return lineCount() > 0 ? _starts.size() - _firstStart : 0;
+}
+
+bool LogicalLineIndex::isLastLineWrapped() const
+{
+    return _continued;
+}
+
+int LogicalLineIndex::logicalLineOf(int line) const
+{
+    Q_ASSERT(line >= 0 && line < lineCount());
+    QVector<int>::const_iterator first = _starts.constBegin() + _firstStart;
+    return std::upper_bound(first, _starts.constEnd(), line + _firstLine) - first - 1;
+}
+
+int LogicalLineIndex::logicalLineStart(int logicalLine) const
+{
+    Q_ASSERT(logicalLine >= 0 && logicalLine < logicalLineCount());
+    return qMax(_starts[_firstStart + logicalLine], _firstLine) - _firstLine;
+}
+
+int LogicalLineIndex::logicalLineEnd(int logicalLine) const
+{
+    Q_ASSERT(logicalLine >= 0 && logicalLine < logicalLineCount());
+    const int next = _firstStart + logicalLine + 1;
+    return (next < _starts.size() ? _starts[next] : _addedLines) - 1 - _firstLine;
+}
+
+// Line Timestamps //////////////////////////////////////
+
+LineTimestamps::LineTimestamps() :
+    _chunks(QVector<Chunk>()),
+    _firstLine(0),
+    _lastChunkLines(0)
+{
+}
+
+qint64 LineTimestamps::currentTime()
+{
+    // the coarse clock is read without a system call, and a resolution of a
+    // few milliseconds is good enough for lines of output
+    struct timespec now;
+#if defined(CLOCK_REALTIME_COARSE)
+    clock_gettime(CLOCK_REALTIME_COARSE, &now);
+#else
+    clock_gettime(CLOCK_REALTIME, &now);
+#endif
+    return static_cast<qint64>(now.tv_sec) * 1000 + now.tv_nsec / 1000000;
+}
+
+void LineTimestamps::addLine(qint64 time)
+{
+    if (_chunks.isEmpty() || _lastChunkLines == LINES_PER_CHUNK) {
+        Chunk chunk;
+        chunk.firstTime = _chunks.isEmpty() ? time : qMax(time, _chunks.last().lastTime);
+        chunk.lastTime = chunk.firstTime;
+        _chunks.append(chunk);
+        _lastChunkLines = 1;
+        return;
+    }
+
+    Chunk &chunk = _chunks.last();
+    quint64 delta = static_cast<quint64>(qMax<qint64>(time - chunk.lastTime, 0));
+    chunk.lastTime += delta;
+
+    // seven bits at a time, the high bit marks that more follow
+    while (delta >= 0x80) {
+        chunk.deltas.append(static_cast<char>((delta & 0x7f) | 0x80));
+        delta >>= 7;
+    }
+    chunk.deltas.append(static_cast<char>(delta));
+    _lastChunkLines++;
+}
+
+void LineTimestamps::removeLines(int count)
+{
+    if (count >= lineCount()) {
+        clear();
+        return;
+    }
+
+    // chunks all lines of which have been dropped
+    _firstLine += count;
+    const int droppedChunks = _firstLine / LINES_PER_CHUNK;
+    if (droppedChunks > 0) {
+        _chunks.remove(0, droppedChunks);
+        _firstLine -= droppedChunks * LINES_PER_CHUNK;
+    }
+}
+
+void LineTimestamps::clear()
+{
+    _chunks.clear();
+    _firstLine = 0;
+    _lastChunkLines = 0;
+}
+
+int LineTimestamps::lineCount() const
+{
+    if (_chunks.isEmpty()) {
+        return 0;
+    }
+    return (_chunks.count() - 1) * LINES_PER_CHUNK + _lastChunkLines - _firstLine;
+}
+
+qint64 LineTimestamps::timeInChunk(const Chunk &chunk, int line)
+{
+    qint64 time = chunk.firstTime;
+    const uchar *delta = reinterpret_cast<const uchar *>(chunk.deltas.constData());
+
+    for (int i = 0; i < line; i++) {
+        quint64 value = 0;
+        int shift = 0;
+        while ((*delta & 0x80) != 0) {
+            value |= static_cast<quint64>(*delta++ & 0x7f) << shift;
+            shift += 7;
+        }
+        value |= static_cast<quint64>(*delta++) << shift;
+        time += value;
+    }
+    return time;
+}
+
+qint64 LineTimestamps::timestamp(int line) const
+{
+    Q_ASSERT(line >= 0 && line < lineCount());
+    const int position = _firstLine + line;
+    return timeInChunk(_chunks[position / LINES_PER_CHUNK], position % LINES_PER_CHUNK);
+}
+
+qint64 LineTimestamps::memoryUsage() const
+{
+    qint64 usage = sizeof(LineTimestamps) + _chunks.capacity() * sizeof(Chunk);
+    for (int i = 0; i < _chunks.count(); i++) {
+        usage += sizeof(QArrayData) + _chunks[i].deltas.capacity();
+    }
+    return usage;
+}
+
 // History Scroll abstract base class //////////////////////////////////////
 
 HistoryScroll::HistoryScroll(HistoryType *t) :
-    _historyType(t)
+    _historyType(t),
+    _logicalLines(LogicalLineIndex()),
+    _nextLineTimestamp(-1)
 {
 }
 
@@ -244,6 +771,32 @@ bool HistoryScroll::hasScroll()
     return true;
 }
 
+HistorySnapshot *HistoryScroll::createSnapshot()
+{
+    return new CopiedHistorySnapshot(this);
+}
+
+const QChar *HistoryScroll::getLineText(int, int &length)
+{
+    length = 0;
+    return nullptr;
+}
+
+void HistoryScroll::getLineRange(int startLine, int count, HistoryLineRange &range)
+{
+    readLineRange(this, startLine, count, range);
+}
+
+bool HistoryScroll::readsLineRanges() const
+{
+    return false;
+}
+
+qint64 HistoryScroll::getLineTimestamp(int)
+{
+    return 0;
+}
+
 // History Scroll File //////////////////////////////////////
 
 /*
@@ -303,6 +856,47 @@ void HistoryScrollFile::getCells(int lineno, int colno, int count, Character res
     _cells.get(reinterpret_cast<char*>(res), count * sizeof(Character), startOfLine(lineno) + colno * sizeof(Character));
 }
 
+void HistoryScrollFile::getLineRange(int startLine, int count, HistoryLineRange &range)
+{
+    Q_ASSERT(startLine >= 0 && count >= 0 && startLine + count <= getLines());
+
+    range.clear(startLine);
+    if (count == 0) {
+        return;
+    }
+
+    // the lines are consecutive in all three files, each of them is read
+    // once.  the index holds the end of each line, which is where the next
+    // one starts, the first line starts at 0
+    QVarLengthArray<qint64, 256> starts(count + 1);
+    if (startLine == 0) {
+        starts[0] = 0;
+        _index.get(reinterpret_cast<char *>(starts.data() + 1), count * sizeof(qint64), 0);
+    } else {
+        _index.get(reinterpret_cast<char *>(starts.data()), (count + 1) * sizeof(qint64),
+                   (startLine - 1) * sizeof(qint64));
+    }
+
+    QVarLengthArray<unsigned char, 256> flags(count);
+    _lineflags.get(reinterpret_cast<char *>(flags.data()), count * sizeof(unsigned char),
+                   startLine * sizeof(unsigned char));
+
+    range.reserve(count, (starts[count] - starts[0]) / sizeof(Character));
+    for (int i = 0; i < count; i++) {
+        range.addLine((starts[i + 1] - starts[i]) / sizeof(Character), flags[i] != 0);
+    }
+
+    if (starts[count] > starts[0]) {
+        _cells.get(reinterpret_cast<char *>(range.lineCells(startLine)), starts[count] - starts[0], starts[0]);
+    }
+}
+
+bool HistoryScrollFile::readsLineRanges() const
+{
+    // each of the files is read once per range
+    return true;
+}
+
 void HistoryScrollFile::addCells(const Character text[], int count)
 {
     _cells.add(reinterpret_cast<const char*>(text), count * sizeof(Character));
@@ -314,6 +908,26 @@ void HistoryScrollFile::addLine(bool previousWrapped)
     _index.add(reinterpret_cast<char *>(&locn), sizeof(qint64));
     unsigned char flags = previousWrapped ? 0x01 : 0x00;
     _lineflags.add(reinterpret_cast<char *>(&flags), sizeof(char));
+    _logicalLines.addLine(previousWrapped);
+    _timestamps.addLine(lineTimestamp());
+}
+
+qint64 HistoryScrollFile::getLineTimestamp(int lineno)
+{
+    return lineno >= 0 && lineno < _timestamps.lineCount() ? _timestamps.timestamp(lineno) : 0;
+}
+
+void HistoryScrollFile::releaseMemory()
+{
+    // the data lives in the temporary files, only the maps cost memory
+    _index.releaseMemory();
+    _cells.releaseMemory();
+    _lineflags.releaseMemory();
+}
+
+HistorySnapshot *HistoryScrollFile::createSnapshot()
+{
+    return new HistoryFileSnapshot(_index, _cells, _lineflags, _timestamps);
 }
 
 // History Scroll None //////////////////////////////////////
@@ -363,15 +977,29 @@ void HistoryScrollNone::addLine(bool)
 void *CompactHistoryBlock::allocate(size_t size)
 {
     Q_ASSERT(size > 0);
-    if (_tail - _blockStart + size > _blockLength) {
+    // the end of the block is page aligned, keep the objects below it aligned
+    size = (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+    if (size > remaining()) {
+        return nullptr;
+    }
+
+    _head -= size;
+    ////qDebug() << "allocated " << length << " bytes at address " << _head;
+    _allocCount++;
+    return _head;
+}
+
+void *CompactHistoryBlock::allocateText(size_t size)
+{
+    Q_ASSERT(size > 0);
+    if (size > remaining()) {
         return nullptr;
     }
 
-    void *block = _tail;
+    void *text = _tail;
     _tail += size;
-    ////qDebug() << "allocated " << length << " bytes at address " << block;
     _allocCount++;
-    return block;
+    return text;
 }
 
 void CompactHistoryBlock::deallocate()
@@ -380,18 +1008,56 @@ void CompactHistoryBlock::deallocate()
     Q_ASSERT(_allocCount >= 0);
 }
 
+void CompactHistoryBlock::releaseMemory()
+{
+    // only the used parts of the block at its start and its end have pages
+    // behind them.  madvise() needs page aligned addresses, the page the
+    // objects start in is included as a whole
+    const size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    const size_t textLength = _tail - _blockStart;
+    quint8 *objects = _blockStart + ((_head - _blockStart) & ~(pageSize - 1));
+    const size_t objectsLength = _blockStart + _blockLength - objects;
+
+    // the pages are faulted back in from swap when the history is read again
+#if defined(MADV_PAGEOUT)
+    if (textLength > 0) {
+        madvise(_blockStart, textLength, MADV_PAGEOUT);
+    }
+    if (objectsLength > 0) {
+        madvise(objects, objectsLength, MADV_PAGEOUT);
+    }
+#elif defined(MADV_COLD)
+    if (textLength > 0) {
+        madvise(_blockStart, textLength, MADV_COLD);
+    }
+    if (objectsLength > 0) {
+        madvise(objects, objectsLength, MADV_COLD);
+    }
+#else
+    Q_UNUSED(textLength);
+    Q_UNUSED(objectsLength);
+#endif
+}
+
 void *CompactHistoryBlockList::allocate(size_t size)
 {
-    CompactHistoryBlock *block;
-    if (list.isEmpty() || list.last()->remaining() < size) {
-        block = new CompactHistoryBlock();
-        list.append(block);
-        ////qDebug() << "new block created, remaining " << block->remaining() << "number of blocks=" << list.size();
-    } else {
-        block = list.last();
-        ////qDebug() << "old block used, remaining " << block->remaining();
+    void *ptr = list.isEmpty() ? nullptr : list.last()->allocate(size);
+    if (ptr == nullptr) {
+        list.append(CompactHistoryBlockPtr(new CompactHistoryBlock()));
+        ////qDebug() << "new block created, number of blocks=" << list.size();
+        ptr = list.last()->allocate(size);
+    }
+    return ptr;
+}
+
+void *CompactHistoryBlockList::allocateText(size_t size)
+{
+    void *ptr = list.isEmpty() ? nullptr : list.last()->allocateText(size);
+    if (ptr == nullptr) {
+        list.append(CompactHistoryBlockPtr(new CompactHistoryBlock()));
+        ptr = list.last()->allocateText(size);
     }
-    return block->allocate(size);
+    return ptr;
 }
 
 void CompactHistoryBlockList::deallocate(void *ptr)
@@ -399,10 +1065,10 @@ void CompactHistoryBlockList::deallocate(void *ptr)
     Q_ASSERT(!list.isEmpty());
 
     int i = 0;
-    CompactHistoryBlock *block = list.at(i);
+    CompactHistoryBlock *block = list.at(i).data();
     while (i < list.size() && !block->contains(ptr)) {
         i++;
-        block = list.at(i);
+        block = list.at(i).data();
     }
 
     Q_ASSERT(i < list.size());
@@ -410,15 +1076,22 @@ void CompactHistoryBlockList::deallocate(void *ptr)
     block->deallocate();
 
     if (!block->isInUse()) {
+        // snapshots may still hold on to the block
         list.removeAt(i);
-        delete block;
         ////qDebug() << "block deleted, new size = " << list.size();
     }
 }
 
+void CompactHistoryBlockList::releaseMemory()
+{
+    // the last block is still being written to
+    for (int i = 0; i < list.size() - 1; i++) {
+        list.at(i)->releaseMemory();
+    }
+}
+
 CompactHistoryBlockList::~CompactHistoryBlockList()
 {
-    qDeleteAll(list.begin(), list.end());
     list.clear();
 }
 
@@ -427,87 +1100,116 @@ void *CompactHistoryLine::operator new(size_t size, CompactHistoryBlockList &blo
     return blockList.allocate(size);
 }
 
-CompactHistoryLine::CompactHistoryLine(const TextLine &line, CompactHistoryBlockList &bList) :
+CompactHistoryLine::CompactHistoryLine(const Character *cells, int count, CompactHistoryBlockList &bList) :
     _blockListRef(bList),
-    _formatArray(nullptr),
-    _text(nullptr),
-    _formatLength(0),
-    _wrapped(false)
-{
-    _length = line.size();
-
-    if (line.size() > 0) {
-        _formatLength = 1;
-        int k = 1;
-
-        // count number of different formats in this text line
-        Character c = line[0];
-        while (k < _length) {
-            if (!(line[k].equalsFormat(c))) {
-                _formatLength++; // format change detected
-                c = line[k];
-            }
-            k++;
+    _segment(),
+    _segments(&_segment),
+    _length(count),
+    _wrapped(false),
+    _plainText(false)
+{
+    if (_length == 0) {
+        return;
+    }
+
+    const int segments = segmentCount();
+    if (segments > 1) {
+        _segments = static_cast<CompactHistorySegment *>(_blockListRef.allocate(sizeof(CompactHistorySegment) * segments));
+        Q_ASSERT(_segments != nullptr);
+    }
+
+    for (int i = 0; i < segments; i++) {
+        const int start = i * SEGMENT_LENGTH;
+        initSegment(_segments[i], cells + start, qMin<int>(_length - start, SEGMENT_LENGTH));
+    }
+
+    // the text can be read without the formats as long as it is in one
+    // piece and every cell holds a character of its own, that is no cell
+    // holds a combined or double width character or is a filler
+    _plainText = segments == 1;
+    for (int i = 0; i < count && _plainText; i++) {
+        const Character &character = cells[i];
+        if (!character.isRealCharacter
+            || (character.rendition & RE_EXTENDED_CHAR) != 0
+            || (character.character >= 0x7f && konsole_wcwidth(character.character) > 1)) {
+            _plainText = false;
         }
+    }
+    ////qDebug() << "line created, length " << length << " at " << &(length);
+}
 
-        ////qDebug() << "number of different formats in string: " << _formatLength;
-        _formatArray = static_cast<CharacterFormat *>(_blockListRef.allocate(sizeof(CharacterFormat) * _formatLength));
-        Q_ASSERT(_formatArray != nullptr);
-        _text = static_cast<quint16 *>(_blockListRef.allocate(sizeof(quint16) * line.size()));
-        Q_ASSERT(_text != nullptr);
-
-        _length = line.size();
-        _wrapped = false;
-
-        // record formats and their positions in the format array
-        c = line[0];
-        _formatArray[0].setFormat(c);
-        _formatArray[0].startPos = 0;                      // there's always at least 1 format (for the entire line, unless a change happens)
-
-        k = 1;                                            // look for possible format changes
-        int j = 1;
-        while (k < _length && j < _formatLength) {
-            if (!(line[k].equalsFormat(c))) {
-                c = line[k];
-                _formatArray[j].setFormat(c);
-                _formatArray[j].startPos = k;
-                ////qDebug() << "format entry " << j << " at pos " << _formatArray[j].startPos << " " << &(_formatArray[j].startPos) ;
-                j++;
-            }
-            k++;
+void CompactHistoryLine::initSegment(CompactHistorySegment &segment, const Character *cells, int count)
+{
+    segment.length = count;
+    segment.formatLength = 1;
+
+    // count number of different formats in this segment
+    Character c = cells[0];
+    for (int k = 1; k < count; k++) {
+        if (!(cells[k].equalsFormat(c))) {
+            segment.formatLength++; // format change detected
+            c = cells[k];
         }
+    }
 
-        // copy character values
-        for (int i = 0; i < line.size(); i++) {
-            _text[i] = line[i].character;
-            ////qDebug() << "char " << i << " at mem " << &(text[i]);
+    ////qDebug() << "number of different formats in string: " << segment.formatLength;
+    segment.formats = static_cast<CharacterFormat *>(_blockListRef.allocate(sizeof(CharacterFormat) * segment.formatLength));
+    Q_ASSERT(segment.formats != nullptr);
+    segment.text = static_cast<quint16 *>(_blockListRef.allocateText(sizeof(quint16) * count));
+    Q_ASSERT(segment.text != nullptr);
+
+    // record formats and their positions in the format array
+    c = cells[0];
+    segment.formats[0].setFormat(c);
+    segment.formats[0].startPos = 0;                      // there's always at least 1 format (for the entire segment, unless a change happens)
+
+    int j = 1;                                            // look for possible format changes
+    for (int k = 1; k < count && j < segment.formatLength; k++) {
+        if (!(cells[k].equalsFormat(c))) {
+            c = cells[k];
+            segment.formats[j].setFormat(c);
+            segment.formats[j].startPos = k;
+            j++;
         }
     }
-    ////qDebug() << "line created, length " << length << " at " << &(length);
+
+    // copy character values
+    for (int i = 0; i < count; i++) {
+        segment.text[i] = cells[i].character;
+    }
 }
 
 CompactHistoryLine::~CompactHistoryLine()
 {
     if (_length > 0) {
-        _blockListRef.deallocate(_text);
-        _blockListRef.deallocate(_formatArray);
+        const int segments = segmentCount();
+        for (int i = 0; i < segments; i++) {
+            _blockListRef.deallocate(_segments[i].text);
+            _blockListRef.deallocate(_segments[i].formats);
+        }
+        if (segments > 1) {
+            _blockListRef.deallocate(_segments);
+        }
     }
     _blockListRef.deallocate(this);
 }
 
 void CompactHistoryLine::getCharacter(int index, Character &r)
 {
-    Q_ASSERT(index < _length);
+    Q_ASSERT(index < static_cast<int>(_length));
+    const CompactHistorySegment &segment = _segments[index / SEGMENT_LENGTH];
+    index %= SEGMENT_LENGTH;
+
     int formatPos = 0;
-    while ((formatPos + 1) < _formatLength && index >= _formatArray[formatPos + 1].startPos) {
+    while ((formatPos + 1) < segment.formatLength && index >= segment.formats[formatPos + 1].startPos) {
         formatPos++;
     }
 
-    r.character = _text[index];
-    r.rendition = _formatArray[formatPos].rendition;
-    r.foregroundColor = _formatArray[formatPos].fgColor;
-    r.backgroundColor = _formatArray[formatPos].bgColor;
-    r.isRealCharacter = _formatArray[formatPos].isRealCharacter;
+    r.character = segment.text[index];
+    r.rendition = segment.formats[formatPos].rendition;
+    r.foregroundColor = segment.formats[formatPos].fgColor;
+    r.backgroundColor = segment.formats[formatPos].bgColor;
+    r.isRealCharacter = segment.formats[formatPos].isRealCharacter;
 }
 
 void CompactHistoryLine::getCharacters(Character *array, int size, int startColumn)
@@ -515,15 +1217,54 @@ void CompactHistoryLine::getCharacters(Character *array, int size, int startColu
     Q_ASSERT(startColumn >= 0 && size >= 0);
     Q_ASSERT(startColumn + size <= static_cast<int>(getLength()));
 
-    for (int i = startColumn; i < size + startColumn; i++) {
-        getCharacter(i, array[i - startColumn]);
+    // only the segments the cells are in are read
+    while (size > 0) {
+        const CompactHistorySegment &segment = _segments[startColumn / SEGMENT_LENGTH];
+        const int column = startColumn % SEGMENT_LENGTH;
+        const int count = qMin(size, segment.length - column);
+
+        getSegmentCharacters(segment, array, count, column);
+
+        array += count;
+        startColumn += count;
+        size -= count;
+    }
+}
+
+void CompactHistoryLine::getSegmentCharacters(const CompactHistorySegment &segment, Character *array, int size, int startColumn) const
+{
+    // merge the text with the format runs, walking both only once
+    int formatPos = 0;
+    while ((formatPos + 1) < segment.formatLength && startColumn >= segment.formats[formatPos + 1].startPos) {
+        formatPos++;
+    }
+
+    const int end = startColumn + size;
+    int i = startColumn;
+    while (i < end) {
+        const CharacterFormat &format = segment.formats[formatPos];
+        const int runEnd = (formatPos + 1) < segment.formatLength
+                           ? qMin<int>(segment.formats[formatPos + 1].startPos, end) : end;
+
+        for (; i < runEnd; i++) {
+            Character &r = array[i - startColumn];
+            r.character = segment.text[i];
+            r.rendition = format.rendition;
+            r.foregroundColor = format.fgColor;
+            r.backgroundColor = format.bgColor;
+            r.isRealCharacter = format.isRealCharacter;
+        }
+        formatPos++;
     }
 }
 
 CompactHistoryScroll::CompactHistoryScroll(unsigned int maxLineCount) :
     HistoryScroll(new CompactHistoryType(maxLineCount)),
     _lines(),
-    _blockList()
+    _blockList(),
+    _timestamps(),
+    _snapshotReference(new QSharedData()),
+    _droppedLines()
 {
     ////qDebug() << "scroll of length " << maxLineCount << " created";
     setMaxNbLines(maxLineCount);
@@ -531,26 +1272,45 @@ CompactHistoryScroll::CompactHistoryScroll(unsigned int maxLineCount) :
 
 CompactHistoryScroll::~CompactHistoryScroll()
 {
-    qDeleteAll(_lines.begin(), _lines.end());
+    // the destructors of the lines only give their memory back to the block
+    // list, which is going away.  snapshots keep the blocks of their lines
+    // mapped, the lines must not be destroyed under them
+    if (!hasSnapshots()) {
+        qDeleteAll(_droppedLines.begin(), _droppedLines.end());
+        qDeleteAll(_lines.begin(), _lines.end());
+    }
+    _droppedLines.clear();
     _lines.clear();
 }
 
-void CompactHistoryScroll::addCellsVector(const TextLine &cells)
+bool CompactHistoryScroll::hasSnapshots() const
 {
-    CompactHistoryLine *line;
-    line = new(_blockList) CompactHistoryLine(cells, _blockList);
+    return _snapshotReference->ref.load() > 1;
+}
 
-    if (_lines.size() > static_cast<int>(_maxLineCount)) {
-        delete _lines.takeAt(0);
+void CompactHistoryScroll::dropLine(CompactHistoryLine *line)
+{
+    if (hasSnapshots()) {
+        _droppedLines.append(line);
+        return;
     }
-    _lines.append(line);
+
+    qDeleteAll(_droppedLines.begin(), _droppedLines.end());
+    _droppedLines.clear();
+    delete line;
 }
 
 void CompactHistoryScroll::addCells(const Character a[], int count)
 {
-    TextLine newLine(count);
-    qCopy(a, a + count, newLine.begin());
-    addCellsVector(newLine);
+    CompactHistoryLine *line;
+    line = new(_blockList) CompactHistoryLine(a, count, _blockList);
+
+    if (_lines.size() > static_cast<int>(_maxLineCount)) {
+        dropLine(_lines.takeAt(0));
+        _logicalLines.removeLines(1);
+        _timestamps.removeLines(1);
+    }
+    _lines.append(line);
 }
 
 void CompactHistoryScroll::addLine(bool previousWrapped)
@@ -558,6 +1318,18 @@ void CompactHistoryScroll::addLine(bool previousWrapped)
     CompactHistoryLine *line = _lines.last();
     ////qDebug() << "last line at address " << line;
     line->setWrapped(previousWrapped);
+    _logicalLines.addLine(previousWrapped);
+    _timestamps.addLine(lineTimestamp());
+}
+
+void CompactHistoryScroll::releaseMemory()
+{
+    _blockList.releaseMemory();
+}
+
+HistorySnapshot *CompactHistoryScroll::createSnapshot()
+{
+    return new CompactHistorySnapshot(_lines, _blockList.blocks(), _timestamps, _snapshotReference);
 }
 
 int CompactHistoryScroll::getLines()
@@ -593,8 +1365,16 @@ void CompactHistoryScroll::setMaxNbLines(unsigned int lineCount)
 {
     _maxLineCount = lineCount;
 
+    // keep getType() in line with the new limit
+    if (_historyType->maximumLineCount() != static_cast<int>(lineCount)) {
+        delete _historyType;
+        _historyType = new CompactHistoryType(lineCount);
+    }
+
     while (_lines.size() > static_cast<int>(lineCount)) {
-        delete _lines.takeAt(0);
+        dropLine(_lines.takeAt(0));
+        _logicalLines.removeLines(1);
+        _timestamps.removeLines(1);
     }
     ////qDebug() << "set max lines to: " << _maxLineCount;
 }
@@ -605,6 +1385,20 @@ bool CompactHistoryScroll::isWrappedLine(int lineNumber)
     return _lines[lineNumber]->isWrapped();
 }
 
+qint64 CompactHistoryScroll::getLineTimestamp(int lineNumber)
+{
+    // the last line gets its time once it is complete, see addLine()
+    return lineNumber >= 0 && lineNumber < _timestamps.lineCount() ? _timestamps.timestamp(lineNumber) : 0;
+}
+
+const QChar *CompactHistoryScroll::getLineText(int lineNumber, int &length)
+{
+    Q_ASSERT(lineNumber < _lines.size());
+    CompactHistoryLine *line = _lines[lineNumber];
+    length = line->getLength();
+    return line->plainText();
+}
+
 //////////////////////////////////////////////////////////////////////
 // History Types
 //////////////////////////////////////////////////////////////////////
@@ -612,6 +1406,11 @@ bool CompactHistoryScroll::isWrappedLine(int lineNumber)
 HistoryType::HistoryType() = default;
 HistoryType::~HistoryType() = default;
 
+bool HistoryType::copiesLines(HistoryScroll *) const
+{
+    return false;
+}
+
 //////////////////////////////
 
 HistoryTypeNone::HistoryTypeNone()
@@ -648,7 +1447,7 @@ bool HistoryTypeFile::isEnabled() const
 
 HistoryScroll *HistoryTypeFile::scroll(HistoryScroll *old) const
 {
-    if (dynamic_cast<HistoryFile *>(old) != nullptr) {
+    if (dynamic_cast<HistoryScrollFile *>(old) != nullptr) {
         return old; // Unchanged.
     }
     HistoryScroll *newScroll = new HistoryScrollFile(_fileName);
@@ -661,11 +1460,13 @@ HistoryScroll *HistoryTypeFile::scroll(HistoryScroll *old) const
             auto tmp_line = new Character[size];
             old->getCells(i, 0, size, tmp_line);
             newScroll->addCells(tmp_line, size);
+            newScroll->setNextLineTimestamp(old->getLineTimestamp(i));
             newScroll->addLine(old->isWrappedLine(i));
             delete [] tmp_line;
         } else {
             old->getCells(i, 0, size, line);
             newScroll->addCells(line, size);
+            newScroll->setNextLineTimestamp(old->getLineTimestamp(i));
             newScroll->addLine(old->isWrappedLine(i));
         }
     }
@@ -679,6 +1480,11 @@ int HistoryTypeFile::maximumLineCount() const
     return -1;
 }
 
+bool HistoryTypeFile::copiesLines(HistoryScroll *old) const
+{
+    return old != nullptr && dynamic_cast<HistoryScrollFile *>(old) == nullptr && old->getLines() > 0;
+}
+
 //////////////////////////////
 
 CompactHistoryType::CompactHistoryType(unsigned int nbLines) :
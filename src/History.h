@@ -25,7 +25,10 @@
 #include <sys/mman.h>
 
 // Qt
+#include <QByteArray>
 #include <QList>
+#include <QSharedData>
+#include <QSharedPointer>
 #include <QVector>
 #include <QTemporaryFile>
 
@@ -56,6 +59,15 @@ public:
     //returns true if the file is mmap'ed
     bool isMapped() const;
 
+    //un-mmaps the file if it is mapped, the next reads fall back to lseek-read
+    //until enough reads happen to map the file again
+    void releaseMemory();
+
+    //mmaps the first 'length' bytes of the file in read-only mode, independently
+    //of map().  the caller owns the mapping and must munmap() it.
+    //returns nullptr if nothing has been written yet or mmap'ing fails
+    uchar *mapCopy(qint64 &length);
+
 private:
     qint64 _length;
     QTemporaryFile _tmpFile;
@@ -71,10 +83,246 @@ private:
 
     //when _readWriteBalance goes below this threshold, the file will be mmap'ed automatically
     static const int MAP_THRESHOLD = -1000;
+
+    //while the file is not mmap'ed, small reads fetch a window of the file around
+    //them, in the direction of the previous read, which the following reads are
+    //served from
+    QByteArray _readAhead;
+    qint64 _readAheadStart;
+    qint64 _lastReadStart;
+
+    static const int READ_AHEAD_SIZE = 64 * 1024;
 };
 
 //////////////////////////////////////////////////////////////////////
 
+//////////////////////////////////////////////////////////////////////
+// Range of history lines
+//////////////////////////////////////////////////////////////////////
+
+/**
+ * The cells and wrapped flags of a range of history lines, read at once with
+ * HistoryScroll::getLineRange() or HistorySnapshot::getLineRange().  The cells
+ * of all lines are kept in one buffer, which is reused when a range is read
+ * into the same object again.
+ *
+ * Lines are numbered like in the history they were read from.
+ */
+class KONSOLEPRIVATE_EXPORT HistoryLineRange
+{
+public:
+    HistoryLineRange();
+
+    /** Returns the number of the first line of the range */
+    int firstLine() const
+    {
+        return _firstLine;
+    }
+
+    /** Returns the number of lines in the range */
+    int lineCount() const
+    {
+        return _wrapped.count();
+    }
+
+    /** Returns true if @p line is in the range */
+    bool contains(int line) const
+    {
+        return line >= _firstLine && line < _firstLine + lineCount();
+    }
+
+    int lineLength(int line) const
+    {
+        Q_ASSERT(contains(line));
+        return _starts[line - _firstLine + 1] - _starts[line - _firstLine];
+    }
+
+    const Character *lineCells(int line) const
+    {
+        Q_ASSERT(contains(line));
+        return _cells.constData() + _starts[line - _firstLine];
+    }
+
+    bool isWrappedLine(int line) const
+    {
+        Q_ASSERT(contains(line));
+        return _wrapped[line - _firstLine] != 0;
+    }
+
+    // used to read lines into the range
+
+    /** Empties the range, the next line added is @p firstLine */
+    void clear(int firstLine);
+    /** Makes room for @p lineCount more lines with @p cellCount cells in total */
+    void reserve(int lineCount, int cellCount);
+    /** Adds a line of @p length cells and returns where its cells go */
+    Character *addLine(int length, bool wrapped);
+    /** Returns where the cells of @p line, which has been added already, go */
+    Character *lineCells(int line)
+    {
+        Q_ASSERT(contains(line));
+        return _cells.data() + _starts[line - _firstLine];
+    }
+
+private:
+    int _firstLine;
+    QVector<Character> _cells;
+    // offset of the cells of each line in _cells, followed by the number of cells
+    QVector<int> _starts;
+    QVector<quint8> _wrapped;
+};
+
+//////////////////////////////////////////////////////////////////////
+// Read-only snapshot of a history scroll
+//////////////////////////////////////////////////////////////////////
+
+/**
+ * A read-only view onto the lines a HistoryScroll contained at the time
+ * the snapshot was created with HistoryScroll::createSnapshot().
+ *
+ * Unlike the scroll itself, a snapshot can be read from another thread
+ * while lines are added to or dropped from the scroll, and it stays valid
+ * after the scroll has been deleted.
+ */
+class KONSOLEPRIVATE_EXPORT HistorySnapshot
+{
+public:
+    virtual ~HistorySnapshot();
+
+    virtual int  getLines() const = 0;
+    virtual int  getLineLen(int lineno) const = 0;
+    virtual void getCells(int lineno, int colno, int count, Character res[]) const = 0;
+    virtual bool isWrappedLine(int lineno) const = 0;
+
+    /** See HistoryScroll::getLineText() */
+    virtual const QChar *getLineText(int lineno, int &length) const;
+
+    /** See HistoryScroll::getLineRange() */
+    virtual void getLineRange(int startLine, int count, HistoryLineRange &range) const;
+    /** See HistoryScroll::readsLineRanges() */
+    virtual bool readsLineRanges() const;
+
+    /** See HistoryScroll::getLineTimestamp() */
+    virtual qint64 getLineTimestamp(int lineno) const;
+};
+
+//////////////////////////////////////////////////////////////////////
+// Index of logical lines
+//////////////////////////////////////////////////////////////////////
+
+/**
+ * Maps the lines of a history scroll to logical lines, that is sequences of
+ * lines joined by wrapping, and back.
+ *
+ * Lines are numbered like in the history scroll.  The first logical line may
+ * have started in lines which have already been dropped from the history, and
+ * the last one continues on the screen if the last line of the history is
+ * wrapped.
+ *
+ * Copies of an index share their data until one of them is changed.
+ */
+class KONSOLEPRIVATE_EXPORT LogicalLineIndex
+{
+public:
+    LogicalLineIndex();
+
+    /** Tells the index that a line was added, which continues on the next line if @p wrapped is true. */
+    void addLine(bool wrapped);
+    /** Tells the index that the first @p count lines were dropped from the history. */
+    void removeLines(int count);
+    /** Removes all lines from the index. */
+    void clear();
+
+    /** Returns the number of lines in the index. */
+    int lineCount() const;
+    /** Returns the number of logical lines in the index. */
+    int logicalLineCount() const;
+    /** Returns true if the last line added continues on the next line. */
+    bool isLastLineWrapped() const;
+
+    /** Returns the logical line which @p line is part of. */
+    int logicalLineOf(int line) const;
+    /** Returns the first line of @p logicalLine which is still in the history. */
+    int logicalLineStart(int logicalLine) const;
+    /** Returns the last line of @p logicalLine in the history. */
+    int logicalLineEnd(int logicalLine) const;
+
+private:
+    void dropLogicalLines();
+
+    // first line of each logical line from _firstStart on.  lines are
+    // counted from the last clear(), so that dropping lines does not
+    // change the numbers
+    QVector<int> _starts;
+    int _firstStart;
+    int _addedLines;
+    int _firstLine;
+    bool _continued;
+
+    // minimum number of dropped logical lines before _starts is compacted
+    static const int COMPACT_THRESHOLD = 4096;
+};
+
+//////////////////////////////////////////////////////////////////////
+// Times the lines were written
+//////////////////////////////////////////////////////////////////////
+
+/**
+ * The times the lines of a history scroll were written to the terminal, in
+ * milliseconds since the epoch.
+ *
+ * Lines are grouped in chunks of LINES_PER_CHUNK lines.  A chunk holds the
+ * time of its first line and, for the following lines, the time elapsed
+ * since the line before as a variable length number, so that lines written
+ * less than 128 ms apart take one byte each.  Times never go backwards, a
+ * line with an earlier time than the line before it gets the time of that
+ * line.
+ *
+ * Copies share their data until one of them is changed.
+ */
+class KONSOLEPRIVATE_EXPORT LineTimestamps
+{
+public:
+    LineTimestamps();
+
+    /** Adds a line which was written at @p time */
+    void addLine(qint64 time);
+    /** Tells the timestamps that the first @p count lines were dropped from the history. */
+    void removeLines(int count);
+    /** Removes all lines. */
+    void clear();
+
+    /** Returns the number of lines. */
+    int lineCount() const;
+    /** Returns the time @p line was written. */
+    qint64 timestamp(int line) const;
+
+    /** Returns the number of bytes used by the timestamps. */
+    qint64 memoryUsage() const;
+
+    /** Returns the current time, as cheaply as the system allows. */
+    static qint64 currentTime();
+
+    static const int LINES_PER_CHUNK = 256;
+
+private:
+    struct Chunk {
+        qint64 firstTime;
+        qint64 lastTime;
+        // time differences between the lines of the chunk
+        QByteArray deltas;
+    };
+
+    // times of the lines of a chunk up to @p line, which is counted within the chunk
+    static qint64 timeInChunk(const Chunk &chunk, int line);
+
+    QVector<Chunk> _chunks;
+    // lines dropped from the first chunk
+    int _firstLine;
+    // lines in the last chunk
+    int _lastChunkLines;
+};
+
 //////////////////////////////////////////////////////////////////////
 // Abstract base class for file and buffer versions
 //////////////////////////////////////////////////////////////////////
@@ -96,27 +344,106 @@ public:
 
     // adding lines.
     virtual void addCells(const Character a[], int count) = 0;
-    // convenience method - this is virtual so that subclasses can take advantage
-    // of QVector's implicit copying
-    virtual void addCellsVector(const QVector<Character> &cells)
+    // convenience method, lines are encoded straight from the cells passed
+    // to addCells() without copying them first
+    void addCellsVector(const QVector<Character> &cells)
     {
-        addCells(cells.data(), cells.size());
+        addCells(cells.constData(), cells.size());
     }
 
     virtual void addLine(bool previousWrapped = false) = 0;
 
+    /**
+     * Returns the text of line @p lineno without its attributes, for readers
+     * which only need the text (searching, copying, saving as plain text).
+     * The text is not copied, it stays valid until the line is removed from
+     * the history.  @p length is set to the length of the line.
+     *
+     * This is only possible for lines which the history stores as plain text
+     * and which consist of real characters of single width, without combining
+     * characters.  The text is then the same as the one PlainTextDecoder
+     * produces for the cells of the line.  For other lines, or if the history
+     * does not keep a separate text plane, nullptr is returned and the line
+     * has to be read with getCells().
+     */
+    virtual const QChar *getLineText(int lineno, int &length);
+
+    /**
+     * Reads the @p count lines from @p startLine on into @p range, which is
+     * faster than reading them one by one for histories which have to be
+     * read from disk.  The lines must be in the history.
+     */
+    virtual void getLineRange(int startLine, int count, HistoryLineRange &range);
+    /**
+     * Returns true if getLineRange() is faster than reading the lines one by
+     * one.  Otherwise it only adds a copy of the cells.
+     */
+    virtual bool readsLineRanges() const;
+
+    /**
+     * Returns the time line @p lineno was written to the terminal, in
+     * milliseconds since the epoch, or 0 if it is not known.
+     */
+    virtual qint64 getLineTimestamp(int lineno);
+
+    /**
+     * Makes the next line added with addLine() carry @p timestamp rather
+     * than the current time.  The Screen passes the time it first wrote to
+     * the line, lines copied from another history keep their time.
+     * A timestamp of 0 keeps the time of the line unknown.
+     */
+    void setNextLineTimestamp(qint64 timestamp)
+    {
+        _nextLineTimestamp = timestamp;
+    }
+
+    /**
+     * Gives back memory which is not needed to keep the history, for example
+     * when the system is under memory pressure.  The contents of the history
+     * are unchanged.
+     */
+    virtual void releaseMemory()
+    {
+    }
+
+    /**
+     * Returns a snapshot of the current contents of the history, which the
+     * caller takes ownership of.  The default implementation copies every line,
+     * subclasses override it to share their storage with the snapshot instead.
+     */
+    virtual HistorySnapshot *createSnapshot();
+
+    /**
+     * Returns the index of the logical lines the lines of the history form.
+     * Subclasses keep it up to date when lines are added or dropped.
+     */
+    const LogicalLineIndex &logicalLines() const
+    {
+        return _logicalLines;
+    }
+
     //
     // FIXME:  Passing around constant references to HistoryType instances
     // is very unsafe, because those references will no longer
     // be valid if the history scroll is deleted.
     //
-    const HistoryType &getType() const
+    virtual const HistoryType &getType() const
     {
         return *_historyType;
     }
 
 protected:
+    // the time of a line being added now, see setNextLineTimestamp()
+    qint64 lineTimestamp()
+    {
+        const qint64 timestamp = _nextLineTimestamp;
+        _nextLineTimestamp = -1;
+        return timestamp >= 0 ? timestamp : LineTimestamps::currentTime();
+    }
+
     HistoryType *_historyType;
+    LogicalLineIndex _logicalLines;
+    qint64 _nextLineTimestamp;
 };
 
 //////////////////////////////////////////////////////////////////////
@@ -134,15 +461,23 @@ public:
     void getCells(int lineno, int colno, int count, Character res[]) Q_DECL_OVERRIDE;
     bool isWrappedLine(int lineno) Q_DECL_OVERRIDE;
 
+    void getLineRange(int startLine, int count, HistoryLineRange &range) Q_DECL_OVERRIDE;
+    bool readsLineRanges() const Q_DECL_OVERRIDE;
+    qint64 getLineTimestamp(int lineno) Q_DECL_OVERRIDE;
+
     void addCells(const Character text[], int count) Q_DECL_OVERRIDE;
     void addLine(bool previousWrapped = false) Q_DECL_OVERRIDE;
 
+    void releaseMemory() Q_DECL_OVERRIDE;
+    HistorySnapshot *createSnapshot() Q_DECL_OVERRIDE;
+
 private:
     qint64 startOfLine(int lineno);
 
     HistoryFile _index; // lines Row(qint64)
     HistoryFile _cells; // text  Row(Character)
     HistoryFile _lineflags; // flags Row(unsigned char)
+    LineTimestamps _timestamps;
 };
 
 //////////////////////////////////////////////////////////////////////
@@ -201,18 +536,38 @@ public:
     bool isRealCharacter;
 };
 
+/*
+   A piece of a line in the compact history: the text and the format runs
+   of up to CompactHistoryLine::SEGMENT_LENGTH cells.  Format positions
+   are relative to the start of the segment.
+*/
+struct CompactHistorySegment
+{
+    CharacterFormat *formats;
+    quint16 *text;
+    quint16 length;
+    quint16 formatLength;
+};
+
+/*
+   A block keeps the text of its lines apart from everything else:
+   text is allocated upwards from the start of the block, so that the
+   text of the lines forms one contiguous plane, while the lines and their
+   attribute runs are allocated downwards from the end of the block.
+*/
 class CompactHistoryBlock
 {
 public:
     CompactHistoryBlock() :
         _blockLength(4096 * 64), // 256kb
-        _head(static_cast<quint8 *>(mmap(nullptr, _blockLength, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0))),
+        _head(nullptr),
         _tail(nullptr),
-        _blockStart(nullptr),
+        _blockStart(static_cast<quint8 *>(mmap(nullptr, _blockLength, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANON, -1, 0))),
         _allocCount(0)
     {
-        Q_ASSERT(_head != MAP_FAILED);
-        _tail = _blockStart = _head;
+        Q_ASSERT(_blockStart != MAP_FAILED);
+        _tail = _blockStart;
+        _head = _blockStart + _blockLength;
     }
 
     virtual ~CompactHistoryBlock()
@@ -223,7 +578,7 @@ public:
 
     virtual unsigned int remaining()
     {
-        return _blockStart + _blockLength - _tail;
+        return _head - _tail;
     }
 
     virtual unsigned  length()
@@ -231,7 +586,10 @@ public:
         return _blockLength;
     }
 
+    // allocates memory for objects and attributes at the end of the block
     virtual void *allocate(size_t size);
+    // allocates memory for text at the start of the block
+    virtual void *allocateText(size_t size);
     virtual bool contains(void *addr)
     {
         return addr >= _blockStart && addr < (_blockStart + _blockLength);
@@ -243,39 +601,62 @@ public:
         return _allocCount != 0;
     }
 
+    // advises the kernel that the block will not be needed soon, so that
+    // its pages can be swapped out (or compressed) before anything else
+    void releaseMemory();
+
 private:
     size_t _blockLength;
+    // start of the objects and attributes
     quint8 *_head;
+    // end of the text
     quint8 *_tail;
     quint8 *_blockStart;
     int _allocCount;
+
+    static const size_t ALIGNMENT = sizeof(void *);
 };
 
+typedef QSharedPointer<CompactHistoryBlock> CompactHistoryBlockPtr;
+
 class CompactHistoryBlockList
 {
 public:
     CompactHistoryBlockList() :
-        list(QList<CompactHistoryBlock *>())
+        list(QList<CompactHistoryBlockPtr>())
     {
     }
 
     ~CompactHistoryBlockList();
 
     void *allocate(size_t size);
+    void *allocateText(size_t size);
     void deallocate(void *);
     int length()
     {
         return list.size();
     }
 
+    // releases all blocks but the one new lines are currently added to
+    void releaseMemory();
+
+    // the blocks currently in use.  blocks are only unmapped once the list and
+    // every copy of this returned by it have dropped their reference, and the
+    // memory of a block is never reused, so lines stay readable through a copy
+    // even after they have been removed from the history
+    QList<CompactHistoryBlockPtr> blocks() const
+    {
+        return list;
+    }
+
 private:
-    QList<CompactHistoryBlock *> list;
+    QList<CompactHistoryBlockPtr> list;
 };
 
 class CompactHistoryLine
 {
 public:
-    CompactHistoryLine(const TextLine &, CompactHistoryBlockList &blockList);
+    CompactHistoryLine(const Character *cells, int count, CompactHistoryBlockList &blockList);
     virtual ~CompactHistoryLine();
 
     // custom new operator to allocate memory from custom pool instead of heap
@@ -302,13 +683,34 @@ public:
         return _length;
     }
 
+    // returns the text of the line if it can be used as it is, without the
+    // formats, see HistoryScroll::getLineText()
+    const QChar *plainText() const
+    {
+        return _plainText ? reinterpret_cast<const QChar *>(_segment.text) : nullptr;
+    }
+
+    // lines are stored in segments of this many cells, so that format
+    // positions fit in 16 bits and long lines are spread over several
+    // blocks.  a slice of a long line is read from the segments it covers
+    static const int SEGMENT_LENGTH = 4096;
+
 protected:
+    void initSegment(CompactHistorySegment &segment, const Character *cells, int count);
+    void getSegmentCharacters(const CompactHistorySegment &segment, Character *array, int size, int startColumn) const;
+    int segmentCount() const
+    {
+        return (_length + SEGMENT_LENGTH - 1) / SEGMENT_LENGTH;
+    }
+
     CompactHistoryBlockList &_blockListRef;
-    CharacterFormat *_formatArray;
-    quint16 _length;
-    quint16 *_text;
-    quint16 _formatLength;
+    // the only segment of lines of up to SEGMENT_LENGTH cells
+    CompactHistorySegment _segment;
+    // _segment, or the segments of a longer line allocated in the block list
+    CompactHistorySegment *_segments;
+    quint32 _length;
     bool _wrapped;
+    bool _plainText;
 };
 
 class KONSOLEPRIVATE_EXPORT CompactHistoryScroll : public HistoryScroll
@@ -323,17 +725,34 @@ public:
     int  getLineLen(int lineNumber) Q_DECL_OVERRIDE;
     void getCells(int lineNumber, int startColumn, int count, Character buffer[]) Q_DECL_OVERRIDE;
     bool isWrappedLine(int lineNumber) Q_DECL_OVERRIDE;
+    const QChar *getLineText(int lineNumber, int &length) Q_DECL_OVERRIDE;
+    qint64 getLineTimestamp(int lineNumber) Q_DECL_OVERRIDE;
 
     void addCells(const Character a[], int count) Q_DECL_OVERRIDE;
-    void addCellsVector(const TextLine &cells) Q_DECL_OVERRIDE;
     void addLine(bool previousWrapped = false) Q_DECL_OVERRIDE;
 
+    void releaseMemory() Q_DECL_OVERRIDE;
+    HistorySnapshot *createSnapshot() Q_DECL_OVERRIDE;
+
     void setMaxNbLines(unsigned int lineCount);
 
 private:
     bool hasDifferentColors(const TextLine &line) const;
+    // deletes a line dropped from the history, or keeps it until no snapshot
+    // can read it any more
+    void dropLine(CompactHistoryLine *line);
+    bool hasSnapshots() const;
+
     HistoryArray _lines;
     CompactHistoryBlockList _blockList;
+    LineTimestamps _timestamps;
+
+    // referenced by every snapshot of the scroll, to tell whether any of them
+    // still exist.  snapshots are only created in the thread the scroll is
+    // used in, so once there are none left no new one can appear meanwhile
+    QExplicitlySharedDataPointer<QSharedData> _snapshotReference;
+    // lines dropped while there were snapshots
+    HistoryArray _droppedLines;
 
     unsigned int _maxLineCount;
 };
@@ -363,6 +782,12 @@ public:
      * same type, returns it.
      */
     virtual HistoryScroll *scroll(HistoryScroll *) const = 0;
+    /**
+     * Returns true if scroll() takes over the lines of @p old by copying
+     * them one by one, rather than keeping or dropping them.  Such a
+     * conversion can be done in a separate thread, see MigratingHistoryScroll
+     */
+    virtual bool copiesLines(HistoryScroll *old) const;
     /**
      * Returns true if the history size is unlimited.
      */
@@ -392,6 +817,7 @@ public:
     int maximumLineCount() const Q_DECL_OVERRIDE;
 
     HistoryScroll *scroll(HistoryScroll *) const Q_DECL_OVERRIDE;
+    bool copiesLines(HistoryScroll *old) const Q_DECL_OVERRIDE;
 
 protected:
     QString _fileName;
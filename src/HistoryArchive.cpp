@@ -0,0 +1,677 @@
+/*
+    This file is part of Konsole, a terminal emulator for KDE.
+
+    Copyright 2018 by The Konsole Developers
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+// Own
+#include "HistoryArchive.h"
+
+#include "konsoledebug.h"
+
+// System
+#include <errno.h>
+#include <fcntl.h>
+#include <limits>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Qt
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QRunnable>
+#include <QSaveFile>
+#include <QThreadPool>
+
+// Konsole
+#include "ExtendedCharTable.h"
+#include "Screen.h"
+
+using namespace Konsole;
+
+static const char ARCHIVE_MAGIC[8] = {'K', 'O', 'N', 'S', 'H', 'I', 'S', 'T'};
+static const quint32 ARCHIVE_VERSION = 1;
+// written as it is, to detect archives written on a machine of another byte order
+static const quint32 ARCHIVE_BYTE_ORDER = 0x01020304;
+
+static const quint8 LINE_WRAPPED_FLAG = 0x01;
+
+struct HistoryArchive::Header
+{
+    char magic[8];
+    quint32 version;
+    quint32 byteOrder;
+    quint32 lineCount;
+    quint32 extendedCharCount;
+    // quint64[lineCount] offsets of the lines
+    quint64 linesOffset;
+    // quint8[lineCount] flags of the lines
+    quint64 flagsOffset;
+    // for each combined character its length (quint16) and its code units
+    quint64 extendedCharsOffset;
+};
+
+// a line is stored as this header followed by its formats and
+// its text (quint16[length]), padded to a multiple of 8 bytes
+struct HistoryArchive::LineHeader
+{
+    quint32 length;
+    quint32 formatCount;
+};
+
+struct HistoryArchive::Format
+{
+    CharacterColor foregroundColor;
+    CharacterColor backgroundColor;
+    quint32 startColumn;
+    RenditionFlags rendition;
+    quint8 isRealCharacter;
+    quint8 padding;
+};
+
+static inline qint64 alignedOffset(qint64 offset)
+{
+    return (offset + 7) & ~7;
+}
+
+// cells at the end of a screen line which have never been written to
+static inline bool isBlank(const Character &c)
+{
+    return c.character == ' ' && c.rendition == DEFAULT_RENDITION
+           && c.backgroundColor == CharacterColor(COLOR_SPACE_DEFAULT, DEFAULT_BACK_COLOR);
+}
+
+static int archivedLineLength(const ScreenSnapshot *snapshot, int line, QVector<Character> &cells)
+{
+    int length = snapshot->getLineLen(line);
+    cells.resize(length);
+    snapshot->getCells(line, 0, length, cells.data());
+
+    if (line >= snapshot->getHistLines() && !snapshot->isWrappedLine(line)) {
+        while (length > 0 && isBlank(cells[length - 1])) {
+            length--;
+        }
+    }
+    return length;
+}
+
+/*
+   Writes an archive in the background and deletes the snapshot afterwards.
+*/
+class HistoryArchiveWriter : public QRunnable
+{
+public:
+    HistoryArchiveWriter(const QString &fileName, ScreenSnapshot *snapshot) :
+        _fileName(fileName),
+        _snapshot(snapshot)
+    {
+    }
+
+    ~HistoryArchiveWriter() Q_DECL_OVERRIDE
+    {
+        delete _snapshot;
+    }
+
+    void run() Q_DECL_OVERRIDE
+    {
+        if (!HistoryArchive::write(_fileName, _snapshot)) {
+            qCDebug(KonsoleDebug) << "Writing the history archive" << _fileName << "failed";
+        }
+    }
+
+private:
+    QString _fileName;
+    ScreenSnapshot *_snapshot;
+};
+
+// the pool waits for the archives being written when it is destroyed at exit
+Q_GLOBAL_STATIC(QThreadPool, archiveWriters)
+
+HistoryArchive::HistoryArchive(uchar *data, qint64 size) :
+    _data(data),
+    _size(size),
+    _header(reinterpret_cast<const Header *>(data)),
+    _lineOffsets(nullptr),
+    _lineFlags(nullptr),
+    _extendedChars(QVector<ushort>())
+{
+}
+
+HistoryArchive::~HistoryArchive()
+{
+    munmap(_data, _size);
+}
+
+bool HistoryArchive::write(const QString &fileName, const ScreenSnapshot *snapshot)
+{
+    QDir().mkpath(QFileInfo(fileName).absolutePath());
+
+    // the output may hold passwords and the like, only the user may read it
+    QSaveFile file(fileName);
+    if (!file.open(QIODevice::WriteOnly)
+        || !file.setPermissions(QFileDevice::ReadOwner | QFileDevice::WriteOwner)) {
+        return false;
+    }
+
+    QVector<Character> cells;
+
+    // leave out the empty lines below the output on the screen
+    int lineCount = snapshot->getLines();
+    while (lineCount > snapshot->getHistLines() && archivedLineLength(snapshot, lineCount - 1, cells) == 0) {
+        lineCount--;
+    }
+
+    Header header;
+    memset(&header, 0, sizeof(Header));
+    memcpy(header.magic, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC));
+    header.version = ARCHIVE_VERSION;
+    header.byteOrder = ARCHIVE_BYTE_ORDER;
+    header.lineCount = lineCount;
+
+    // the header is written again once the offsets are known
+    bool ok = file.write(reinterpret_cast<const char *>(&header), sizeof(Header)) == sizeof(Header);
+    qint64 offset = sizeof(Header);
+
+    QVector<quint64> lineOffsets(lineCount);
+    QByteArray lineFlags(lineCount, 0);
+
+    // combined characters are stored by their index in the archive
+    QHash<ushort, quint16> extendedIndexes;
+    QByteArray extendedChars;
+
+    QVector<Format> formats;
+    QVector<quint16> text;
+    const char padding[8] = {0};
+
+    for (int line = 0; line < lineCount && ok; line++) {
+        const int length = archivedLineLength(snapshot, line, cells);
+
+        formats.resize(0);
+        text.resize(length);
+
+        for (int i = 0; i < length; i++) {
+            Character &c = cells[i];
+
+            if ((c.rendition & RE_EXTENDED_CHAR) != 0) {
+                QHash<ushort, quint16>::const_iterator iter = extendedIndexes.constFind(c.character);
+                if (iter != extendedIndexes.constEnd()) {
+                    text[i] = iter.value();
+                } else {
+                    // archives are written in the background, so the
+                    // sequence is copied rather than looked up in place
+                    const QVector<ushort> chars = ExtendedCharTable::instance.copyExtendedChar(c.character);
+                    if (!chars.isEmpty() && extendedIndexes.count() < 0xffff) {
+                        const quint16 extendedLength = chars.size();
+                        text[i] = extendedIndexes.count();
+                        extendedIndexes.insert(c.character, text[i]);
+                        extendedChars.append(reinterpret_cast<const char *>(&extendedLength), sizeof(quint16));
+                        extendedChars.append(reinterpret_cast<const char *>(chars.constData()), extendedLength * sizeof(quint16));
+                    } else {
+                        c.rendition &= ~RE_EXTENDED_CHAR;
+                        text[i] = ' ';
+                    }
+                }
+            } else {
+                text[i] = c.character;
+            }
+
+            // unlike the compact history, the runs keep cells with and without
+            // combined characters apart
+            if (formats.isEmpty()
+                || formats.last().rendition != c.rendition
+                || formats.last().foregroundColor != c.foregroundColor
+                || formats.last().backgroundColor != c.backgroundColor
+                || formats.last().isRealCharacter != static_cast<quint8>(c.isRealCharacter)) {
+                Format format;
+                memset(&format, 0, sizeof(Format));
+                format.foregroundColor = c.foregroundColor;
+                format.backgroundColor = c.backgroundColor;
+                format.startColumn = i;
+                format.rendition = c.rendition;
+                format.isRealCharacter = c.isRealCharacter ? 1 : 0;
+                formats.append(format);
+            }
+        }
+
+        LineHeader lineHeader;
+        lineHeader.length = length;
+        lineHeader.formatCount = formats.count();
+
+        const qint64 recordLength = sizeof(LineHeader) + formats.count() * sizeof(Format) + length * sizeof(quint16);
+        const qint64 paddingLength = alignedOffset(recordLength) - recordLength;
+
+        lineOffsets[line] = offset;
+        lineFlags[line] = snapshot->isWrappedLine(line) ? LINE_WRAPPED_FLAG : 0;
+
+        ok = file.write(reinterpret_cast<const char *>(&lineHeader), sizeof(LineHeader)) == sizeof(LineHeader)
+             && file.write(reinterpret_cast<const char *>(formats.constData()), formats.count() * sizeof(Format))
+                == static_cast<qint64>(formats.count() * sizeof(Format))
+             && file.write(reinterpret_cast<const char *>(text.constData()), length * sizeof(quint16))
+                == static_cast<qint64>(length * sizeof(quint16))
+             && file.write(padding, paddingLength) == paddingLength;
+        offset += recordLength + paddingLength;
+    }
+
+    header.linesOffset = offset;
+    header.flagsOffset = header.linesOffset + lineCount * sizeof(quint64);
+    header.extendedCharsOffset = header.flagsOffset + lineCount;
+    header.extendedCharCount = extendedIndexes.count();
+
+    ok = ok
+         && file.write(reinterpret_cast<const char *>(lineOffsets.constData()), lineCount * sizeof(quint64))
+            == static_cast<qint64>(lineCount * sizeof(quint64))
+         && file.write(lineFlags) == lineFlags.size()
+         && file.write(extendedChars) == extendedChars.size()
+         && file.seek(0)
+         && file.write(reinterpret_cast<const char *>(&header), sizeof(Header)) == sizeof(Header);
+
+    if (!ok) {
+        file.cancelWriting();
+        return false;
+    }
+
+    return file.commit();
+}
+
+void HistoryArchive::writeInBackground(const QString &fileName, ScreenSnapshot *snapshot)
+{
+    // one archive after the other, so that saving many sessions at once
+    // does not have them compete for the disk
+    archiveWriters->setMaxThreadCount(1);
+    archiveWriters->start(new HistoryArchiveWriter(fileName, snapshot));
+}
+
+QSharedPointer<HistoryArchive> HistoryArchive::open(const QString &fileName)
+{
+    const int fd = ::open(QFile::encodeName(fileName).constData(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return QSharedPointer<HistoryArchive>();
+    }
+
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0 || fileStat.st_size < static_cast<off_t>(sizeof(Header))) {
+        ::close(fd);
+        return QSharedPointer<HistoryArchive>();
+    }
+
+    // the pages are only read from the file when the lines are
+    void *data = mmap(nullptr, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (data == MAP_FAILED) {
+        qCDebug(KonsoleDebug) << "mmap'ing history archive failed.  errno = " << errno;
+        return QSharedPointer<HistoryArchive>();
+    }
+
+    QSharedPointer<HistoryArchive> archive(new HistoryArchive(static_cast<uchar *>(data), fileStat.st_size));
+    const Header *header = archive->_header;
+    const quint64 size = fileStat.st_size;
+
+    if (memcmp(header->magic, ARCHIVE_MAGIC, sizeof(ARCHIVE_MAGIC)) != 0
+        || header->version != ARCHIVE_VERSION
+        || header->byteOrder != ARCHIVE_BYTE_ORDER
+        || header->lineCount > static_cast<quint32>(std::numeric_limits<int>::max())
+        || header->linesOffset % sizeof(quint64) != 0
+        || header->linesOffset > size
+        || (size - header->linesOffset) / sizeof(quint64) < header->lineCount
+        || header->flagsOffset != header->linesOffset + header->lineCount * sizeof(quint64)
+        || header->extendedCharsOffset != header->flagsOffset + header->lineCount
+        || header->extendedCharsOffset > size) {
+        qCDebug(KonsoleDebug) << "Not a valid history archive:" << fileName;
+        return QSharedPointer<HistoryArchive>();
+    }
+
+    archive->_lineOffsets = reinterpret_cast<const quint64 *>(archive->_data + header->linesOffset);
+    archive->_lineFlags = archive->_data + header->flagsOffset;
+
+    // the combined characters have to be known when the lines are read,
+    // possibly in other threads, register them now
+    quint64 offset = header->extendedCharsOffset;
+    archive->_extendedChars.reserve(header->extendedCharCount);
+    for (quint32 i = 0; i < header->extendedCharCount; i++) {
+        quint16 length = 0;
+        if (offset + sizeof(quint16) > size) {
+            break;
+        }
+        memcpy(&length, archive->_data + offset, sizeof(quint16));
+        offset += sizeof(quint16);
+        if (offset + length * sizeof(quint16) > size) {
+            break;
+        }
+
+        QVector<ushort> chars(length);
+        memcpy(chars.data(), archive->_data + offset, length * sizeof(quint16));
+        offset += length * sizeof(quint16);
+
+        archive->_extendedChars << ExtendedCharTable::instance.createExtendedChar(chars.constData(), length);
+    }
+
+    return archive;
+}
+
+const HistoryArchive::LineHeader *HistoryArchive::line(int lineno) const
+{
+    if (lineno < 0 || lineno >= getLines()) {
+        return nullptr;
+    }
+
+    // the lines are checked when they are read, so that a damaged archive
+    // does not have to be read completely when it is opened
+    const quint64 offset = _lineOffsets[lineno];
+    if (offset % sizeof(quint64) != 0 || offset + sizeof(LineHeader) > static_cast<quint64>(_size)) {
+        return nullptr;
+    }
+
+    const LineHeader *header = reinterpret_cast<const LineHeader *>(_data + offset);
+    const quint64 end = offset + sizeof(LineHeader)
+                        + static_cast<quint64>(header->formatCount) * sizeof(Format)
+                        + static_cast<quint64>(header->length) * sizeof(quint16);
+    if (end > static_cast<quint64>(_size) || header->length > static_cast<quint32>(std::numeric_limits<int>::max())
+        || (header->length > 0 && header->formatCount == 0)) {
+        return nullptr;
+    }
+
+    return header;
+}
+
+int HistoryArchive::getLines() const
+{
+    return _header->lineCount;
+}
+
+int HistoryArchive::getLineLen(int lineno) const
+{
+    const LineHeader *header = line(lineno);
+    return header != nullptr ? header->length : 0;
+}
+
+void HistoryArchive::getCells(int lineno, int colno, int count, Character res[]) const
+{
+    const LineHeader *header = line(lineno);
+    if (header == nullptr || colno < 0 || count < 0 || static_cast<quint32>(colno + count) > header->length) {
+        for (int i = 0; i < count; i++) {
+            res[i] = Character();
+        }
+        return;
+    }
+
+    const Format *formats = reinterpret_cast<const Format *>(header + 1);
+    const quint16 *text = reinterpret_cast<const quint16 *>(formats + header->formatCount);
+
+    quint32 formatPos = 0;
+    for (int i = 0; i < count; i++) {
+        const quint32 column = colno + i;
+        while (formatPos + 1 < header->formatCount && formats[formatPos + 1].startColumn <= column) {
+            formatPos++;
+        }
+
+        const Format &format = formats[formatPos];
+        Character &c = res[i];
+        c.character = text[column];
+        c.rendition = format.rendition;
+        c.foregroundColor = format.foregroundColor;
+        c.backgroundColor = format.backgroundColor;
+        c.isRealCharacter = format.isRealCharacter != 0;
+
+        if ((c.rendition & RE_EXTENDED_CHAR) != 0) {
+            if (c.character < _extendedChars.count()) {
+                c.character = _extendedChars[c.character];
+            } else {
+                c.rendition &= ~RE_EXTENDED_CHAR;
+                c.character = ' ';
+            }
+        }
+    }
+}
+
+bool HistoryArchive::isWrappedLine(int lineno) const
+{
+    return lineno >= 0 && lineno < getLines() && (_lineFlags[lineno] & LINE_WRAPPED_FLAG) != 0;
+}
+
+void HistoryArchive::releaseMemory()
+{
+    // the pages are read from the file again when they are needed
+    madvise(_data, _size, MADV_DONTNEED);
+}
+
+// Restored History Scroll //////////////////////////////////////
+
+/*
+   Snapshot of a RestoredHistoryScroll, the archive is read-only
+   and can be shared as it is.
+*/
+class RestoredHistorySnapshot : public HistorySnapshot
+{
+public:
+    RestoredHistorySnapshot(const QSharedPointer<HistoryArchive> &archive, int firstLine, HistorySnapshot *scroll) :
+        _archive(archive),
+        _firstLine(firstLine),
+        _restoredLines(archive.isNull() ? 0 : archive->getLines() - firstLine),
+        _scroll(scroll)
+    {
+    }
+
+    ~RestoredHistorySnapshot() Q_DECL_OVERRIDE
+    {
+        delete _scroll;
+    }
+
+    int getLines() const Q_DECL_OVERRIDE
+    {
+        return _restoredLines + _scroll->getLines();
+    }
+
+    int getLineLen(int lineno) const Q_DECL_OVERRIDE
+    {
+        return lineno < _restoredLines ? _archive->getLineLen(lineno + _firstLine)
+                                       : _scroll->getLineLen(lineno - _restoredLines);
+    }
+
+    void getCells(int lineno, int colno, int count, Character res[]) const Q_DECL_OVERRIDE
+    {
+        if (lineno < _restoredLines) {
+            _archive->getCells(lineno + _firstLine, colno, count, res);
+        } else {
+            _scroll->getCells(lineno - _restoredLines, colno, count, res);
+        }
+    }
+
+    bool isWrappedLine(int lineno) const Q_DECL_OVERRIDE
+    {
+        return lineno < _restoredLines ? _archive->isWrappedLine(lineno + _firstLine)
+                                       : _scroll->isWrappedLine(lineno - _restoredLines);
+    }
+
+    const QChar *getLineText(int lineno, int &length) const Q_DECL_OVERRIDE
+    {
+        if (lineno < _restoredLines) {
+            length = _archive->getLineLen(lineno + _firstLine);
+            return nullptr;
+        }
+        return _scroll->getLineText(lineno - _restoredLines, length);
+    }
+
+    qint64 getLineTimestamp(int lineno) const Q_DECL_OVERRIDE
+    {
+        // the archive does not keep the times of its lines
+        return lineno < _restoredLines ? 0 : _scroll->getLineTimestamp(lineno - _restoredLines);
+    }
+
+private:
+    QSharedPointer<HistoryArchive> _archive;
+    int _firstLine;
+    int _restoredLines;
+    HistorySnapshot *_scroll;
+};
+
+RestoredHistoryScroll::RestoredHistoryScroll(const QSharedPointer<HistoryArchive> &archive, HistoryScroll *scroll) :
+    HistoryScroll(nullptr),
+    _archive(archive),
+    _firstLine(0),
+    _scroll(nullptr)
+{
+    setScroll(scroll);
+}
+
+RestoredHistoryScroll::~RestoredHistoryScroll()
+{
+    delete _scroll;
+}
+
+bool RestoredHistoryScroll::hasScroll()
+{
+    return _scroll->hasScroll();
+}
+
+int RestoredHistoryScroll::restoredLines() const
+{
+    return _archive.isNull() ? 0 : _archive->getLines() - _firstLine;
+}
+
+int RestoredHistoryScroll::getLines()
+{
+    return restoredLines() + _scroll->getLines();
+}
+
+int RestoredHistoryScroll::getLineLen(int lineno)
+{
+    const int restored = restoredLines();
+    return lineno < restored ? _archive->getLineLen(lineno + _firstLine)
+                             : _scroll->getLineLen(lineno - restored);
+}
+
+void RestoredHistoryScroll::getCells(int lineno, int colno, int count, Character res[])
+{
+    const int restored = restoredLines();
+    if (lineno < restored) {
+        _archive->getCells(lineno + _firstLine, colno, count, res);
+    } else {
+        _scroll->getCells(lineno - restored, colno, count, res);
+    }
+}
+
+bool RestoredHistoryScroll::isWrappedLine(int lineno)
+{
+    const int restored = restoredLines();
+    return lineno < restored ? _archive->isWrappedLine(lineno + _firstLine)
+                             : _scroll->isWrappedLine(lineno - restored);
+}
+
+const QChar *RestoredHistoryScroll::getLineText(int lineno, int &length)
+{
+    const int restored = restoredLines();
+    if (lineno < restored) {
+        length = _archive->getLineLen(lineno + _firstLine);
+        return nullptr;
+    }
+    return _scroll->getLineText(lineno - restored, length);
+}
+
+qint64 RestoredHistoryScroll::getLineTimestamp(int lineno)
+{
+    const int restored = restoredLines();
+    return lineno < restored ? 0 : _scroll->getLineTimestamp(lineno - restored);
+}
+
+void RestoredHistoryScroll::addCells(const Character a[], int count)
+{
+    const int previousLines = _scroll->getLines();
+    _scroll->addCells(a, count);
+    linesAdded(previousLines);
+}
+
+void RestoredHistoryScroll::linesAdded(int previousLines)
+{
+    // the scroll drops lines of its own once the restored ones are gone
+    const int dropped = previousLines + 1 - _scroll->getLines();
+    if (dropped > 0) {
+        _logicalLines.removeLines(dropped);
+    }
+}
+
+void RestoredHistoryScroll::addLine(bool previousWrapped)
+{
+    _scroll->setNextLineTimestamp(lineTimestamp());
+    _scroll->addLine(previousWrapped);
+    _logicalLines.addLine(previousWrapped);
+    dropRestoredLines();
+}
+
+void RestoredHistoryScroll::dropRestoredLines()
+{
+    const int maxLines = _scroll->getType().maximumLineCount();
+    if (_archive.isNull() || maxLines < 0) {
+        return;
+    }
+
+    const int dropped = qMin(restoredLines() + _scroll->getLines() - maxLines, restoredLines());
+    if (dropped > 0) {
+        _firstLine += dropped;
+        _logicalLines.removeLines(dropped);
+    }
+
+    if (restoredLines() == 0) {
+        // unmapped once no snapshot uses it any more
+        _archive.clear();
+        _firstLine = 0;
+    }
+}
+
+void RestoredHistoryScroll::releaseMemory()
+{
+    _scroll->releaseMemory();
+    if (!_archive.isNull()) {
+        _archive->releaseMemory();
+    }
+}
+
+HistorySnapshot *RestoredHistoryScroll::createSnapshot()
+{
+    return new RestoredHistorySnapshot(_archive, _firstLine, _scroll->createSnapshot());
+}
+
+const HistoryType &RestoredHistoryScroll::getType() const
+{
+    return _scroll->getType();
+}
+
+HistoryScroll *RestoredHistoryScroll::takeScroll()
+{
+    HistoryScroll *scroll = _scroll;
+    _scroll = nullptr;
+    return scroll;
+}
+
+void RestoredHistoryScroll::setScroll(HistoryScroll *scroll)
+{
+    delete _scroll;
+    _scroll = scroll;
+
+    dropRestoredLines();
+
+    // the new scroll may have kept fewer lines than the old one
+    _logicalLines.clear();
+    const int lines = getLines();
+    for (int i = 0; i < lines; i++) {
+        _logicalLines.addLine(isWrappedLine(i));
+    }
+}
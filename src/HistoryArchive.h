@@ -0,0 +1,159 @@
+/*
+    This file is part of Konsole, a terminal emulator for KDE.
+
+    Copyright 2018 by The Konsole Developers
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+#ifndef HISTORYARCHIVE_H
+#define HISTORYARCHIVE_H
+
+// Qt
+#include <QSharedPointer>
+#include <QString>
+#include <QVector>
+
+// Konsole
+#include "History.h"
+#include "konsoleprivate_export.h"
+
+namespace Konsole {
+class ScreenSnapshot;
+
+/**
+ * A file holding the output of a terminal, the lines of its history followed
+ * by those of its screen image, so that they can be restored into the history
+ * of a session when Konsole is started again.
+ *
+ * Each line is stored as its text followed by runs of cells which share their
+ * attributes, like CompactHistoryScroll keeps them in memory.  The file starts
+ * with the offsets of the lines and their wrapped flags, so that single lines
+ * can be found without reading the lines before them.
+ *
+ * An archive is mapped into memory when it is opened and lines are read from
+ * it only when they are needed, opening an archive costs next to nothing
+ * regardless of its size.  Once open, an archive can be read from any thread.
+ */
+class KONSOLEPRIVATE_EXPORT HistoryArchive
+{
+public:
+    ~HistoryArchive();
+
+    /**
+     * Writes the lines of @p snapshot to the archive @p fileName, replacing
+     * the file if it exists.  Empty lines at the bottom of the screen image
+     * are left out.  Returns false if the file could not be written.
+     */
+    static bool write(const QString &fileName, const ScreenSnapshot *snapshot);
+
+    /**
+     * Like write(), but writes the archive in a background thread, which takes
+     * ownership of @p snapshot.  Archives which are still being written when
+     * Konsole quits are finished before it exits.
+     */
+    static void writeInBackground(const QString &fileName, ScreenSnapshot *snapshot);
+
+    /**
+     * Opens the archive @p fileName.  Returns a null pointer if the file does
+     * not exist or is not a valid archive.  The file can be removed once it is
+     * open, the archive keeps it mapped.
+     *
+     * This registers the combined characters of the archive in
+     * ExtendedCharTable::instance, it has to be called in the main thread.
+     */
+    static QSharedPointer<HistoryArchive> open(const QString &fileName);
+
+    int  getLines() const;
+    int  getLineLen(int lineno) const;
+    void getCells(int lineno, int colno, int count, Character res[]) const;
+    bool isWrappedLine(int lineno) const;
+
+    /** Tells the kernel that the pages read from the archive are not needed any more. */
+    void releaseMemory();
+
+private:
+    HistoryArchive(uchar *data, qint64 size);
+    Q_DISABLE_COPY(HistoryArchive)
+
+    struct Header;
+    struct LineHeader;
+    struct Format;
+
+    const LineHeader *line(int lineno) const;
+
+    uchar *_data;
+    qint64 _size;
+    const Header *_header;
+    const quint64 *_lineOffsets;
+    const quint8 *_lineFlags;
+
+    // keys in ExtendedCharTable::instance of the combined characters in the archive
+    QVector<ushort> _extendedChars;
+};
+
+/**
+ * A history scroll serving lines restored from a HistoryArchive, followed
+ * by the lines of another scroll which new lines are added to.
+ *
+ * The restored lines count towards the maximum number of lines of the other
+ * scroll's history type, and they are dropped first when it is exceeded.
+ */
+class KONSOLEPRIVATE_EXPORT RestoredHistoryScroll : public HistoryScroll
+{
+public:
+    /** Takes ownership of @p scroll */
+    RestoredHistoryScroll(const QSharedPointer<HistoryArchive> &archive, HistoryScroll *scroll);
+    ~RestoredHistoryScroll() Q_DECL_OVERRIDE;
+
+    bool hasScroll() Q_DECL_OVERRIDE;
+
+    int  getLines() Q_DECL_OVERRIDE;
+    int  getLineLen(int lineno) Q_DECL_OVERRIDE;
+    void getCells(int lineno, int colno, int count, Character res[]) Q_DECL_OVERRIDE;
+    bool isWrappedLine(int lineno) Q_DECL_OVERRIDE;
+    const QChar *getLineText(int lineno, int &length) Q_DECL_OVERRIDE;
+    qint64 getLineTimestamp(int lineno) Q_DECL_OVERRIDE;
+
+    void addCells(const Character a[], int count) Q_DECL_OVERRIDE;
+    void addLine(bool previousWrapped = false) Q_DECL_OVERRIDE;
+
+    void releaseMemory() Q_DECL_OVERRIDE;
+    HistorySnapshot *createSnapshot() Q_DECL_OVERRIDE;
+
+    /** Returns the type of the scroll new lines are added to. */
+    const HistoryType &getType() const Q_DECL_OVERRIDE;
+
+    /**
+     * Returns the scroll new lines are added to and gives up ownership of it.
+     * setScroll() has to be called before the history is used again.
+     */
+    HistoryScroll *takeScroll();
+    /** Makes @p scroll the scroll new lines are added to, and takes ownership of it */
+    void setScroll(HistoryScroll *scroll);
+
+private:
+    int restoredLines() const;
+    void linesAdded(int previousLines);
+    void dropRestoredLines();
+
+    QSharedPointer<HistoryArchive> _archive;
+    int _firstLine;
+    HistoryScroll *_scroll;
+};
+}
+
+#endif // HISTORYARCHIVE_H
@@ -0,0 +1,384 @@
+/*
+    This file is part of Konsole, a terminal emulator for KDE.
+
+    Copyright 2018 by The Konsole Developers
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+// Own
+#include "HistoryIndex.h"
+
+// System
+#include <algorithm>
+
+using namespace Konsole;
+
+static inline quint64 trigramKey(QChar first, QChar second, QChar third)
+{
+    return (static_cast<quint64>(first.unicode()) << 32)
+           | (static_cast<quint64>(second.unicode()) << 16)
+           | third.unicode();
+}
+
+HistoryIndex::HistoryIndex() :
+    _buckets(QHash<quint64, QVector<quint32> >()),
+    _bucketOwners(QVector<quint32>()),
+    _ownersOffset(0),
+    _addedLines(0),
+    _firstLine(0),
+    _compactedLine(0),
+    _unindexedLines(0),
+    _owner(0),
+    _continued(false),
+    _tailLength(0),
+    _lineText(QString()),
+    _lineStream(&_lineText)
+{
+}
+
+void HistoryIndex::addLine(const Character *characters, int count, bool wrapped)
+{
+    const quint32 bucket = _addedLines / LINES_PER_BUCKET;
+
+    if (!_continued) {
+        _owner = bucket;
+        _tailLength = 0;
+    }
+
+    if (_addedLines % LINES_PER_BUCKET == 0) {
+        _bucketOwners.append(_owner);
+    }
+
+    // index the text searches see, not the raw characters
+    _lineText.resize(0);
+    _decoder.begin(&_lineStream);
+    _decoder.decodeLine(characters, count, wrapped ? LINE_WRAPPED : LINE_DEFAULT);
+    _decoder.end();
+
+    addText(_lineText);
+
+    _addedLines++;
+    _continued = wrapped;
+}
+
+void HistoryIndex::addText(const QString &text)
+{
+    for (int i = 0; i < text.length(); i++) {
+        const QChar c = text[i].toCaseFolded();
+
+        if (_tailLength < 2) {
+            _tail[_tailLength++] = c;
+            continue;
+        }
+
+        // the buckets are added in ascending order, a trigram repeated
+        // within a bucket only needs to be recorded once
+        QVector<quint32> &buckets = _buckets[trigramKey(_tail[0], _tail[1], c)];
+        if (buckets.isEmpty() || buckets.last() != _owner) {
+            buckets.append(_owner);
+        }
+
+        _tail[0] = _tail[1];
+        _tail[1] = c;
+    }
+}
+
+void HistoryIndex::setLineCount(int lineCount)
+{
+    // the unindexed lines are the oldest ones, they are dropped first
+    const int droppedLines = this->lineCount() - lineCount;
+    if (droppedLines > 0) {
+        const int droppedUnindexed = qMin(droppedLines, _unindexedLines);
+        _unindexedLines -= droppedUnindexed;
+        _firstLine = qMin(_firstLine + droppedLines - droppedUnindexed, _addedLines);
+    }
+
+    if (_firstLine - _compactedLine >= COMPACT_INTERVAL) {
+        compact();
+    }
+}
+
+void HistoryIndex::prependUnindexedLines(int count)
+{
+    _unindexedLines += count;
+}
+
+int HistoryIndex::lineCount() const
+{
+    return _unindexedLines + _addedLines - _firstLine;
+}
+
+void HistoryIndex::clear()
+{
+    _buckets.clear();
+    _bucketOwners.clear();
+    _ownersOffset = 0;
+    _addedLines = 0;
+    _firstLine = 0;
+    _compactedLine = 0;
+    _unindexedLines = 0;
+    _owner = 0;
+    _continued = false;
+    _tailLength = 0;
+}
+
+quint32 HistoryIndex::firstBucket() const
+{
+    // the first line may continue a wrapped line which started in an
+    // earlier bucket, the trigrams of that bucket are still needed
+    const quint32 bucket = _firstLine / LINES_PER_BUCKET;
+    const int ownerIndex = bucket - _ownersOffset;
+
+    if (ownerIndex >= 0 && ownerIndex < _bucketOwners.count()) {
+        return _bucketOwners[ownerIndex];
+    }
+    return bucket;
+}
+
+void HistoryIndex::compact()
+{
+    const quint32 first = firstBucket();
+
+    QHash<quint64, QVector<quint32> >::iterator iter = _buckets.begin();
+    while (iter != _buckets.end()) {
+        QVector<quint32> &buckets = iter.value();
+        const int dropped = std::lower_bound(buckets.constBegin(), buckets.constEnd(), first)
+                            - buckets.constBegin();
+
+        if (dropped == buckets.count()) {
+            iter = _buckets.erase(iter);
+            continue;
+        }
+
+        if (dropped > 0) {
+            buckets.remove(0, dropped);
+            if (buckets.count() < buckets.capacity() / 2) {
+                buckets.squeeze();
+            }
+        }
+        ++iter;
+    }
+
+    const quint32 firstOwner = _firstLine / LINES_PER_BUCKET;
+    if (firstOwner > _ownersOffset) {
+        _bucketOwners.remove(0, qMin<int>(firstOwner - _ownersOffset, _bucketOwners.count()));
+        _ownersOffset = firstOwner;
+    }
+
+    _compactedLine = _firstLine;
+}
+
+bool HistoryIndex::findCandidates(const QRegularExpression &regExp, QVector<QPair<int, int> > &lines) const
+{
+    const QString literal = requiredLiteral(regExp);
+    if (literal.length() < 3) {
+        return false;
+    }
+
+    lines.clear();
+
+    if (_unindexedLines > 0) {
+        lines << qMakePair(0, _unindexedLines - 1);
+    }
+
+    // every bucket with a match contains all trigrams of the literal
+    QVector<const QVector<quint32> *> bucketLists;
+    for (int i = 0; i + 2 < literal.length(); i++) {
+        const quint64 key = trigramKey(literal[i].toCaseFolded(),
+                                       literal[i + 1].toCaseFolded(),
+                                       literal[i + 2].toCaseFolded());
+
+        QHash<quint64, QVector<quint32> >::const_iterator iter = _buckets.constFind(key);
+        if (iter == _buckets.constEnd()) {
+            return true;
+        }
+        bucketLists << &iter.value();
+    }
+
+    // check the buckets of the rarest trigram against the other ones
+    std::sort(bucketLists.begin(), bucketLists.end(),
+              [](const QVector<quint32> *a, const QVector<quint32> *b) {
+                  return a->count() < b->count();
+              });
+
+    const QVector<quint32> &rarest = *bucketLists.first();
+    const int lastLine = lineCount() - 1;
+
+    for (QVector<quint32>::const_iterator bucket = std::lower_bound(rarest.constBegin(), rarest.constEnd(), firstBucket());
+         bucket != rarest.constEnd(); ++bucket) {
+        bool found = true;
+        for (int i = 1; i < bucketLists.count() && found; i++) {
+            found = std::binary_search(bucketLists[i]->constBegin(), bucketLists[i]->constEnd(), *bucket);
+        }
+
+        if (!found) {
+            continue;
+        }
+
+        const int first = static_cast<int>(*bucket * LINES_PER_BUCKET) - _firstLine + _unindexedLines;
+        const int last = qMin(first + LINES_PER_BUCKET - 1, lastLine);
+        if (last >= _unindexedLines) {
+            lines << qMakePair(qMax(first, _unindexedLines), last);
+        }
+    }
+
+    return true;
+}
+
+qint64 HistoryIndex::memoryUsage() const
+{
+    // a hash node holds the key, the vector and the hash chain
+    static const int NODE_SIZE = sizeof(void *) + sizeof(uint) + sizeof(quint64) + sizeof(QVector<quint32>);
+
+    qint64 usage = sizeof(HistoryIndex)
+                   + _buckets.capacity() * sizeof(void *)
+                   + _bucketOwners.capacity() * sizeof(quint32)
+                   + _lineText.capacity() * sizeof(QChar);
+
+    QHash<quint64, QVector<quint32> >::const_iterator iter = _buckets.constBegin();
+    for (; iter != _buckets.constEnd(); ++iter) {
+        usage += NODE_SIZE + sizeof(QArrayData) + iter.value().capacity() * sizeof(quint32);
+    }
+
+    return usage;
+}
+
+QString HistoryIndex::requiredLiteral(const QRegularExpression &regExp)
+{
+    // with these options literal text in the pattern does not need to
+    // appear as such in the matches, or matches may span lines
+    if ((regExp.patternOptions() & (QRegularExpression::ExtendedPatternSyntaxOption
+                                    | QRegularExpression::DotMatchesEverythingOption)) != 0) {
+        return QString();
+    }
+
+    const QString pattern = regExp.pattern();
+
+    QString longest;
+    QString current;
+    // literal text in groups may be optional, it is not used
+    int groupDepth = 0;
+
+    for (int i = 0; i < pattern.length(); i++) {
+        const QChar c = pattern[i];
+
+        switch (c.unicode()) {
+        case '|':
+            // any part of the pattern may be avoided
+            return QString();
+        case '\\': {
+            if (i + 1 == pattern.length()) {
+                return QString();
+            }
+            const QChar escaped = pattern[++i];
+            if (escaped.unicode() >= 128 || !escaped.isLetterOrNumber()) {
+                // an escaped special character, as in the patterns
+                // QRegularExpression::escape() creates for plain text
+                if (groupDepth == 0) {
+                    current += escaped;
+                }
+                break;
+            }
+            // character types and assertions which never match a new line,
+            // anything else (\s, \n, \Q, back references, ...) is not handled
+            if (!QStringLiteral("dwbBAzZG").contains(escaped)) {
+                return QString();
+            }
+            if (current.length() > longest.length()) {
+                longest = current;
+            }
+            current.clear();
+            break;
+        }
+        case '*':
+        case '?':
+        case '{':
+            // the preceding character may be missing or repeated
+            if (!current.isEmpty()) {
+                current.chop(1);
+            }
+            if (current.length() > longest.length()) {
+                longest = current;
+            }
+            current.clear();
+            if (c == QLatin1Char('{')) {
+                while (i < pattern.length() && pattern[i] != QLatin1Char('}')) {
+                    i++;
+                }
+            }
+            break;
+        case '[': {
+            // negated classes and escapes in classes may match a new line
+            int end = i + 1;
+            if (end < pattern.length() && pattern[end] == QLatin1Char('^')) {
+                return QString();
+            }
+            if (end < pattern.length() && pattern[end] == QLatin1Char(']')) {
+                end++;
+            }
+            while (end < pattern.length() && pattern[end] != QLatin1Char(']')) {
+                if (pattern[end] == QLatin1Char('\\')) {
+                    return QString();
+                }
+                end++;
+            }
+            i = end;
+            if (current.length() > longest.length()) {
+                longest = current;
+            }
+            current.clear();
+            break;
+        }
+        case '(':
+            // (?...) may change the meaning of what follows
+            if (i + 1 < pattern.length() && pattern[i + 1] == QLatin1Char('?')) {
+                return QString();
+            }
+            groupDepth++;
+            if (current.length() > longest.length()) {
+                longest = current;
+            }
+            current.clear();
+            break;
+        case ')':
+            groupDepth--;
+            break;
+        case '+':
+        case '.':
+        case '^':
+        case '$':
+        case ']':
+        case '}':
+            if (current.length() > longest.length()) {
+                longest = current;
+            }
+            current.clear();
+            break;
+        default:
+            if (groupDepth == 0) {
+                current += c;
+            }
+            break;
+        }
+    }
+
+    if (current.length() > longest.length()) {
+        longest = current;
+    }
+
+    return longest.length() >= 3 ? longest : QString();
+}
@@ -0,0 +1,159 @@
+/*
+    This file is part of Konsole, a terminal emulator for KDE.
+
+    Copyright 2018 by The Konsole Developers
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+#ifndef HISTORYINDEX_H
+#define HISTORYINDEX_H
+
+// Qt
+#include <QHash>
+#include <QPair>
+#include <QRegularExpression>
+#include <QString>
+#include <QTextStream>
+#include <QVector>
+
+// Konsole
+#include "Character.h"
+#include "TerminalCharacterDecoder.h"
+#include "konsoleprivate_export.h"
+
+namespace Konsole {
+/**
+ * A trigram index over the lines of a history scroll, used to find the
+ * lines which may contain matches for a search without reading the
+ * whole history.
+ *
+ * Lines are added with addLine() in the order they are added to the history,
+ * and setLineCount() tells the index how many of them the history still
+ * holds, so that the entries of dropped lines can be pruned.  Lines the
+ * history gains before its first line, which would otherwise have to be
+ * read all at once, are not indexed but searched in full, see
+ * prependUnindexedLines().
+ *
+ * To keep the index small, lines are grouped into buckets of LINES_PER_BUCKET
+ * lines, and the index records for each trigram (three case folded UTF-16
+ * code units) the buckets which contain it.  The trigrams of a line which
+ * continues a wrapped line are recorded in the bucket the wrapped line
+ * started in, so that matches spanning wrapped lines are found as well.
+ *
+ * The text indexed is the text PlainTextDecoder produces for the lines,
+ * which is the text searches are run on.
+ */
+class KONSOLEPRIVATE_EXPORT HistoryIndex
+{
+public:
+    HistoryIndex();
+
+    /**
+     * Adds the next line of the history to the index.
+     *
+     * @param characters The characters of the line
+     * @param count The number of characters in the line
+     * @param wrapped Whether the line continues on the next line
+     */
+    void addLine(const Character *characters, int count, bool wrapped);
+
+    /**
+     * Tells the index that the history holds the last @p lineCount lines
+     * added, older lines have been dropped from the history.
+     */
+    void setLineCount(int lineCount);
+
+    /**
+     * Tells the index that @p count lines were put before the first line of
+     * the history.  They are not indexed, findCandidates() returns them as
+     * candidates for every search until they are dropped.
+     */
+    void prependUnindexedLines(int count);
+
+    /** Returns the number of lines of the history, see setLineCount() */
+    int lineCount() const;
+
+    /** Removes all lines from the index. */
+    void clear();
+
+    /**
+     * Looks up the lines of the history which may contain matches for
+     * @p regExp.  Any match of @p regExp is in one of the ranges of lines
+     * returned in @p lines or in a line which the last line of a range wraps
+     * into.  Ranges are sorted and given as pairs of first and last line.
+     *
+     * Returns false if the index cannot narrow down the search for @p regExp,
+     * because it has no literal text of at least three characters every match
+     * must contain, see requiredLiteral().  All lines have to be searched then.
+     */
+    bool findCandidates(const QRegularExpression &regExp, QVector<QPair<int, int> > &lines) const;
+
+    /** Returns the number of bytes used by the index. */
+    qint64 memoryUsage() const;
+
+    /**
+     * Returns the longest piece of literal text every match of @p regExp
+     * contains, or an empty string if there is none or the pattern uses
+     * features which cannot be handled safely, like alternations and
+     * character classes which may match new lines.
+     */
+    static QString requiredLiteral(const QRegularExpression &regExp);
+
+    /** The number of lines grouped in one bucket of the index */
+    static const int LINES_PER_BUCKET = 64;
+
+private:
+    Q_DISABLE_COPY(HistoryIndex)
+
+    void addText(const QString &text);
+    quint32 firstBucket() const;
+    void compact();
+
+    // buckets containing each trigram, in ascending order
+    QHash<quint64, QVector<quint32> > _buckets;
+
+    // for each bucket from _ownersOffset on, the bucket the logical
+    // line continued by the first line of the bucket started in
+    QVector<quint32> _bucketOwners;
+    quint32 _ownersOffset;
+
+    // line numbers count all lines added since the index was created or
+    // cleared, so that they do not change when lines are dropped
+    int _addedLines;
+    int _firstLine;
+    int _compactedLine;
+    // lines before the first indexed one, see prependUnindexedLines()
+    int _unindexedLines;
+
+    // bucket the current logical line started in
+    quint32 _owner;
+    bool _continued;
+
+    // last two code units of the current logical line
+    QChar _tail[2];
+    int _tailLength;
+
+    QString _lineText;
+    QTextStream _lineStream;
+    PlainTextDecoder _decoder;
+
+    // minimum number of dropped lines between two compactions
+    static const int COMPACT_INTERVAL = 64 * LINES_PER_BUCKET;
+};
+}
+
+#endif // HISTORYINDEX_H
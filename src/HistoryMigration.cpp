@@ -0,0 +1,226 @@
+/*
+    This file is part of Konsole, a terminal emulator for KDE.
+
+    Copyright 2018 by The Konsole Developers
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+// Own
+#include "HistoryMigration.h"
+
+// Qt
+#include <QThread>
+#include <QVarLengthArray>
+
+using namespace Konsole;
+
+// copies lines @p first to @p last of @p source, a HistorySnapshot or HistoryScroll, to @p target
+template<typename Source>
+static void copyLines(Source *source, int first, int last, HistoryScroll *target)
+{
+    QVarLengthArray<Character, 1024> cells;
+
+    for (int line = first; line <= last; line++) {
+        const int count = source->getLineLen(line);
+        cells.resize(count);
+        source->getCells(line, 0, count, cells.data());
+        target->addCells(cells.constData(), count);
+        target->setNextLineTimestamp(source->getLineTimestamp(line));
+        target->addLine(source->isWrappedLine(line));
+    }
+}
+
+/*
+   Copies the lines of a snapshot into a history scroll, which is not used
+   by anything else until the thread has finished.
+*/
+class HistoryMigrationThread : public QThread
+{
+public:
+    HistoryMigrationThread(HistorySnapshot *snapshot, HistoryScroll *target) :
+        _snapshot(snapshot),
+        _target(target)
+    {
+    }
+
+    ~HistoryMigrationThread() Q_DECL_OVERRIDE
+    {
+        delete _snapshot;
+    }
+
+protected:
+    void run() Q_DECL_OVERRIDE
+    {
+        setPriority(QThread::LowPriority);
+
+        const int lineCount = _snapshot->getLines();
+
+        // lines the target would drop straight away are not copied
+        const int maxLines = _target->getType().maximumLineCount();
+        const int firstLine = maxLines >= 0 ? qMax(lineCount - maxLines, 0) : 0;
+
+        for (int line = firstLine; line < lineCount && !isInterruptionRequested(); line += LINES_PER_STEP) {
+            copyLines(static_cast<const HistorySnapshot *>(_snapshot), line,
+                      qMin(line + LINES_PER_STEP, lineCount) - 1, _target);
+        }
+    }
+
+private:
+    HistorySnapshot *_snapshot;
+    HistoryScroll *_target;
+
+    // number of lines copied between checks for interruption
+    static const int LINES_PER_STEP = 1000;
+};
+
+MigratingHistoryScroll::MigratingHistoryScroll(HistoryScroll *source, HistoryScroll *target) :
+    HistoryScroll(nullptr),
+    _source(source),
+    _target(target),
+    _thread(new HistoryMigrationThread(source->createSnapshot(), target)),
+    _addedLines(0)
+{
+    _logicalLines = _source->logicalLines();
+}
+
+MigratingHistoryScroll::~MigratingHistoryScroll()
+{
+    if (_thread != nullptr) {
+        _thread->requestInterruption();
+        _thread->wait();
+        delete _thread;
+    }
+    delete _target;
+    delete _source;
+}
+
+bool MigratingHistoryScroll::hasScroll()
+{
+    return _source->hasScroll();
+}
+
+int MigratingHistoryScroll::getLines()
+{
+    return _source->getLines();
+}
+
+int MigratingHistoryScroll::getLineLen(int lineno)
+{
+    return _source->getLineLen(lineno);
+}
+
+void MigratingHistoryScroll::getCells(int lineno, int colno, int count, Character res[])
+{
+    _source->getCells(lineno, colno, count, res);
+}
+
+bool MigratingHistoryScroll::isWrappedLine(int lineno)
+{
+    return _source->isWrappedLine(lineno);
+}
+
+const QChar *MigratingHistoryScroll::getLineText(int lineno, int &length)
+{
+    return _source->getLineText(lineno, length);
+}
+
+qint64 MigratingHistoryScroll::getLineTimestamp(int lineno)
+{
+    return _source->getLineTimestamp(lineno);
+}
+
+void MigratingHistoryScroll::addCells(const Character a[], int count)
+{
+    const int previousLines = _source->getLines();
+    _source->addCells(a, count);
+    linesAdded(previousLines);
+}
+
+void MigratingHistoryScroll::linesAdded(int previousLines)
+{
+    // the source may drop lines as new ones are added
+    const int dropped = previousLines + 1 - _source->getLines();
+    if (dropped > 0) {
+        _logicalLines.removeLines(dropped);
+    }
+    _addedLines++;
+}
+
+void MigratingHistoryScroll::addLine(bool previousWrapped)
+{
+    _source->setNextLineTimestamp(lineTimestamp());
+    _source->addLine(previousWrapped);
+    _logicalLines.addLine(previousWrapped);
+}
+
+void MigratingHistoryScroll::releaseMemory()
+{
+    // the target belongs to the thread until it has finished
+    _source->releaseMemory();
+}
+
+HistorySnapshot *MigratingHistoryScroll::createSnapshot()
+{
+    return _source->createSnapshot();
+}
+
+const HistoryType &MigratingHistoryScroll::getType() const
+{
+    return _target->getType();
+}
+
+QThread *MigratingHistoryScroll::thread() const
+{
+    return _thread;
+}
+
+bool MigratingHistoryScroll::isFinished() const
+{
+    return _thread->isFinished();
+}
+
+HistoryScroll *MigratingHistoryScroll::takeTarget()
+{
+    Q_ASSERT(isFinished());
+
+    // finished() is emitted before the thread has quite ended
+    _thread->wait();
+    delete _thread;
+    _thread = nullptr;
+
+    // the lines added since the snapshot was taken, as far as the source still has them
+    const int lineCount = _source->getLines();
+    copyLines(_source, qMax(lineCount - _addedLines, 0), lineCount - 1, _target);
+
+    HistoryScroll *target = _target;
+    _target = nullptr;
+    return target;
+}
+
+HistoryScroll *MigratingHistoryScroll::takeSource()
+{
+    if (_thread != nullptr) {
+        _thread->requestInterruption();
+        _thread->wait();
+        delete _thread;
+        _thread = nullptr;
+    }
+
+    HistoryScroll *source = _source;
+    _source = nullptr;
+    return source;
+}
@@ -0,0 +1,109 @@
+/*
+    This file is part of Konsole, a terminal emulator for KDE.
+
+    Copyright 2018 by The Konsole Developers
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+#ifndef HISTORYMIGRATION_H
+#define HISTORYMIGRATION_H
+
+// Konsole
+#include "History.h"
+#include "konsoleprivate_export.h"
+
+class QThread;
+
+namespace Konsole {
+/**
+ * A history scroll which is being converted to another type of history,
+ * like Screen::setScroll() does when a history type is chosen which cannot
+ * take over the lines of the current one.
+ *
+ * The lines of the current (source) scroll are copied into the new (target)
+ * scroll from a snapshot, in a separate thread.  Until they have been copied,
+ * the source scroll serves all reads and new lines are added to it.  Once the
+ * thread has finished, takeTarget() copies the lines added in the meantime
+ * and hands out the target scroll, which replaces this one.
+ */
+class KONSOLEPRIVATE_EXPORT MigratingHistoryScroll : public HistoryScroll
+{
+public:
+    /**
+     * Copies the lines of @p source into @p target, taking ownership of both.
+     * The copying starts once thread() is started.
+     */
+    MigratingHistoryScroll(HistoryScroll *source, HistoryScroll *target);
+    ~MigratingHistoryScroll() Q_DECL_OVERRIDE;
+
+    bool hasScroll() Q_DECL_OVERRIDE;
+
+    int  getLines() Q_DECL_OVERRIDE;
+    int  getLineLen(int lineno) Q_DECL_OVERRIDE;
+    void getCells(int lineno, int colno, int count, Character res[]) Q_DECL_OVERRIDE;
+    bool isWrappedLine(int lineno) Q_DECL_OVERRIDE;
+    const QChar *getLineText(int lineno, int &length) Q_DECL_OVERRIDE;
+    qint64 getLineTimestamp(int lineno) Q_DECL_OVERRIDE;
+
+    void addCells(const Character a[], int count) Q_DECL_OVERRIDE;
+    void addLine(bool previousWrapped = false) Q_DECL_OVERRIDE;
+
+    void releaseMemory() Q_DECL_OVERRIDE;
+    HistorySnapshot *createSnapshot() Q_DECL_OVERRIDE;
+
+    /** Returns the type of the target scroll */
+    const HistoryType &getType() const Q_DECL_OVERRIDE;
+
+    /**
+     * Returns the thread copying the lines, which finishes once all of them
+     * have been copied.  It is not running until the caller starts it.
+     */
+    QThread *thread() const;
+    /** Returns true once the thread has copied all lines, see takeTarget() */
+    bool isFinished() const;
+
+    /**
+     * Copies the lines added to the source scroll since the conversion
+     * started, and returns the target scroll, which the caller takes
+     * ownership of.  This must only be called once isFinished() is true.
+     */
+    HistoryScroll *takeTarget();
+
+    /**
+     * Stops the conversion and returns the source scroll, which the caller
+     * takes ownership of.
+     */
+    HistoryScroll *takeSource();
+
+    /** The minimum number of lines for which conversions are done in a separate thread */
+    static const int MIN_LINES = 1000;
+
+private:
+    Q_DISABLE_COPY(MigratingHistoryScroll)
+
+    void linesAdded(int previousLines);
+
+    HistoryScroll *_source;
+    HistoryScroll *_target;
+    QThread *_thread;
+
+    // lines added to the source since the conversion started
+    int _addedLines;
+};
+}
+
+#endif // HISTORYMIGRATION_H
@@ -39,6 +39,7 @@ using namespace Konsole;
 IncrementalSearchBar::IncrementalSearchBar(QWidget *aParent) :
     QWidget(aParent),
     _searchEdit(nullptr),
+    _matchCountLabel(nullptr),
     _caseSensitive(nullptr),
     _regExpression(nullptr),
     _highlightMatches(nullptr),
@@ -79,6 +80,13 @@ IncrementalSearchBar::IncrementalSearchBar(QWidget *aParent) :
             &Konsole::IncrementalSearchBar::notifySearchChanged);
     connect(_searchEdit, &QLineEdit::textChanged, _searchTimer,
             static_cast<void (QTimer::*)()>(&QTimer::start));
+    connect(_searchEdit, &QLineEdit::textChanged, this,
+            &Konsole::IncrementalSearchBar::searchTextEdited);
+
+    _matchCountLabel = new QLabel(this);
+    _matchCountLabel->setObjectName(QStringLiteral("match-count-label"));
+    _matchCountLabel->setToolTip(i18nc("@info:tooltip", "Current match and number of matches"));
+    _matchCountLabel->hide();
 
     _findNextButton = new QToolButton(this);
     _findNextButton->setObjectName(QStringLiteral("find-next-button"));
@@ -115,6 +123,7 @@ IncrementalSearchBar::IncrementalSearchBar(QWidget *aParent) :
     barLayout->addWidget(closeButton);
     barLayout->addWidget(findLabel);
     barLayout->addWidget(_searchEdit);
+    barLayout->addWidget(_matchCountLabel);
     barLayout->addWidget(_findNextButton);
     barLayout->addWidget(_findPreviousButton);
     barLayout->addWidget(_searchFromButton);
@@ -272,6 +281,28 @@ void IncrementalSearchBar::setFoundMatch(bool match)
     }
 }
 
+void IncrementalSearchBar::setMatchCount(int currentMatch, int matchCount)
+{
+    if (_searchEdit->text().isEmpty()) {
+        clearMatchCount();
+        return;
+    }
+
+    if (currentMatch > 0) {
+        _matchCountLabel->setText(i18nc("@label Number of the current match and number of matches",
+                                        "%1 of %2", currentMatch, matchCount));
+    } else {
+        _matchCountLabel->setText(i18ncp("@label Number of matches", "%1 match", "%1 matches", matchCount));
+    }
+    _matchCountLabel->show();
+}
+
+void IncrementalSearchBar::clearMatchCount()
+{
+    _matchCountLabel->clear();
+    _matchCountLabel->hide();
+}
+
 void IncrementalSearchBar::clearLineEdit()
 {
     _searchEdit->setStyleSheet(QString());
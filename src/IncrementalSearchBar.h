@@ -26,6 +26,7 @@
 
 class QAction;
 class QTimer;
+class QLabel;
 class QLineEdit;
 class QToolButton;
 
@@ -91,6 +92,20 @@ public:
      */
     void setFoundMatch(bool match);
 
+    /**
+     * Shows the number of the current match and the number of matches for
+     * the search text next to the search box, for example "23 of 1,204".
+     * This may be called repeatedly while the matches are being counted.
+     *
+     * @param currentMatch The number of the current match, or 0 if there
+     * is no current match yet.
+     * @param matchCount The number of matches found.
+     */
+    void setMatchCount(int currentMatch, int matchCount);
+
+    /** Hides the match count shown with setMatchCount() */
+    void clearMatchCount();
+
     /** Returns the current search text */
     QString searchText();
 
@@ -105,6 +120,11 @@ public:
 Q_SIGNALS:
     /** Emitted when the text entered in the search box is altered */
     void searchChanged(const QString &text);
+    /**
+     * Emitted on every change of the text in the search box.  Unlike searchChanged(),
+     * which is delayed until the user stops typing, this is emitted immediately.
+     */
+    void searchTextEdited();
     /** Emitted when the user clicks the button to find the next match */
     void findNextClicked();
     /** Emitted when the user clicks the button to find the previous match */
@@ -150,6 +170,7 @@ private:
     Q_DISABLE_COPY(IncrementalSearchBar)
 
     QLineEdit *_searchEdit;
+    QLabel *_matchCountLabel;
     QAction *_caseSensitive;
     QAction *_regExpression;
     QAction *_highlightMatches;
@@ -0,0 +1,380 @@
+/*
+    This file is part of Konsole, a terminal emulator for KDE.
+
+    Copyright 2018 by The Konsole Developers
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+
+// Own
+#include "LineBlockCharacters.h"
+
+// Konsole
+#include "LineFont.h"
+
+using namespace Konsole;
+
+/**
+ A table for emulating the simple (single width) unicode drawing chars.
+ It represents the 250x - 257x glyphs. If it's zero, we can't use it.
+ if it's not, it's encoded as follows: imagine a 5x5 grid where the points are numbered
+ 0 to 24 left to top, top to bottom. Each point is represented by the corresponding bit.
+
+ Then, the pixels basically have the following interpretation:
+ _|||_
+ -...-
+ -...-
+ -...-
+ _|||_
+
+where _ = none
+      | = vertical line.
+      - = horizontal line.
+ */
+
+enum LineEncode {
+    TopL  = (1 << 1),
+    TopC  = (1 << 2),
+    TopR  = (1 << 3),
+
+    LeftT = (1 << 5),
+    Int11 = (1 << 6),
+    Int12 = (1 << 7),
+    Int13 = (1 << 8),
+    RightT = (1 << 9),
+
+    LeftC = (1 << 10),
+    Int21 = (1 << 11),
+    Int22 = (1 << 12),
+    Int23 = (1 << 13),
+    RightC = (1 << 14),
+
+    LeftB = (1 << 15),
+    Int31 = (1 << 16),
+    Int32 = (1 << 17),
+    Int33 = (1 << 18),
+    RightB = (1 << 19),
+
+    BotL  = (1 << 21),
+    BotC  = (1 << 22),
+    BotR  = (1 << 23)
+};
+
+static void drawLineChar(QPainter& paint, int x, int y, int w, int h, uchar code)
+{
+    //Calculate cell midpoints, end points.
+    const int cx = x + w / 2;
+    const int cy = y + h / 2;
+    const int ex = x + w - 1;
+    const int ey = y + h - 1;
+
+    const quint32 toDraw = LineChars[code];
+
+    //Top _lines:
+    if ((toDraw & TopL) != 0u) {
+        paint.drawLine(cx - 1, y, cx - 1, cy - 2);
+    }
+    if ((toDraw & TopC) != 0u) {
+        paint.drawLine(cx, y, cx, cy - 2);
+    }
+    if ((toDraw & TopR) != 0u) {
+        paint.drawLine(cx + 1, y, cx + 1, cy - 2);
+    }
+
+    //Bot _lines:
+    if ((toDraw & BotL) != 0u) {
+        paint.drawLine(cx - 1, cy + 2, cx - 1, ey);
+    }
+    if ((toDraw & BotC) != 0u) {
+        paint.drawLine(cx, cy + 2, cx, ey);
+    }
+    if ((toDraw & BotR) != 0u) {
+        paint.drawLine(cx + 1, cy + 2, cx + 1, ey);
+    }
+
+    //Left _lines:
+    if ((toDraw & LeftT) != 0u) {
+        paint.drawLine(x, cy - 1, cx - 2, cy - 1);
+    }
+    if ((toDraw & LeftC) != 0u) {
+        paint.drawLine(x, cy, cx - 2, cy);
+    }
+    if ((toDraw & LeftB) != 0u) {
+        paint.drawLine(x, cy + 1, cx - 2, cy + 1);
+    }
+
+    //Right _lines:
+    if ((toDraw & RightT) != 0u) {
+        paint.drawLine(cx + 2, cy - 1, ex, cy - 1);
+    }
+    if ((toDraw & RightC) != 0u) {
+        paint.drawLine(cx + 2, cy, ex, cy);
+    }
+    if ((toDraw & RightB) != 0u) {
+        paint.drawLine(cx + 2, cy + 1, ex, cy + 1);
+    }
+
+    //Intersection points.
+    if ((toDraw & Int11) != 0u) {
+        paint.drawPoint(cx - 1, cy - 1);
+    }
+    if ((toDraw & Int12) != 0u) {
+        paint.drawPoint(cx, cy - 1);
+    }
+    if ((toDraw & Int13) != 0u) {
+        paint.drawPoint(cx + 1, cy - 1);
+    }
+
+    if ((toDraw & Int21) != 0u) {
+        paint.drawPoint(cx - 1, cy);
+    }
+    if ((toDraw & Int22) != 0u) {
+        paint.drawPoint(cx, cy);
+    }
+    if ((toDraw & Int23) != 0u) {
+        paint.drawPoint(cx + 1, cy);
+    }
+
+    if ((toDraw & Int31) != 0u) {
+        paint.drawPoint(cx - 1, cy + 1);
+    }
+    if ((toDraw & Int32) != 0u) {
+        paint.drawPoint(cx, cy + 1);
+    }
+    if ((toDraw & Int33) != 0u) {
+        paint.drawPoint(cx + 1, cy + 1);
+    }
+}
+
+static void drawOtherChar(QPainter& paint, int x, int y, int w, int h, uchar code)
+{
+    //Calculate cell midpoints, end points.
+    const int cx = x + w / 2;
+    const int cy = y + h / 2;
+    const int ex = x + w - 1;
+    const int ey = y + h - 1;
+
+    // Double dashes
+    if (0x4C <= code && code <= 0x4F) {
+        const int xHalfGap = qMax(w / 15, 1);
+        const int yHalfGap = qMax(h / 15, 1);
+        switch (code) {
+        case 0x4D: // BOX DRAWINGS HEAVY DOUBLE DASH HORIZONTAL
+            paint.drawLine(x, cy - 1, cx - xHalfGap - 1, cy - 1);
+            paint.drawLine(x, cy + 1, cx - xHalfGap - 1, cy + 1);
+            paint.drawLine(cx + xHalfGap, cy - 1, ex, cy - 1);
+            paint.drawLine(cx + xHalfGap, cy + 1, ex, cy + 1);
+            // No break!
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 8, 0))
+            Q_FALLTHROUGH();
+#endif
+        case 0x4C: // BOX DRAWINGS LIGHT DOUBLE DASH HORIZONTAL
+            paint.drawLine(x, cy, cx - xHalfGap - 1, cy);
+            paint.drawLine(cx + xHalfGap, cy, ex, cy);
+            break;
+        case 0x4F: // BOX DRAWINGS HEAVY DOUBLE DASH VERTICAL
+            paint.drawLine(cx - 1, y, cx - 1, cy - yHalfGap - 1);
+            paint.drawLine(cx + 1, y, cx + 1, cy - yHalfGap - 1);
+            paint.drawLine(cx - 1, cy + yHalfGap, cx - 1, ey);
+            paint.drawLine(cx + 1, cy + yHalfGap, cx + 1, ey);
+            // No break!
+#if (QT_VERSION >= QT_VERSION_CHECK(5, 8, 0))
+            Q_FALLTHROUGH();
+#endif
+        case 0x4E: // BOX DRAWINGS LIGHT DOUBLE DASH VERTICAL
+            paint.drawLine(cx, y, cx, cy - yHalfGap - 1);
+            paint.drawLine(cx, cy + yHalfGap, cx, ey);
+            break;
+        }
+    }
+
+    // Rounded corner characters
+    else if (0x6D <= code && code <= 0x70) {
+        const int r = w * 3 / 8;
+        const int d = 2 * r;
+        switch (code) {
+        case 0x6D: // BOX DRAWINGS LIGHT ARC DOWN AND RIGHT
+            paint.drawLine(cx, cy + r, cx, ey);
+            paint.drawLine(cx + r, cy, ex, cy);
+            paint.drawArc(cx, cy, d, d, 90 * 16, 90 * 16);
+            break;
+        case 0x6E: // BOX DRAWINGS LIGHT ARC DOWN AND LEFT
+            paint.drawLine(cx, cy + r, cx, ey);
+            paint.drawLine(x, cy, cx - r, cy);
+            paint.drawArc(cx - d, cy, d, d, 0 * 16, 90 * 16);
+            break;
+        case 0x6F: // BOX DRAWINGS LIGHT ARC UP AND LEFT
+            paint.drawLine(cx, y, cx, cy - r);
+            paint.drawLine(x, cy, cx - r, cy);
+            paint.drawArc(cx - d, cy - d, d, d, 270 * 16, 90 * 16);
+            break;
+        case 0x70: // BOX DRAWINGS LIGHT ARC UP AND RIGHT
+            paint.drawLine(cx, y, cx, cy - r);
+            paint.drawLine(cx + r, cy, ex, cy);
+            paint.drawArc(cx, cy - d, d, d, 180 * 16, 90 * 16);
+            break;
+        }
+    }
+
+    // Diagonals
+    else if (0x71 <= code && code <= 0x73) {
+        switch (code) {
+        case 0x71: // BOX DRAWINGS LIGHT DIAGONAL UPPER RIGHT TO LOWER LEFT
+            paint.drawLine(ex, y, x, ey);
+            break;
+        case 0x72: // BOX DRAWINGS LIGHT DIAGONAL UPPER LEFT TO LOWER RIGHT
+            paint.drawLine(x, y, ex, ey);
+            break;
+        case 0x73: // BOX DRAWINGS LIGHT DIAGONAL CROSS
+            paint.drawLine(ex, y, x, ey);
+            paint.drawLine(x, y, ex, ey);
+            break;
+        }
+    }
+}
+
+static void drawBlockChar(QPainter& paint, int x, int y, int w, int h, uchar code)
+{
+    const QColor color = paint.pen().color();
+
+    // U+2581 - U+2587: lower one eighth block to lower seven eighths block
+    if (0x81 <= code && code <= 0x87) {
+        const int height = h * (code - 0x80) / 8;
+        paint.fillRect(x, y + h - height, w, height, color);
+        return;
+    }
+
+    // U+2589 - U+258F: left seven eighths block to left one eighth block
+    if (0x89 <= code && code <= 0x8F) {
+        paint.fillRect(x, y, w * (0x90 - code) / 8, h, color);
+        return;
+    }
+
+    // U+2591 - U+2593: light, medium and dark shade
+    if (0x91 <= code && code <= 0x93) {
+        QColor shade(color);
+        shade.setAlphaF(color.alphaF() * (code - 0x90) / 4);
+        paint.fillRect(x, y, w, h, shade);
+        return;
+    }
+
+    const int cx = x + w / 2;
+    const int cy = y + h / 2;
+    const int rw = x + w - cx;
+    const int bh = y + h - cy;
+
+    switch (code) {
+    case 0x80: // UPPER HALF BLOCK
+        paint.fillRect(x, y, w, cy - y, color);
+        break;
+    case 0x88: // FULL BLOCK
+        paint.fillRect(x, y, w, h, color);
+        break;
+    case 0x90: // RIGHT HALF BLOCK
+        paint.fillRect(cx, y, rw, h, color);
+        break;
+    case 0x94: // UPPER ONE EIGHTH BLOCK
+        paint.fillRect(x, y, w, h / 8, color);
+        break;
+    case 0x95: // RIGHT ONE EIGHTH BLOCK
+        paint.fillRect(x + w - w / 8, y, w / 8, h, color);
+        break;
+    default: {
+        // U+2596 - U+259F: the quadrants, as which of the upper left, upper
+        // right, lower left and lower right quadrants are filled
+        static const uchar quadrants[] = {
+            0x4, 0x8, 0x1, 0xD, 0x9, 0x7, 0xB, 0x2, 0x6, 0xE
+        };
+        if (code < 0x96 || code > 0x9F) {
+            break;
+        }
+        const uchar filled = quadrants[code - 0x96];
+        if ((filled & 0x1) != 0) {
+            paint.fillRect(x, y, cx - x, cy - y, color);
+        }
+        if ((filled & 0x2) != 0) {
+            paint.fillRect(cx, y, rw, cy - y, color);
+        }
+        if ((filled & 0x4) != 0) {
+            paint.fillRect(x, cy, cx - x, bh, color);
+        }
+        if ((filled & 0x8) != 0) {
+            paint.fillRect(cx, cy, rw, bh, color);
+        }
+        break;
+    }
+    }
+}
+
+static void drawBrailleChar(QPainter& paint, int x, int y, int w, int h, uchar code)
+{
+    const QColor color = paint.pen().color();
+
+    // the dots are numbered down the left column and then down the right
+    // one, dots 7 and 8 at the bottom were added later and come last
+    static const uchar dotColumns[] = {0, 0, 0, 1, 1, 1, 0, 1};
+    static const uchar dotRows[] = {0, 1, 2, 0, 1, 2, 3, 3};
+
+    const int dotWidth = qMax(1, w / 4);
+    const int dotHeight = qMax(1, qMin(dotWidth, h / 8));
+
+    for (int dot = 0; dot < 8; dot++) {
+        if ((code & (1 << dot)) == 0) {
+            continue;
+        }
+
+        // each dot is centered in its part of a grid of 2 x 4 parts
+        const int dotX = x + (w * (2 * dotColumns[dot] + 1)) / 4 - dotWidth / 2;
+        const int dotY = y + (h * (2 * dotRows[dot] + 1)) / 8 - dotHeight / 2;
+        paint.fillRect(dotX, dotY, dotWidth, dotHeight, color);
+    }
+}
+
+void LineBlockCharacters::draw(QPainter &paint, const QRect &cellRect, const QChar &character, bool bold)
+{
+    const ushort codePoint = character.unicode();
+    const uchar code = character.cell();
+    const int x = cellRect.x();
+    const int y = cellRect.y();
+    const int w = cellRect.width();
+    const int h = cellRect.height();
+
+    if ((codePoint & 0xFF00) == 0x2800) {
+        drawBrailleChar(paint, x, y, w, h, code);
+        return;
+    }
+
+    if (code >= 0x80) {
+        drawBlockChar(paint, x, y, w, h, code);
+        return;
+    }
+
+    const QPen originalPen = paint.pen();
+    if (bold) {
+        QPen boldPen(originalPen);
+        boldPen.setWidth(3);
+        paint.setPen(boldPen);
+    }
+
+    if (LineChars[code] != 0u) {
+        drawLineChar(paint, x, y, w, h, code);
+    } else {
+        drawOtherChar(paint, x, y, w, h, code);
+    }
+
+    paint.setPen(originalPen);
+}
@@ -0,0 +1,47 @@
+/*
+    This file is part of Konsole, a terminal emulator for KDE.
+
+    Copyright 2018 by The Konsole Developers
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+
+#ifndef LINEBLOCKCHARACTERS_H
+#define LINEBLOCKCHARACTERS_H
+
+// Qt
+#include <QChar>
+#include <QPainter>
+#include <QRect>
+
+namespace Konsole {
+/**
+ * Draws the box drawing (U+2500 - U+257F), block element (U+2580 - U+259F)
+ * and braille (U+2800 - U+28FF) characters which isSupportedLineChar()
+ * accepts, so that they fill their cells and join up with the characters
+ * next to them regardless of the font.
+ */
+namespace LineBlockCharacters {
+/**
+ * Draws @p character into @p cellRect with the color of the painter's pen.
+ * The lines of box drawing characters are drawn thicker if @p bold is true.
+ */
+void draw(QPainter &paint, const QRect &cellRect, const QChar &character, bool bold);
+}
+}
+
+#endif // LINEBLOCKCHARACTERS_H
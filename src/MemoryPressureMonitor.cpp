@@ -0,0 +1,241 @@
+/*
+    This file is part of Konsole, a terminal emulator for KDE.
+
+    Copyright 2018 by The Konsole Developers
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+// Own
+#include "MemoryPressureMonitor.h"
+
+#include "konsoledebug.h"
+
+// System
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+
+// Qt
+#include <QDateTime>
+#include <QFile>
+#include <QSocketNotifier>
+#include <QTimer>
+
+using namespace Konsole;
+
+static const char PRESSURE_FILE[] = "/proc/pressure/memory";
+
+// Wake up when some task stalled on memory for 150ms within a 2s window.
+// Unprivileged PSI triggers require the window to be a multiple of 2s.
+static const char PRESSURE_TRIGGER[] = "some 150000 2000000";
+
+// When polling, a 'some avg10' above this percentage counts as pressure
+static const double PRESSURE_THRESHOLD = 10.0;
+
+Q_GLOBAL_STATIC(MemoryPressureMonitor, theMemoryPressureMonitor)
+MemoryPressureMonitor *MemoryPressureMonitor::instance()
+{
+    return theMemoryPressureMonitor;
+}
+
+MemoryPressureMonitor::MemoryPressureMonitor() :
+    _triggerFd(-1),
+    _triggerNotifier(nullptr),
+    _pollTimer(new QTimer(this)),
+    _cgroupEventsPath(QString()),
+    _lastCgroupEvents(0),
+    _underPressure(false),
+    _lastReclaim(0)
+{
+    _pollTimer->setInterval(POLL_INTERVAL);
+    connect(_pollTimer, &QTimer::timeout, this, &Konsole::MemoryPressureMonitor::checkPressure);
+
+#if defined(Q_OS_LINUX)
+    // memory.events of the (v2) cgroup we run in counts how often the
+    // cgroup hit its 'high' and 'max' limits
+    QFile cgroupFile(QStringLiteral("/proc/self/cgroup"));
+    if (cgroupFile.open(QIODevice::ReadOnly)) {
+        foreach (const QByteArray &line, cgroupFile.readAll().split('\n')) {
+            if (line.startsWith("0::")) {
+                const QString eventsPath = QStringLiteral("/sys/fs/cgroup")
+                                           + QString::fromLocal8Bit(line.mid(3))
+                                           + QStringLiteral("/memory.events");
+                if (QFile::exists(eventsPath)) {
+                    _cgroupEventsPath = eventsPath;
+                    _lastCgroupEvents = readCgroupEvents();
+                }
+                break;
+            }
+        }
+    }
+
+    if (!setupTrigger()) {
+        if (hasPressureSource()) {
+            qCDebug(KonsoleDebug) << "PSI trigger unavailable, polling memory pressure";
+            _pollTimer->start();
+        }
+    }
+#endif
+}
+
+MemoryPressureMonitor::~MemoryPressureMonitor()
+{
+    delete _triggerNotifier;
+
+    if (_triggerFd >= 0) {
+        ::close(_triggerFd);
+    }
+}
+
+bool MemoryPressureMonitor::isUnderPressure() const
+{
+    return _underPressure;
+}
+
+bool MemoryPressureMonitor::setupTrigger()
+{
+    _triggerFd = ::open(PRESSURE_FILE, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (_triggerFd < 0) {
+        return false;
+    }
+
+    // the trigger stays registered for as long as the file is kept open
+    if (::write(_triggerFd, PRESSURE_TRIGGER, strlen(PRESSURE_TRIGGER) + 1) < 0) {
+        ::close(_triggerFd);
+        _triggerFd = -1;
+        return false;
+    }
+
+    // the kernel signals a trigger with POLLPRI
+    _triggerNotifier = new QSocketNotifier(_triggerFd, QSocketNotifier::Exception, this);
+    connect(_triggerNotifier, &QSocketNotifier::activated, this, &Konsole::MemoryPressureMonitor::pressureTriggered);
+
+    return true;
+}
+
+bool MemoryPressureMonitor::hasPressureSource() const
+{
+    if (!_cgroupEventsPath.isEmpty()) {
+        return true;
+    }
+
+    // the file exists but cannot be read when PSI is disabled at boot
+    QFile file(QLatin1String(PRESSURE_FILE));
+    return file.open(QIODevice::ReadOnly) && file.readLine().startsWith("some ");
+}
+
+bool MemoryPressureMonitor::readPressure() const
+{
+    QFile file(QLatin1String(PRESSURE_FILE));
+    if (!file.open(QIODevice::ReadOnly)) {
+        return false;
+    }
+
+    // some avg10=0.00 avg60=0.00 avg300=0.00 total=0
+    const QList<QByteArray> fields = file.readLine().simplified().split(' ');
+    foreach (const QByteArray &field, fields) {
+        if (field.startsWith("avg10=")) {
+            return field.mid(6).toDouble() > PRESSURE_THRESHOLD;
+        }
+    }
+
+    return false;
+}
+
+quint64 MemoryPressureMonitor::readCgroupEvents() const
+{
+    if (_cgroupEventsPath.isEmpty()) {
+        return 0;
+    }
+
+    QFile file(_cgroupEventsPath);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return 0;
+    }
+
+    quint64 events = 0;
+    foreach (const QByteArray &line, file.readAll().split('\n')) {
+        const QList<QByteArray> fields = line.split(' ');
+        if (fields.count() == 2 && (fields[0] == "high" || fields[0] == "max")) {
+            events += fields[1].toULongLong();
+        }
+    }
+
+    return events;
+}
+
+void MemoryPressureMonitor::pressureTriggered()
+{
+    setUnderPressure(true);
+    requestReclaim();
+
+    // triggers only tell when pressure starts, poll to find out when it ends
+    if (!_pollTimer->isActive()) {
+        _pollTimer->start();
+    }
+}
+
+void MemoryPressureMonitor::checkPressure()
+{
+    const quint64 cgroupEvents = readCgroupEvents();
+    const bool cgroupPressure = cgroupEvents > _lastCgroupEvents;
+    _lastCgroupEvents = cgroupEvents;
+
+    if (cgroupPressure || readPressure()) {
+        setUnderPressure(true);
+        requestReclaim();
+    } else {
+        setUnderPressure(false);
+
+        // without a trigger there is nothing to wait for once neither
+        // source can be read any more
+        if (_triggerNotifier != nullptr || !hasPressureSource()) {
+            _pollTimer->stop();
+        }
+    }
+}
+
+void MemoryPressureMonitor::setUnderPressure(bool underPressure)
+{
+    if (_underPressure == underPressure) {
+        return;
+    }
+
+    _underPressure = underPressure;
+    qCDebug(KonsoleDebug) << "Memory pressure" << (underPressure ? "started" : "ended");
+
+    emit pressureChanged(underPressure);
+}
+
+void MemoryPressureMonitor::requestReclaim()
+{
+    const qint64 now = QDateTime::currentMSecsSinceEpoch();
+    if (_lastReclaim != 0 && now - _lastReclaim < RECLAIM_INTERVAL) {
+        return;
+    }
+    _lastReclaim = now;
+
+    emit reclaimRequested();
+
+#if defined(__GLIBC__)
+    // hand the heap memory released by the listeners back to the system
+    malloc_trim(0);
+#endif
+}
@@ -0,0 +1,108 @@
+/*
+    This file is part of Konsole, a terminal emulator for KDE.
+
+    Copyright 2018 by The Konsole Developers
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+#ifndef MEMORYPRESSUREMONITOR_H
+#define MEMORYPRESSUREMONITOR_H
+
+// Qt
+#include <QObject>
+#include <QString>
+
+// Konsole
+#include "konsoleprivate_export.h"
+
+class QSocketNotifier;
+class QTimer;
+
+namespace Konsole {
+/**
+ * Watches the system for memory pressure and asks the rest of Konsole
+ * to give memory back while it lasts.
+ *
+ * On Linux the monitor registers a PSI trigger on /proc/pressure/memory
+ * and is woken up by the kernel when tasks stall on memory.  If triggers
+ * are not available (older kernels, no permission) it falls back to
+ * polling the PSI averages and the memory.events counters of the cgroup
+ * Konsole runs in.  On other systems the monitor never reports pressure.
+ *
+ * Objects holding memory which can be rebuilt or paged out cheaply
+ * (history blocks, rendering caches) connect to reclaimRequested().
+ */
+class KONSOLEPRIVATE_EXPORT MemoryPressureMonitor : public QObject
+{
+    Q_OBJECT
+
+public:
+    MemoryPressureMonitor();
+    ~MemoryPressureMonitor() Q_DECL_OVERRIDE;
+
+    /** Returns the memory pressure monitor instance. */
+    static MemoryPressureMonitor *instance();
+
+    /** Returns true while the system is considered to be under memory pressure. */
+    bool isUnderPressure() const;
+
+Q_SIGNALS:
+    /**
+     * Emitted when memory pressure starts or ends.
+     * Caches which were dropped can be refilled once @p underPressure is false.
+     */
+    void pressureChanged(bool underPressure);
+
+    /**
+     * Emitted when memory should be given back.  This is emitted when pressure
+     * starts and then at most once per RECLAIM_INTERVAL while it lasts.
+     */
+    void reclaimRequested();
+
+private Q_SLOTS:
+    void pressureTriggered();
+    void checkPressure();
+
+private:
+    Q_DISABLE_COPY(MemoryPressureMonitor)
+
+    bool setupTrigger();
+    // returns true if PSI averages or cgroup memory events can be read
+    bool hasPressureSource() const;
+    bool readPressure() const;
+    quint64 readCgroupEvents() const;
+    void setUnderPressure(bool underPressure);
+    void requestReclaim();
+
+    int _triggerFd;
+    QSocketNotifier *_triggerNotifier;
+    QTimer *_pollTimer;
+
+    QString _cgroupEventsPath;
+    quint64 _lastCgroupEvents;
+
+    bool _underPressure;
+    qint64 _lastReclaim;
+
+    // interval used for polling and for checking whether the pressure is gone
+    static const int POLL_INTERVAL = 5000;
+    // minimum time between two reclaimRequested() signals
+    static const int RECLAIM_INTERVAL = 10000;
+};
+}
+
+#endif // MEMORYPRESSUREMONITOR_H
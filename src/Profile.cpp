@@ -51,6 +51,7 @@ static const char TERMINAL_GROUP[]    = "Terminal Features";
 static const char CURSOR_GROUP[]      = "Cursor Options";
 static const char INTERACTION_GROUP[] = "Interaction Options";
 static const char ENCODING_GROUP[]    = "Encoding Options";
+static const char LOGGING_GROUP[]     = "Session Log";
 
 const Profile::PropertyInfo Profile::DefaultPropertyNames[] = {
     // General
@@ -126,6 +127,13 @@ const Profile::PropertyInfo Profile::DefaultPropertyNames[] = {
     // Encoding
     , { DefaultEncoding , "DefaultEncoding" , ENCODING_GROUP , QVariant::String }
 
+    // Session Log
+    , { SessionLogMode , "SessionLogMode" , LOGGING_GROUP , QVariant::Int }
+    , { SessionLogDirectory , "SessionLogDirectory" , LOGGING_GROUP , QVariant::String }
+    , { SessionLogCompressed , "SessionLogCompressed" , LOGGING_GROUP , QVariant::Bool }
+    , { SessionLogMaxSize , "SessionLogMaxSize" , LOGGING_GROUP , QVariant::Int }
+    , { SessionLogMaxParts , "SessionLogMaxParts" , LOGGING_GROUP , QVariant::Int }
+
     , { static_cast<Profile::Property>(0) , nullptr , nullptr, QVariant::Invalid }
 };
 
@@ -216,6 +224,12 @@ void Profile::useFallback()
 
     setProperty(WordCharacters, QStringLiteral(":@-./_~?&=%+#"));
 
+    setProperty(SessionLogMode, Enum::NoSessionLog);
+    setProperty(SessionLogDirectory, QString());
+    setProperty(SessionLogCompressed, false);
+    setProperty(SessionLogMaxSize, 0);
+    setProperty(SessionLogMaxParts, 10);
+
     // Fallback should not be shown in menus
     setHidden(true);
 }
@@ -285,7 +285,28 @@ public:
         */
         AlternateScrolling,
         /** (int) Keyboard modifiers to show URL hints */
-        UrlHintsModifiers
+        UrlHintsModifiers,
+        /** (SessionLogModeEnum) Specifies whether and how the output of
+         * sessions using this profile is logged to files.
+         *
+         * See Enum::SessionLogModeEnum
+         */
+        SessionLogMode,
+        /** (QString) The directory session logs are written to.  If empty,
+         * the logs are written to the "logs" directory in Konsole's data
+         * directory.
+         */
+        SessionLogDirectory,
+        /** (bool) Specifies whether session logs are compressed with gzip. */
+        SessionLogCompressed,
+        /** (int) The size in MiB after which a new part of a session log is
+         * started, or 0 to never split logs.
+         */
+        SessionLogMaxSize,
+        /** (int) The number of parts of a session log which are kept, the
+         * oldest ones are removed.  0 keeps all of them.
+         */
+        SessionLogMaxParts
     };
 
     /**
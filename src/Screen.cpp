@@ -30,6 +30,9 @@
 #include "konsole_wcwidth.h"
 #include "TerminalCharacterDecoder.h"
 #include "History.h"
+#include "HistoryArchive.h"
+#include "HistoryMigration.h"
+#include "HistoryIndex.h"
 #include "ExtendedCharTable.h"
 
 using namespace Konsole;
@@ -63,7 +66,11 @@ Screen::Screen(int lines, int columns):
     _lastScrolledRegion(QRect()),
     _droppedLines(0),
     _lineProperties(QVarLengthArray<LineProperty, 64>()),
+    _lineTimestamps(QVarLengthArray<qint64, 64>()),
     _history(new HistoryScrollNone()),
+    _historyIndex(nullptr),
+    _commandIndex(),
+    _historyLines(new HistoryLineRange()),
     _cuX(0),
     _cuY(0),
     _currentForeground(CharacterColor()),
@@ -83,9 +90,12 @@ Screen::Screen(int lines, int columns):
     _lastDrawnChar(0)
 {
     _lineProperties.resize(_lines + 1);
+    _lineTimestamps.resize(_lines + 1);
     for (int i = 0; i < _lines + 1; i++) {
         _lineProperties[i] = LINE_DEFAULT;
+        _lineTimestamps[i] = 0;
     }
+    reserveLines();
 
     initTabStops();
     clearSelection();
@@ -96,6 +106,8 @@ Screen::~Screen()
 {
     delete[] _screenLines;
     delete _history;
+    delete _historyIndex;
+    delete _historyLines;
 }
 
 void Screen::cursorUp(int n)
@@ -177,6 +189,11 @@ void Screen::index()
     } else if (_cuY < _lines - 1) {
         _cuY += 1;
     }
+
+    // an empty line of output is written when the cursor moves onto it
+    if (_lineTimestamps[_cuY] == 0) {
+        _lineTimestamps[_cuY] = LineTimestamps::currentTime();
+    }
 }
 
 void Screen::reverseIndex()
@@ -368,8 +385,10 @@ void Screen::resizeImage(int new_lines, int new_columns)
     }
 
     _lineProperties.resize(new_lines + 1);
+    _lineTimestamps.resize(new_lines + 1);
     for (int i = _lines; (i > 0) && (i < new_lines + 1); i++) {
         _lineProperties[i] = LINE_DEFAULT;
+        _lineTimestamps[i] = 0;
     }
 
     clearSelection();
@@ -380,6 +399,7 @@ void Screen::resizeImage(int new_lines, int new_columns)
 
     _lines = new_lines;
     _columns = new_columns;
+    reserveLines();
     _cuX = qMin(_cuX, _columns - 1);
     _cuY = qMin(_cuY, _lines - 1);
 
@@ -390,6 +410,16 @@ void Screen::resizeImage(int new_lines, int new_columns)
     clearSelection();
 }
 
+void Screen::reserveLines()
+{
+    // lines are allocated once for the full width of the screen and then
+    // passed around by moveImage(), they only grow if characters are
+    // written beyond the width
+    for (int i = 0; i < _lines + 1; i++) {
+        _screenLines[i].reserve(_columns);
+    }
+}
+
 void Screen::setDefaultMargins()
 {
     _topMargin = 0;
@@ -452,11 +482,25 @@ void Screen::copyFromHistory(Character* dest, int startLine, int count) const
 {
     Q_ASSERT(startLine >= 0 && count > 0 && startLine + count <= _history->getLines());
 
+    // histories read from disk read the lines at once, the others are read
+    // straight into @p dest
+    const bool readRange = _history->readsLineRanges();
+    if (readRange) {
+        _history->getLineRange(startLine, count, *_historyLines);
+    }
+
     for (int line = startLine; line < startLine + count; line++) {
-        const int length = qMin(_columns, _history->getLineLen(line));
         const int destLineOffset  = (line - startLine) * _columns;
+        int length = 0;
 
-        _history->getCells(line, 0, length, dest + destLineOffset);
+        if (readRange) {
+            length = qMin(_columns, _historyLines->lineLength(line));
+            const Character *cells = _historyLines->lineCells(line);
+            qCopy(cells, cells + length, dest + destLineOffset);
+        } else {
+            length = qMin(_columns, _history->getLineLen(line));
+            _history->getCells(line, 0, length, dest + destLineOffset);
+        }
 
         for (int column = length; column < _columns; column++) {
             dest[destLineOffset + column] = Screen::DefaultChar;
@@ -565,6 +609,48 @@ QVector<LineProperty> Screen::getLineProperties(int startLine , int endLine) con
     return result;
 }
 
+// Finds the logical line 'line' is part of, in the history lines
+// described by 'history' followed by 'screenLines' lines of the screen
+static void findLogicalLine(const LogicalLineIndex &history, const LineProperty *lineProperties,
+                            int screenLines, int line, int &firstLine, int &lastLine)
+{
+    const int historyLines = history.lineCount();
+
+    if (line < historyLines) {
+        const int logicalLine = history.logicalLineOf(line);
+        firstLine = history.logicalLineStart(logicalLine);
+        lastLine = history.logicalLineEnd(logicalLine);
+
+        if (lastLine < historyLines - 1 || !history.isLastLineWrapped() || screenLines == 0) {
+            return;
+        }
+        // continued on the screen
+        lastLine = historyLines;
+    } else {
+        firstLine = line;
+        while (firstLine > historyLines && (lineProperties[firstLine - historyLines - 1] & LINE_WRAPPED) != 0) {
+            firstLine--;
+        }
+        if (firstLine == historyLines && historyLines > 0 && history.isLastLineWrapped()) {
+            firstLine = history.logicalLineStart(history.logicalLineCount() - 1);
+        }
+        lastLine = line;
+    }
+
+    while (lastLine - historyLines < screenLines - 1
+           && (lineProperties[lastLine - historyLines] & LINE_WRAPPED) != 0) {
+        lastLine++;
+    }
+}
+
+void Screen::getLogicalLineRange(int line, int &firstLine, int &lastLine) const
+{
+    Q_ASSERT(line >= 0 && line < _history->getLines() + _lines);
+    Q_ASSERT(_history->logicalLines().lineCount() == _history->getLines());
+
+    findLogicalLine(_history->logicalLines(), _lineProperties.constData(), _lines, line, firstLine, lastLine);
+}
+
 void Screen::reset()
 {
     // Clear screen, but preserve the current line
@@ -751,6 +837,10 @@ void Screen::displayCharacter(unsigned short c)
         }
     }
 
+    if (_lineTimestamps[_cuY] == 0) {
+        _lineTimestamps[_cuY] = LineTimestamps::currentTime();
+    }
+
     // ensure current line vector has enough elements
     if (_screenLines[_cuY].size() < _cuX + w) {
         _screenLines[_cuY].resize(_cuX + w);
@@ -845,7 +935,11 @@ void Screen::scrollUp(int from, int n)
     _lastScrolledRegion = QRect(0, _topMargin, _columns - 1, (_bottomMargin - _topMargin));
 
     //FIXME: make sure `topMargin', `bottomMargin', `from', `n' is in bounds.
-    moveImage(loc(0, from), loc(0, from + n), loc(_columns, _bottomMargin));
+    // the lines below the bottom margin must not be moved, moveImage()
+    // swaps the lines it moves
+    if (from + n <= _bottomMargin) {
+        moveImage(loc(0, from), loc(0, from + n), loc(_columns - 1, _bottomMargin));
+    }
     clearImage(loc(0, _bottomMargin - n + 1), loc(_columns - 1, _bottomMargin), ' ');
 }
 
@@ -939,6 +1033,10 @@ void Screen::clearImage(int loca, int loce, char c)
         const int endCol = (y == bottomLine) ? loce % _columns : _columns - 1;
         const int startCol = (y == topLine) ? loca % _columns : 0;
 
+        if (startCol == 0 && endCol == _columns - 1) {
+            _lineTimestamps[y] = 0;
+        }
+
         QVector<Character>& line = _screenLines[y];
 
         if (isDefaultCh && endCol == _columns - 1) {
@@ -967,15 +1065,22 @@ void Screen::moveImage(int dest, int sourceBegin, int sourceEnd)
     //so it matters that we do the copy in the right order -
     //forwards if dest < sourceBegin or backwards otherwise.
     //(search the web for 'memmove implementation' for details)
+    //
+    //lines are swapped rather than copied, so that the lines moved out of
+    //the way end up in the part of the source area which is not overwritten.
+    //the callers clear that part, which keeps the lines' memory and so no
+    //line is allocated or freed while scrolling
     if (dest < sourceBegin) {
         for (int i = 0; i <= lines; i++) {
-            _screenLines[(dest / _columns) + i ] = _screenLines[(sourceBegin / _columns) + i ];
+            _screenLines[(dest / _columns) + i ].swap(_screenLines[(sourceBegin / _columns) + i ]);
             _lineProperties[(dest / _columns) + i] = _lineProperties[(sourceBegin / _columns) + i];
+            _lineTimestamps[(dest / _columns) + i] = _lineTimestamps[(sourceBegin / _columns) + i];
         }
     } else {
         for (int i = lines; i >= 0; i--) {
-            _screenLines[(dest / _columns) + i ] = _screenLines[(sourceBegin / _columns) + i ];
+            _screenLines[(dest / _columns) + i ].swap(_screenLines[(sourceBegin / _columns) + i ]);
             _lineProperties[(dest / _columns) + i] = _lineProperties[(sourceBegin / _columns) + i];
+            _lineTimestamps[(dest / _columns) + i] = _lineTimestamps[(sourceBegin / _columns) + i];
         }
     }
 
@@ -1254,6 +1359,11 @@ void Screen::writeToStream(TerminalCharacterDecoder* decoder,
 
     Q_ASSERT(top >= 0 && left >= 0 && bottom >= 0 && right >= 0);
 
+    // history lines without a text plane are read in ranges of lines, if
+    // the history reads ranges faster
+    HistoryLineRange historyLines;
+    const int rangeLines = _history->readsLineRanges() ? _history->getLines() : 0;
+
     for (int y = top; y <= bottom; y++) {
         int start = 0;
         if (y == top || _blockSelectionMode) {
@@ -1265,13 +1375,21 @@ void Screen::writeToStream(TerminalCharacterDecoder* decoder,
             count = right - start + 1;
         }
 
+        int textLength = 0;
+        if (y < rangeLines && !historyLines.contains(y)
+            && _history->getLineText(y, textLength) == nullptr) {
+            _history->getLineRange(y, qMin(qMin(bottom + 1, rangeLines) - y, HISTORY_RANGE_LINES),
+                                   historyLines);
+        }
+
         const bool appendNewLine = (y != bottom);
         int copied = copyLineToStream(y,
                                       start,
                                       count,
                                       decoder,
                                       appendNewLine,
-                                      options);
+                                      options,
+                                      historyLines.contains(y) ? &historyLines : nullptr);
 
         // if the selection goes beyond the end of the last line then
         // append a new line character.
@@ -1292,7 +1410,8 @@ int Screen::copyLineToStream(int line ,
                              int count,
                              TerminalCharacterDecoder* decoder,
                              bool appendNewLine,
-                             const DecodingOptions options) const
+                             const DecodingOptions options,
+                             const HistoryLineRange *historyLines) const
 {
     //buffer to hold characters for decoding
     //the buffer is static to avoid initializing every
@@ -1307,7 +1426,8 @@ int Screen::copyLineToStream(int line ,
 
     //determine if the line is in the history buffer or the screen image
     if (line < _history->getLines()) {
-        const int lineLength = _history->getLineLen(line);
+        const int lineLength = historyLines != nullptr ? historyLines->lineLength(line) : _history->getLineLen(line);
+        const bool wrapped = historyLines != nullptr ? historyLines->isWrappedLine(line) : _history->isWrappedLine(line);
 
         // ensure that start position is before end of line
         start = qMin(start, qMax(0, lineLength - 1));
@@ -1324,11 +1444,30 @@ int Screen::copyLineToStream(int line ,
         // safety checks
         Q_ASSERT(start >= 0);
         Q_ASSERT(count >= 0);
-        Q_ASSERT((start + count) <= _history->getLineLen(line));
+        Q_ASSERT((start + count) <= lineLength);
+
+        // plain text can be read from the history without its attributes
+        PlainTextDecoder *plainTextDecoder = dynamic_cast<PlainTextDecoder *>(decoder);
+        int textLength = 0;
+        const QChar *text = plainTextDecoder != nullptr && historyLines == nullptr
+                            && (options & TrimLeadingWhitespace) == 0
+                            ? _history->getLineText(line, textLength) : nullptr;
+        if (text != nullptr) {
+            QChar lineEnd;
+            if (appendNewLine && (count + 1 < MAX_CHARS) && !wrapped) {
+                lineEnd = options.testFlag(PreserveLineBreaks) ? QLatin1Char('\n') : QLatin1Char(' ');
+            }
+            plainTextDecoder->decodeText(text + start, count, lineEnd);
+            return lineEnd.isNull() ? count : count + 1;
+        }
 
-        _history->getCells(line, start, count, characterBuffer);
+        if (historyLines != nullptr) {
+            qCopy(historyLines->lineCells(line) + start, historyLines->lineCells(line) + start + count, characterBuffer);
+        } else {
+            _history->getCells(line, start, count, characterBuffer);
+        }
 
-        if (_history->isWrappedLine(line)) {
+        if (wrapped) {
             currentLineProperties |= LINE_WRAPPED;
         }
     } else {
@@ -1426,11 +1565,19 @@ void Screen::addHistLine()
     if (hasScroll()) {
         const int oldHistLines = _history->getLines();
 
-        _history->addCellsVector(_screenLines[0]);
+        // the line is encoded by the history straight from the screen
+        _history->addCells(_screenLines[0].constData(), _screenLines[0].count());
+        _history->setNextLineTimestamp(_lineTimestamps[0]);
         _history->addLine((_lineProperties[0] & LINE_WRAPPED) != 0);
 
         const int newHistLines = _history->getLines();
 
+        if (_historyIndex != nullptr) {
+            _historyIndex->addLine(_screenLines[0].constData(), _screenLines[0].count(),
+                                   (_lineProperties[0] & LINE_WRAPPED) != 0);
+            _historyIndex->setLineCount(newHistLines);
+        }
+
         const bool beginIsTL = (_selBegin == _selTopLeft);
 
         // If the history is full, increment the count
@@ -1474,6 +1621,10 @@ void Screen::addHistLine()
             }
         }
     }
+
+    // without a history the line is dropped right away
+    _commandIndex.addLine();
+    _commandIndex.setLineCount(_history->getLines());
 }
 
 int Screen::getHistLines() const
@@ -1485,13 +1636,154 @@ void Screen::setScroll(const HistoryType& t , bool copyPreviousScroll)
 {
     clearSelection();
 
-    if (copyPreviousScroll) {
+    // a conversion still in progress starts over from the previous history.
+    // the migration is deleted last, @p t may be the type of its target
+    MigratingHistoryScroll *migration = dynamic_cast<MigratingHistoryScroll *>(_history);
+    if (migration != nullptr) {
+        _history = migration->takeSource();
+    }
+
+    RestoredHistoryScroll *restored = dynamic_cast<RestoredHistoryScroll *>(_history);
+
+    if (copyPreviousScroll && restored != nullptr && t.isEnabled()) {
+        // the restored lines stay in the archive, only the lines added
+        // since then are converted
+        restored->setScroll(t.scroll(restored->takeScroll()));
+    } else if (copyPreviousScroll && t.copiesLines(_history)
+               && _history->getLines() >= MigratingHistoryScroll::MIN_LINES) {
+        // the lines are copied in a separate thread, the previous history
+        // is used until they have been copied
+        _history = new MigratingHistoryScroll(_history, t.scroll(nullptr));
+    } else if (copyPreviousScroll) {
         _history = t.scroll(_history);
     } else {
         HistoryScroll* oldScroll = _history;
         _history = t.scroll(nullptr);
         delete oldScroll;
     }
+
+    delete migration;
+
+    // the new history keeps the last lines of the old one, if any
+    _commandIndex.setLineCount(_history->getLines());
+    if (_historyIndex != nullptr) {
+        if (_history->getLines() == 0) {
+            _historyIndex->clear();
+        } else {
+            _historyIndex->setLineCount(_history->getLines());
+        }
+    }
+}
+
+QThread *Screen::historyMigration() const
+{
+    MigratingHistoryScroll *migration = dynamic_cast<MigratingHistoryScroll *>(_history);
+    return migration != nullptr ? migration->thread() : nullptr;
+}
+
+void Screen::finishHistoryMigration()
+{
+    MigratingHistoryScroll *migration = dynamic_cast<MigratingHistoryScroll *>(_history);
+    if (migration == nullptr || !migration->isFinished()) {
+        return;
+    }
+
+    const int lines = _history->getLines();
+    _history = migration->takeTarget();
+    delete migration;
+
+    // lines the previous history dropped during the conversion are kept by
+    // the new one, or the new one keeps fewer lines, line numbers have
+    // changed.  Reading the extra lines to index them would stall the
+    // display for large histories, they are searched in full instead
+    const int newLines = _history->getLines();
+    if (newLines != lines) {
+        clearSelection();
+        if (_historyIndex != nullptr) {
+            if (newLines > lines) {
+                _historyIndex->prependUnindexedLines(newLines - lines);
+            } else {
+                _historyIndex->setLineCount(newLines);
+            }
+        }
+        _commandIndex.setLineCount(newLines);
+    }
+}
+
+void Screen::restoreHistory(const QSharedPointer<HistoryArchive> &archive)
+{
+    if (!_history->hasScroll() || archive->getLines() == 0) {
+        return;
+    }
+
+    clearSelection();
+    _history = new RestoredHistoryScroll(archive, _history);
+
+    // the restored lines come before the others.  They are not indexed,
+    // which would read the whole archive, but searched in full
+    _commandIndex.setLineCount(_history->getLines());
+
+    if (_historyIndex != nullptr) {
+        _historyIndex->prependUnindexedLines(archive->getLines());
+    }
+}
+
+void Screen::releaseMemory()
+{
+    _history->releaseMemory();
+}
+
+void Screen::setHistoryIndexEnabled(bool enable)
+{
+    if (enable == (_historyIndex != nullptr)) {
+        return;
+    }
+
+    if (!enable) {
+        delete _historyIndex;
+        _historyIndex = nullptr;
+        return;
+    }
+
+    _historyIndex = new HistoryIndex();
+
+    QVector<Character> line;
+    for (int i = 0; i < _history->getLines(); i++) {
+        line.resize(_history->getLineLen(i));
+        _history->getCells(i, 0, line.count(), line.data());
+        _historyIndex->addLine(line.constData(), line.count(), _history->isWrappedLine(i));
+    }
+    _historyIndex->setLineCount(_history->getLines());
+}
+
+const HistoryIndex *Screen::historyIndex() const
+{
+    return _historyIndex;
+}
+
+void Screen::setCommandMark(CommandIndex::Mark mark, int exitCode)
+{
+    _commandIndex.addMark(mark, _history->getLines() + _cuY, _cuX, exitCode);
+}
+
+const CommandIndex &Screen::commandIndex() const
+{
+    return _commandIndex;
+}
+
+ScreenSnapshot *Screen::createSnapshot() const
+{
+    QVector<ImageLine> screenLines(_lines);
+    QVector<LineProperty> lineProperties(_lines);
+    QVector<qint64> lineTimestamps(_lines);
+    for (int i = 0; i < _lines; i++) {
+        screenLines[i] = _screenLines[i];
+        lineProperties[i] = _lineProperties[i];
+        lineTimestamps[i] = _lineTimestamps[i];
+    }
+
+    return new ScreenSnapshot(_history->createSnapshot(), _history->logicalLines(),
+                              screenLines, lineProperties, lineTimestamps, _columns);
 }
 
 bool Screen::hasScroll() const
@@ -1518,3 +1810,158 @@ void Screen::fillWithDefaultChar(Character* dest, int count)
         dest[i] = Screen::DefaultChar;
     }
 }
+
+ScreenSnapshot::ScreenSnapshot(HistorySnapshot *history, const LogicalLineIndex &logicalLines,
+                               const QVector<QVector<Character> > &screenLines,
+                               const QVector<LineProperty> &lineProperties,
+                               const QVector<qint64> &lineTimestamps, int columns) :
+    _history(history),
+    _logicalLines(new LogicalLineIndex(logicalLines)),
+    _screenLines(screenLines),
+    _lineProperties(lineProperties),
+    _lineTimestamps(lineTimestamps),
+    _columns(columns)
+{
+}
+
+ScreenSnapshot::~ScreenSnapshot()
+{
+    delete _history;
+    delete _logicalLines;
+}
+
+int ScreenSnapshot::getLines() const
+{
+    return _history->getLines() + _screenLines.count();
+}
+
+int ScreenSnapshot::getHistLines() const
+{
+    return _history->getLines();
+}
+
+int ScreenSnapshot::getColumns() const
+{
+    return _columns;
+}
+
+int ScreenSnapshot::getLineLen(int line) const
+{
+    if (line < _history->getLines()) {
+        return _history->getLineLen(line);
+    }
+
+    const int screenLine = line - _history->getLines();
+    return screenLine < _screenLines.count() ? qMin(_screenLines[screenLine].count(), _columns) : 0;
+}
+
+void ScreenSnapshot::getCells(int line, int column, int count, Character res[]) const
+{
+    Q_ASSERT(column >= 0 && count >= 0 && column + count <= getLineLen(line));
+
+    if (line < _history->getLines()) {
+        _history->getCells(line, column, count, res);
+        return;
+    }
+
+    const QVector<Character> &data = _screenLines[line - _history->getLines()];
+    qCopy(data.constBegin() + column, data.constBegin() + column + count, res);
+}
+
+bool ScreenSnapshot::isWrappedLine(int line) const
+{
+    if (line < _history->getLines()) {
+        return _history->isWrappedLine(line);
+    }
+
+    const int screenLine = line - _history->getLines();
+    return screenLine < _lineProperties.count() && (_lineProperties[screenLine] & LINE_WRAPPED) != 0;
+}
+
+qint64 ScreenSnapshot::getLineTimestamp(int line) const
+{
+    if (line < _history->getLines()) {
+        return _history->getLineTimestamp(line);
+    }
+
+    const int screenLine = line - _history->getLines();
+    return screenLine < _lineTimestamps.count() ? _lineTimestamps[screenLine] : 0;
+}
+
+void ScreenSnapshot::getLogicalLineRange(int line, int &firstLine, int &lastLine) const
+{
+    Q_ASSERT(line >= 0 && line < getLines());
+    Q_ASSERT(_logicalLines->lineCount() == _history->getLines());
+
+    findLogicalLine(*_logicalLines, _lineProperties.constData(), _lineProperties.count(), line, firstLine, lastLine);
+}
+
+void ScreenSnapshot::writeLinesToStream(TerminalCharacterDecoder *decoder, int fromLine, int toLine) const
+{
+    // unlike Screen::copyLineToStream() this may run in several threads,
+    // so the buffer cannot be static
+    QVarLengthArray<Character, 1024> characterBuffer;
+    const int historyLines = _history->getLines();
+    const int lastLine = qMin(toLine, getLines() - 1);
+    // plain text can be read from the history without its attributes
+    PlainTextDecoder *plainTextDecoder = dynamic_cast<PlainTextDecoder *>(decoder);
+    // other history lines are read in ranges of lines, if that is faster
+    HistoryLineRange historyRange;
+    const bool readRange = _history->readsLineRanges();
+    const bool timestamps = decoder->usesLineTimestamps();
+
+    for (int line = qMax(fromLine, 0); line <= lastLine; line++) {
+        LineProperty currentLineProperties = 0;
+        int count = 0;
+
+        if (timestamps) {
+            decoder->setLineTimestamp(getLineTimestamp(line));
+        }
+
+        if (line < historyLines) {
+            const QChar *text = plainTextDecoder != nullptr ? _history->getLineText(line, count) : nullptr;
+            if (text != nullptr) {
+                plainTextDecoder->decodeText(text, count, _history->isWrappedLine(line) ? QChar() : QChar(QLatin1Char('\n')));
+                continue;
+            }
+
+            bool wrapped;
+            if (readRange) {
+                if (!historyRange.contains(line)) {
+                    _history->getLineRange(line, qMin(qMin(lastLine + 1, historyLines) - line, Screen::HISTORY_RANGE_LINES),
+                                           historyRange);
+                }
+
+                count = historyRange.lineLength(line);
+                characterBuffer.resize(count + 1);
+                qCopy(historyRange.lineCells(line), historyRange.lineCells(line) + count, characterBuffer.begin());
+                wrapped = historyRange.isWrappedLine(line);
+            } else {
+                count = _history->getLineLen(line);
+                characterBuffer.resize(count + 1);
+                _history->getCells(line, 0, count, characterBuffer.data());
+                wrapped = _history->isWrappedLine(line);
+            }
+
+            if (wrapped) {
+                currentLineProperties |= LINE_WRAPPED;
+            }
+        } else {
+            const int screenLine = line - historyLines;
+            const QVector<Character> &data = _screenLines[screenLine];
+
+            count = qMin(data.count(), _columns);
+            characterBuffer.resize(count + 1);
+            qCopy(data.constBegin(), data.constBegin() + count, characterBuffer.begin());
+
+            currentLineProperties |= _lineProperties[screenLine];
+        }
+
+        if ((currentLineProperties & LINE_WRAPPED) == 0) {
+            characterBuffer[count] = Character('\n');
+            count++;
+        }
+
+        decoder->decodeLine(characterBuffer.constData(), count, currentLineProperties);
+    }
+}
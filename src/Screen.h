@@ -26,12 +26,16 @@
 // Qt
 #include <QRect>
 #include <QSet>
+#include <QSharedPointer>
 #include <QVector>
 #include <QBitArray>
 #include <QVarLengthArray>
 
+class QThread;
+
 // Konsole
 #include "Character.h"
+#include "CommandIndex.h"
 
 #define MODE_Origin    0
 #define MODE_Wrap      1
@@ -46,6 +50,12 @@ class TerminalCharacterDecoder;
 class TerminalDisplay;
 class HistoryType;
 class HistoryScroll;
+class HistorySnapshot;
+class HistoryIndex;
+class HistoryLineRange;
+class HistoryArchive;
+class LogicalLineIndex;
+class ScreenSnapshot;
 
 /**
     \brief An image of characters with associated attributes.
@@ -394,6 +404,17 @@ public:
      */
     QVector<LineProperty> getLineProperties(int startLine, int endLine) const;
 
+    /**
+     * Finds the logical line @p line is part of, that is the lines joined to it
+     * by wrapping, in the history and the screen image.  Lines are numbered as
+     * in getLineProperties().
+     *
+     * @param line The line to look up
+     * @param firstLine Set to the first line of the logical line
+     * @param lastLine Set to the last line of the logical line
+     */
+    void getLogicalLineRange(int line, int &firstLine, int &lastLine) const;
+
     /** Return the number of lines. */
     int getLines() const
     {
@@ -412,10 +433,61 @@ public:
      * Sets the type of storage used to keep lines in the history.
      * If @p copyPreviousScroll is true then the contents of the previous
      * history buffer are copied into the new scroll.
+     *
+     * Large histories are copied in a separate thread, see historyMigration().
      */
     void setScroll(const HistoryType &, bool copyPreviousScroll = true);
     /** Returns the type of storage used to keep lines in the history. */
     const HistoryType &getScroll() const;
+    /**
+     * Returns the thread copying the lines of the previous history into the
+     * new one after a call to setScroll(), or nullptr if there is none.  The
+     * previous history is used until finishHistoryMigration() is called once
+     * the thread has finished.  See MigratingHistoryScroll
+     *
+     * The thread is not started yet, so that the caller can connect to its
+     * finished() signal before starting it.
+     */
+    QThread *historyMigration() const;
+    /**
+     * Replaces the previous history with the new one, if the thread returned
+     * by historyMigration() has finished.
+     */
+    void finishHistoryMigration();
+    /**
+     * Adds the lines of @p archive to the history, in front of the lines it
+     * already has, see RestoredHistoryScroll.  Nothing is restored if the
+     * screen has no history.
+     */
+    void restoreHistory(const QSharedPointer<HistoryArchive> &archive);
+    /**
+     * Gives back memory used by the history which is not needed to keep
+     * its contents.  See HistoryScroll::releaseMemory()
+     */
+    void releaseMemory();
+
+    /**
+     * Returns a read-only copy of the history and the screen image, which the
+     * caller takes ownership of.  See ScreenSnapshot
+     */
+    ScreenSnapshot *createSnapshot() const;
+
+    /**
+     * Sets whether the lines in the history are indexed to speed up searches.
+     * The index is built from the lines already in the history and then kept
+     * up to date as lines are added to and dropped from the history.
+     */
+    void setHistoryIndexEnabled(bool enable);
+    /** Returns the index of the lines in the history, or nullptr if it is disabled */
+    const HistoryIndex *historyIndex() const;
+
+    /**
+     * Records a prompt or command mark sent by the shell at the cursor
+     * position.  See CommandIndex
+     */
+    void setCommandMark(CommandIndex::Mark mark, int exitCode = -1);
+    /** Returns the index of the commands run in the terminal */
+    const CommandIndex &commandIndex() const;
     /**
      * Returns true if this screen keeps lines that are scrolled off the screen
      * in a history buffer.
@@ -597,6 +669,9 @@ public:
 
     static const Character DefaultChar;
 
+    /** The number of history lines read at once when writing lines to a stream */
+    static const int HISTORY_RANGE_LINES = 256;
+
 private:
     //copies a line of text from the screen or history into a stream using a
     //specified character decoder.  Returns the number of lines actually copied,
@@ -609,8 +684,10 @@ private:
     //count - the number of characters on the line to copy
     //decoder - a decoder which converts terminal characters (an Character array) into text
     //appendNewLine - if true a new line character (\n) is appended to the end of the line
+    //historyLines - if not null, holds the line, which is in the history, already read
     int  copyLineToStream(int line, int start, int count, TerminalCharacterDecoder *decoder,
-                          bool appendNewLine, const Konsole::Screen::DecodingOptions options) const;
+                          bool appendNewLine, const Konsole::Screen::DecodingOptions options,
+                          const HistoryLineRange *historyLines = nullptr) const;
 
     //fills a section of the screen image with the character 'c'
     //the parameters are specified as offsets from the start of the screen image.
@@ -623,6 +700,8 @@ private:
     //
     //NOTE: moveImage() can only move whole lines
     void moveImage(int dest, int sourceBegin, int sourceEnd);
+    // reserves the full width of the screen for each line
+    void reserveLines();
     // scroll up 'n' lines in current region, clearing the bottom 'n' lines
     void scrollUp(int from, int n);
     // scroll down 'n' lines in current region, clearing the top 'n' lines
@@ -664,9 +743,17 @@ private:
     int _droppedLines;
 
     QVarLengthArray<LineProperty, 64> _lineProperties;
+    // the time each line was first written to since it was cleared, in
+    // milliseconds since the epoch, or 0.  It is passed on to the history
+    // when the line scrolls into it
+    QVarLengthArray<qint64, 64> _lineTimestamps;
 
     // history buffer ---------------
     HistoryScroll *_history;
+    HistoryIndex *_historyIndex;
+    CommandIndex _commandIndex;
+    // history lines read by copyFromHistory(), kept to reuse its memory
+    HistoryLineRange *_historyLines;
 
     // cursor location
     int _cuX;
@@ -727,6 +814,68 @@ private:
     unsigned short _lastDrawnChar;
 };
 
+/**
+ * A read-only copy of the output of a Screen, its history followed by the
+ * screen image, as it was when Screen::createSnapshot() was called.
+ *
+ * Taking a snapshot is cheap: the screen lines are implicitly shared and the
+ * history storage is shared with the snapshot where possible.  Unlike the
+ * Screen itself, a snapshot may be read from another thread while the
+ * emulation goes on changing the screen.
+ */
+class ScreenSnapshot
+{
+public:
+    ~ScreenSnapshot();
+
+    /** Returns the number of lines, history and screen image together. */
+    int getLines() const;
+    /** Returns the number of lines which were in the history. */
+    int getHistLines() const;
+    /** Returns the number of columns of the screen image. */
+    int getColumns() const;
+    /** Returns the number of cells in @p line. */
+    int getLineLen(int line) const;
+    /** Copies @p count cells of @p line, starting at @p column, to @p res. */
+    void getCells(int line, int column, int count, Character res[]) const;
+    /** Returns true if @p line continues on the next line. */
+    bool isWrappedLine(int line) const;
+    /**
+     * Returns the time @p line was written, see
+     * HistoryScroll::getLineTimestamp().  Lines of the screen image which
+     * have not been written to return 0.
+     */
+    qint64 getLineTimestamp(int line) const;
+    /** See Screen::getLogicalLineRange() */
+    void getLogicalLineRange(int line, int &firstLine, int &lastLine) const;
+
+    /**
+     * Copies lines @p fromLine to @p toLine to a stream, like
+     * Screen::writeLinesToStream() does.
+     *
+     * Each line is passed to the decoder in a single decodeLine() call,
+     * together with the new line ending it unless the line is wrapped.
+     * PlainTextDecoder::linePositions() thus holds one entry per line.
+     */
+    void writeLinesToStream(TerminalCharacterDecoder *decoder, int fromLine, int toLine) const;
+
+private:
+    friend class Screen;
+
+    ScreenSnapshot(HistorySnapshot *history, const LogicalLineIndex &logicalLines,
+                   const QVector<QVector<Character> > &screenLines,
+                   const QVector<LineProperty> &lineProperties,
+                   const QVector<qint64> &lineTimestamps, int columns);
+    Q_DISABLE_COPY(ScreenSnapshot)
+
+    HistorySnapshot *_history;
+    LogicalLineIndex *_logicalLines;
+    QVector<QVector<Character> > _screenLines;
+    QVector<LineProperty> _lineProperties;
+    QVector<qint64> _lineTimestamps;
+    int _columns;
+};
+
 }
 
 Q_DECLARE_OPERATORS_FOR_FLAGS(Konsole::Screen::DecodingOptions)
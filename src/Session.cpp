@@ -36,6 +36,7 @@
 #include <QFile>
 #include <QStringList>
 #include <QKeyEvent>
+#include <QStandardPaths>
 
 // KDE
 #include <KLocalizedString>
@@ -55,6 +56,9 @@
 #include "Vt102Emulation.h"
 #include "ZModemDialog.h"
 #include "History.h"
+#include "MemoryPressureMonitor.h"
+#include "KonsoleSettings.h"
+#include "SessionLog.h"
 #include "konsoledebug.h"
 
 using namespace Konsole;
@@ -101,6 +105,7 @@ Session::Session(QObject* parent) :
     , _zmodemBusy(false)
     , _zmodemProc(nullptr)
     , _zmodemProgress(nullptr)
+    , _log(nullptr)
     , _hasDarkBackground(false)
     , _preferredSize(QSize())
     , _readOnly(false)
@@ -127,6 +132,12 @@ Session::Session(QObject* parent) :
     connect(_emulation, &Konsole::Emulation::imageResizeRequest, this, &Konsole::Session::resizeRequest);
     connect(_emulation, &Konsole::Emulation::sessionAttributeRequest, this, &Konsole::Session::sessionAttributeRequest);
 
+    //give memory back when the system runs low on it
+    connect(MemoryPressureMonitor::instance(), &Konsole::MemoryPressureMonitor::reclaimRequested, _emulation, &Konsole::Emulation::releaseMemory);
+
+    //index the history for searching
+    _emulation->setHistoryIndexEnabled(KonsoleSettings::searchIndexHistory());
+
     //create new teletype for I/O with shell process
     openTeletype(-1);
 
@@ -146,6 +157,8 @@ Session::~Session()
 {
     delete _foregroundProcessInfo;
     delete _sessionProcessInfo;
+    // writes the output still queued
+    delete _log;
     delete _emulation;
     delete _shellProcess;
     delete _zmodemProc;
@@ -230,6 +243,10 @@ void Session::setCodec(QTextCodec* codec)
     }
 
     emulation()->setCodec(codec);
+
+    if (_log != nullptr) {
+        _log->setCodec(_emulation->codec());
+    }
 }
 
 bool Session::setCodec(const QByteArray& name)
@@ -1228,6 +1245,35 @@ void Session::clearHistory()
     _emulation->clearHistory();
 }
 
+void Session::setSessionLog(Enum::SessionLogModeEnum mode, const QString &directory, bool compressed,
+                            qint64 maxFileSize, int maxParts)
+{
+    const SessionLog::Format format = mode == Enum::TextSessionLog ? SessionLog::PlainText
+                                                                   : SessionLog::RawOutput;
+
+    // keep writing to the current log if only its size limits change
+    if (_log != nullptr && mode != Enum::NoSessionLog && _log->format() == format
+        && _log->isCompressed() == compressed
+        && QFileInfo(_log->fileName()).absolutePath() == QDir(directory).absolutePath()) {
+        _log->setMaxFileSize(maxFileSize);
+        _log->setMaxParts(maxParts);
+        return;
+    }
+
+    delete _log;
+    _log = nullptr;
+
+    if (mode == Enum::NoSessionLog) {
+        return;
+    }
+
+    _log = new SessionLog(SessionLog::logFileName(directory, _nameTitle, _sessionId), format, compressed);
+    _log->setMaxFileSize(maxFileSize);
+    _log->setMaxParts(maxParts);
+    _log->setCodec(_emulation->codec());
+    _log->start(QThread::LowPriority);
+}
+
 QStringList Session::arguments() const
 {
     return _arguments;
@@ -1447,6 +1493,10 @@ void Session::zmodemFinished()
 
 void Session::onReceiveBlock(const char* buf, int len)
 {
+    if (_log != nullptr) {
+        _log->write(buf, len);
+    }
+
     _emulation->receiveData(buf, len);
 }
 
@@ -1563,6 +1613,21 @@ int Session::historySize() const
     }
 }
 
+void Session::setHistoryIndexEnabled(bool enable)
+{
+    _emulation->setHistoryIndexEnabled(enable);
+}
+
+bool Session::isHistoryIndexEnabled() const
+{
+    return _emulation->isHistoryIndexEnabled();
+}
+
+qlonglong Session::historyIndexMemoryUsage() const
+{
+    return _emulation->historyIndexMemoryUsage();
+}
+
 int Session::foregroundProcessId()
 {
     int pid;
@@ -1604,6 +1669,14 @@ void Session::saveSession(KConfigGroup& group)
     group.writeEntry("RemoteTab",      tabTitleFormat(RemoteTabTitle));
     group.writeEntry("SessionGuid",    _uniqueIdentifier.toString());
     group.writeEntry("Encoding",       QString::fromUtf8(codec()));
+
+    if (KonsoleSettings::restoreScrollback() && _emulation->history().isEnabled()) {
+        // the archive is written in the background, it is complete
+        // before Konsole exits
+        const QString fileName = scrollbackFileName();
+        _emulation->archiveHistory(fileName);
+        group.writePathEntry("Scrollback", fileName);
+    }
 }
 
 void Session::restoreSession(KConfigGroup& group)
@@ -1630,6 +1703,28 @@ void Session::restoreSession(KConfigGroup& group)
     if (!value.isEmpty()) {
         setCodec(value.toUtf8());
     }
+    value = group.readPathEntry("Scrollback", QString());
+    if (!value.isEmpty()) {
+        _emulation->restoreHistory(value);
+    }
+}
+
+void Session::removeScrollbackArchive()
+{
+    QFile::remove(scrollbackFileName());
+}
+
+QString Session::scrollbackDirectory()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::AppDataLocation)
+           + QLatin1String("/scrollback");
+}
+
+QString Session::scrollbackFileName() const
+{
+    // without the braces
+    const QString uuid = _uniqueIdentifier.toString().mid(1, 36);
+    return scrollbackDirectory() + QLatin1Char('/') + uuid + QLatin1String(".history");
 }
 
 QString Session::validDirectory(const QString& dir) const
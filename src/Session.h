@@ -37,6 +37,7 @@
 #include "konsoleprivate_export.h"
 #include "config-konsole.h" //krazy:exclude=includes
 #include "Shortcut_p.h"
+#include "Enumeration.h"
 
 class QColor;
 
@@ -50,6 +51,7 @@ class ProcessInfo;
 class TerminalDisplay;
 class ZModemDialog;
 class HistoryType;
+class SessionLog;
 
 /**
  * Represents a terminal session consisting of a pseudo-teletype and a terminal emulation.
@@ -226,6 +228,22 @@ public:
      */
     void clearHistory();
 
+    /**
+     * Logs the output of the session to a file in @p directory as it is
+     * received, see SessionLog.  A new log is started if the mode, directory
+     * or compression change, and logging stops for Enum::NoSessionLog.
+     *
+     * @param mode Whether and how the output is logged
+     * @param directory The directory the log is written to
+     * @param compressed Whether the log is compressed with gzip
+     * @param maxFileSize The size in bytes after which a new part of the
+     * log is started, or 0 to never split the log
+     * @param maxParts The number of parts of the log which are kept, or 0
+     * to keep all of them
+     */
+    void setSessionLog(Enum::SessionLogModeEnum mode, const QString &directory, bool compressed,
+                       qint64 maxFileSize, int maxParts);
+
     /**
      * Sets the key bindings used by this session.  The bindings
      * specify how input key sequences are translated into
@@ -369,6 +387,14 @@ public:
     void saveSession(KConfigGroup &group);
     void restoreSession(KConfigGroup &group);
 
+    /**
+     * Removes the archive the output was saved to by saveSession(), once the
+     * session is closed for good and will not be restored.
+     */
+    void removeScrollbackArchive();
+    /** Returns the directory the output of sessions is saved to by saveSession(). */
+    static QString scrollbackDirectory();
+
     void sendSignal(int signal);
 
     void reportBackgroundColor(const QColor &c);
@@ -581,6 +607,23 @@ public Q_SLOTS:
      */
     Q_SCRIPTABLE int historySize() const;
 
+    /**
+     * Sets whether the history of this session is indexed to speed up searches
+     * through it.  The index costs memory, see historyIndexMemoryUsage().
+     */
+    Q_SCRIPTABLE void setHistoryIndexEnabled(bool enable);
+
+    /**
+     * Returns true if the history of this session is indexed.
+     */
+    Q_SCRIPTABLE bool isHistoryIndexEnabled() const;
+
+    /**
+     * Returns the number of bytes used by the history index of this session,
+     * or 0 if the history is not indexed.
+     */
+    Q_SCRIPTABLE qlonglong historyIndexMemoryUsage() const;
+
 Q_SIGNALS:
 
     /** Emitted when the terminal process starts. */
@@ -750,6 +793,8 @@ private:
     void updateWorkingDirectory();
 
     QString validDirectory(const QString &dir) const;
+    // the archive the output is saved to with the session, see HistoryArchive
+    QString scrollbackFileName() const;
 
     QUuid _uniqueIdentifier;            // SHELL_SESSION_ID
 
@@ -802,6 +847,9 @@ private:
     KProcess *_zmodemProc;
     ZModemDialog *_zmodemProgress;
 
+    // the output is logged to, if it is
+    SessionLog *_log;
+
     bool _hasDarkBackground;
 
     QSize _preferredSize;
@@ -36,6 +36,7 @@
 #include <QStandardPaths>
 #include <QUrl>
 #include <QIcon>
+#include <QTextStream>
 
 // KDE
 #include <KActionMenu>
@@ -65,6 +66,7 @@
 #include "HistorySizeDialog.h"
 #include "IncrementalSearchBar.h"
 #include "RenameTabDialog.h"
+#include "Screen.h"
 #include "ScreenWindow.h"
 #include "Session.h"
 #include "ProfileList.h"
@@ -74,6 +76,10 @@
 #include "PrintOptions.h"
 
 // for SaveHistoryTask
+#include <QBuffer>
+#include <QProgressDialog>
+#include <QSaveFile>
+#include <QScopedPointer>
 #include <KIO/Job>
 #include <KJob>
 #include "TerminalCharacterDecoder.h"
@@ -81,6 +87,9 @@
 // For Unix signal names
 #include <signal.h>
 
+// for SearchHistoryThread
+#include <algorithm>
+
 using namespace Konsole;
 
 // TODO - Replace the icon choices below when suitable icons for silence and
@@ -609,6 +618,21 @@ void SessionController::setupCommonActions()
     action = collection->addAction(QStringLiteral("select-line"), this, SLOT(selectLine()));
     action->setText(i18n("Select &Line"));
 
+    // these need a shell which marks its prompts and the output of commands
+    action = collection->addAction(QStringLiteral("select-command-output"), this, SLOT(selectCommandOutput()));
+    action->setText(i18n("Select Command &Output"));
+
+    action = collection->addAction(QStringLiteral("save-command-output"), this, SLOT(saveCommandOutput()));
+    action->setText(i18n("Save Command Output As..."));
+
+    action = collection->addAction(QStringLiteral("previous-prompt"), this, SLOT(scrollToPreviousPrompt()));
+    action->setText(i18n("Previous Prompt"));
+    action->setIcon(QIcon::fromTheme(QStringLiteral("go-up")));
+
+    action = collection->addAction(QStringLiteral("next-prompt"), this, SLOT(scrollToNextPrompt()));
+    action->setText(i18n("Next Prompt"));
+    action->setIcon(QIcon::fromTheme(QStringLiteral("go-down")));
+
     action = KStandardAction::saveAs(this, SLOT(saveHistory()), collection);
     action->setText(i18n("Save Output &As..."));
 #ifdef Q_OS_MACOS
@@ -996,6 +1020,110 @@ void SessionController::selectLine()
 {
     _view->selectCurrentLine();
 }
+
+void SessionController::scrollToPreviousPrompt()
+{
+    ScreenWindow *window = _view->screenWindow();
+    const int line = window->screen()->commandIndex().previousPrompt(window->currentLine());
+    if (line < 0) {
+        return;
+    }
+
+    window->scrollTo(line);
+    window->setTrackOutput(false);
+    window->notifyOutputChanged();
+}
+
+void SessionController::scrollToNextPrompt()
+{
+    ScreenWindow *window = _view->screenWindow();
+    const int line = window->screen()->commandIndex().nextPrompt(window->currentLine());
+
+    // past the last prompt the view follows the output again
+    window->scrollTo(line >= 0 ? line : window->lineCount());
+    window->setTrackOutput(line < 0 || window->atEndOfOutput());
+    window->notifyOutputChanged();
+}
+
+// the command whose output is selected or saved: the command at the top of
+// the view, or the last finished command if the view follows the output
+static int currentCommand(ScreenWindow *window)
+{
+    const CommandIndex &commands = window->screen()->commandIndex();
+    if (!window->atEndOfOutput()) {
+        return commands.findCommand(window->currentLine());
+    }
+
+    CommandIndex::Position start;
+    CommandIndex::Position end;
+    for (int i = commands.commandCount() - 1; i >= 0; i--) {
+        if (commands.commandOutput(i, start, end) && end.line >= 0) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+void SessionController::selectCommandOutput()
+{
+    ScreenWindow *window = _view->screenWindow();
+    const int command = currentCommand(window);
+
+    CommandIndex::Position start;
+    CommandIndex::Position end;
+    if (command < 0 || !window->screen()->commandIndex().commandOutput(command, start, end)) {
+        return;
+    }
+
+    // the output ends before the position of the next mark
+    if (end.line < 0) {
+        end.line = window->lineCount() - 1;
+        end.column = window->columnCount();
+    } else if (end.column == 0) {
+        end.line--;
+        end.column = window->columnCount();
+    }
+    if (end.line < start.line || (end.line == start.line && end.column <= start.column)) {
+        return;
+    }
+
+    if (start.line < window->currentLine() || start.line >= window->currentLine() + window->windowLines()) {
+        window->scrollTo(start.line);
+        window->setTrackOutput(false);
+    }
+
+    // selections are set relative to the top of the view
+    window->clearSelection();
+    window->setSelectionStart(start.column, start.line - window->currentLine(), false);
+    window->setSelectionEnd(end.column - 1, end.line - window->currentLine());
+    window->notifyOutputChanged();
+    _view->copyToX11Selection();
+}
+
+void SessionController::saveCommandOutput()
+{
+    ScreenWindow *window = _view->screenWindow();
+    const int command = currentCommand(window);
+
+    CommandIndex::Position start;
+    CommandIndex::Position end;
+    if (command < 0 || !window->screen()->commandIndex().commandOutput(command, start, end)) {
+        return;
+    }
+
+    // whole lines are saved, up to the end of the output if the command
+    // is still running
+    const int lastLine = end.line < 0 ? -1 : (end.column == 0 ? end.line - 1 : end.line);
+    if (lastLine >= 0 && lastLine < start.line) {
+        return;
+    }
+
+    auto task = new SaveHistoryTask(this);
+    task->setAutoDelete(true);
+    task->addSession(_session);
+    task->setLineRange(start.line, lastLine);
+    task->execute();
+}
 static const KXmlGuiWindow* findWindow(const QObject* object)
 {
     // Walk up the QObject hierarchy to find a KXmlGuiWindow.
@@ -1223,15 +1351,20 @@ void SessionController::enableSearchBar(bool showSearchBar)
     _searchBar->setVisible(showSearchBar);
     if (showSearchBar) {
         connect(_searchBar.data(), &Konsole::IncrementalSearchBar::searchChanged, this, &Konsole::SessionController::searchTextChanged);
+        connect(_searchBar.data(), &Konsole::IncrementalSearchBar::searchTextEdited, this, &Konsole::SessionController::cancelSearch);
         connect(_searchBar.data(), &Konsole::IncrementalSearchBar::searchReturnPressed, this, &Konsole::SessionController::findPreviousInHistory);
         connect(_searchBar.data(), &Konsole::IncrementalSearchBar::searchShiftPlusReturnPressed, this, &Konsole::SessionController::findNextInHistory);
     } else {
         disconnect(_searchBar.data(), &Konsole::IncrementalSearchBar::searchChanged, this,
                    &Konsole::SessionController::searchTextChanged);
+        disconnect(_searchBar.data(), &Konsole::IncrementalSearchBar::searchTextEdited, this,
+                   &Konsole::SessionController::cancelSearch);
         disconnect(_searchBar.data(), &Konsole::IncrementalSearchBar::searchReturnPressed, this,
                    &Konsole::SessionController::findPreviousInHistory);
         disconnect(_searchBar.data(), &Konsole::IncrementalSearchBar::searchShiftPlusReturnPressed, this,
                    &Konsole::SessionController::findNextInHistory);
+        cancelSearch();
+        _searchBar->clearMatchCount();
         if ((!_view.isNull()) && (_view->screenWindow() != nullptr)) {
             _view->screenWindow()->setCurrentResultLine(-1);
         }
@@ -1328,11 +1461,29 @@ void SessionController::searchCompleted(bool success)
     }
 }
 
+void SessionController::searchProgress(int currentMatch, int matchCount)
+{
+    if (!_searchBar.isNull()) {
+        _searchBar->setMatchCount(currentMatch, matchCount);
+    }
+}
+
+void SessionController::cancelSearch()
+{
+    if (!_searchTask.isNull()) {
+        _searchTask->cancel();
+        _searchTask.clear();
+    }
+}
+
 void SessionController::beginSearch(const QString& text, Enum::SearchDirection direction)
 {
     Q_ASSERT(_searchBar);
     Q_ASSERT(_searchFilter);
 
+    // a new search replaces the one still running
+    cancelSearch();
+
     QRegularExpression regExp = regexpFromSearchBarOptions();
     _searchFilter->setRegExp(regExp);
 
@@ -1347,8 +1498,10 @@ void SessionController::beginSearch(const QString& text, Enum::SearchDirection d
     if (!regExp.pattern().isEmpty()) {
         _view->screenWindow()->setCurrentResultLine(-1);
         auto task = new SearchHistoryTask(this);
+        _searchTask = task;
 
         connect(task, &Konsole::SearchHistoryTask::completed, this, &Konsole::SessionController::searchCompleted);
+        connect(task, &Konsole::SearchHistoryTask::searchProgress, this, &Konsole::SessionController::searchProgress);
 
         task->setRegExp(regExp);
         task->setSearchDirection(direction);
@@ -1358,6 +1511,7 @@ void SessionController::beginSearch(const QString& text, Enum::SearchDirection d
         task->execute();
     } else if (text.isEmpty()) {
         searchCompleted(false);
+        _searchBar->clearMatchCount();
     }
 
     _view->processFilters();
@@ -1808,18 +1962,202 @@ QList<SessionPtr> SessionTask::sessions() const
     return _sessions;
 }
 
+SaveHistoryThread::SaveHistoryThread(ScreenSnapshot *snapshot, TerminalCharacterDecoder *decoder, QObject *parent)
+    : QThread(parent)
+    , _snapshot(snapshot)
+    , _decoder(decoder)
+    , _fileName(QString())
+    , _errorString(QString())
+    , _firstLine(0)
+    , _lastLine(-1)
+    , _mutex()
+    , _dataAvailable()
+    , _dataTaken()
+    , _chunks(QQueue<QByteArray>())
+    , _finished(false)
+{
+}
+
+SaveHistoryThread::~SaveHistoryThread()
+{
+    delete _decoder;
+    delete _snapshot;
+}
+
+void SaveHistoryThread::setFileName(const QString &fileName)
+{
+    _fileName = fileName;
+}
+
+void SaveHistoryThread::setLineRange(int firstLine, int lastLine)
+{
+    _firstLine = firstLine;
+    _lastLine = lastLine;
+}
+
+int SaveHistoryThread::firstWrittenLine() const
+{
+    return qMax(_firstLine, 0);
+}
+
+int SaveHistoryThread::lastWrittenLine() const
+{
+    return _lastLine >= 0 ? qMin(_lastLine, _snapshot->getLines() - 1) : _snapshot->getLines() - 1;
+}
+
+int SaveHistoryThread::lineCount() const
+{
+    return qMax(lastWrittenLine() - firstWrittenLine() + 1, 0);
+}
+
+QByteArray SaveHistoryThread::takeData()
+{
+    QMutexLocker locker(&_mutex);
+
+    while (_chunks.isEmpty() && !_finished && !isInterruptionRequested()) {
+        _dataAvailable.wait(&_mutex);
+    }
+
+    if (_chunks.isEmpty() || isInterruptionRequested()) {
+        return QByteArray();
+    }
+
+    _dataTaken.wakeOne();
+    return _chunks.dequeue();
+}
+
+void SaveHistoryThread::cancel()
+{
+    requestInterruption();
+
+    QMutexLocker locker(&_mutex);
+    _dataAvailable.wakeAll();
+    _dataTaken.wakeAll();
+}
+
+QString SaveHistoryThread::errorString() const
+{
+    QMutexLocker locker(&_mutex);
+    return _errorString;
+}
+
+bool SaveHistoryThread::writeChunk(QSaveFile *file, const QByteArray &data)
+{
+    if (file != nullptr) {
+        return file->write(data) == data.size();
+    }
+
+    QMutexLocker locker(&_mutex);
+    while (_chunks.count() >= MAX_QUEUED_CHUNKS && !isInterruptionRequested()) {
+        _dataTaken.wait(&_mutex);
+    }
+    _chunks.enqueue(data);
+    _dataAvailable.wakeOne();
+    return true;
+}
+
+void SaveHistoryThread::run()
+{
+    QScopedPointer<QSaveFile> file;
+    if (!_fileName.isEmpty()) {
+        file.reset(new QSaveFile(_fileName));
+        if (!file->open(QIODevice::WriteOnly)) {
+            QMutexLocker locker(&_mutex);
+            _errorString = file->errorString();
+            return;
+        }
+    }
+
+    // the decoder writes into a buffer which is handed out, and replaced,
+    // whenever it holds a chunk of output
+    QBuffer buffer;
+    buffer.open(QIODevice::WriteOnly);
+    QTextStream stream(&buffer);
+    // JSON and asciicast files are UTF-8, the other formats follow suit
+    stream.setCodec("UTF-8");
+
+    const int firstLine = firstWrittenLine();
+    const int lastLine = lastWrittenLine();
+    const int lineCount = qMax(lastLine - firstLine + 1, 0);
+    bool ok = true;
+
+    _decoder->begin(&stream);
+    for (int line = firstLine; line <= lastLine && ok && !isInterruptionRequested(); line += LINES_PER_STEP) {
+        const int stepLastLine = qMin(line + LINES_PER_STEP - 1, lastLine);
+        _snapshot->writeLinesToStream(_decoder, line, stepLastLine);
+
+        stream.flush();
+        if (buffer.size() >= CHUNK_SIZE) {
+            ok = writeChunk(file.data(), buffer.data());
+            buffer.close();
+            buffer.setData(QByteArray());
+            buffer.open(QIODevice::WriteOnly);
+
+            emit saveProgress(stepLastLine - firstLine + 1, lineCount);
+        }
+    }
+    _decoder->end();
+    stream.flush();
+
+    if (ok && !isInterruptionRequested() && buffer.size() > 0) {
+        ok = writeChunk(file.data(), buffer.data());
+    }
+
+    if (file.isNull()) {
+        QMutexLocker locker(&_mutex);
+        _finished = true;
+        _dataAvailable.wakeAll();
+        return;
+    }
+
+    if (!ok || isInterruptionRequested() || !file->commit()) {
+        QMutexLocker locker(&_mutex);
+        if (!isInterruptionRequested()) {
+            _errorString = file->errorString();
+        }
+        file->cancelWriting();
+    }
+}
+
 SaveHistoryTask::SaveHistoryTask(QObject* parent)
     : SessionTask(parent)
+    , _saves(QHash<SaveHistoryThread *, SaveJob>())
+    , _firstLine(0)
+    , _lastLine(-1)
 {
 }
-SaveHistoryTask::~SaveHistoryTask() = default;
+
+SaveHistoryTask::~SaveHistoryTask()
+{
+    // running saves are stopped, the threads delete themselves once they have stopped
+    QHash<SaveHistoryThread *, SaveJob>::const_iterator iter = _saves.constBegin();
+    for (; iter != _saves.constEnd(); ++iter) {
+        disconnect(iter.key(), nullptr, this, nullptr);
+        connect(iter.key(), &QThread::finished, iter.key(), &QObject::deleteLater);
+        iter.key()->cancel();
+        if (iter.key()->isFinished()) {
+            iter.key()->deleteLater();
+        }
+
+        if (iter.value().job != nullptr) {
+            disconnect(iter.value().job, nullptr, this, nullptr);
+            iter.value().job->kill();
+        }
+        delete iter.value().progress;
+    }
+}
+
+void SaveHistoryTask::setLineRange(int firstLine, int lastLine)
+{
+    _firstLine = firstLine;
+    _lastLine = lastLine;
+}
 
 void SaveHistoryTask::execute()
 {
     // TODO - think about the UI when saving multiple history sessions, if there are more than two or
     //        three then providing a URL for each one will be tedious
 
-    // TODO - show a warning ( preferably passive ) if saving the history output fails
     QFileDialog* dialog = new QFileDialog(QApplication::activeWindow(),
             QString(),
             QDir::homePath());
@@ -1830,15 +2168,27 @@ void SaveHistoryTask::execute()
     mimeTypes << QStringLiteral("text/html");
     dialog->setMimeTypeFilters(mimeTypes);
 
+    const QString timestampsFilter = i18n("Plain text with timestamps (*.txt)");
+    const QString ansiFilter = i18n("Text with colors, for terminals (*.ans)");
+    const QString jsonLinesFilter = i18n("JSON lines with attributes (*.jsonl)");
+    const QString asciicastFilter = i18n("Asciicast recording (*.cast)");
+    dialog->setNameFilters(dialog->nameFilters() << timestampsFilter << ansiFilter
+                                                 << jsonLinesFilter << asciicastFilter);
+
     // iterate over each session in the task and display a dialog to allow the user to choose where
     // to save that session's history.
-    // then start a KIO job to transfer the data from the history to the chosen URL
+    // then start a thread writing a snapshot of the output to the chosen URL
     foreach(const SessionPtr& session, sessions()) {
         dialog->setWindowTitle(i18n("Save Output From %1", session->title(Session::NameRole)));
 
+        // the output is taken as it is now, new output does not disturb the
+        // save nor move the lines to save
+        ScreenSnapshot *snapshot = session->emulation()->createSnapshot();
+
         int result = dialog->exec();
 
         if (result != QDialog::Accepted) {
+            delete snapshot;
             continue;
         }
 
@@ -1847,89 +2197,165 @@ void SaveHistoryTask::execute()
         if (!url.isValid()) {
             // UI:  Can we make this friendlier?
             KMessageBox::sorry(nullptr , i18n("%1 is an invalid URL, the output could not be saved.", url.url()));
+            delete snapshot;
             continue;
         }
 
-        KIO::TransferJob* job = KIO::put(url,
-                                         -1,   // no special permissions
-                                         // overwrite existing files
-                                         // do not resume an existing transfer
-                                         // show progress information only for remote
-                                         // URLs
-                                         KIO::Overwrite | (url.isLocalFile() ? KIO::HideProgressInfo : KIO::DefaultFlags)
-                                         // a better solution would be to show progress
-                                         // information after a certain period of time
-                                         // instead, since the overall speed of transfer
-                                         // depends on factors other than just the protocol
-                                         // used
-                                        );
+        const QString nameFilter = dialog->selectedNameFilter();
+        const QString fileName = (dialog->selectedFiles()).at(0);
+
+        TerminalCharacterDecoder *decoder;
+        if ((nameFilter.contains(QLatin1String("html"), Qt::CaseInsensitive)) ||
+           (fileName.endsWith(QLatin1String("html"), Qt::CaseInsensitive))) {
+            decoder = new HTMLDecoder();
+        } else if (nameFilter == ansiFilter || fileName.endsWith(QLatin1String(".ans"), Qt::CaseInsensitive)) {
+            decoder = new AnsiDecoder();
+        } else if (nameFilter == jsonLinesFilter || fileName.endsWith(QLatin1String(".jsonl"), Qt::CaseInsensitive)) {
+            decoder = new JsonLinesDecoder();
+        } else if (nameFilter == asciicastFilter || fileName.endsWith(QLatin1String(".cast"), Qt::CaseInsensitive)) {
+            const QSize size = session->emulation()->imageSize();
+            decoder = new AsciicastDecoder(size.width(), size.height());
+        } else {
+            auto plainTextDecoder = new PlainTextDecoder();
+            plainTextDecoder->setWriteTimestamps(nameFilter == timestampsFilter);
+            decoder = plainTextDecoder;
+        }
+
+        auto thread = new SaveHistoryThread(snapshot, decoder);
+        thread->setLineRange(_firstLine, _lastLine);
 
         SaveJob jobInfo;
         jobInfo.session = session;
-        jobInfo.lastLineFetched = -1;  // when each request for data comes in from the KIO subsystem
-        // lastLineFetched is used to keep track of how much of the history
-        // has already been sent, and where the next request should continue
-        // from.
-        // this is set to -1 to indicate the job has just been started
-
-        if (((dialog->selectedNameFilter()).contains(QLatin1String("html"), Qt::CaseInsensitive)) ||
-           ((dialog->selectedFiles()).at(0).endsWith(QLatin1String("html"), Qt::CaseInsensitive))) {
-            jobInfo.decoder = new HTMLDecoder();
+        jobInfo.job = nullptr;
+
+        if (url.isLocalFile()) {
+            // local files are written by the thread itself
+            thread->setFileName(url.toLocalFile());
         } else {
-            jobInfo.decoder = new PlainTextDecoder();
+            // the thread encodes the output for the job to send
+            jobInfo.job = KIO::put(url,
+                                   -1,   // no special permissions
+                                   // overwrite existing files
+                                   // do not resume an existing transfer
+                                   // the progress dialog below is shown instead
+                                   KIO::Overwrite | KIO::HideProgressInfo);
+
+            connect(jobInfo.job, &KIO::TransferJob::dataReq, this, &Konsole::SaveHistoryTask::jobDataRequested);
+            connect(jobInfo.job, &KIO::TransferJob::result, this, &Konsole::SaveHistoryTask::jobResult);
         }
 
-        _jobSession.insert(job, jobInfo);
+        // only shown if saving takes a while
+        jobInfo.progress = new QProgressDialog(i18n("Saving output from %1...", session->title(Session::NameRole)),
+                                               i18n("Cancel"), 0, qMax(thread->lineCount(), 1),
+                                               QApplication::activeWindow());
+        jobInfo.progress->setWindowTitle(i18n("Save Output"));
+        jobInfo.progress->setMinimumDuration(500);
+        jobInfo.progress->setAutoClose(false);
+        jobInfo.progress->setAutoReset(false);
+        jobInfo.progress->setValue(0);
+
+        _saves.insert(thread, jobInfo);
 
-        connect(job, &KIO::TransferJob::dataReq, this, &Konsole::SaveHistoryTask::jobDataRequested);
-        connect(job, &KIO::TransferJob::result, this, &Konsole::SaveHistoryTask::jobResult);
+        connect(thread, &Konsole::SaveHistoryThread::saveProgress, this, &Konsole::SaveHistoryTask::saveProgress);
+        connect(thread, &QThread::finished, this, &Konsole::SaveHistoryTask::threadFinished);
+        connect(jobInfo.progress, &QProgressDialog::canceled, this, &Konsole::SaveHistoryTask::saveCancelled);
+
+        thread->start(QThread::LowPriority);
     }
 
     dialog->deleteLater();
+
+    // nothing to save
+    if (_saves.isEmpty()) {
+        emit completed(false);
+
+        if (autoDelete()) {
+            deleteLater();
+        }
+    }
 }
+
 void SaveHistoryTask::jobDataRequested(KIO::Job* job , QByteArray& data)
 {
-    // TODO - Report progress information for the job
-
-    // PERFORMANCE:  Do some tests and tweak this value to get faster saving
-    const int LINES_PER_REQUEST = 500;
-
-    SaveJob& info = _jobSession[job];
+    QHash<SaveHistoryThread *, SaveJob>::const_iterator iter = _saves.constBegin();
+    for (; iter != _saves.constEnd(); ++iter) {
+        if (iter.value().job == job) {
+            // the thread keeps a few chunks ahead of the job, this rarely waits.
+            // an empty chunk ends the transfer
+            data = iter.key()->takeData();
+            return;
+        }
+    }
+}
 
-    // transfer LINES_PER_REQUEST lines from the session's history
-    // to the save location
-    if (!info.session.isNull()) {
-        // note:  when retrieving lines from the emulation,
-        // the first line is at index 0.
+void SaveHistoryTask::jobResult(KJob* job)
+{
+    QHash<SaveHistoryThread *, SaveJob>::const_iterator iter = _saves.constBegin();
+    for (; iter != _saves.constEnd(); ++iter) {
+        if (iter.value().job == job) {
+            finishSave(iter.key(), job->error() != 0 && job->error() != KJob::KilledJobError
+                                   ? job->errorString() : QString());
+            return;
+        }
+    }
+}
 
-        int sessionLines = info.session->emulation()->lineCount();
+void SaveHistoryTask::threadFinished()
+{
+    SaveHistoryThread *thread = qobject_cast<SaveHistoryThread *>(sender());
 
-        if (sessionLines - 1 == info.lastLineFetched) {
-            return; // if there is no more data to transfer then stop the job
-        }
+    // saves to remote URLs finish with their job
+    if (_saves.contains(thread) && _saves[thread].job == nullptr) {
+        finishSave(thread, thread->errorString());
+    }
+}
 
-        int copyUpToLine = qMin(info.lastLineFetched + LINES_PER_REQUEST ,
-                                sessionLines - 1);
+void SaveHistoryTask::saveProgress(int linesWritten, int lineCount)
+{
+    SaveHistoryThread *thread = qobject_cast<SaveHistoryThread *>(sender());
 
-        QTextStream stream(&data, QIODevice::ReadWrite);
-        info.decoder->begin(&stream);
-        info.session->emulation()->writeToStream(info.decoder , info.lastLineFetched + 1 , copyUpToLine);
-        info.decoder->end();
+    if (_saves.contains(thread)) {
+        QProgressDialog *progress = _saves[thread].progress;
+        progress->setMaximum(qMax(lineCount, 1));
+        progress->setValue(linesWritten);
+    }
+}
 
-        info.lastLineFetched = copyUpToLine;
+void SaveHistoryTask::saveCancelled()
+{
+    QHash<SaveHistoryThread *, SaveJob>::const_iterator iter = _saves.constBegin();
+    for (; iter != _saves.constEnd(); ++iter) {
+        if (iter.value().progress == sender()) {
+            iter.key()->cancel();
+            if (iter.value().job != nullptr) {
+                iter.value().job->kill(KJob::EmitResult);
+            }
+            return;
+        }
     }
 }
-void SaveHistoryTask::jobResult(KJob* job)
+
+void SaveHistoryTask::finishSave(SaveHistoryThread *thread, const QString &errorString)
 {
-    if (job->error() != 0) {
-        KMessageBox::sorry(nullptr , i18n("A problem occurred when saving the output.\n%1", job->errorString()));
+    const SaveJob jobInfo = _saves.take(thread);
+
+    // the thread may still be encoding output nobody takes any more
+    disconnect(thread, nullptr, this, nullptr);
+    connect(thread, &QThread::finished, thread, &QObject::deleteLater);
+    thread->cancel();
+    if (thread->isFinished()) {
+        thread->deleteLater();
     }
 
-    TerminalCharacterDecoder * decoder = _jobSession[job].decoder;
+    jobInfo.progress->deleteLater();
 
-    _jobSession.remove(job);
+    if (!errorString.isEmpty()) {
+        KMessageBox::sorry(nullptr , i18n("A problem occurred when saving the output.\n%1", errorString));
+    }
 
-    delete decoder;
+    if (!_saves.isEmpty()) {
+        return;
+    }
 
     // notify the world that the task is done
     emit completed(true);
@@ -1944,12 +2370,23 @@ void SearchHistoryTask::addScreenWindow(Session* session , ScreenWindow* searchW
 }
 void SearchHistoryTask::execute()
 {
+    _foundMatch = false;
+
     QMapIterator< SessionPtr , ScreenWindowPtr > iter(_windows);
 
     while (iter.hasNext()) {
         iter.next();
         executeOnScreenWindow(iter.key() , iter.value());
     }
+
+    // nothing to search for
+    if (_threads.isEmpty()) {
+        emit completed(false);
+
+        if (autoDelete()) {
+            deleteLater();
+        }
+    }
 }
 
 void SearchHistoryTask::executeOnScreenWindow(SessionPtr session , ScreenWindowPtr window)
@@ -1957,123 +2394,92 @@ void SearchHistoryTask::executeOnScreenWindow(SessionPtr session , ScreenWindowP
     Q_ASSERT(session);
     Q_ASSERT(window);
 
-    Emulation* emulation = session->emulation();
+    if (_regExp.pattern().isEmpty()) {
+        return;
+    }
 
-    if (!_regExp.pattern().isEmpty()) {
-        int pos = -1;
-        const bool forwards = (_direction == Enum::ForwardsSearch);
-        const int lastLine = window->lineCount() - 1;
+    Emulation *emulation = session->emulation();
 
-        int startLine;
-        if (forwards && (_startLine == lastLine)) {
-            startLine = 0;
-        } else if (!forwards && (_startLine == 0)) {
-            startLine = lastLine;
-        } else {
-            startLine = _startLine + (forwards ? 1 : -1);
-        }
+    // the search runs on a snapshot, new output does not disturb it.  the
+    // candidates from the history index are looked up at the same time
+    QVector<QPair<int, int> > candidateLines;
+    const bool hasCandidateLines = emulation->findHistoryCandidates(_regExp, candidateLines);
 
-        QString string;
-
-        //text stream to read history into string for pattern or regular expression searching
-        QTextStream searchStream(&string);
-
-        PlainTextDecoder decoder;
-        decoder.setRecordLinePositions(true);
-
-        //setup first and last lines depending on search direction
-        int line = startLine;
-
-        //read through and search history in blocks of 10K lines.
-        //this balances the need to retrieve lots of data from the history each time
-        //(for efficient searching)
-        //without using silly amounts of memory if the history is very large.
-        const int maxDelta = qMin(window->lineCount(), 10000);
-        int delta = forwards ? maxDelta : -maxDelta;
-
-        int endLine = line;
-        bool hasWrapped = false;  // set to true when we reach the top/bottom
-        // of the output and continue from the other
-        // end
-
-        //loop through history in blocks of <delta> lines.
-        do {
-            // ensure that application does not appear to hang
-            // if searching through a lengthy output
-            QApplication::processEvents();
-
-            // calculate lines to search in this iteration
-            if (hasWrapped) {
-                if (endLine == lastLine) {
-                    line = 0;
-                } else if (endLine == 0) {
-                    line = lastLine;
-                }
-
-                endLine += delta;
-
-                if (forwards) {
-                    endLine = qMin(startLine , endLine);
-                } else {
-                    endLine = qMax(startLine , endLine);
-                }
-            } else {
-                endLine += delta;
-
-                if (endLine > lastLine) {
-                    hasWrapped = true;
-                    endLine = lastLine;
-                } else if (endLine < 0) {
-                    hasWrapped = true;
-                    endLine = 0;
-                }
-            }
+    auto thread = new SearchHistoryThread(emulation->createSnapshot(), _regExp, _direction, _startLine);
+    if (hasCandidateLines) {
+        thread->setCandidateLines(candidateLines);
+    }
+    _threads.insert(thread, window);
 
-            decoder.begin(&searchStream);
-            emulation->writeToStream(&decoder, qMin(endLine, line) , qMax(endLine, line));
-            decoder.end();
+    connect(thread, &Konsole::SearchHistoryThread::matchFound, this, &Konsole::SearchHistoryTask::threadMatchFound);
+    connect(thread, &Konsole::SearchHistoryThread::searchProgress, this, &Konsole::SearchHistoryTask::searchProgress);
+    connect(thread, &Konsole::SearchHistoryThread::searchFinished, this, &Konsole::SearchHistoryTask::threadSearchFinished);
+    connect(thread, &QThread::finished, thread, &QObject::deleteLater);
 
-            // line number search below assumes that the buffer ends with a new-line
-            string.append(QLatin1Char('\n'));
+    thread->start(QThread::LowPriority);
+}
 
-            if (forwards) {
-                pos = string.indexOf(_regExp);
-            } else {
-                pos = string.lastIndexOf(_regExp);
-            }
+void SearchHistoryTask::threadMatchFound(int line)
+{
+    SearchHistoryThread *thread = qobject_cast<SearchHistoryThread *>(sender());
+    const ScreenWindowPtr window = _threads.value(thread);
 
-            //if a match is found, position the cursor on that line and update the screen
-            if (pos != -1) {
-                int newLines = 0;
-                QList<int> linePositions = decoder.linePositions();
-                while (newLines < linePositions.count() && linePositions[newLines] <= pos) {
-                    newLines++;
-                }
+    if (!window.isNull()) {
+        highlightResult(window, line);
+    }
 
-                // ignore the new line at the start of the buffer
-                newLines--;
+    if (!_foundMatch) {
+        _foundMatch = true;
+        emit completed(true);
+    }
+}
 
-                int findPos = qMin(line, endLine) + newLines;
+void SearchHistoryTask::threadSearchFinished(int currentMatch, int matchCount)
+{
+    SearchHistoryThread *thread = qobject_cast<SearchHistoryThread *>(sender());
+    const ScreenWindowPtr window = _threads.value(thread);
 
-                highlightResult(window, findPos);
+    emit searchProgress(currentMatch, matchCount);
 
-                emit completed(true);
+    // if no match was found, clear selection to indicate this
+    if (matchCount == 0 && !window.isNull()) {
+        window->clearSelection();
+        window->notifyOutputChanged();
+    }
 
-                return;
-            }
+    threadDone(thread);
+}
 
-            //clear the current block of text and move to the next one
-            string.clear();
-            line = endLine;
-        } while (startLine != endLine);
+void SearchHistoryTask::threadDone(SearchHistoryThread *thread)
+{
+    _threads.remove(thread);
 
-        // if no match was found, clear selection to indicate this
-        window->clearSelection();
-        window->notifyOutputChanged();
+    if (!_threads.isEmpty()) {
+        return;
+    }
+
+    if (!_foundMatch) {
+        emit completed(false);
+    }
+
+    if (autoDelete()) {
+        deleteLater();
+    }
+}
+
+void SearchHistoryTask::cancel()
+{
+    foreach (SearchHistoryThread *thread, _threads.keys()) {
+        disconnect(thread, nullptr, this, nullptr);
+        thread->requestInterruption();
     }
+    _threads.clear();
 
-    emit completed(false);
+    if (autoDelete()) {
+        deleteLater();
+    }
 }
+
 void SearchHistoryTask::highlightResult(ScreenWindowPtr window , int findPos)
 {
     //work out how many lines into the current block of text the search result was found
@@ -2101,8 +2507,18 @@ SearchHistoryTask::SearchHistoryTask(QObject* parent)
     : SessionTask(parent)
     , _direction(Enum::BackwardsSearch)
     , _startLine(0)
+    , _foundMatch(false)
 {
 }
+
+SearchHistoryTask::~SearchHistoryTask()
+{
+    // running threads delete themselves once they have stopped
+    foreach (SearchHistoryThread *thread, _threads.keys()) {
+        disconnect(thread, nullptr, this, nullptr);
+        thread->requestInterruption();
+    }
+}
 void SearchHistoryTask::setSearchDirection(Enum::SearchDirection direction)
 {
     _direction = direction;
@@ -2124,6 +2540,222 @@ QRegularExpression SearchHistoryTask::regExp() const
     return _regExp;
 }
 
+SearchHistoryThread::SearchHistoryThread(ScreenSnapshot *snapshot, const QRegularExpression &regExp,
+                                         Enum::SearchDirection direction, int startLine, QObject *parent)
+    : QThread(parent)
+    , _snapshot(snapshot)
+    , _regExp(regExp)
+    , _direction(direction)
+    , _startLine(startLine)
+    , _candidateLines(QVector<QPair<int, int> >())
+    , _hasCandidateLines(false)
+{
+}
+
+void SearchHistoryThread::setCandidateLines(const QVector<QPair<int, int> > &lines)
+{
+    _candidateLines = lines;
+    _hasCandidateLines = true;
+}
+
+SearchHistoryThread::~SearchHistoryThread()
+{
+    delete _snapshot;
+}
+
+void SearchHistoryThread::run()
+{
+    const bool forwards = (_direction == Enum::ForwardsSearch);
+    const int lastLine = _snapshot->getLines() - 1;
+
+    // the search starts on the line after (or before) the start line,
+    // which is the line of the previous match
+    int startLine;
+    if (forwards && (_startLine >= lastLine)) {
+        startLine = 0;
+    } else if (!forwards && (_startLine <= 0)) {
+        startLine = lastLine;
+    } else {
+        startLine = _startLine + (forwards ? 1 : -1);
+    }
+    startLine = qBound(0, startLine, qMax(lastLine, 0));
+
+    // the lines to search, as sorted ranges which do not overlap.  with
+    // the history index only the candidates in the history are searched,
+    // together with the lines they wrap into, and the whole screen.  The
+    // index only holds the text of the history, the screen is searched from
+    // the start of the logical line the history ends in
+    QVector<QPair<int, int> > ranges;
+    if (_hasCandidateLines) {
+        QVector<QPair<int, int> > lines = _candidateLines;
+        const int histLines = _snapshot->getHistLines();
+        int screenFirst = histLines;
+        if (histLines <= lastLine) {
+            int screenLast = 0;
+            _snapshot->getLogicalLineRange(histLines, screenFirst, screenLast);
+        }
+        lines << qMakePair(screenFirst, lastLine);
+        // that line may start before the last candidates
+        std::sort(lines.begin(), lines.end());
+
+        for (int i = 0; i < lines.count(); i++) {
+            int last = qMin(lines[i].second, lastLine);
+            if (last >= 0) {
+                int first = 0;
+                _snapshot->getLogicalLineRange(last, first, last);
+            }
+
+            if (!ranges.isEmpty() && lines[i].first <= ranges.last().second + 1) {
+                ranges.last().second = qMax(ranges.last().second, last);
+            } else if (lines[i].first <= last) {
+                ranges << qMakePair(lines[i].first, last);
+            }
+        }
+    } else if (lastLine >= 0) {
+        ranges << qMakePair(0, lastLine);
+    }
+
+    // order the ranges in the search direction: from the start line to the
+    // bottom or top of the output, and then from the other end back to the
+    // start line
+    const int split = forwards ? startLine : startLine + 1;
+    QVector<QPair<int, int> > lower;
+    QVector<QPair<int, int> > upper;
+    for (int i = 0; i < ranges.count(); i++) {
+        if (ranges[i].second < split) {
+            lower << ranges[i];
+        } else if (ranges[i].first >= split) {
+            upper << ranges[i];
+        } else {
+            lower << qMakePair(ranges[i].first, split - 1);
+            upper << qMakePair(split, ranges[i].second);
+        }
+    }
+
+    QVector<QPair<int, int> > ordered;
+    if (forwards) {
+        ordered << upper << lower;
+    } else {
+        for (int i = lower.count() - 1; i >= 0; i--) {
+            ordered << lower[i];
+        }
+        for (int i = upper.count() - 1; i >= 0; i--) {
+            ordered << upper[i];
+        }
+    }
+
+    // split them into blocks of at most BLOCK_SIZE lines.  the lines of a
+    // block are decoded in ascending order within each range, so the first
+    // match in the search direction is the first match of a block when
+    // searching forwards and the last one when searching backwards
+    QList<QVector<QPair<int, int> > > blocks;
+    QVector<QPair<int, int> > block;
+    int blockLines = 0;
+    for (int i = 0; i < ordered.count(); i++) {
+        int first = ordered[i].first;
+        int last = ordered[i].second;
+
+        while (first <= last) {
+            const int count = qMin(BLOCK_SIZE - blockLines, last - first + 1);
+            if (forwards) {
+                block << qMakePair(first, first + count - 1);
+                first += count;
+            } else {
+                block.prepend(qMakePair(last - count + 1, last));
+                last -= count;
+            }
+
+            blockLines += count;
+            if (blockLines == BLOCK_SIZE) {
+                blocks << block;
+                block.clear();
+                blockLines = 0;
+            }
+        }
+    }
+    if (!block.isEmpty()) {
+        blocks << block;
+    }
+
+    QString string;
+    QTextStream searchStream(&string);
+
+    PlainTextDecoder decoder;
+    decoder.setRecordLinePositions(true);
+
+    // the current match, and the number of matches above it
+    int currentLine = -1;
+    int currentColumn = -1;
+    int matchesBefore = 0;
+    int matchCount = 0;
+
+    for (int i = 0; i < blocks.count(); i++) {
+        if (isInterruptionRequested()) {
+            return;
+        }
+
+        // the line decoded at each line position
+        QVector<int> blockLineNumbers;
+
+        string.clear();
+        decoder.begin(&searchStream);
+        for (int j = 0; j < blocks[i].count(); j++) {
+            _snapshot->writeLinesToStream(&decoder, blocks[i][j].first, blocks[i][j].second);
+            for (int line = blocks[i][j].first; line <= blocks[i][j].second; line++) {
+                blockLineNumbers << line;
+            }
+        }
+        decoder.end();
+
+        // there is exactly one line position per line, see ScreenSnapshot
+        const QList<int> linePositions = decoder.linePositions();
+
+        QVector<int> lines;
+        QVector<int> columns;
+        QRegularExpressionMatchIterator iter = _regExp.globalMatch(string);
+        while (iter.hasNext()) {
+            const QRegularExpressionMatch match = iter.next();
+            // patterns matching the empty string would match everywhere
+            if (match.capturedLength() == 0) {
+                continue;
+            }
+
+            const int pos = match.capturedStart();
+            const int index = std::upper_bound(linePositions.constBegin(), linePositions.constEnd(), pos)
+                              - linePositions.constBegin() - 1;
+            lines << blockLineNumbers[index];
+            columns << pos - linePositions[index];
+        }
+
+        if (lines.isEmpty()) {
+            emit searchProgress(currentLine == -1 ? 0 : matchesBefore + 1, matchCount);
+            continue;
+        }
+
+        // blocks are searched in the search direction, the current
+        // match is in the first block with matches
+        if (currentLine == -1) {
+            const int current = forwards ? 0 : lines.count() - 1;
+            currentLine = lines[current];
+            currentColumn = columns[current];
+            emit matchFound(currentLine);
+        }
+
+        for (int j = 0; j < lines.count(); j++) {
+            if (lines[j] < currentLine || (lines[j] == currentLine && columns[j] < currentColumn)) {
+                matchesBefore++;
+            }
+        }
+        matchCount += lines.count();
+
+        emit searchProgress(matchesBefore + 1, matchCount);
+    }
+
+    if (!isInterruptionRequested()) {
+        emit searchFinished(currentLine == -1 ? 0 : matchesBefore + 1, matchCount);
+    }
+}
+
 QString SessionController::userTitle() const
 {
     if (!_session.isNull()) {
@@ -28,6 +28,10 @@
 #include <QString>
 #include <QHash>
 #include <QRegularExpression>
+#include <QThread>
+#include <QMutex>
+#include <QQueue>
+#include <QWaitCondition>
 
 // KDE
 #include <KXMLGUIClient>
@@ -39,9 +43,12 @@
 
 namespace KIO {
 class Job;
+class TransferJob;
 }
 
 class QAction;
+class QProgressDialog;
+class QSaveFile;
 class QTextCodec;
 class QKeyEvent;
 class QTimer;
@@ -67,6 +74,10 @@ class EditProfileDialog;
 // SaveHistoryTask
 class TerminalCharacterDecoder;
 
+// SearchHistoryTask
+class ScreenSnapshot;
+class SearchHistoryTask;
+
 typedef QPointer<Session> SessionPtr;
 
 /**
@@ -239,6 +250,10 @@ private Q_SLOTS:
     void paste();
     void selectAll();
     void selectLine();
+    void scrollToPreviousPrompt();
+    void scrollToNextPrompt();
+    void selectCommandOutput();
+    void saveCommandOutput();
     void pasteFromX11Selection(); // shortcut only
     void copyInputActionsTriggered(QAction *action);
     void copyInputToAllTabs();
@@ -278,6 +293,8 @@ private Q_SLOTS:
     void sessionReadOnlyChanged();
     void searchTextChanged(const QString &text);
     void searchCompleted(bool success);
+    void searchProgress(int currentMatch, int matchCount);
+    void cancelSearch(); // stops the search which is still running, if any
     void searchClosed(); // called when the user clicks on the
     // history search bar's close button
 
@@ -349,6 +366,7 @@ private:
     int _searchStartLine;
     int _prevSearchResultLine;
     QPointer<IncrementalSearchBar> _searchBar;
+    QPointer<SearchHistoryTask> _searchTask;
 
     KCodecAction *_codecAction;
 
@@ -433,9 +451,94 @@ private:
     QList< SessionPtr > _sessions;
 };
 
+/**
+ * Writes a snapshot of the output of a session with a decoder in a separate
+ * thread, so that the UI stays responsive while saving very large output logs.
+ * Used by SaveHistoryTask.
+ *
+ * The output is either written to a local file, see setFileName(), or handed
+ * out in chunks of about CHUNK_SIZE bytes with takeData(), for a KIO job to
+ * send it to a remote location.  The thread encodes a few chunks ahead of the
+ * ones taken.
+ *
+ * Use cancel() to stop writing, a partially written file is removed.  The
+ * thread deletes the snapshot and the decoder when it is deleted itself.
+ */
+class SaveHistoryThread : public QThread
+{
+    Q_OBJECT
+
+public:
+    /**
+     * Constructs a thread which writes @p snapshot with @p decoder, taking
+     * ownership of both.
+     */
+    SaveHistoryThread(ScreenSnapshot *snapshot, TerminalCharacterDecoder *decoder, QObject *parent = nullptr);
+    ~SaveHistoryThread() Q_DECL_OVERRIDE;
+
+    /** Writes the output to the local file @p fileName, instead of handing it out with takeData() */
+    void setFileName(const QString &fileName);
+
+    /** Writes only lines @p firstLine to @p lastLine of the snapshot, rather than all of them */
+    void setLineRange(int firstLine, int lastLine);
+    /** Returns the number of lines which are written, see setLineRange() */
+    int lineCount() const;
+
+    /**
+     * Returns the next chunk of output, waiting until it has been encoded if
+     * needed.  Returns an empty array once all output has been taken or the
+     * thread has been cancelled.
+     */
+    QByteArray takeData();
+
+    /** Stops writing the output, and wakes up a thread waiting in takeData() */
+    void cancel();
+
+    /** Returns the reason why the output could not be written to the file, or an empty string */
+    QString errorString() const;
+
+Q_SIGNALS:
+    /** Emitted after each chunk of output, when @p linesWritten of @p lineCount lines have been written */
+    void saveProgress(int linesWritten, int lineCount);
+
+protected:
+    void run() Q_DECL_OVERRIDE;
+
+private:
+    Q_DISABLE_COPY(SaveHistoryThread)
+
+    bool writeChunk(QSaveFile *file, const QByteArray &data);
+    int firstWrittenLine() const;
+    int lastWrittenLine() const;
+
+    ScreenSnapshot *_snapshot;
+    TerminalCharacterDecoder *_decoder;
+    QString _fileName;
+    QString _errorString;
+    int _firstLine;
+    int _lastLine;
+
+    // chunks waiting for takeData(), guarded by _mutex
+    mutable QMutex _mutex;
+    QWaitCondition _dataAvailable;
+    QWaitCondition _dataTaken;
+    QQueue<QByteArray> _chunks;
+    bool _finished;
+
+    // size of the chunks of output handed out or written at once
+    static const int CHUNK_SIZE = 1024 * 1024;
+    // number of chunks encoded ahead of takeData()
+    static const int MAX_QUEUED_CHUNKS = 4;
+    // number of lines decoded between checks of the chunk size
+    static const int LINES_PER_STEP = 256;
+};
+
 /**
  * A task which prompts for a URL for each session and saves that session's output
  * to the given URL
+ *
+ * The output is written from a snapshot in a SaveHistoryThread.  A progress
+ * dialog, which allows cancelling the save, is shown when saving takes a while.
  */
 class SaveHistoryTask : public SessionTask
 {
@@ -454,40 +557,119 @@ public:
      */
     void execute() Q_DECL_OVERRIDE;
 
+    /**
+     * Saves only lines @p firstLine to @p lastLine of the output, counted
+     * like the lines of the screen, as they are when execute() is called.
+     */
+    void setLineRange(int firstLine, int lastLine);
+
 private Q_SLOTS:
     void jobDataRequested(KIO::Job *job, QByteArray &data);
     void jobResult(KJob *job);
+    void threadFinished();
+    void saveProgress(int linesWritten, int lineCount);
+    void saveCancelled();
 
 private:
-    class SaveJob // structure to keep information needed to process
-        // incoming data requests from jobs
+    class SaveJob // structure to keep information about a save in progress
     {
     public:
         SessionPtr session; // the session associated with a history save job
-        int lastLineFetched; // the last line processed in the previous data request
-        // set this to -1 at the start of the save job
-
-        TerminalCharacterDecoder *decoder;  // decoder used to convert terminal characters
-        // into output
+        KIO::TransferJob *job; // the job sending the output to a remote URL, or null
+        QProgressDialog *progress;
     };
 
-    QHash<KJob *, SaveJob> _jobSession;
+    void finishSave(SaveHistoryThread *thread, const QString &errorString);
+
+    QHash<SaveHistoryThread *, SaveJob> _saves;
+    int _firstLine;
+    int _lastLine;
+};
+
+/**
+ * Searches a snapshot of the output for matches for a regular expression in
+ * a separate thread, so that the UI stays responsive while searching very
+ * large output logs.  Used by SearchHistoryTask.
+ *
+ * The search starts at a line and goes on in one direction, wrapping around
+ * at the top or bottom of the output, until all lines have been searched.
+ * The first match found is the current match, further matches are counted
+ * and reported while the search goes on.  Matches are numbered from the top
+ * of the output.
+ *
+ * Use requestInterruption() to stop the search, no signals are emitted once
+ * the search has been interrupted.  The thread deletes the snapshot when it
+ * is deleted itself.
+ */
+class SearchHistoryThread : public QThread
+{
+    Q_OBJECT
+
+public:
+    /**
+     * Constructs a thread which searches @p snapshot, taking ownership of it.
+     * @p startLine is the first line searched.
+     */
+    SearchHistoryThread(ScreenSnapshot *snapshot, const QRegularExpression &regExp,
+                        Enum::SearchDirection direction, int startLine, QObject *parent = nullptr);
+    ~SearchHistoryThread() Q_DECL_OVERRIDE;
+
+    /**
+     * Restricts the search of the history to the ranges of lines in @p lines,
+     * found with the history index, and the lines they wrap into.  The lines of
+     * the screen image are always searched.  See Emulation::findHistoryCandidates()
+     */
+    void setCandidateLines(const QVector<QPair<int, int> > &lines);
+
+Q_SIGNALS:
+    /** Emitted once when the current match has been found, on line @p line. */
+    void matchFound(int line);
+
+    /**
+     * Emitted after each block of lines has been searched.
+     *
+     * @param currentMatch The number of the current match, counting from the top
+     * of the output, or 0 if no match has been found yet.
+     * @param matchCount The number of matches found so far.
+     */
+    void searchProgress(int currentMatch, int matchCount);
+
+    /**
+     * Emitted when all lines have been searched.
+     * The parameters are the final values of those of searchProgress().
+     */
+    void searchFinished(int currentMatch, int matchCount);
+
+protected:
+    void run() Q_DECL_OVERRIDE;
+
+private:
+    Q_DISABLE_COPY(SearchHistoryThread)
+
+    ScreenSnapshot *_snapshot;
+    QRegularExpression _regExp;
+    Enum::SearchDirection _direction;
+    int _startLine;
+    QVector<QPair<int, int> > _candidateLines;
+    bool _hasCandidateLines;
+
+    // number of lines decoded and searched at once
+    static const int BLOCK_SIZE = 10000;
 };
 
-//class SearchHistoryThread;
 /**
  * A task which searches through the output of sessions for matches for a given regular expression.
  * SearchHistoryTask operates on ScreenWindow instances rather than sessions added by addSession().
  * A screen window can be added to the list to search using addScreenWindow()
  *
  * When execute() is called, the search begins in the direction specified by searchDirection(),
- * starting at the position of the current selection.
+ * starting at the position of the current selection.  The search runs on a snapshot of
+ * the output in a SearchHistoryThread: completed() is emitted as soon as the first match has
+ * been found, while the remaining output is searched to count the matches.  The search
+ * can be stopped at any time with cancel().
  *
  * FIXME - This is not a proper implementation of SessionTask, in that it ignores sessions specified
  * with addSession()
- *
- * TODO - Implementation requirements:
- *          May provide progress feedback to the user when searching very large output logs.
  */
 class SearchHistoryTask : public SessionTask
 {
@@ -498,6 +680,7 @@ public:
      * Constructs a new search task.
      */
     explicit SearchHistoryTask(QObject *parent = nullptr);
+    ~SearchHistoryTask() Q_DECL_OVERRIDE;
 
     /** Adds a screen window to the list to search when execute() is called. */
     void addScreenWindow(Session *session, ScreenWindow *searchWindow);
@@ -516,29 +699,50 @@ public:
     void setStartLine(int line);
 
     /**
-     * Performs a search through the session's history, starting at the position
+     * Starts a search through the session's history, starting at the position
      * of the current selection, in the direction specified by setSearchDirection().
      *
      * If it finds a match, the ScreenWindow specified in the constructor is
      * scrolled to the position where the match occurred and the selection
-     * is set to the matching text.  execute() then returns immediately.
+     * is set to the matching text.  The search is performed asynchronously,
+     * execute() returns immediately.
      *
      * To continue the search looking for further matches, call execute() again.
      */
     void execute() Q_DECL_OVERRIDE;
 
+    /**
+     * Stops the search.  No further signals are emitted by the task, which
+     * deletes itself if autoDelete() is set.
+     */
+    void cancel();
+
+Q_SIGNALS:
+    /**
+     * Emitted while the search is running and when it has finished.
+     * See SearchHistoryThread::searchProgress()
+     */
+    void searchProgress(int currentMatch, int matchCount);
+
+private Q_SLOTS:
+    void threadMatchFound(int line);
+    void threadSearchFinished(int currentMatch, int matchCount);
+
 private:
     typedef QPointer<ScreenWindow> ScreenWindowPtr;
 
     void executeOnScreenWindow(SessionPtr session, ScreenWindowPtr window);
     void highlightResult(ScreenWindowPtr window, int position);
+    void threadDone(SearchHistoryThread *thread);
 
     QMap< SessionPtr, ScreenWindowPtr > _windows;
     QRegularExpression _regExp;
     Enum::SearchDirection _direction;
     int _startLine;
 
-    //static QPointer<SearchHistoryThread> _thread;
+    // the window searched by each running thread
+    QHash<SearchHistoryThread *, ScreenWindowPtr> _threads;
+    bool _foundMatch;
 };
 }
 
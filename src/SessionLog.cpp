@@ -0,0 +1,393 @@
+/*
+    This file is part of Konsole, a terminal emulator for KDE.
+
+    Copyright 2018 by The Konsole Developers
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+// Own
+#include "SessionLog.h"
+
+// Qt
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QTextCodec>
+#include <QTextDecoder>
+
+// KDE
+#include <KCompressionDevice>
+
+// System
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// Konsole
+#include "konsoledebug.h"
+
+using namespace Konsole;
+
+SessionLog::SessionLog(const QString &fileName, Format format, bool compressed, QObject *parent) :
+    QThread(parent),
+    _fileName(fileName),
+    _format(format),
+    _compressed(compressed),
+    _mutex(),
+    _dataAvailable(),
+    _queue(QByteArray()),
+    _queueDropped(0),
+    _droppedBytes(0),
+    _maxFileSize(0),
+    _maxParts(0),
+    _codec(nullptr),
+    _errorString(QString()),
+    _file(nullptr),
+    _device(nullptr),
+    _part(1),
+    _firstPart(1),
+    _decoderCodec(nullptr),
+    _decoder(nullptr),
+    _filterState(NormalText)
+{
+}
+
+SessionLog::~SessionLog()
+{
+    stop();
+    wait();
+
+    delete _decoder;
+}
+
+QString SessionLog::logFileName(const QString &directory, const QString &sessionName, int sessionId)
+{
+    QString name = sessionName;
+    name.replace(QLatin1Char('/'), QLatin1Char('_'));
+
+    return QStringLiteral("%1/%2-%3-%4-%5.log").arg(directory, name,
+                                                    QDateTime::currentDateTime().toString(QStringLiteral("yyyyMMdd-hhmmss")),
+                                                    QString::number(QCoreApplication::applicationPid()),
+                                                    QString::number(sessionId));
+}
+
+QString SessionLog::fileName() const
+{
+    return _fileName;
+}
+
+SessionLog::Format SessionLog::format() const
+{
+    return _format;
+}
+
+bool SessionLog::isCompressed() const
+{
+    return _compressed;
+}
+
+void SessionLog::setMaxFileSize(qint64 maxFileSize)
+{
+    QMutexLocker locker(&_mutex);
+    _maxFileSize = maxFileSize;
+}
+
+void SessionLog::setMaxParts(int maxParts)
+{
+    QMutexLocker locker(&_mutex);
+    _maxParts = maxParts;
+}
+
+void SessionLog::setCodec(const QTextCodec *codec)
+{
+    QMutexLocker locker(&_mutex);
+    _codec = codec;
+}
+
+void SessionLog::write(const char *data, int length)
+{
+    QMutexLocker locker(&_mutex);
+
+    if (!_errorString.isEmpty()) {
+        return;
+    }
+
+    // once output has been dropped, all of it is dropped until the queue has
+    // been written, so that the note about it ends up in the right place
+    if (_queueDropped > 0 || _queue.size() + length > MAX_QUEUED_BYTES) {
+        _queueDropped += length;
+        _droppedBytes += length;
+        return;
+    }
+
+    _queue.append(data, length);
+
+    if (_queue.size() >= WRITE_THRESHOLD && _queue.size() - length < WRITE_THRESHOLD) {
+        _dataAvailable.wakeOne();
+    }
+}
+
+void SessionLog::stop()
+{
+    requestInterruption();
+
+    QMutexLocker locker(&_mutex);
+    _dataAvailable.wakeAll();
+}
+
+qint64 SessionLog::droppedBytes() const
+{
+    QMutexLocker locker(&_mutex);
+    return _droppedBytes;
+}
+
+QString SessionLog::errorString() const
+{
+    QMutexLocker locker(&_mutex);
+    return _errorString;
+}
+
+QString SessionLog::partFileName(int part) const
+{
+    QString name = _fileName;
+    if (part > 1) {
+        name += QLatin1Char('.') + QString::number(part);
+    }
+    if (_compressed) {
+        name += QLatin1String(".gz");
+    }
+    return name;
+}
+
+bool SessionLog::openPart()
+{
+    const QString name = partFileName(_part);
+    QDir().mkpath(QFileInfo(name).absolutePath());
+
+    // appending keeps what is there, should a part exist already.  The
+    // output may hold passwords and the like, only the user may read it
+    const int fd = ::open(QFile::encodeName(name).constData(), O_WRONLY | O_APPEND | O_CREAT | O_CLOEXEC,
+                          S_IRUSR | S_IWUSR);
+    if (fd < 0) {
+        QMutexLocker locker(&_mutex);
+        _errorString = QString::fromLocal8Bit(strerror(errno));
+        return false;
+    }
+
+    _file = new QFile();
+    if (!_file->open(fd, QIODevice::WriteOnly | QIODevice::Append, QFileDevice::AutoCloseHandle)) {
+        QMutexLocker locker(&_mutex);
+        _errorString = _file->errorString();
+        ::close(fd);
+        delete _file;
+        _file = nullptr;
+        return false;
+    }
+
+    if (_compressed) {
+        _device = new KCompressionDevice(_file, false, KCompressionDevice::GZip);
+        _device->open(QIODevice::WriteOnly);
+    } else {
+        _device = _file;
+    }
+    return true;
+}
+
+bool SessionLog::closePart()
+{
+    if (_file == nullptr) {
+        return true;
+    }
+
+    if (_device != _file) {
+        _device->close();
+        delete _device;
+    }
+    _device = nullptr;
+
+    _file->close();
+    const bool ok = _file->error() == QFileDevice::NoError;
+    if (!ok) {
+        QMutexLocker locker(&_mutex);
+        _errorString = _file->errorString();
+    }
+
+    delete _file;
+    _file = nullptr;
+    return ok;
+}
+
+bool SessionLog::writeData(const QByteArray &data)
+{
+    if (data.isEmpty()) {
+        return true;
+    }
+
+    if (_device->write(data) != data.size()) {
+        QMutexLocker locker(&_mutex);
+        _errorString = _device->errorString();
+        return false;
+    }
+
+    // hand uncompressed output to the system right away, so that the log can
+    // be followed while it is written.  compressed output is only written
+    // once the compressor has filled a block
+    if (_device == _file) {
+        _file->flush();
+    }
+    return true;
+}
+
+QByteArray SessionLog::filterText(const QByteArray &data)
+{
+    const QString text = _decoder->toUnicode(data);
+
+    QString filtered;
+    filtered.reserve(text.length());
+
+    for (const QChar c : text) {
+        const ushort code = c.unicode();
+
+        switch (_filterState) {
+        case NormalText:
+            if (code == 0x1b) {
+                _filterState = Escape;
+            } else if (code == 0x9b) {
+                _filterState = ControlSequence;
+            } else if (code == 0x90 || code == 0x9d || code == 0x98 || code == 0x9e || code == 0x9f) {
+                _filterState = ControlString;
+            } else if (code == '\b') {
+                if (!filtered.isEmpty() && filtered.at(filtered.length() - 1) != QLatin1Char('\n')) {
+                    filtered.chop(1);
+                }
+            } else if (code == '\n' || code == '\t' || (code >= 0x20 && code != 0x7f && (code < 0x80 || code > 0x9f))) {
+                filtered += c;
+            }
+            break;
+        case Escape:
+            if (code == '[') {
+                _filterState = ControlSequence;
+            } else if (code == ']' || code == 'P' || code == 'X' || code == '^' || code == '_') {
+                _filterState = ControlString;
+            } else if (code >= 0x20 && code <= 0x2f) {
+                // character set designations and the like
+                _filterState = EscapeIntermediate;
+            } else {
+                _filterState = NormalText;
+            }
+            break;
+        case EscapeIntermediate:
+            if (code < 0x20 || code > 0x2f) {
+                _filterState = NormalText;
+            }
+            break;
+        case ControlSequence:
+            if (code >= 0x40 && code <= 0x7e) {
+                _filterState = NormalText;
+            }
+            break;
+        case ControlString:
+            // terminated by BEL or ST
+            if (code == 0x07 || code == 0x9c) {
+                _filterState = NormalText;
+            } else if (code == 0x1b) {
+                _filterState = ControlStringEscape;
+            }
+            break;
+        case ControlStringEscape:
+            _filterState = code == '\\' ? NormalText : ControlString;
+            break;
+        }
+    }
+
+    return filtered.toUtf8();
+}
+
+void SessionLog::run()
+{
+    _part = 1;
+    _firstPart = 1;
+    bool ok = openPart();
+
+    while (ok) {
+        QByteArray data;
+        qint64 dropped;
+        qint64 maxFileSize;
+        int maxParts;
+        const QTextCodec *codec;
+
+        {
+            QMutexLocker locker(&_mutex);
+            if (_queue.size() < WRITE_THRESHOLD && !isInterruptionRequested()) {
+                _dataAvailable.wait(&_mutex, FLUSH_INTERVAL);
+            }
+
+            data.swap(_queue);
+            dropped = _queueDropped;
+            _queueDropped = 0;
+            maxFileSize = _maxFileSize;
+            maxParts = _maxParts;
+            codec = _codec;
+        }
+
+        if (data.isEmpty() && dropped == 0) {
+            if (isInterruptionRequested()) {
+                break;
+            }
+            continue;
+        }
+
+        if (_format == PlainText) {
+            if (_decoder == nullptr || codec != _decoderCodec) {
+                delete _decoder;
+                _decoderCodec = codec;
+                _decoder = (codec != nullptr ? codec : QTextCodec::codecForName("UTF-8"))->makeDecoder();
+            }
+            data = filterText(data);
+        }
+
+        ok = writeData(data);
+
+        if (ok && dropped > 0) {
+            ok = writeData(QStringLiteral("\n[Konsole: %1 bytes of output were not logged]\n").arg(dropped).toUtf8());
+
+            // the output continues somewhere unknown
+            delete _decoder;
+            _decoder = nullptr;
+            _filterState = NormalText;
+        }
+
+        if (ok && maxFileSize > 0 && _file->pos() >= maxFileSize) {
+            ok = closePart();
+            _part++;
+            ok = ok && openPart();
+
+            while (maxParts > 0 && _firstPart <= _part - maxParts) {
+                QFile::remove(partFileName(_firstPart));
+                _firstPart++;
+            }
+        }
+    }
+
+    if (!closePart() || !ok) {
+        qCDebug(KonsoleDebug) << "Could not write session log" << _fileName << ":" << errorString();
+    }
+}
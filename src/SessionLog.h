@@ -0,0 +1,173 @@
+/*
+    This file is part of Konsole, a terminal emulator for KDE.
+
+    Copyright 2018 by The Konsole Developers
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+#ifndef SESSIONLOG_H
+#define SESSIONLOG_H
+
+// Qt
+#include <QByteArray>
+#include <QMutex>
+#include <QString>
+#include <QThread>
+#include <QWaitCondition>
+
+// Konsole
+#include "konsoleprivate_export.h"
+
+class QFile;
+class QIODevice;
+class QTextCodec;
+class QTextDecoder;
+
+namespace Konsole {
+/**
+ * Writes the output of a session to log files as it is received, in a
+ * background thread.
+ *
+ * write() only appends the data to a queue, which the thread writes to the
+ * file once it holds WRITE_THRESHOLD bytes or FLUSH_INTERVAL has passed.
+ * The queue holds at most MAX_QUEUED_BYTES bytes.  If the thread cannot keep
+ * up, for example because the disk is slow, further output is dropped until
+ * the queue has been written, and a note of how much was dropped is written
+ * in its place.  write() never waits for the disk.
+ *
+ * The output is written either as it was received, or as UTF-8 text with
+ * escape sequences and control characters other than new lines and tabs
+ * removed.  Logs can be compressed with gzip, and split into parts of about
+ * a maximum size.  The parts of a log are numbered, the first one is named
+ * like the log itself.  The oldest parts are removed once there are more
+ * than a maximum number of them.  Only the user can read the files.
+ *
+ * Stop the thread with stop(), or by deleting the log, which writes the
+ * output still queued and waits for the thread to finish.
+ */
+class KONSOLEPRIVATE_EXPORT SessionLog : public QThread
+{
+    Q_OBJECT
+
+public:
+    enum Format {
+        /** The output as it was received, escape sequences included */
+        RawOutput,
+        /** The text of the output, decoded with the codec of the session */
+        PlainText
+    };
+
+    /**
+     * Constructs a log written to @p fileName, to which ".gz" is appended for
+     * compressed logs.  Call start() to start writing.
+     */
+    SessionLog(const QString &fileName, Format format, bool compressed, QObject *parent = nullptr);
+    ~SessionLog() Q_DECL_OVERRIDE;
+
+    /**
+     * Returns a name for the log of a session named @p sessionName in
+     * @p directory, unique to the session and the time it was started.
+     */
+    static QString logFileName(const QString &directory, const QString &sessionName, int sessionId);
+
+    QString fileName() const;
+    Format format() const;
+    bool isCompressed() const;
+
+    /**
+     * Starts a new part of the log once the current one has grown to
+     * @p maxFileSize bytes, or never if it is 0.  Compressed parts are
+     * limited in their compressed size.
+     */
+    void setMaxFileSize(qint64 maxFileSize);
+    /**
+     * Keeps at most @p maxParts parts of the log, removing the oldest one
+     * when a new one is started, or all of them if it is 0.
+     */
+    void setMaxParts(int maxParts);
+
+    /** Sets the codec the output is decoded with for plain text logs */
+    void setCodec(const QTextCodec *codec);
+
+    /** Queues @p length bytes of output at @p data to be written */
+    void write(const char *data, int length);
+
+    /** Writes the output still queued and stops the thread */
+    void stop();
+
+    /** Returns the number of bytes of output which had to be dropped */
+    qint64 droppedBytes() const;
+
+    /** Returns the reason why the log could not be written, or an empty string */
+    QString errorString() const;
+
+    /** The maximum number of bytes of output waiting to be written */
+    static const int MAX_QUEUED_BYTES = 8 * 1024 * 1024;
+    /** The number of queued bytes which wake up the thread */
+    static const int WRITE_THRESHOLD = 64 * 1024;
+    /** The longest time output waits to be written, in milliseconds */
+    static const int FLUSH_INTERVAL = 1000;
+
+protected:
+    void run() Q_DECL_OVERRIDE;
+
+private:
+    Q_DISABLE_COPY(SessionLog)
+
+    bool openPart();
+    bool closePart();
+    bool writeData(const QByteArray &data);
+    QString partFileName(int part) const;
+    QByteArray filterText(const QByteArray &data);
+
+    const QString _fileName;
+    const Format _format;
+    const bool _compressed;
+
+    // guarded by _mutex
+    mutable QMutex _mutex;
+    QWaitCondition _dataAvailable;
+    QByteArray _queue;
+    qint64 _queueDropped;
+    qint64 _droppedBytes;
+    qint64 _maxFileSize;
+    int _maxParts;
+    const QTextCodec *_codec;
+    QString _errorString;
+
+    // used by the thread only
+    QFile *_file;
+    QIODevice *_device;
+    int _part;
+    int _firstPart;
+    const QTextCodec *_decoderCodec;
+    QTextDecoder *_decoder;
+
+    // state of filterText() between blocks of output
+    enum FilterState {
+        NormalText,
+        Escape,
+        EscapeIntermediate,
+        ControlSequence,
+        ControlString,
+        ControlStringEscape
+    };
+    FilterState _filterState;
+};
+}
+
+#endif // SESSIONLOG_H
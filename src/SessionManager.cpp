@@ -25,6 +25,11 @@
 #include "konsoledebug.h"
 
 // Qt
+#include <QApplication>
+#include <QDir>
+#include <QFileInfo>
+#include <QSet>
+#include <QStandardPaths>
 #include <QStringList>
 #include <QTextCodec>
 
@@ -45,11 +50,16 @@ SessionManager::SessionManager() :
     _sessions(QList<Session *>()),
     _sessionProfiles(QHash<Session *, Profile::Ptr>()),
     _sessionRuntimeProfiles(QHash<Session *, Profile::Ptr>()),
-    _restoreMapping(QHash<Session *, int>())
+    _restoreMapping(QHash<Session *, int>()),
+    _quitting(false)
 {
     ProfileManager *profileMananger = ProfileManager::instance();
     connect(profileMananger, &Konsole::ProfileManager::profileChanged, this,
             &Konsole::SessionManager::profileChanged);
+
+    connect(QCoreApplication::instance(), &QCoreApplication::aboutToQuit, this, [this]() {
+        _quitting = true;
+    });
 }
 
 SessionManager::~SessionManager()
@@ -74,6 +84,8 @@ SessionManager* SessionManager::instance()
 
 void SessionManager::closeAllSessions()
 {
+    _quitting = true;
+
     // close remaining sessions
     foreach (Session *session, _sessions) {
         session->close();
@@ -81,6 +93,34 @@ void SessionManager::closeAllSessions()
     _sessions.clear();
 }
 
+void SessionManager::pruneScrollbackArchives()
+{
+    // restored sessions remove their archive once it is mapped.  Archives
+    // which a saved desktop session still refers to are kept, as the
+    // instance restoring it may not have been started yet, the remaining
+    // ones belong to sessions which are gone
+    QSet<QString> referencedArchives;
+    const QDir sessionDir(QStandardPaths::writableLocation(QStandardPaths::GenericConfigLocation)
+                          + QLatin1String("/session"));
+    const QStringList sessionFilter(QCoreApplication::applicationName() + QLatin1String("_*"));
+    foreach (const QString &sessionFile, sessionDir.entryList(sessionFilter, QDir::Files)) {
+        const KConfig config(sessionDir.absoluteFilePath(sessionFile), KConfig::SimpleConfig);
+        foreach (const QString &groupName, config.groupList()) {
+            const QString archive = config.group(groupName).readPathEntry("Scrollback", QString());
+            if (!archive.isEmpty()) {
+                referencedArchives.insert(QFileInfo(archive).fileName());
+            }
+        }
+    }
+
+    QDir dir(Session::scrollbackDirectory());
+    foreach (const QString &fileName, dir.entryList(QStringList() << QStringLiteral("*.history"), QDir::Files)) {
+        if (!referencedArchives.contains(fileName)) {
+            dir.remove(fileName);
+        }
+    }
+}
+
 const QList<Session *> SessionManager::sessions() const
 {
     return _sessions;
@@ -127,6 +167,12 @@ void SessionManager::sessionTerminated(Session *session)
 {
     Q_ASSERT(session);
 
+    // the session is closed for good unless Konsole quits, possibly after
+    // saving it with the desktop session
+    if (!_quitting && !qApp->isSavingSession()) {
+        session->removeScrollbackArchive();
+    }
+
     _sessions.removeAll(session);
     _sessionProfiles.remove(session);
     _sessionRuntimeProfiles.remove(session);
@@ -263,6 +309,21 @@ void SessionManager::applyProfile(Session *session, const Profile::Ptr profile,
     if (apply.shouldApply(Profile::SilenceSeconds)) {
         session->setMonitorSilenceSeconds(profile->silenceSeconds());
     }
+
+    // Session Log
+    if (apply.shouldApply(Profile::SessionLogMode) || apply.shouldApply(Profile::SessionLogDirectory)
+        || apply.shouldApply(Profile::SessionLogCompressed) || apply.shouldApply(Profile::SessionLogMaxSize)
+        || apply.shouldApply(Profile::SessionLogMaxParts)) {
+        const auto mode = static_cast<Enum::SessionLogModeEnum>(profile->property<int>(Profile::SessionLogMode));
+        QString directory = profile->property<QString>(Profile::SessionLogDirectory);
+        if (directory.isEmpty()) {
+            directory = QStandardPaths::writableLocation(QStandardPaths::AppDataLocation)
+                        + QLatin1String("/logs");
+        }
+        session->setSessionLog(mode, directory, profile->property<bool>(Profile::SessionLogCompressed),
+                               profile->property<int>(Profile::SessionLogMaxSize) * qint64(1024 * 1024),
+                               profile->property<int>(Profile::SessionLogMaxParts));
+    }
 }
 
 void SessionManager::sessionProfileCommandReceived(const QString &text)
@@ -62,6 +62,14 @@ public:
     /** Kill all running sessions. */
     void closeAllSessions();
 
+    /**
+     * Removes the archives of the output saved with sessions which were not
+     * restored and which no saved desktop session refers to any more, see
+     * Session::saveSession().  Called once the sessions of the desktop
+     * session, if any, have been restored.
+     */
+    void pruneScrollbackArchives();
+
     /**
      * Creates a new session using the settings specified by the specified
      * profile.
@@ -132,6 +140,9 @@ private:
     QHash<Session *, Profile::Ptr> _sessionProfiles;
     QHash<Session *, Profile::Ptr> _sessionRuntimeProfiles;
     QHash<Session *, int> _restoreMapping;
+
+    // sessions closed while Konsole quits keep the output saved with them
+    bool _quitting;
 };
 
 /** Utility class to simplify code in SessionManager::applyProfile(). */
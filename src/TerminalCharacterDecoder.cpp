@@ -23,6 +23,7 @@
 #include "TerminalCharacterDecoder.h"
 
 // Qt
+#include <QDateTime>
 #include <QTextStream>
 
 // Konsole
@@ -31,12 +32,108 @@
 #include "ColorScheme.h"
 
 using namespace Konsole;
+
+// the attributes written by the decoders which keep them
+static const RenditionFlags ATTRIBUTES = RE_BOLD | RE_BLINK | RE_UNDERLINE | RE_REVERSE | RE_ITALIC
+                                         | RE_FAINT | RE_STRIKEOUT | RE_CONCEAL | RE_OVERLINE;
+
+// characters which are not real are only written before the last real
+// character of a line, see PlainTextDecoder::decodeLine()
+static int lastRealCharacter(const Character *characters, int count)
+{
+    for (int i = count - 1; i >= 0; i--) {
+        if (characters[i].isRealCharacter && characters[i].character != '\n') {
+            return i;
+        }
+    }
+    return -1;
+}
+
+// appends the text of @p character and returns the number of columns it takes
+static int appendCharacter(QString &text, const Character &character)
+{
+    if ((character.rendition & RE_EXTENDED_CHAR) != 0) {
+        const QVector<ushort> chars = ExtendedCharTable::instance.copyExtendedChar(character.character);
+        if (chars.isEmpty()) {
+            return 1;
+        }
+        const QString s = QString::fromUtf16(chars.constData(), chars.size());
+        text.append(s);
+        return qMax(1, string_width(s));
+    }
+
+    text.append(QChar(character.character));
+    return qMax(1, konsole_wcwidth(character.character));
+}
+
+static bool isDefaultColor(const CharacterColor &color)
+{
+    return color.colorSpace() == COLOR_SPACE_DEFAULT || color.colorSpace() == COLOR_SPACE_UNDEFINED;
+}
+
+static bool isDefaultFormat(const Character &character)
+{
+    return (character.rendition & ATTRIBUTES) == DEFAULT_RENDITION
+           && isDefaultColor(character.foregroundColor) && isDefaultColor(character.backgroundColor);
+}
+
+static bool equalFormats(const Character &a, const Character &b)
+{
+    return (a.rendition & ATTRIBUTES) == (b.rendition & ATTRIBUTES)
+           && a.foregroundColor == b.foregroundColor && a.backgroundColor == b.backgroundColor;
+}
+
+// the number of a system color in the 256 color palette.  bold text is drawn
+// in intensive colors, bold text in intensive colors is not told apart
+static int paletteNumber(const CharacterColor &color, bool bold)
+{
+    return color.colorNumber() + (color.isIntensive() && !bold ? 8 : 0);
+}
+
+static void appendJsonString(QString &text, const QString &string)
+{
+    static const char hexDigits[] = "0123456789abcdef";
+
+    text.append(QLatin1Char('"'));
+    for (const QChar c : string) {
+        switch (c.unicode()) {
+        case '"':
+            text.append(QLatin1String("\\\""));
+            break;
+        case '\\':
+            text.append(QLatin1String("\\\\"));
+            break;
+        case '\n':
+            text.append(QLatin1String("\\n"));
+            break;
+        case '\r':
+            text.append(QLatin1String("\\r"));
+            break;
+        case '\t':
+            text.append(QLatin1String("\\t"));
+            break;
+        default:
+            if (c.unicode() < 0x20) {
+                text.append(QLatin1String("\\u00"));
+                text.append(QLatin1Char(hexDigits[c.unicode() >> 4]));
+                text.append(QLatin1Char(hexDigits[c.unicode() & 0xf]));
+            } else {
+                text.append(c);
+            }
+        }
+    }
+    text.append(QLatin1Char('"'));
+}
+
 PlainTextDecoder::PlainTextDecoder()
     : _output(nullptr)
     , _includeLeadingWhitespace(true)
     , _includeTrailingWhitespace(true)
     , _recordLinePositions(false)
     , _linePositions(QList<int>())
+    , _writeTimestamps(false)
+    , _timestamp(0)
+    , _continuesLine(false)
 {
 }
 void PlainTextDecoder::setLeadingWhitespace(bool enable)
@@ -58,6 +155,8 @@ bool PlainTextDecoder::trailingWhitespace() const
 void PlainTextDecoder::begin(QTextStream* output)
 {
     _output = output;
+    _timestamp = 0;
+    _continuesLine = false;
     if (!_linePositions.isEmpty()) {
         _linePositions.clear();
     }
@@ -75,8 +174,34 @@ QList<int> PlainTextDecoder::linePositions() const
 {
     return _linePositions;
 }
-void PlainTextDecoder::decodeLine(const Character* const characters, int count, LineProperty /*properties*/
-                                 )
+void PlainTextDecoder::setWriteTimestamps(bool enable)
+{
+    _writeTimestamps = enable;
+}
+bool PlainTextDecoder::usesLineTimestamps() const
+{
+    return _writeTimestamps;
+}
+void PlainTextDecoder::setLineTimestamp(qint64 timestamp)
+{
+    _timestamp = timestamp;
+}
+void PlainTextDecoder::writeTimestamp(bool wrapped)
+{
+    const bool continuesLine = _continuesLine;
+    _continuesLine = wrapped;
+    if (!_writeTimestamps || continuesLine) {
+        return;
+    }
+
+    static const QString format = QStringLiteral("yyyy-MM-dd hh:mm:ss.zzz");
+    if (_timestamp != 0) {
+        *_output << '[' << QDateTime::fromMSecsSinceEpoch(_timestamp).toString(format) << "] ";
+    } else {
+        *_output << QString(format.length() + 3, QLatin1Char(' '));
+    }
+}
+void PlainTextDecoder::decodeLine(const Character* const characters, int count, LineProperty properties)
 {
     Q_ASSERT(_output);
 
@@ -85,6 +210,8 @@ void PlainTextDecoder::decodeLine(const Character* const characters, int count,
         _linePositions << pos;
     }
 
+    writeTimestamp((properties & LINE_WRAPPED) != 0);
+
     //TODO should we ignore or respect the LINE_WRAPPED line property?
 
     //note:  we build up a QString and send it to the text stream rather writing into the text
@@ -135,10 +262,9 @@ void PlainTextDecoder::decodeLine(const Character* const characters, int count,
 
     for (int i = start; i < outputCount;) {
         if ((characters[i].rendition & RE_EXTENDED_CHAR) != 0) {
-            ushort extendedCharLength = 0;
-            const ushort* chars = ExtendedCharTable::instance.lookupExtendedChar(characters[i].character, extendedCharLength);
-            if (chars != nullptr) {
-                const QString s = QString::fromUtf16(chars, extendedCharLength);
+            const QVector<ushort> chars = ExtendedCharTable::instance.copyExtendedChar(characters[i].character);
+            if (!chars.isEmpty()) {
+                const QString s = QString::fromUtf16(chars.constData(), chars.size());
                 plainText.append(s);
                 i += qMax(1, string_width(s));
             } else {
@@ -163,6 +289,59 @@ void PlainTextDecoder::decodeLine(const Character* const characters, int count,
     *_output << plainText;
 }
 
+void PlainTextDecoder::decodeText(const QChar *text, int count, QChar lineEnd)
+{
+    Q_ASSERT(_output);
+
+    if (_recordLinePositions && (_output->string() != nullptr)) {
+        int pos = _output->string()->count();
+        _linePositions << pos;
+    }
+
+    writeTimestamp(lineEnd.isNull());
+
+    // every character is real and takes one column, this only has to
+    // trim whitespace like decodeLine() does for 'text' + 'lineEnd'
+    const int total = lineEnd.isNull() ? count : count + 1;
+    auto charAt = [text, count, lineEnd](int i) {
+        return i < count ? text[i] : lineEnd;
+    };
+
+    int start = 0;
+    if (!_includeLeadingWhitespace) {
+        for (start = 0; start < total; start++) {
+            if (!charAt(start).isSpace()) {
+                break;
+            }
+        }
+    }
+
+    int outputCount = total - start;
+
+    if (outputCount <= 0) {
+        return;
+    }
+
+    if (!_includeTrailingWhitespace) {
+        for (int i = total - 1 ; i >= start ; i--) {
+            if (!charAt(i).isSpace()) {
+                break;
+            } else {
+                outputCount--;
+            }
+        }
+    }
+
+    // the text is written as it is, without copying it into a string first
+    const int textEnd = qMin(outputCount, count);
+    if (textEnd > start) {
+        *_output << QString::fromRawData(text + start, textEnd - start);
+    }
+    if (outputCount > count) {
+        *_output << lineEnd;
+    }
+}
+
 HTMLDecoder::HTMLDecoder() :
     _output(nullptr)
     , _colorTable(ColorScheme::defaultTable)
@@ -256,10 +435,9 @@ void HTMLDecoder::decodeLine(const Character* const characters, int count, LineP
         //output current character
         if (spaceCount < 2) {
             if ((characters[i].rendition & RE_EXTENDED_CHAR) != 0) {
-                ushort extendedCharLength = 0;
-                const ushort* chars = ExtendedCharTable::instance.lookupExtendedChar(characters[i].character, extendedCharLength);
-                if (chars != nullptr) {
-                    text.append(QString::fromUtf16(chars, extendedCharLength));
+                const QVector<ushort> chars = ExtendedCharTable::instance.copyExtendedChar(characters[i].character);
+                if (!chars.isEmpty()) {
+                    text.append(QString::fromUtf16(chars.constData(), chars.size()));
                 }
             } else {
                 //escape HTML tag characters and just display others as they are
@@ -306,3 +484,428 @@ void HTMLDecoder::setColorTable(const ColorEntry* table)
 {
     _colorTable = table;
 }
+
+AnsiDecoder::AnsiDecoder() :
+    _output(nullptr),
+    _lineEnd(QStringLiteral("\n")),
+    _lastRendition(DEFAULT_RENDITION),
+    _lastForeColor(CharacterColor(COLOR_SPACE_DEFAULT, DEFAULT_FORE_COLOR)),
+    _lastBackColor(CharacterColor(COLOR_SPACE_DEFAULT, DEFAULT_BACK_COLOR))
+{
+}
+
+void AnsiDecoder::setLineEnd(const QString &lineEnd)
+{
+    _lineEnd = lineEnd;
+}
+
+void AnsiDecoder::begin(QTextStream *output)
+{
+    _output = output;
+    _lastRendition = DEFAULT_RENDITION;
+    _lastForeColor = CharacterColor(COLOR_SPACE_DEFAULT, DEFAULT_FORE_COLOR);
+    _lastBackColor = CharacterColor(COLOR_SPACE_DEFAULT, DEFAULT_BACK_COLOR);
+}
+
+void AnsiDecoder::end()
+{
+    Q_ASSERT(_output);
+
+    QString text;
+    appendReset(text);
+    *_output << text;
+
+    _output = nullptr;
+}
+
+void AnsiDecoder::decodeLine(const Character * const characters, int count, LineProperty /*properties*/)
+{
+    Q_ASSERT(_output);
+
+    QString text;
+    text.reserve(count + 16);
+    appendLine(text, characters, count);
+
+    *_output << text;
+}
+
+void AnsiDecoder::appendLine(QString &text, const Character *characters, int count)
+{
+    const bool lineEnd = count > 0 && characters[count - 1].character == '\n';
+    const int end = lineEnd ? count - 1 : count;
+    const int realCharacterGuard = lastRealCharacter(characters, end);
+
+    for (int i = 0; i < end;) {
+        if (!characters[i].isRealCharacter && i > realCharacterGuard) {
+            ++i;
+            continue;
+        }
+        appendAttributes(text, characters[i]);
+        i += appendCharacter(text, characters[i]);
+    }
+
+    if (lineEnd) {
+        // the attributes are set again on the next line, so that
+        // backgrounds do not spill into the new line
+        appendReset(text);
+        text.append(_lineEnd);
+    }
+}
+
+void AnsiDecoder::appendReset(QString &text)
+{
+    if (_lastRendition != DEFAULT_RENDITION || !isDefaultColor(_lastForeColor) || !isDefaultColor(_lastBackColor)) {
+        text.append(QLatin1String("\033[0m"));
+    }
+
+    _lastRendition = DEFAULT_RENDITION;
+    _lastForeColor = CharacterColor(COLOR_SPACE_DEFAULT, DEFAULT_FORE_COLOR);
+    _lastBackColor = CharacterColor(COLOR_SPACE_DEFAULT, DEFAULT_BACK_COLOR);
+}
+
+static void appendParameter(QString &parameters, int value)
+{
+    if (!parameters.isEmpty()) {
+        parameters.append(QLatin1Char(';'));
+    }
+    parameters.append(QString::number(value));
+}
+
+static void appendColorParameters(QString &parameters, const CharacterColor &color, bool foreground, bool bold)
+{
+    const int base = foreground ? 30 : 40;
+
+    switch (color.colorSpace()) {
+    case COLOR_SPACE_SYSTEM:
+        appendParameter(parameters, (color.isIntensive() && !(foreground && bold) ? base + 60 : base)
+                                    + color.colorNumber());
+        break;
+    case COLOR_SPACE_256:
+        appendParameter(parameters, base + 8);
+        appendParameter(parameters, 5);
+        appendParameter(parameters, color.colorNumber());
+        break;
+    case COLOR_SPACE_RGB:
+        appendParameter(parameters, base + 8);
+        appendParameter(parameters, 2);
+        appendParameter(parameters, (color.colorNumber() >> 16) & 0xff);
+        appendParameter(parameters, (color.colorNumber() >> 8) & 0xff);
+        appendParameter(parameters, color.colorNumber() & 0xff);
+        break;
+    default:
+        appendParameter(parameters, base + 9);
+        break;
+    }
+}
+
+void AnsiDecoder::appendAttributes(QString &text, const Character &character)
+{
+    const RenditionFlags rendition = character.rendition & ATTRIBUTES;
+
+    if (rendition == _lastRendition && character.foregroundColor == _lastForeColor
+        && character.backgroundColor == _lastBackColor) {
+        return;
+    }
+
+    if (isDefaultFormat(character)) {
+        appendReset(text);
+        return;
+    }
+
+    // only the attributes which change are set or reset
+    static const struct {
+        RenditionFlags flag;
+        int on;
+        int off;
+    } attributes[] = {
+        {RE_BOLD, 1, 22}, {RE_FAINT, 2, 22}, {RE_ITALIC, 3, 23}, {RE_UNDERLINE, 4, 24},
+        {RE_BLINK, 5, 25}, {RE_REVERSE, 7, 27}, {RE_CONCEAL, 8, 28}, {RE_STRIKEOUT, 9, 29},
+        {RE_OVERLINE, 53, 55}
+    };
+
+    QString parameters;
+    RenditionFlags removed = _lastRendition & ~rendition;
+    RenditionFlags added = rendition & ~_lastRendition;
+
+    // bold and faint are reset together
+    if ((removed & (RE_BOLD | RE_FAINT)) != 0) {
+        appendParameter(parameters, 22);
+        removed &= ~(RE_BOLD | RE_FAINT);
+        added |= rendition & (RE_BOLD | RE_FAINT);
+    }
+
+    for (const auto &attribute : attributes) {
+        if ((removed & attribute.flag) != 0) {
+            appendParameter(parameters, attribute.off);
+        } else if ((added & attribute.flag) != 0) {
+            appendParameter(parameters, attribute.on);
+        }
+    }
+
+    // bold changes which color is written for intensive colors
+    const bool bold = (rendition & RE_BOLD) != 0;
+    const bool boldChanged = ((rendition ^ _lastRendition) & RE_BOLD) != 0;
+    if (character.foregroundColor != _lastForeColor
+        || (boldChanged && character.foregroundColor.colorSpace() == COLOR_SPACE_SYSTEM
+            && character.foregroundColor.isIntensive())) {
+        appendColorParameters(parameters, character.foregroundColor, true, bold);
+    }
+    if (character.backgroundColor != _lastBackColor) {
+        appendColorParameters(parameters, character.backgroundColor, false, bold);
+    }
+
+    text.append(QLatin1String("\033["));
+    text.append(parameters);
+    text.append(QLatin1Char('m'));
+
+    _lastRendition = rendition;
+    _lastForeColor = character.foregroundColor;
+    _lastBackColor = character.backgroundColor;
+}
+
+JsonLinesDecoder::JsonLinesDecoder() :
+    _output(nullptr),
+    _timestamp(0),
+    _text(QString()),
+    _runs(QString())
+{
+}
+
+void JsonLinesDecoder::begin(QTextStream *output)
+{
+    _output = output;
+    _timestamp = 0;
+}
+
+void JsonLinesDecoder::end()
+{
+    _output = nullptr;
+}
+
+bool JsonLinesDecoder::usesLineTimestamps() const
+{
+    return true;
+}
+
+void JsonLinesDecoder::setLineTimestamp(qint64 timestamp)
+{
+    _timestamp = timestamp;
+}
+
+static void appendJsonColor(QString &text, const char *key, const CharacterColor &color, bool bold)
+{
+    if (isDefaultColor(color)) {
+        return;
+    }
+
+    text.append(QLatin1String(",\""));
+    text.append(QLatin1String(key));
+    text.append(QLatin1String("\":"));
+
+    switch (color.colorSpace()) {
+    case COLOR_SPACE_SYSTEM:
+        text.append(QString::number(paletteNumber(color, bold)));
+        break;
+    case COLOR_SPACE_256:
+        text.append(QString::number(color.colorNumber()));
+        break;
+    default:
+        text.append(QStringLiteral("\"#%1\"").arg(color.colorNumber(), 6, 16, QLatin1Char('0')));
+        break;
+    }
+}
+
+static void appendJsonRun(QString &runs, int start, int length, const Character &format)
+{
+    static const struct {
+        RenditionFlags flag;
+        const char *name;
+    } attributes[] = {
+        {RE_BOLD, "bold"}, {RE_FAINT, "faint"}, {RE_ITALIC, "italic"}, {RE_UNDERLINE, "underline"},
+        {RE_BLINK, "blink"}, {RE_REVERSE, "reverse"}, {RE_CONCEAL, "conceal"},
+        {RE_STRIKEOUT, "strikeout"}, {RE_OVERLINE, "overline"}
+    };
+
+    if (!runs.isEmpty()) {
+        runs.append(QLatin1Char(','));
+    }
+    runs.append(QStringLiteral("{\"start\":%1,\"length\":%2").arg(start).arg(length));
+
+    const bool bold = (format.rendition & RE_BOLD) != 0;
+    appendJsonColor(runs, "fg", format.foregroundColor, bold);
+    appendJsonColor(runs, "bg", format.backgroundColor, false);
+
+    for (const auto &attribute : attributes) {
+        if ((format.rendition & attribute.flag) != 0) {
+            runs.append(QLatin1String(",\""));
+            runs.append(QLatin1String(attribute.name));
+            runs.append(QLatin1String("\":true"));
+        }
+    }
+    runs.append(QLatin1Char('}'));
+}
+
+void JsonLinesDecoder::decodeLine(const Character * const characters, int count, LineProperty properties)
+{
+    Q_ASSERT(_output);
+
+    _text.clear();
+    _runs.clear();
+
+    const int end = count > 0 && characters[count - 1].character == '\n' ? count - 1 : count;
+    const int realCharacterGuard = lastRealCharacter(characters, end);
+
+    // the run of characters in the same format being collected, if any
+    int runStart = -1;
+    Character runFormat;
+
+    for (int i = 0; i < end;) {
+        const Character &character = characters[i];
+        if (!character.isRealCharacter && i > realCharacterGuard) {
+            ++i;
+            continue;
+        }
+
+        const int position = _text.length();
+        if (runStart >= 0 && !equalFormats(character, runFormat)) {
+            appendJsonRun(_runs, runStart, position - runStart, runFormat);
+            runStart = -1;
+        }
+        if (runStart < 0 && !isDefaultFormat(character)) {
+            runStart = position;
+            runFormat = character;
+        }
+
+        i += appendCharacter(_text, character);
+    }
+
+    if (runStart >= 0) {
+        appendJsonRun(_runs, runStart, _text.length() - runStart, runFormat);
+    }
+
+    QString line;
+    line.reserve(_text.length() + _runs.length() + 48);
+    line.append(QLatin1String("{\"text\":"));
+    appendJsonString(line, _text);
+    if ((properties & LINE_WRAPPED) != 0) {
+        line.append(QLatin1String(",\"wrapped\":true"));
+    }
+    if (_timestamp != 0) {
+        line.append(QLatin1String(",\"time\":"));
+        line.append(QString::number(_timestamp));
+    }
+    if (!_runs.isEmpty()) {
+        line.append(QLatin1String(",\"runs\":["));
+        line.append(_runs);
+        line.append(QLatin1Char(']'));
+    }
+    line.append(QLatin1String("}\n"));
+
+    *_output << line;
+    _timestamp = 0;
+}
+
+// the longest text played back at once, longer stretches of lines added at
+// the same time are split into several events
+static const int MAX_EVENT_LENGTH = 64 * 1024;
+
+AsciicastDecoder::AsciicastDecoder(int columns, int lines) :
+    _output(nullptr),
+    _ansiDecoder(AnsiDecoder()),
+    _columns(columns),
+    _lines(lines),
+    _headerWritten(false),
+    _firstTimestamp(0),
+    _timestamp(0),
+    _eventTimestamp(0),
+    _eventText(QString())
+{
+    // the recording is played back on a terminal
+    _ansiDecoder.setLineEnd(QStringLiteral("\r\n"));
+}
+
+void AsciicastDecoder::begin(QTextStream *output)
+{
+    _output = output;
+    _ansiDecoder.begin(output);
+    _headerWritten = false;
+    _firstTimestamp = 0;
+    _timestamp = 0;
+    _eventTimestamp = 0;
+    _eventText.clear();
+}
+
+void AsciicastDecoder::end()
+{
+    Q_ASSERT(_output);
+
+    if (!_headerWritten) {
+        *_output << QStringLiteral("{\"version\": 2, \"width\": %1, \"height\": %2}\n").arg(_columns).arg(_lines);
+        _headerWritten = true;
+    }
+
+    _ansiDecoder.appendReset(_eventText);
+    writeEvent();
+
+    _output = nullptr;
+}
+
+bool AsciicastDecoder::usesLineTimestamps() const
+{
+    return true;
+}
+
+void AsciicastDecoder::setLineTimestamp(qint64 timestamp)
+{
+    _timestamp = timestamp;
+}
+
+void AsciicastDecoder::decodeLine(const Character * const characters, int count, LineProperty /*properties*/)
+{
+    Q_ASSERT(_output);
+
+    if (!_headerWritten) {
+        QString header = QStringLiteral("{\"version\": 2, \"width\": %1, \"height\": %2").arg(_columns).arg(_lines);
+        if (_timestamp != 0) {
+            header.append(QStringLiteral(", \"timestamp\": %1").arg(_timestamp / 1000));
+        }
+        header.append(QLatin1String("}\n"));
+        *_output << header;
+        _headerWritten = true;
+    }
+
+    if (_timestamp != 0 && _firstTimestamp == 0) {
+        _firstTimestamp = _timestamp;
+    }
+
+    // lines without a time are played back with the line before them
+    const qint64 timestamp = _timestamp != 0 ? _timestamp : _eventTimestamp;
+    if (timestamp != _eventTimestamp || _eventText.length() >= MAX_EVENT_LENGTH) {
+        writeEvent();
+    }
+    _eventTimestamp = timestamp;
+
+    _ansiDecoder.appendLine(_eventText, characters, count);
+    _timestamp = 0;
+}
+
+void AsciicastDecoder::writeEvent()
+{
+    if (_eventText.isEmpty()) {
+        return;
+    }
+
+    // in seconds since the first line with a known time
+    const qint64 time = _eventTimestamp != 0 ? qMax<qint64>(_eventTimestamp - _firstTimestamp, 0) : 0;
+
+    QString event;
+    event.reserve(_eventText.length() + 32);
+    event.append(QLatin1Char('['));
+    event.append(QString::number(time / 1000.0, 'f', 6));
+    event.append(QLatin1String(", \"o\", "));
+    appendJsonString(event, _eventText);
+    event.append(QLatin1String("]\n"));
+
+    *_output << event;
+    _eventText.clear();
+}
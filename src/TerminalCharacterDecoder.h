@@ -24,6 +24,7 @@
 
 // Qt
 #include <QList>
+#include <QString>
 
 // Konsole
 #include "Character.h"
@@ -63,6 +64,25 @@ public:
      */
     virtual void decodeLine(const Character * const characters, int count,
                             LineProperty properties) = 0;
+
+    /**
+     * Returns true if the decoder records the times lines were written,
+     * which are then passed to setLineTimestamp() before each line.
+     */
+    virtual bool usesLineTimestamps() const
+    {
+        return false;
+    }
+
+    /**
+     * Sets the time the next line passed to decodeLine() was written to the
+     * terminal, in milliseconds since the epoch, or 0 if it is not known.
+     * See HistoryScroll::getLineTimestamp()
+     */
+    virtual void setLineTimestamp(qint64 timestamp)
+    {
+        Q_UNUSED(timestamp);
+    }
 };
 
 /**
@@ -104,6 +124,13 @@ public:
     QList<int> linePositions() const;
     /** Enables recording of character positions at which new lines are added.  See linePositions() */
     void setRecordLinePositions(bool record);
+    /**
+     * Prefixes each line which does not continue a wrapped line with the time
+     * it was written, as passed to setLineTimestamp().  Lines written at an
+     * unknown time are indented by the width of a time instead.
+     * Defaults to false.
+     */
+    void setWriteTimestamps(bool enable);
 
     void begin(QTextStream *output) Q_DECL_OVERRIDE;
     void end() Q_DECL_OVERRIDE;
@@ -111,13 +138,32 @@ public:
     void decodeLine(const Character * const characters, int count,
                     LineProperty properties) Q_DECL_OVERRIDE;
 
+    bool usesLineTimestamps() const Q_DECL_OVERRIDE;
+    void setLineTimestamp(qint64 timestamp) Q_DECL_OVERRIDE;
+
+    /**
+     * Converts a line of plain text, as returned by HistoryScroll::getLineText(),
+     * into plain text.  The output is the same as the one of decodeLine() for
+     * the characters of @p text followed by @p lineEnd, without having to
+     * create them.  If @p lineEnd is null, nothing is appended to the text.
+     */
+    void decodeText(const QChar *text, int count, QChar lineEnd = QChar());
+
 private:
+    // writes the time of the line, unless the line continues the one before
+    void writeTimestamp(bool wrapped);
+
     QTextStream *_output;
     bool _includeLeadingWhitespace;
     bool _includeTrailingWhitespace;
 
     bool _recordLinePositions;
     QList<int> _linePositions;
+
+    bool _writeTimestamps;
+    qint64 _timestamp;
+    // true if the last line was wrapped
+    bool _continuesLine;
 };
 
 /**
@@ -154,6 +200,111 @@ private:
     CharacterColor _lastForeColor;
     CharacterColor _lastBackColor;
 };
+
+/**
+ * A terminal character decoder which produces text with the escape sequences
+ * to set its colors and attributes, which looks like the original output when
+ * it is written to a terminal, for example with cat.
+ *
+ * Escape sequences are only written where the attributes change, and only
+ * for the attributes which do.
+ */
+class KONSOLEPRIVATE_EXPORT AnsiDecoder : public TerminalCharacterDecoder
+{
+public:
+    AnsiDecoder();
+
+    /** Sets the text written for the end of a line, "\n" by default */
+    void setLineEnd(const QString &lineEnd);
+
+    void begin(QTextStream *output) Q_DECL_OVERRIDE;
+    void end() Q_DECL_OVERRIDE;
+
+    void decodeLine(const Character * const characters, int count,
+                    LineProperty properties) Q_DECL_OVERRIDE;
+
+    /** Like decodeLine(), but appends the text to @p text rather than the output */
+    void appendLine(QString &text, const Character *characters, int count);
+    /** Appends the escape sequence to reset all attributes to @p text, if any are set */
+    void appendReset(QString &text);
+
+private:
+    void appendAttributes(QString &text, const Character &character);
+
+    QTextStream *_output;
+    QString _lineEnd;
+    RenditionFlags _lastRendition;
+    CharacterColor _lastForeColor;
+    CharacterColor _lastBackColor;
+};
+
+/**
+ * A terminal character decoder which produces one JSON object per line, in
+ * the JSON Lines format.  Each object holds the text of the line and the runs
+ * of characters which are not drawn in the default colors and attributes:
+ *
+ *     {"text":"$ ls","time":1514764800000,"runs":[{"start":0,"length":1,"fg":2,"bold":true}]}
+ *
+ * Runs are positioned in UTF-16 code units of the text.  Colors are given as
+ * numbers of the 256 color palette, or as "#rrggbb" strings.  Keys for default
+ * values are left out, "wrapped" is only set for lines which continue on the
+ * next line and "time" only for lines written at a known time.
+ */
+class KONSOLEPRIVATE_EXPORT JsonLinesDecoder : public TerminalCharacterDecoder
+{
+public:
+    JsonLinesDecoder();
+
+    void begin(QTextStream *output) Q_DECL_OVERRIDE;
+    void end() Q_DECL_OVERRIDE;
+
+    void decodeLine(const Character * const characters, int count,
+                    LineProperty properties) Q_DECL_OVERRIDE;
+
+    bool usesLineTimestamps() const Q_DECL_OVERRIDE;
+    void setLineTimestamp(qint64 timestamp) Q_DECL_OVERRIDE;
+
+private:
+    QTextStream *_output;
+    qint64 _timestamp;
+    QString _text;
+    QString _runs;
+};
+
+/**
+ * A terminal character decoder which produces an asciicast (version 2)
+ * recording, which plays back the output line by line at the times the lines
+ * were written.  Lines written at the same time are played back
+ * together, lines without a known time together with the line before.
+ */
+class KONSOLEPRIVATE_EXPORT AsciicastDecoder : public TerminalCharacterDecoder
+{
+public:
+    /** Constructs a decoder for a terminal of @p columns by @p lines */
+    AsciicastDecoder(int columns, int lines);
+
+    void begin(QTextStream *output) Q_DECL_OVERRIDE;
+    void end() Q_DECL_OVERRIDE;
+
+    void decodeLine(const Character * const characters, int count,
+                    LineProperty properties) Q_DECL_OVERRIDE;
+
+    bool usesLineTimestamps() const Q_DECL_OVERRIDE;
+    void setLineTimestamp(qint64 timestamp) Q_DECL_OVERRIDE;
+
+private:
+    void writeEvent();
+
+    QTextStream *_output;
+    AnsiDecoder _ansiDecoder;
+    int _columns;
+    int _lines;
+    bool _headerWritten;
+    qint64 _firstTimestamp;
+    qint64 _timestamp;
+    qint64 _eventTimestamp;
+    QString _eventText;
+};
 }
 
 #endif
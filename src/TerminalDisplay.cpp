@@ -26,6 +26,9 @@
 // Config
 #include <config-konsole.h>
 
+// System
+#include <algorithm>
+
 // Qt
 #include <QApplication>
 #include <QClipboard>
@@ -45,6 +48,9 @@
 #include <QDrag>
 #include <QDesktopServices>
 #include <QAccessible>
+#include <QWindow>
+#include <QGlyphRun>
+#include <QTextLayout>
 
 // KDE
 #include <KShell>
@@ -64,13 +70,14 @@
 #include "konsole_wcwidth.h"
 #include "TerminalCharacterDecoder.h"
 #include "Screen.h"
-#include "LineFont.h"
+#include "LineBlockCharacters.h"
 #include "SessionController.h"
 #include "ExtendedCharTable.h"
 #include "TerminalDisplayAccessible.h"
 #include "SessionManager.h"
 #include "Session.h"
 #include "WindowSystemInfo.h"
+#include "MemoryPressureMonitor.h"
 
 using namespace Konsole;
 
@@ -160,6 +167,7 @@ void TerminalDisplay::setBackgroundColor(const QColor& color)
     setPalette(p);
 
     updateScrollBarPalette();
+    invalidateLineCache();
     update();
 }
 QColor TerminalDisplay::getBackgroundColor() const
@@ -172,6 +180,7 @@ void TerminalDisplay::setForegroundColor(const QColor& color)
     _colorTable[DEFAULT_FORE_COLOR] = color;
 
     updateScrollBarPalette();
+    invalidateLineCache();
     update();
 }
 void TerminalDisplay::setColorTable(const ColorEntry table[])
@@ -198,6 +207,17 @@ static inline bool isLineCharString(const QString& string)
     return isSupportedLineChar(string.at(0).unicode());
 }
 
+static inline bool isAsciiString(const QString& string)
+{
+    for (int i = 0; i < string.length(); i++) {
+        if (string.at(i).unicode() > 0x7e) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
 void TerminalDisplay::fontChange(const QFont&)
 {
     QFontMetrics fm(font());
@@ -225,6 +245,9 @@ void TerminalDisplay::fontChange(const QFont&)
 
     _fontAscent = fm.ascent();
 
+    _glyphCache.setFont(font(), QSize(_fontWidth, _fontHeight), _fontAscent + _lineSpacing);
+    invalidateLineCache();
+
     emit changedFontMetricSignal(_fontHeight, _fontWidth);
     propagateSize();
     update();
@@ -396,6 +419,7 @@ TerminalDisplay::TerminalDisplay(QWidget* parent)
     , _textBlinking(false)
     , _cursorBlinking(false)
     , _hasTextBlinker(false)
+    , _blinkingRuns(QVector<QVector<QPair<int, int> > >())
     , _urlHintsModifiers(Qt::NoModifier)
     , _showUrlHint(false)
     , _openLinksByDirectClick(false)
@@ -411,13 +435,18 @@ TerminalDisplay::TerminalDisplay(QWidget* parent)
     , _size(QSize())
     , _blendColor(qRgba(0, 0, 0, 0xff))
     , _wallpaper(nullptr)
+    , _backgroundLayer(QPixmap())
+    , _backgroundLayerColor(0)
     , _filterChain(new TerminalImageFilterChain())
     , _mouseOverHotspotArea(QRegion())
     , _filterUpdateRequired(true)
+    , _imageUpdatePending(false)
     , _cursorShape(Enum::BlockCursor)
     , _cursorColor(QColor())
     , _antialiasText(true)
     , _useFontLineCharacters(false)
+    , _glyphCache()
+    , _cachedLines(QVector<CachedLine>())
     , _printerFriendly(false)
     , _sessionController(nullptr)
     , _trimLeadingSpaces(false)
@@ -455,6 +484,8 @@ TerminalDisplay::TerminalDisplay(QWidget* parent)
     _blinkCursorTimer->setInterval(QApplication::cursorFlashTime() / 2);
     connect(_blinkCursorTimer, &QTimer::timeout, this, &Konsole::TerminalDisplay::blinkCursorEvent);
 
+    connect(MemoryPressureMonitor::instance(), &Konsole::MemoryPressureMonitor::reclaimRequested, this, &Konsole::TerminalDisplay::releaseCaches);
+
     // hide mouse cursor on keystroke or idle
     KCursor::setAutoHideCursor(this, true);
     setMouseTracking(true);
@@ -518,246 +549,14 @@ TerminalDisplay::~TerminalDisplay()
 /*                                                                           */
 /* ------------------------------------------------------------------------- */
 
-/**
- A table for emulating the simple (single width) unicode drawing chars.
- It represents the 250x - 257x glyphs. If it's zero, we can't use it.
- if it's not, it's encoded as follows: imagine a 5x5 grid where the points are numbered
- 0 to 24 left to top, top to bottom. Each point is represented by the corresponding bit.
-
- Then, the pixels basically have the following interpretation:
- _|||_
- -...-
- -...-
- -...-
- _|||_
-
-where _ = none
-      | = vertical line.
-      - = horizontal line.
- */
-
-enum LineEncode {
-    TopL  = (1 << 1),
-    TopC  = (1 << 2),
-    TopR  = (1 << 3),
-
-    LeftT = (1 << 5),
-    Int11 = (1 << 6),
-    Int12 = (1 << 7),
-    Int13 = (1 << 8),
-    RightT = (1 << 9),
-
-    LeftC = (1 << 10),
-    Int21 = (1 << 11),
-    Int22 = (1 << 12),
-    Int23 = (1 << 13),
-    RightC = (1 << 14),
-
-    LeftB = (1 << 15),
-    Int31 = (1 << 16),
-    Int32 = (1 << 17),
-    Int33 = (1 << 18),
-    RightB = (1 << 19),
-
-    BotL  = (1 << 21),
-    BotC  = (1 << 22),
-    BotR  = (1 << 23)
-};
-
-static void drawLineChar(QPainter& paint, int x, int y, int w, int h, uchar code)
-{
-    //Calculate cell midpoints, end points.
-    const int cx = x + w / 2;
-    const int cy = y + h / 2;
-    const int ex = x + w - 1;
-    const int ey = y + h - 1;
-
-    const quint32 toDraw = LineChars[code];
-
-    //Top _lines:
-    if ((toDraw & TopL) != 0u) {
-        paint.drawLine(cx - 1, y, cx - 1, cy - 2);
-    }
-    if ((toDraw & TopC) != 0u) {
-        paint.drawLine(cx, y, cx, cy - 2);
-    }
-    if ((toDraw & TopR) != 0u) {
-        paint.drawLine(cx + 1, y, cx + 1, cy - 2);
-    }
-
-    //Bot _lines:
-    if ((toDraw & BotL) != 0u) {
-        paint.drawLine(cx - 1, cy + 2, cx - 1, ey);
-    }
-    if ((toDraw & BotC) != 0u) {
-        paint.drawLine(cx, cy + 2, cx, ey);
-    }
-    if ((toDraw & BotR) != 0u) {
-        paint.drawLine(cx + 1, cy + 2, cx + 1, ey);
-    }
-
-    //Left _lines:
-    if ((toDraw & LeftT) != 0u) {
-        paint.drawLine(x, cy - 1, cx - 2, cy - 1);
-    }
-    if ((toDraw & LeftC) != 0u) {
-        paint.drawLine(x, cy, cx - 2, cy);
-    }
-    if ((toDraw & LeftB) != 0u) {
-        paint.drawLine(x, cy + 1, cx - 2, cy + 1);
-    }
-
-    //Right _lines:
-    if ((toDraw & RightT) != 0u) {
-        paint.drawLine(cx + 2, cy - 1, ex, cy - 1);
-    }
-    if ((toDraw & RightC) != 0u) {
-        paint.drawLine(cx + 2, cy, ex, cy);
-    }
-    if ((toDraw & RightB) != 0u) {
-        paint.drawLine(cx + 2, cy + 1, ex, cy + 1);
-    }
-
-    //Intersection points.
-    if ((toDraw & Int11) != 0u) {
-        paint.drawPoint(cx - 1, cy - 1);
-    }
-    if ((toDraw & Int12) != 0u) {
-        paint.drawPoint(cx, cy - 1);
-    }
-    if ((toDraw & Int13) != 0u) {
-        paint.drawPoint(cx + 1, cy - 1);
-    }
-
-    if ((toDraw & Int21) != 0u) {
-        paint.drawPoint(cx - 1, cy);
-    }
-    if ((toDraw & Int22) != 0u) {
-        paint.drawPoint(cx, cy);
-    }
-    if ((toDraw & Int23) != 0u) {
-        paint.drawPoint(cx + 1, cy);
-    }
-
-    if ((toDraw & Int31) != 0u) {
-        paint.drawPoint(cx - 1, cy + 1);
-    }
-    if ((toDraw & Int32) != 0u) {
-        paint.drawPoint(cx, cy + 1);
-    }
-    if ((toDraw & Int33) != 0u) {
-        paint.drawPoint(cx + 1, cy + 1);
-    }
-}
-
-static void drawOtherChar(QPainter& paint, int x, int y, int w, int h, uchar code)
-{
-    //Calculate cell midpoints, end points.
-    const int cx = x + w / 2;
-    const int cy = y + h / 2;
-    const int ex = x + w - 1;
-    const int ey = y + h - 1;
-
-    // Double dashes
-    if (0x4C <= code && code <= 0x4F) {
-        const int xHalfGap = qMax(w / 15, 1);
-        const int yHalfGap = qMax(h / 15, 1);
-        switch (code) {
-        case 0x4D: // BOX DRAWINGS HEAVY DOUBLE DASH HORIZONTAL
-            paint.drawLine(x, cy - 1, cx - xHalfGap - 1, cy - 1);
-            paint.drawLine(x, cy + 1, cx - xHalfGap - 1, cy + 1);
-            paint.drawLine(cx + xHalfGap, cy - 1, ex, cy - 1);
-            paint.drawLine(cx + xHalfGap, cy + 1, ex, cy + 1);
-            // No break!
-#if (QT_VERSION >= QT_VERSION_CHECK(5, 8, 0))
-            Q_FALLTHROUGH();
-#endif
-        case 0x4C: // BOX DRAWINGS LIGHT DOUBLE DASH HORIZONTAL
-            paint.drawLine(x, cy, cx - xHalfGap - 1, cy);
-            paint.drawLine(cx + xHalfGap, cy, ex, cy);
-            break;
-        case 0x4F: // BOX DRAWINGS HEAVY DOUBLE DASH VERTICAL
-            paint.drawLine(cx - 1, y, cx - 1, cy - yHalfGap - 1);
-            paint.drawLine(cx + 1, y, cx + 1, cy - yHalfGap - 1);
-            paint.drawLine(cx - 1, cy + yHalfGap, cx - 1, ey);
-            paint.drawLine(cx + 1, cy + yHalfGap, cx + 1, ey);
-            // No break!
-#if (QT_VERSION >= QT_VERSION_CHECK(5, 8, 0))
-            Q_FALLTHROUGH();
-#endif
-        case 0x4E: // BOX DRAWINGS LIGHT DOUBLE DASH VERTICAL
-            paint.drawLine(cx, y, cx, cy - yHalfGap - 1);
-            paint.drawLine(cx, cy + yHalfGap, cx, ey);
-            break;
-        }
-    }
-
-    // Rounded corner characters
-    else if (0x6D <= code && code <= 0x70) {
-        const int r = w * 3 / 8;
-        const int d = 2 * r;
-        switch (code) {
-        case 0x6D: // BOX DRAWINGS LIGHT ARC DOWN AND RIGHT
-            paint.drawLine(cx, cy + r, cx, ey);
-            paint.drawLine(cx + r, cy, ex, cy);
-            paint.drawArc(cx, cy, d, d, 90 * 16, 90 * 16);
-            break;
-        case 0x6E: // BOX DRAWINGS LIGHT ARC DOWN AND LEFT
-            paint.drawLine(cx, cy + r, cx, ey);
-            paint.drawLine(x, cy, cx - r, cy);
-            paint.drawArc(cx - d, cy, d, d, 0 * 16, 90 * 16);
-            break;
-        case 0x6F: // BOX DRAWINGS LIGHT ARC UP AND LEFT
-            paint.drawLine(cx, y, cx, cy - r);
-            paint.drawLine(x, cy, cx - r, cy);
-            paint.drawArc(cx - d, cy - d, d, d, 270 * 16, 90 * 16);
-            break;
-        case 0x70: // BOX DRAWINGS LIGHT ARC UP AND RIGHT
-            paint.drawLine(cx, y, cx, cy - r);
-            paint.drawLine(cx + r, cy, ex, cy);
-            paint.drawArc(cx, cy - d, d, d, 180 * 16, 90 * 16);
-            break;
-        }
-    }
-
-    // Diagonals
-    else if (0x71 <= code && code <= 0x73) {
-        switch (code) {
-        case 0x71: // BOX DRAWINGS LIGHT DIAGONAL UPPER RIGHT TO LOWER LEFT
-            paint.drawLine(ex, y, x, ey);
-            break;
-        case 0x72: // BOX DRAWINGS LIGHT DIAGONAL UPPER LEFT TO LOWER RIGHT
-            paint.drawLine(x, y, ex, ey);
-            break;
-        case 0x73: // BOX DRAWINGS LIGHT DIAGONAL CROSS
-            paint.drawLine(ex, y, x, ey);
-            paint.drawLine(x, y, ex, ey);
-            break;
-        }
-    }
-}
-
 void TerminalDisplay::drawLineCharString(QPainter& painter, int x, int y, const QString& str,
         const Character* attributes)
 {
-    const QPen& originalPen = painter.pen();
-
-    if (((attributes->rendition & RE_BOLD) != 0) && _boldIntense) {
-        QPen boldPen(originalPen);
-        boldPen.setWidth(3);
-        painter.setPen(boldPen);
-    }
+    const bool bold = ((attributes->rendition & RE_BOLD) != 0) && _boldIntense;
 
     for (int i = 0 ; i < str.length(); i++) {
-        const uchar code = str[i].cell();
-        if (LineChars[code] != 0u) {
-            drawLineChar(painter, x + (_fontWidth * i), y, _fontWidth, _fontHeight, code);
-        } else {
-            drawOtherChar(painter, x + (_fontWidth * i), y, _fontWidth, _fontHeight, code);
-        }
+        LineBlockCharacters::draw(painter, QRect(x + (_fontWidth * i), y, _fontWidth, _fontHeight), str[i], bold);
     }
-
-    painter.setPen(originalPen);
 }
 
 void TerminalDisplay::setKeyboardCursorShape(Enum::CursorShapeEnum shape)
@@ -795,12 +594,16 @@ void TerminalDisplay::setOpacity(qreal opacity)
     }*/
 
     _blendColor = color.rgba();
+    _backgroundLayer = QPixmap();
     updateScrollBarPalette();
+    invalidateLineCache();
 }
 
 void TerminalDisplay::setWallpaper(ColorSchemeWallpaper::Ptr p)
 {
     _wallpaper = p;
+    _backgroundLayer = QPixmap();
+    clearLineCache();
 }
 
 void TerminalDisplay::drawBackground(QPainter& painter, const QRect& rect, const QColor& backgroundColor, bool useOpacitySetting)
@@ -813,7 +616,16 @@ void TerminalDisplay::drawBackground(QPainter& painter, const QRect& rect, const
     // being outside of the terminal display and visual consistency with other KDE
     // applications.
 
-    if (useOpacitySetting && !_wallpaper->isNull() &&
+    if (useOpacitySetting && usesBackgroundLayer() && painter.device() == this) {
+        // the layer replaces what is behind it, so that the display is as
+        // transparent as the layer is
+        const QPixmap& layer = backgroundLayer(backgroundColor);
+        const qreal layerScale = layer.devicePixelRatioF();
+        const QPainter::CompositionMode compositionMode = painter.compositionMode();
+        painter.setCompositionMode(QPainter::CompositionMode_Source);
+        painter.drawPixmap(QRectF(rect), layer, QRectF(QPointF(rect.topLeft()) * layerScale, QSizeF(rect.size()) * layerScale));
+        painter.setCompositionMode(compositionMode);
+    } else if (useOpacitySetting && !_wallpaper->isNull() &&
             _wallpaper->draw(painter, rect, _opacity)) {
     } else if (qAlpha(_blendColor) < 0xff && useOpacitySetting) {
 #if defined(Q_OS_MACOS)
@@ -824,16 +636,61 @@ void TerminalDisplay::drawBackground(QPainter& painter, const QRect& rect, const
         QColor color(backgroundColor);
         color.setAlpha(qAlpha(_blendColor));
 
-        painter.save();
+        const QPainter::CompositionMode compositionMode = painter.compositionMode();
         painter.setCompositionMode(QPainter::CompositionMode_Source);
         painter.fillRect(rect, color);
-        painter.restore();
+        painter.setCompositionMode(compositionMode);
 #endif
     } else {
         painter.fillRect(rect, backgroundColor);
     }
 }
 
+bool TerminalDisplay::usesBackgroundLayer() const
+{
+    // a translucent background is a single color, which is as quick to fill
+    // as to copy, so the layer is only worth its memory for wallpapers
+    return !_wallpaper->isNull();
+}
+
+bool TerminalDisplay::usesTranslucentBackground() const
+{
+#if defined(Q_OS_MACOS)
+    // translucent backgrounds are drawn opaque on MacOS, see drawBackground()
+    return false;
+#else
+    return _wallpaper->isNull() && qAlpha(_blendColor) < 0xff;
+#endif
+}
+
+const QPixmap& TerminalDisplay::backgroundLayer(const QColor& backgroundColor)
+{
+    const qreal scale = devicePixelRatioF();
+    const QSize layerSize(qRound(width() * scale), qRound(height() * scale));
+
+    if (!_backgroundLayer.isNull() && _backgroundLayer.size() == layerSize
+            && _backgroundLayer.devicePixelRatioF() == scale
+            && _backgroundLayerColor == backgroundColor.rgba()) {
+        return _backgroundLayer;
+    }
+
+    // the wallpaper is tiled over the layer and scaled to the display's
+    // scale once, rather than for every area of the display which is painted
+    _backgroundLayer = QPixmap(layerSize);
+    _backgroundLayer.setDevicePixelRatio(scale);
+    _backgroundLayer.fill(Qt::transparent);
+    _backgroundLayerColor = backgroundColor.rgba();
+
+    QPainter painter(&_backgroundLayer);
+    if (!_wallpaper->draw(painter, rect(), _opacity)) {
+        QColor color(backgroundColor);
+        color.setAlpha(qAlpha(_blendColor));
+        painter.fillRect(rect(), color);
+    }
+
+    return _backgroundLayer;
+}
+
 void TerminalDisplay::drawCursor(QPainter& painter,
                                  const QRect& rect,
                                  const QColor& foregroundColor,
@@ -908,6 +765,59 @@ void TerminalDisplay::drawCharacters(QPainter& painter,
     const bool useStrikeOut = ((style->rendition & RE_STRIKEOUT) != 0) || font().strikeOut();
     const bool useOverline = ((style->rendition & RE_OVERLINE) != 0) || font().overline();
 
+    const CharacterColor& textColor = (invertCharacterColor ? style->backgroundColor : style->foregroundColor);
+    const QColor color = textColor.color(_colorTable);
+
+    const bool lineCharString = isLineCharString(text) && !_useFontLineCharacters;
+
+    // draw the text from the glyph cache if it has one glyph per cell, which
+    // is what the glyph cache draws.  line characters always fill their
+    // cells, whatever the font
+    const int deviceType = painter.device()->devType();
+    if ((lineCharString || _fixedFont) && !_printerFriendly
+            && (deviceType == QInternal::Widget || deviceType == QInternal::Pixmap)
+            && text.length() * _fontWidth == rect.width()) {
+        GlyphCache::Style glyphStyle;
+        if (lineCharString) {
+            // like drawLineCharString(), which ignores the font
+            glyphStyle |= GlyphCache::LineCharacters;
+            if (((style->rendition & RE_BOLD) != 0) && _boldIntense) {
+                glyphStyle |= GlyphCache::Bold;
+            }
+        } else {
+            if (useBold) {
+                glyphStyle |= GlyphCache::Bold;
+            }
+            if (useItalic) {
+                glyphStyle |= GlyphCache::Italic;
+            }
+            if (useUnderline) {
+                glyphStyle |= GlyphCache::Underline;
+            }
+            if (useStrikeOut) {
+                glyphStyle |= GlyphCache::StrikeOut;
+            }
+            if (useOverline) {
+                glyphStyle |= GlyphCache::Overline;
+            }
+        }
+
+        // cached glyphs with an opaque background keep subpixel anti-aliasing,
+        // they can only be used where nothing else is drawn behind the text
+        QColor glyphBackground(Qt::transparent);
+        if ((style->rendition & RE_CURSOR) == 0) {
+            const QColor backgroundColor = style->backgroundColor.color(_colorTable);
+            if (backgroundColor != palette().background().color()
+                    || (qAlpha(_blendColor) == 0xff && _wallpaper->isNull())) {
+                glyphBackground = backgroundColor;
+            }
+        }
+
+        if (_glyphCache.drawText(painter, rect.topLeft(), text, glyphStyle, color, glyphBackground)) {
+            return;
+        }
+    }
+
     QFont font = painter.font();
     if (font.bold() != useBold
             || font.underline() != useUnderline
@@ -923,8 +833,6 @@ void TerminalDisplay::drawCharacters(QPainter& painter,
     }
 
     // setup pen
-    const CharacterColor& textColor = (invertCharacterColor ? style->backgroundColor : style->foregroundColor);
-    const QColor color = textColor.color(_colorTable);
     QPen pen = painter.pen();
     if (pen.color() != color) {
         pen.setColor(color);
@@ -932,7 +840,7 @@ void TerminalDisplay::drawCharacters(QPainter& painter,
     }
 
     // draw text
-    if (isLineCharString(text) && !_useFontLineCharacters) {
+    if (lineCharString) {
         drawLineCharString(painter, rect.x(), rect.y(), text, style);
     } else {
         // Force using LTR as the document layout for the terminal area, because
@@ -944,20 +852,86 @@ void TerminalDisplay::drawCharacters(QPainter& painter,
         painter.setClipRect(rect);
         if (_bidiEnabled) {
             painter.drawText(rect.x(), rect.y() + _fontAscent + _lineSpacing, text);
-        } else {
+        } else if (_fixedFont && isAsciiString(text)) {
+            // the advances of the glyphs are the width of a cell
             painter.drawText(rect.x(), rect.y() + _fontAscent + _lineSpacing, LTR_OVERRIDE_CHAR + text);
+        } else {
+            drawTextInCells(painter, rect, text);
         }
         painter.setClipping(false);
     }
 }
 
+void TerminalDisplay::drawTextInCells(QPainter& painter, const QRect& rect, const QString& text)
+{
+    // the text is laid out as a whole, so that the characters missing from
+    // the font are taken from fallback fonts and joining characters are
+    // shaped together.  the glyphs of each character are then moved to the
+    // cell of the character, rather than left where their advances put them
+    QTextLayout layout(LTR_OVERRIDE_CHAR + text, painter.font(), painter.device());
+    layout.beginLayout();
+    const QTextLine line = layout.createLine();
+    layout.endLayout();
+    if (!line.isValid()) {
+        return;
+    }
+
+    const qreal baselineOffset = rect.y() + _fontAscent + _lineSpacing - line.ascent();
+
+    // the glyphs from the same font are drawn together
+    QVector<QGlyphRun> glyphRuns;
+    QVector<QVector<quint32> > glyphIndexes;
+    QVector<QVector<QPointF> > glyphPositions;
+
+    int column = 0;
+    int start = 0;
+    while (start < text.length()) {
+        // combining characters and the low halves of surrogate pairs are in
+        // the cell of the character before them
+        int end = start + 1;
+        while (end < text.length()
+                && (text.at(end).isLowSurrogate()
+                    || konsole_wcwidth(text.at(end).unicode()) <= 0)) {
+            end++;
+        }
+
+        // the layout starts with the LTR override character
+        const qreal offset = rect.x() + column * _fontWidth - line.cursorToX(start + 1);
+
+        foreach (const QGlyphRun& glyphRun, line.glyphRuns(start + 1, end - start)) {
+            int index = 0;
+            while (index < glyphRuns.size()
+                    && (glyphRuns[index].rawFont() != glyphRun.rawFont() || glyphRuns[index].flags() != glyphRun.flags())) {
+                index++;
+            }
+            if (index == glyphRuns.size()) {
+                glyphRuns.append(glyphRun);
+                glyphIndexes.append(QVector<quint32>());
+                glyphPositions.append(QVector<QPointF>());
+            }
+
+            glyphIndexes[index] += glyphRun.glyphIndexes();
+            foreach (const QPointF& position, glyphRun.positions()) {
+                glyphPositions[index].append(QPointF(position.x() + offset, position.y() + baselineOffset));
+            }
+        }
+
+        column += qMax(1, konsole_wcwidth(text.at(start).unicode()));
+        start = end;
+    }
+
+    for (int i = 0; i < glyphRuns.size(); i++) {
+        glyphRuns[i].setGlyphIndexes(glyphIndexes[i]);
+        glyphRuns[i].setPositions(glyphPositions[i]);
+        painter.drawGlyphRun(QPointF(0, 0), glyphRuns[i]);
+    }
+}
+
 void TerminalDisplay::drawTextFragment(QPainter& painter ,
                                        const QRect& rect,
                                        const QString& text,
                                        const Character* style)
 {
-    painter.save();
-
     // setup painter
     const QColor foregroundColor = style->foregroundColor.color(_colorTable);
     const QColor backgroundColor = style->backgroundColor.color(_colorTable);
@@ -977,8 +951,6 @@ void TerminalDisplay::drawTextFragment(QPainter& painter ,
 
     // draw text
     drawCharacters(painter, rect, text, style, invertCharacterColor);
-
-    painter.restore();
 }
 
 void TerminalDisplay::drawPrinterFriendlyTextFragment(QPainter& painter,
@@ -1112,8 +1084,32 @@ void TerminalDisplay::scrollImage(int lines , const QRect& screenWindowRegion)
 
     Q_ASSERT(scrollRect.isValid() && !scrollRect.isEmpty());
 
-    //scroll the display vertically to match internal _image
-    scroll(0 , _fontHeight * (-lines) , scrollRect);
+    //move the cached lines along with the internal _image, the lines
+    //which have scrolled into view are not known yet
+    if (!_cachedLines.isEmpty()) {
+        const auto regionBegin = _cachedLines.begin() + region.top();
+        const auto regionEnd = regionBegin + region.height();
+        if (lines > 0) {
+            std::rotate(regionBegin, regionBegin + lines, regionEnd);
+            for (auto it = regionBegin + linesToMove; it != regionEnd; ++it) {
+                it->valid = false;
+            }
+        } else {
+            std::rotate(regionBegin, regionEnd + lines, regionEnd);
+            for (auto it = regionBegin; it != regionBegin - lines; ++it) {
+                it->valid = false;
+            }
+        }
+    }
+
+    if (usesLineCache()) {
+        //the background stays where it is, so the region is repainted with
+        //the lines drawn over the background from the line cache
+        update(QRect(scrollRect.left(), top, scrollRect.width(), region.height() * _fontHeight));
+    } else {
+        //scroll the display vertically to match internal _image
+        scroll(0 , _fontHeight * (-lines) , scrollRect);
+    }
 }
 
 QRegion TerminalDisplay::hotSpotRegion() const
@@ -1160,6 +1156,11 @@ void TerminalDisplay::processFilters()
         return;
     }
 
+    // the filters are run once the display can be seen again
+    if (!isContentShown()) {
+        return;
+    }
+
     QRegion preUpdateHotSpots = hotSpotRegion();
 
     // use _screenWindow->getImage() here rather than _image because
@@ -1179,21 +1180,57 @@ void TerminalDisplay::processFilters()
     _filterUpdateRequired = false;
 }
 
+bool TerminalDisplay::isContentShown() const
+{
+    if (!isVisible()) {
+        return false;
+    }
+
+    const QWindow *windowHandle = window()->windowHandle();
+    return windowHandle == nullptr || windowHandle->isExposed();
+}
+
+void TerminalDisplay::updatePendingImage()
+{
+    if (!_imageUpdatePending || !isContentShown()) {
+        return;
+    }
+
+    _imageUpdatePending = false;
+
+    // the scrolling which happened in the meantime was not applied to
+    // the line cache
+    invalidateLineCache();
+    updateLineProperties();
+    updateImage();
+    processFilters();
+}
+
 void TerminalDisplay::updateImage()
 {
     if (_screenWindow.isNull()) {
         return;
     }
 
+    // nothing is drawn while the display cannot be seen.  _image keeps what
+    // was last shown, and is compared with the screen window's image once
+    // the display is shown again
+    if (!isContentShown()) {
+        _screenWindow->resetScrollCount();
+        _imageUpdatePending = true;
+        return;
+    }
+
+    // lines which have been moved by scrolling have to be looked at again
+    // for blinking text, even if they are the same as before
+    const bool linesMoved = _screenWindow->scrollCount() != 0;
+
     // optimization - scroll the existing image where possible and
     // avoid expensive text drawing for parts of the image that
     // can simply be moved up or down
-    // disable this shortcut for transparent konsole with scaled pixels, otherwise we get rendering artefacts, see BUG 350651
-    if (!(WindowSystemInfo::HAVE_TRANSPARENCY && (qApp->devicePixelRatio() > 1.0)) && _wallpaper->isNull()) {
-        scrollImage(_screenWindow->scrollCount() ,
-                    _screenWindow->scrollRegion());
-        _screenWindow->resetScrollCount();
-    }
+    scrollImage(_screenWindow->scrollCount() ,
+                _screenWindow->scrollRegion());
+    _screenWindow->resetScrollCount();
 
     if (_image == nullptr) {
         // Create _image.
@@ -1210,97 +1247,61 @@ void TerminalDisplay::updateImage()
     Q_ASSERT(this->_usedLines <= this->_lines);
     Q_ASSERT(this->_usedColumns <= this->_columns);
 
-    int y, x, len;
-
     const QPoint tL  = contentsRect().topLeft();
     const int    tLx = tL.x();
     const int    tLy = tL.y();
-    _hasTextBlinker = false;
-
-    CharacterColor cf;       // undefined
 
     const int linesToUpdate = qMin(this->_lines, qMax(0, lines));
     const int columnsToUpdate = qMin(this->_columns, qMax(0, columns));
+    const bool findAllBlinkingRuns = linesMoved || columnsToUpdate != _usedColumns;
 
-    auto dirtyMask = new char[columnsToUpdate + 2];
-    QRegion dirtyRegion;
+    // the areas to repaint, in the order of the lines.  a QRegion is only
+    // made once all of them are known
+    QVector<QRect> dirtyRects;
+    QVector<QRect> lineRects;
+    int previousDirtyLine = -1;
+    int previousDirtyLineStart = 0;
 
     // debugging variable, this records the number of lines that are found to
     // be 'dirty' ( ie. have changed from the old _image to the new _image ) and
     // which therefore need to be repainted
     int dirtyLineCount = 0;
 
-    for (y = 0; y < linesToUpdate; ++y) {
-        const Character* currentLine = &_image[y * this->_columns];
+    for (int y = 0; y < linesToUpdate; ++y) {
+        Character* const currentLine = &_image[y * this->_columns];
         const Character* const newLine = &newimg[y * columns];
 
-        bool updateLine = false;
-
-        // The dirty mask indicates which characters need repainting. We also
-        // mark surrounding neighbors dirty, in case the character exceeds
-        // its cell boundaries
-        memset(dirtyMask, 0, columnsToUpdate + 2);
+        // most lines do not change from one update to the next, so the lines
+        // are compared as a whole first.  the padding bytes of the characters
+        // can differ between equal lines, lines which are not identical are
+        // compared character by character
+        const bool bytesChanged = memcmp(currentLine, newLine, columnsToUpdate * sizeof(Character)) != 0;
+        const bool lineChanged = bytesChanged && !std::equal(newLine, newLine + columnsToUpdate, currentLine);
 
-        for (x = 0 ; x < columnsToUpdate ; ++x) {
-            if (newLine[x] != currentLine[x]) {
-                dirtyMask[x] = 1;
-            }
+        if (lineChanged && y < _cachedLines.size()) {
+            _cachedLines[y].valid = false;
         }
 
-        if (!_resizing) { // not while _resizing, we're expecting a paintEvent
-            for (x = 0; x < columnsToUpdate; ++x) {
-                _hasTextBlinker |= (newLine[x].rendition & RE_BLINK);
-
-                // Start drawing if this character or the next one differs.
-                // We also take the next one into account to handle the situation
-                // where characters exceed their cell width.
-                if (dirtyMask[x] != 0) {
-                    if (newLine[x + 0].character == 0u) {
-                        continue;
-                    }
-                    const bool lineDraw = newLine[x + 0].isLineChar();
-                    const bool doubleWidth = (x + 1 == columnsToUpdate) ? false : (newLine[x + 1].character == 0);
-                    const RenditionFlags cr = newLine[x].rendition;
-                    const CharacterColor clipboard = newLine[x].backgroundColor;
-                    if (newLine[x].foregroundColor != cf) {
-                        cf = newLine[x].foregroundColor;
-                    }
-                    const int lln = columnsToUpdate - x;
-                    for (len = 1; len < lln; ++len) {
-                        const Character& ch = newLine[x + len];
-
-                        if (ch.character == 0u) {
-                            continue; // Skip trailing part of multi-col chars.
-                        }
-
-                        const bool nextIsDoubleWidth = (x + len + 1 == columnsToUpdate) ? false : (newLine[x + len + 1].character == 0);
-
-                        if (ch.foregroundColor != cf ||
-                                ch.backgroundColor != clipboard ||
-                                (ch.rendition & ~RE_EXTENDED_CHAR) != (cr & ~RE_EXTENDED_CHAR) ||
-                                (dirtyMask[x + len] == 0) ||
-                                ch.isLineChar() != lineDraw ||
-                                nextIsDoubleWidth != doubleWidth) {
-                            break;
-                        }
-                    }
-
-                    const bool saveFixedFont = _fixedFont;
-                    if (lineDraw) {
-                        _fixedFont = false;
-                    }
-                    if (doubleWidth) {
-                        _fixedFont = false;
-                    }
-
-                    updateLine = true;
+        // the blinking text of lines which have not changed is still known
+        if (bytesChanged || findAllBlinkingRuns) {
+            QVector<QPair<int, int> >& runs = _blinkingRuns[y];
+            runs.resize(0);
+            for (int x = 0; x < columnsToUpdate; ++x) {
+                if ((newLine[x].rendition & RE_BLINK) == 0) {
+                    continue;
+                }
 
-                    _fixedFont = saveFixedFont;
-                    x += len - 1;
+                const int start = x;
+                while (x + 1 < columnsToUpdate && (newLine[x + 1].rendition & RE_BLINK) != 0) {
+                    ++x;
                 }
+                runs.append(qMakePair(start, x));
             }
         }
 
+        // not while _resizing, we're expecting a paintEvent
+        bool updateLine = lineChanged && !_resizing;
+
         //both the top and bottom halves of double height _lines must always be redrawn
         //although both top and bottom halves contain the same characters, only
         //the top one is actually
@@ -1314,21 +1315,72 @@ void TerminalDisplay::updateImage()
         if (updateLine) {
             dirtyLineCount++;
 
-            // add the area occupied by this line to the region which needs to be
-            // repainted
-            QRect dirtyRect = QRect(_contentRect.left() + tLx ,
-                                    _contentRect.top() + tLy + _fontHeight * y ,
-                                    _fontWidth * columnsToUpdate ,
-                                    _fontHeight);
+            // add the areas of the line which have changed to the area which
+            // needs to be repainted.  the changed characters are padded by a
+            // character on each side, in case their glyphs exceed their cell
+            // or they are a part of a multi-column character.  The characters
+            // of double width and double height lines are not drawn in the
+            // cells of their columns, these lines are repainted as a whole
+            const int top = _contentRect.top() + tLy + _fontHeight * y;
+            lineRects.resize(0);
+            if (!lineChanged || (_lineProperties.count() > y
+                                 && (_lineProperties[y] & (LINE_DOUBLEWIDTH | LINE_DOUBLEHEIGHT)) != 0)) {
+                lineRects.append(QRect(_contentRect.left() + tLx, top, _fontWidth * columnsToUpdate, _fontHeight));
+            } else {
+                int lastDirty = -2;
+                for (int x = 0; x < columnsToUpdate; ++x) {
+                    if (newLine[x] == currentLine[x]) {
+                        continue;
+                    }
+
+                    const int left = qMax(0, x - 1);
+                    const int right = qMin(columnsToUpdate - 1, x + 1);
+                    if (left <= lastDirty + 1) {
+                        lineRects.last().setRight(_contentRect.left() + tLx + _fontWidth * (right + 1) - 1);
+                    } else {
+                        lineRects.append(QRect(_contentRect.left() + tLx + _fontWidth * left, top,
+                                               _fontWidth * (right - left + 1), _fontHeight));
+                    }
+                    lastDirty = right;
+                }
+            }
 
-            dirtyRegion |= dirtyRect;
+            // lines next to each other which changed in the same columns are
+            // repainted as one rectangle per area
+            bool merged = false;
+            if (previousDirtyLine == y - 1 && dirtyRects.size() - previousDirtyLineStart == lineRects.size()) {
+                merged = true;
+                for (int i = 0; i < lineRects.size(); i++) {
+                    const QRect& previousRect = dirtyRects[previousDirtyLineStart + i];
+                    if (previousRect.left() != lineRects[i].left() || previousRect.right() != lineRects[i].right()) {
+                        merged = false;
+                        break;
+                    }
+                }
+            }
+            if (merged) {
+                for (int i = previousDirtyLineStart; i < dirtyRects.size(); i++) {
+                    dirtyRects[i].setBottom(top + _fontHeight - 1);
+                }
+            } else {
+                previousDirtyLineStart = dirtyRects.size();
+                dirtyRects += lineRects;
+            }
+            previousDirtyLine = y;
         }
 
         // replace the line of characters in the old _image with the
         // current line of the new _image
-        memcpy((void*)currentLine, (const void*)newLine, columnsToUpdate * sizeof(Character));
+        if (bytesChanged) {
+            memcpy((void*)currentLine, (const void*)newLine, columnsToUpdate * sizeof(Character));
+        }
     }
 
+    // the rectangles are sorted, do not overlap and those starting at the
+    // same line have the same height, which is what setRects() expects
+    QRegion dirtyRegion;
+    dirtyRegion.setRects(dirtyRects.constData(), dirtyRects.size());
+
     // if the new _image is smaller than the previous _image, then ensure that the area
     // outside the new _image is cleared
     if (linesToUpdate < _usedLines) {
@@ -1339,6 +1391,9 @@ void TerminalDisplay::updateImage()
     }
     _usedLines = linesToUpdate;
 
+    if (columnsToUpdate != _usedColumns) {
+        invalidateLineCache();
+    }
     if (columnsToUpdate < _usedColumns) {
         dirtyRegion |= QRect(_contentRect.left() + tLx + columnsToUpdate * _fontWidth ,
                              _contentRect.top() + tLy ,
@@ -1352,6 +1407,21 @@ void TerminalDisplay::updateImage()
     // update the parts of the display which have changed
     update(dirtyRegion);
 
+    for (int y = linesToUpdate; y < _blinkingRuns.size(); ++y) {
+        _blinkingRuns[y].resize(0);
+    }
+
+    // not while _resizing, we're expecting a paintEvent
+    _hasTextBlinker = false;
+    if (_allowBlinkingText && !_resizing) {
+        for (int y = 0; y < linesToUpdate; ++y) {
+            if (!_blinkingRuns[y].isEmpty()) {
+                _hasTextBlinker = true;
+                break;
+            }
+        }
+    }
+
     if (_allowBlinkingText && _hasTextBlinker && !_blinkTextTimer->isActive()) {
         _blinkTextTimer->start();
     }
@@ -1359,7 +1429,6 @@ void TerminalDisplay::updateImage()
         _blinkTextTimer->stop();
         _textBlinking = false;
     }
-    delete[] dirtyMask;
 
 #ifndef QT_NO_ACCESSIBILITY
     QAccessibleEvent dataChangeEvent(this, QAccessible::VisibleDataChanged);
@@ -1398,10 +1467,34 @@ void TerminalDisplay::paintEvent(QPaintEvent* pe)
 {
     QPainter paint(this);
 
-    foreach(const QRect & rect, (pe->region() & contentsRect()).rects()) {
-        drawBackground(paint, rect, palette().background().color(),
-                       true /* use opacity setting */);
-        drawContents(paint, rect);
+    const bool useLineCache = usesLineCache();
+    const bool translucent = usesTranslucentBackground();
+    const QVector<QRect> rects = (pe->region() & contentsRect()).rects();
+
+    if (translucent) {
+        // the background replaces what is behind it, so that the display is
+        // as transparent as the background.  The composition mode is set once
+        // for all of the painted areas
+        QColor color(palette().background().color());
+        color.setAlpha(qAlpha(_blendColor));
+
+        paint.setCompositionMode(QPainter::CompositionMode_Source);
+        foreach(const QRect & rect, rects) {
+            paint.fillRect(rect, color);
+        }
+        paint.setCompositionMode(QPainter::CompositionMode_SourceOver);
+    }
+
+    foreach(const QRect & rect, rects) {
+        if (!translucent) {
+            drawBackground(paint, rect, palette().background().color(),
+                           true /* use opacity setting */);
+        }
+        if (useLineCache) {
+            drawCachedContents(paint, rect);
+        } else {
+            drawContents(paint, rect);
+        }
     }
     drawCurrentResultRect(paint);
     drawInputMethodPreeditString(paint, preeditRect());
@@ -1587,6 +1680,17 @@ void TerminalDisplay::drawContents(QPainter& paint, const QRect& rect)
     const int rlx = qMin(_usedColumns - 1, qMax(0, (rect.right()  - tLx - _contentRect.left()) / _fontWidth));
     const int rly = qMin(_usedLines - 1,  qMax(0, (rect.bottom() - tLy - _contentRect.top()) / _fontHeight));
 
+    // the fragments leave the pen and font of the painter as they need them,
+    // rather than each of them saving and restoring its state
+    paint.save();
+
+    // the fragments of text are collected first, and drawn once all of them
+    // are known: their backgrounds merged into as few rectangles as possible,
+    // then the cursor, then their text grouped by font and color
+    QVector<TextFragment> fragments;
+    QString fragmentText;
+    fragmentText.reserve((rlx - lux + 1) * (rly - luy + 1));
+
     const int numberOfColumns = _usedColumns;
     QString unistr;
     unistr.reserve(numberOfColumns);
@@ -1629,47 +1733,59 @@ void TerminalDisplay::drawContents(QPainter& paint, const QRect& rect)
             }
 
             const bool lineDraw = _image[loc(x, y)].isLineChar();
-            const bool doubleWidth = (_image[ qMin(loc(x, y) + 1, _imageSize) ].character == 0);
+            bool doubleWidth = (_image[ qMin(loc(x, y) + 1, _imageSize) ].character == 0);
             const CharacterColor currentForeground = _image[loc(x, y)].foregroundColor;
             const CharacterColor currentBackground = _image[loc(x, y)].backgroundColor;
             const RenditionFlags currentRendition = _image[loc(x, y)].rendition;
 
-            if(_image[loc(x, y)].character <= 0x7e) {
-                while (x + len <= rlx &&
-                        _image[loc(x + len, y)].foregroundColor == currentForeground &&
-                        _image[loc(x + len, y)].backgroundColor == currentBackground &&
-                        (_image[loc(x + len, y)].rendition & ~RE_EXTENDED_CHAR) == (currentRendition & ~RE_EXTENDED_CHAR) &&
-                        (_image[ qMin(loc(x + len, y) + 1, _imageSize) ].character == 0) == doubleWidth &&
-                        _image[loc(x + len, y)].isLineChar() == lineDraw &&
-                        _image[loc(x + len, y)].character <= 0x7e) {
-                    const quint16 c = _image[loc(x + len, y)].character;
-                    if ((_image[loc(x + len, y)].rendition & RE_EXTENDED_CHAR) != 0) {
-                        // sequence of characters
-                        ushort extendedCharLength = 0;
-                        const ushort* chars = ExtendedCharTable::instance.lookupExtendedChar(c, extendedCharLength);
-                        if (chars != nullptr) {
-                            Q_ASSERT(extendedCharLength > 1);
-                            bufferSize += extendedCharLength - 1;
-                            unistr.resize(bufferSize);
-                            disstrU = unistr.data();
-                            for (int index = 0 ; index < extendedCharLength ; index++) {
-                                Q_ASSERT(p < bufferSize);
-                                disstrU[p++] = chars[index];
-                            }
-                        }
-                    } else {
-                        // single character
-                        if (c != 0u) {
+            // the following characters with the same attributes are drawn
+            // along with this one, whatever their width.  drawCharacters()
+            // puts the characters of a run into their cells.  Bidirectional
+            // text is drawn as it is laid out instead, which only keeps
+            // ASCII characters in their cells, so runs end at other ones
+            auto isAsciiCell = [this](int cellX, int cellY) {
+                const Character &cell = _image[loc(cellX, cellY)];
+                return cell.character <= 0x7e && (cell.rendition & RE_EXTENDED_CHAR) == 0;
+            };
+            const bool asciiRun = isAsciiCell(x, y);
+            if (doubleWidth && x + 1 <= rlx) {
+                len++; // Skip trailing part of multi-column character
+            }
+            while (x + len <= rlx &&
+                    _image[loc(x + len, y)].character != 0 &&
+                    (!_bidiEnabled || (asciiRun && isAsciiCell(x + len, y))) &&
+                    _image[loc(x + len, y)].foregroundColor == currentForeground &&
+                    _image[loc(x + len, y)].backgroundColor == currentBackground &&
+                    (_image[loc(x + len, y)].rendition & ~RE_EXTENDED_CHAR) == (currentRendition & ~RE_EXTENDED_CHAR) &&
+                    _image[loc(x + len, y)].isLineChar() == lineDraw) {
+                const quint16 c = _image[loc(x + len, y)].character;
+                if ((_image[loc(x + len, y)].rendition & RE_EXTENDED_CHAR) != 0) {
+                    // sequence of characters
+                    ushort extendedCharLength = 0;
+                    const ushort* chars = ExtendedCharTable::instance.lookupExtendedChar(c, extendedCharLength);
+                    if (chars != nullptr) {
+                        Q_ASSERT(extendedCharLength > 1);
+                        bufferSize += extendedCharLength - 1;
+                        unistr.resize(bufferSize);
+                        disstrU = unistr.data();
+                        for (int index = 0 ; index < extendedCharLength ; index++) {
                             Q_ASSERT(p < bufferSize);
-                            disstrU[p++] = c; //fontMap(c);
+                            disstrU[p++] = chars[index];
                         }
                     }
+                } else {
+                    // single character
+                    Q_ASSERT(p < bufferSize);
+                    disstrU[p++] = c; //fontMap(c);
+                }
 
-                    if (doubleWidth) { // assert((_image[loc(x+len,y)+1].character == 0)), see above if condition
+                if (_image[ qMin(loc(x + len, y) + 1, _imageSize) ].character == 0) {
+                    doubleWidth = true;
+                    if (x + len + 1 <= rlx) {
                         len++; // Skip trailing part of multi-column character
                     }
-                    len++;
                 }
+                len++;
             }
             if ((x + len < _usedColumns) && (_image[loc(x + len, y)].character == 0u)) {
                 len++; // Adjust for trailing part of multi-column character
@@ -1697,38 +1813,62 @@ void TerminalDisplay::drawContents(QPainter& paint, const QRect& rect)
                 }
             }
 
-            //Apply text scaling matrix.
-            paint.setWorldMatrix(textScale, true);
-
-            //calculate the area in which the text will be drawn
-            QRect textArea = QRect(_contentRect.left() + tLx + _fontWidth * x , _contentRect.top() + tLy + _fontHeight * y , _fontWidth * len , _fontHeight);
-
-            //move the calculated area to take account of scaling applied to the painter.
-            //the position of the area from the origin (0,0) is scaled
-            //by the opposite of whatever
-            //transformation has been applied to the painter.  this ensures that
-            //painting does actually start from textArea.topLeft()
-            //(instead of textArea.topLeft() * painter-scale)
-            textArea.moveTopLeft(textScale.inverted().map(textArea.topLeft()));
+            if (!textScale.isIdentity()) {
+                //Apply text scaling matrix.
+                paint.setWorldMatrix(textScale, true);
+
+                //calculate the area in which the text will be drawn
+                QRect textArea = QRect(_contentRect.left() + tLx + _fontWidth * x , _contentRect.top() + tLy + _fontHeight * y , _fontWidth * len , _fontHeight);
+
+                //move the calculated area to take account of scaling applied to the painter.
+                //the position of the area from the origin (0,0) is scaled
+                //by the opposite of whatever
+                //transformation has been applied to the painter.  this ensures that
+                //painting does actually start from textArea.topLeft()
+                //(instead of textArea.topLeft() * painter-scale)
+                textArea.moveTopLeft(textScale.inverted().map(textArea.topLeft()));
+
+                //paint text fragment of double width and double height lines
+                //right away, their backgrounds are scaled along with the text
+                if (_printerFriendly) {
+                    drawPrinterFriendlyTextFragment(paint,
+                                                    textArea,
+                                                    unistr,
+                                                    &_image[loc(x, y)]);
+                } else {
+                    drawTextFragment(paint,
+                                     textArea,
+                                     unistr,
+                                     &_image[loc(x, y)]);
+                }
 
-            //paint text fragment
-            if (_printerFriendly) {
-                drawPrinterFriendlyTextFragment(paint,
-                                                textArea,
-                                                unistr,
-                                                &_image[loc(x, y)]);
+                //reset back to single-width, single-height _lines
+                paint.setWorldMatrix(textScale.inverted(), true);
             } else {
-                drawTextFragment(paint,
-                                 textArea,
-                                 unistr,
-                                 &_image[loc(x, y)]);
+                const Character* style = &_image[loc(x, y)];
+
+                TextFragment fragment;
+                fragment.area = QRect(_contentRect.left() + tLx + _fontWidth * x , _contentRect.top() + tLy + _fontHeight * y , _fontWidth * len , _fontHeight);
+                fragment.textOffset = fragmentText.length();
+                fragment.textLength = unistr.length();
+                fragment.style = style;
+                fragment.foregroundColor = style->foregroundColor.color(_colorTable);
+                fragment.backgroundColor = style->backgroundColor.color(_colorTable);
+                fragment.fixedFont = _fixedFont;
+                fragment.invertCharacterColor = false;
+                fragment.blank = true;
+                for (int i = 0; i < unistr.length(); i++) {
+                    if (unistr.at(i) != QLatin1Char(' ')) {
+                        fragment.blank = false;
+                        break;
+                    }
+                }
+                fragments.append(fragment);
+                fragmentText += unistr;
             }
 
             _fixedFont = save__fixedFont;
 
-            //reset back to single-width, single-height _lines
-            paint.setWorldMatrix(textScale.inverted(), true);
-
             if (y < _lineProperties.size() - 1) {
                 //double-height _lines are represented by two adjacent _lines
                 //containing the same characters
@@ -1743,6 +1883,249 @@ void TerminalDisplay::drawContents(QPainter& paint, const QRect& rect)
             x += len - 1;
         }
     }
+
+    if (_printerFriendly) {
+        foreach (const TextFragment& fragment, fragments) {
+            drawPrinterFriendlyTextFragment(paint,
+                                            fragment.area,
+                                            QString::fromRawData(fragmentText.constData() + fragment.textOffset, fragment.textLength),
+                                            fragment.style);
+        }
+    } else {
+        drawFragments(paint, fragments, fragmentText);
+    }
+
+    paint.restore();
+}
+
+void TerminalDisplay::drawFragments(QPainter& painter, QVector<TextFragment>& fragments, const QString& fragmentText)
+{
+    const QColor displayBackground = palette().background().color();
+
+    // draw the backgrounds which differ from the display's background color.
+    // fragments next to each other with the same background color are merged
+    // into runs, and runs covering the same columns of consecutive lines into
+    // rectangles
+    QVector<QRect> backgroundRects;
+    QVector<QColor> backgroundColors;
+    QVector<int> previousLine; // the rectangles reaching into the line before
+    QVector<int> currentLine;
+    int lineTop = 0;
+
+    for (int i = 0; i < fragments.size();) {
+        const int top = fragments[i].area.top();
+        if (top == lineTop + _fontHeight) {
+            previousLine.swap(currentLine);
+        } else {
+            previousLine.clear();
+        }
+        currentLine.clear();
+        lineTop = top;
+
+        while (i < fragments.size() && fragments[i].area.top() == top) {
+            const QColor& color = fragments[i].backgroundColor;
+            QRect run = fragments[i].area;
+            for (i++; i < fragments.size(); i++) {
+                const TextFragment& fragment = fragments[i];
+                if (fragment.area.top() != top || fragment.area.left() != run.right() + 1
+                        || fragment.backgroundColor != color) {
+                    break;
+                }
+                run.setRight(fragment.area.right());
+            }
+
+            if (color == displayBackground) {
+                continue;
+            }
+
+            int index = -1;
+            foreach (int candidate, previousLine) {
+                if (backgroundRects[candidate].left() == run.left()
+                        && backgroundRects[candidate].right() == run.right()
+                        && backgroundColors[candidate] == color) {
+                    index = candidate;
+                    break;
+                }
+            }
+
+            if (index != -1) {
+                backgroundRects[index].setBottom(run.bottom());
+            } else {
+                index = backgroundRects.size();
+                backgroundRects.append(run);
+                backgroundColors.append(color);
+            }
+            currentLine.append(index);
+        }
+    }
+
+    for (int i = 0; i < backgroundRects.size(); i++) {
+        drawBackground(painter, backgroundRects[i], backgroundColors[i],
+                       false /* do not use transparency */);
+    }
+
+    // draw cursor shape if the fragment contains the cursor
+    // this may alter the foreground and background colors
+    for (int i = 0; i < fragments.size(); i++) {
+        TextFragment& fragment = fragments[i];
+        if ((fragment.style->rendition & RE_CURSOR) != 0) {
+            drawCursor(painter, fragment.area, fragment.foregroundColor, fragment.backgroundColor,
+                       fragment.invertCharacterColor);
+        }
+    }
+
+    // draw the text grouped by font and color, so that the font and pen of
+    // the painter change as rarely as possible.  the fragments do not overlap,
+    // the order they are drawn in does not matter
+    const RenditionFlags decorations = RE_UNDERLINE | RE_STRIKEOUT | RE_OVERLINE;
+    const bool fontDecorations = font().underline() || font().strikeOut() || font().overline();
+    const RenditionFlags fontRendition = RE_BOLD | RE_ITALIC | decorations;
+
+    QVector<QPair<quint64, int> > drawingOrder;
+    drawingOrder.reserve(fragments.size());
+    for (int i = 0; i < fragments.size(); i++) {
+        const TextFragment& fragment = fragments[i];
+
+        // a blank fragment has nothing to draw unless it has lines through it
+        if (fragment.blank && (fragment.style->rendition & decorations) == 0 && !fontDecorations) {
+            continue;
+        }
+
+        const QColor& textColor = fragment.invertCharacterColor ? fragment.backgroundColor : fragment.foregroundColor;
+        const quint64 key = (static_cast<quint64>(fragment.style->rendition & fontRendition) << 32) | textColor.rgba();
+        drawingOrder.append(qMakePair(key, i));
+    }
+    std::sort(drawingOrder.begin(), drawingOrder.end());
+
+    const bool saveFixedFont = _fixedFont;
+    for (int i = 0; i < drawingOrder.size(); i++) {
+        const TextFragment& fragment = fragments[drawingOrder[i].second];
+        _fixedFont = fragment.fixedFont;
+        drawCharacters(painter,
+                       fragment.area,
+                       QString::fromRawData(fragmentText.constData() + fragment.textOffset, fragment.textLength),
+                       fragment.style,
+                       fragment.invertCharacterColor);
+    }
+    _fixedFont = saveFixedFont;
+}
+
+void TerminalDisplay::drawCachedContents(QPainter& paint, const QRect& rect)
+{
+    const QPoint tL  = contentsRect().topLeft();
+    const int    tLx = tL.x();
+    const int    tLy = tL.y();
+
+    const int luy = qMin(_usedLines - 1,  qMax(0, (rect.top()    - tLy - _contentRect.top()) / _fontHeight));
+    const int rly = qMin(_usedLines - 1,  qMax(0, (rect.bottom() - tLy - _contentRect.top()) / _fontHeight));
+
+    const qreal devicePixelRatio = devicePixelRatioF();
+
+    for (int y = luy; y <= rly; y++) {
+        const QRect lineRect(_contentRect.left() + tLx, _contentRect.top() + tLy + _fontHeight * y,
+                             _fontWidth * _usedColumns, _fontHeight);
+
+        // the top half of a double height line is drawn over both halves
+        if (y < _lineProperties.size() && (_lineProperties[y] & LINE_DOUBLEHEIGHT) != 0) {
+            drawContents(paint, rect & lineRect.adjusted(0, 0, 0, _fontHeight));
+            y++;
+            continue;
+        }
+
+        const QRect area = rect & lineRect;
+        if (area.isEmpty()) {
+            continue;
+        }
+
+        if (!isLineCacheable(y)) {
+            drawContents(paint, area);
+            continue;
+        }
+
+        const LineProperty property = y < _lineProperties.size() ? _lineProperties[y] : LINE_DEFAULT;
+        const CachedLine &cachedLine = _cachedLines[y];
+        if (!cachedLine.valid || cachedLine.property != property
+                || cachedLine.pixmap.devicePixelRatio() != devicePixelRatio) {
+            updateCachedLine(y);
+        }
+
+        const QRectF source(QPointF(area.topLeft() - lineRect.topLeft()) * devicePixelRatio,
+                            QSizeF(area.size()) * devicePixelRatio);
+        paint.drawPixmap(QRectF(area), _cachedLines[y].pixmap, source);
+    }
+}
+
+bool TerminalDisplay::usesLineCache() const
+{
+    // moving the pixels of the display would move the wallpaper along with the
+    // text, and leaves artefacts for transparent displays with scaled pixels,
+    // see BUG 350651
+    return !_wallpaper->isNull() || (WindowSystemInfo::HAVE_TRANSPARENCY && (qApp->devicePixelRatio() > 1.0));
+}
+
+bool TerminalDisplay::isLineCacheable(int line) const
+{
+    if (line >= _cachedLines.size()) {
+        return false;
+    }
+
+    // the cursor and blinking text change without the line changing
+    const Character* const characters = &_image[loc(0, line)];
+    for (int x = 0; x < _usedColumns; x++) {
+        if ((characters[x].rendition & (RE_CURSOR | RE_BLINK)) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void TerminalDisplay::updateCachedLine(int line)
+{
+    CachedLine &cachedLine = _cachedLines[line];
+
+    const qreal devicePixelRatio = devicePixelRatioF();
+    const QSize pixelSize = QSize(_fontWidth * _columns, _fontHeight) * devicePixelRatio;
+    if (cachedLine.pixmap.size() != pixelSize || cachedLine.pixmap.devicePixelRatio() != devicePixelRatio) {
+        cachedLine.pixmap = QPixmap(pixelSize);
+        cachedLine.pixmap.setDevicePixelRatio(devicePixelRatio);
+    }
+
+    // the lines of an opaque display are rendered over its background, which
+    // keeps the subpixel anti-aliasing of the text
+    if (qAlpha(_blendColor) == 0xff && _wallpaper->isNull()) {
+        cachedLine.pixmap.fill(palette().background().color());
+    } else {
+        cachedLine.pixmap.fill(Qt::transparent);
+    }
+
+    const QRect lineRect(_contentRect.left() + contentsRect().left(),
+                         _contentRect.top() + contentsRect().top() + _fontHeight * line,
+                         _fontWidth * _usedColumns, _fontHeight);
+
+    QPainter painter(&cachedLine.pixmap);
+    painter.setFont(font());
+    painter.setLayoutDirection(layoutDirection());
+    painter.translate(-lineRect.topLeft());
+    drawContents(painter, lineRect);
+    painter.end();
+
+    cachedLine.property = line < _lineProperties.size() ? _lineProperties[line] : LINE_DEFAULT;
+    cachedLine.valid = true;
+}
+
+void TerminalDisplay::invalidateLineCache()
+{
+    for (auto it = _cachedLines.begin(); it != _cachedLines.end(); ++it) {
+        it->valid = false;
+    }
+}
+
+void TerminalDisplay::clearLineCache()
+{
+    for (auto it = _cachedLines.begin(); it != _cachedLines.end(); ++it) {
+        it->pixmap = QPixmap();
+        it->valid = false;
+    }
 }
 
 void TerminalDisplay::drawCurrentResultRect(QPainter& painter)
@@ -1853,9 +2236,40 @@ void TerminalDisplay::blinkTextEvent()
 
     _textBlinking = !_textBlinking;
 
-    // TODO: Optimize to only repaint the areas of the widget where there is
-    // blinking text rather than repainting the whole widget.
-    update();
+    update(blinkingRegion());
+}
+
+QRegion TerminalDisplay::blinkingRegion() const
+{
+    const QPoint tL = contentsRect().topLeft();
+    QRegion region;
+
+    for (int y = 0; y < qMin(_usedLines, _blinkingRuns.size()); ++y) {
+        const QVector<QPair<int, int> >& runs = _blinkingRuns[y];
+        if (runs.isEmpty()) {
+            continue;
+        }
+
+        const int top = _contentRect.top() + tL.y() + _fontHeight * y;
+
+        // the characters of double width and double height lines are not
+        // drawn in their own cells, these lines are repainted as a whole
+        if (_lineProperties.count() > y && (_lineProperties[y] & (LINE_DOUBLEWIDTH | LINE_DOUBLEHEIGHT)) != 0) {
+            region |= QRect(_contentRect.left() + tL.x(), top, _fontWidth * _usedColumns, _fontHeight);
+            continue;
+        }
+
+        // the runs are padded by a character on each side like changed
+        // characters are in updateImage()
+        foreach (const auto& run, runs) {
+            const int left = qMax(0, run.first - 1);
+            const int right = qMin(_usedColumns - 1, run.second + 1);
+            region |= QRect(_contentRect.left() + tL.x() + _fontWidth * left, top,
+                            _fontWidth * (right - left + 1), _fontHeight);
+        }
+    }
+
+    return region;
 }
 
 void TerminalDisplay::blinkCursorEvent()
@@ -1868,9 +2282,38 @@ void TerminalDisplay::blinkCursorEvent()
 
 void TerminalDisplay::updateCursor()
 {
-    int cursorLocation = loc(cursorPosition().x(), cursorPosition().y());
-    int charWidth = konsole_wcwidth(_image[cursorLocation].character);
-    QRect cursorRect = imageToWidget(QRect(cursorPosition(), QSize(charWidth, 1)));
+    if (_image == nullptr) {
+        return;
+    }
+
+    const QPoint position = cursorPosition();
+    const int cursorLocation = loc(position.x(), position.y());
+    if (cursorLocation < 0 || cursorLocation >= _imageSize) {
+        return;
+    }
+
+    // the cursor is not drawn if it is hidden or has been scrolled out of
+    // view, so there is nothing to repaint
+    if ((_image[cursorLocation].rendition & RE_CURSOR) == 0) {
+        return;
+    }
+
+    const int charWidth = qMax(1, konsole_wcwidth(_image[cursorLocation].character));
+    QRect cursorRect = imageToWidget(QRect(position, QSize(charWidth, 1)));
+
+    // double width lines draw the cursor twice as wide and from twice as far
+    // to the right, double height ones over the line below or above as well
+    if (_lineProperties.count() > position.y()) {
+        const LineProperty property = _lineProperties[position.y()];
+        if ((property & LINE_DOUBLEWIDTH) != 0) {
+            cursorRect.translate(cursorRect.left() - _contentRect.left(), 0);
+            cursorRect.setWidth(cursorRect.width() * 2);
+        }
+        if ((property & LINE_DOUBLEHEIGHT) != 0) {
+            cursorRect.adjust(0, -_fontHeight, 0, _fontHeight);
+        }
+    }
+
     update(cursorRect);
 }
 
@@ -1931,6 +2374,7 @@ void TerminalDisplay::updateImageSize()
 void TerminalDisplay::makeImage()
 {
     _wallpaper->load();
+    _backgroundLayer = QPixmap();
 
     calcGeometry();
 
@@ -1945,6 +2389,9 @@ void TerminalDisplay::makeImage()
     // certain boundary conditions: _image[_imageSize] is a valid but unused position
     _image = new Character[_imageSize + 1];
 
+    _cachedLines = QVector<CachedLine>(_lines);
+    _blinkingRuns = QVector<QVector<QPair<int, int> > >(_lines);
+
     clearImage();
 }
 
@@ -2016,10 +2463,24 @@ QSize TerminalDisplay::sizeHint() const
 void TerminalDisplay::showEvent(QShowEvent*)
 {
     emit changedContentSizeSignal(_contentRect.height(), _contentRect.width());
+
+    // the window handle exists once the display is shown.  Installing the
+    // filter again does not add it twice
+    if (window()->windowHandle() != nullptr) {
+        window()->windowHandle()->installEventFilter(this);
+    }
+
+    updatePendingImage();
 }
 void TerminalDisplay::hideEvent(QHideEvent*)
 {
     emit changedContentSizeSignal(_contentRect.height(), _contentRect.width());
+
+    // hidden displays, like the ones of other tabs, keep none of their
+    // pixmaps.  The cached lines and the layer are rendered again when the
+    // display is shown
+    clearLineCache();
+    _backgroundLayer = QPixmap();
 }
 
 void TerminalDisplay::setMargin(int margin)
@@ -2829,32 +3290,12 @@ void TerminalDisplay::viewScrolledByUser()
 */
 QPoint TerminalDisplay::findLineStart(const QPoint &pnt)
 {
-    const int visibleScreenLines = _lineProperties.size();
     const int topVisibleLine = _screenWindow->currentLine();
-    Screen *screen = _screenWindow->screen();
-    int line = pnt.y();
-    int lineInHistory= line + topVisibleLine;
+    int firstLine = 0;
+    int lastLine = 0;
 
-    QVector<LineProperty> lineProperties = _lineProperties;
-
-    while (lineInHistory > 0) {
-        for (; line > 0; line--, lineInHistory--) {
-            // Does previous line wrap around?
-            if ((lineProperties[line - 1] & LINE_WRAPPED) == 0) {
-                return QPoint(0, lineInHistory - topVisibleLine);
-            }
-        }
-
-        if (lineInHistory < 1) {
-            break;
-        }
-
-        // _lineProperties is only for the visible screen, so grab new data
-        int newRegionStart = qMax(0, lineInHistory - visibleScreenLines);
-        lineProperties = screen->getLineProperties(newRegionStart, lineInHistory - 1);
-        line = lineInHistory - newRegionStart;
-    }
-    return QPoint(0, lineInHistory - topVisibleLine);
+    _screenWindow->screen()->getLogicalLineRange(pnt.y() + topVisibleLine, firstLine, lastLine);
+    return QPoint(0, firstLine - topVisibleLine);
 }
 
 /* Moving right/down from the line containing pnt, return the ending
@@ -2862,27 +3303,12 @@ QPoint TerminalDisplay::findLineStart(const QPoint &pnt)
 */
 QPoint TerminalDisplay::findLineEnd(const QPoint &pnt)
 {
-    const int visibleScreenLines = _lineProperties.size();
     const int topVisibleLine = _screenWindow->currentLine();
-    const int maxY = _screenWindow->lineCount() - 1;
-    Screen *screen = _screenWindow->screen();
-    int line = pnt.y();
-    int lineInHistory= line + topVisibleLine;
-
-    QVector<LineProperty> lineProperties = _lineProperties;
+    int firstLine = 0;
+    int lastLine = 0;
 
-    while (lineInHistory < maxY) {
-        for (; line < lineProperties.count() && lineInHistory < maxY; line++, lineInHistory++) {
-            // Does current line wrap around?
-            if ((lineProperties[line] & LINE_WRAPPED) == 0) {
-                return QPoint(_columns - 1, lineInHistory - topVisibleLine);
-            }
-        }
-
-        line = 0;
-        lineProperties = screen->getLineProperties(lineInHistory, qMin(lineInHistory + visibleScreenLines, maxY));
-    }
-    return QPoint(_columns - 1, lineInHistory - topVisibleLine);
+    _screenWindow->screen()->getLogicalLineRange(pnt.y() + topVisibleLine, firstLine, lastLine);
+    return QPoint(_columns - 1, lastLine - topVisibleLine);
 }
 
 QPoint TerminalDisplay::findWordStart(const QPoint &pnt)
@@ -3425,6 +3851,13 @@ void TerminalDisplay::dismissOutputSuspendedMessage()
     outputSuspended(false);
 }
 
+void TerminalDisplay::releaseCaches()
+{
+    _glyphCache.clear();
+    clearLineCache();
+    _backgroundLayer = QPixmap();
+}
+
 KMessageWidget* TerminalDisplay::createMessageWidget(const QString &text) {
     auto widget = new KMessageWidget(text);
     widget->setWordWrap(true);
@@ -3590,6 +4023,16 @@ bool TerminalDisplay::event(QEvent* event)
     return eventHandled ? true : QWidget::event(event);
 }
 
+bool TerminalDisplay::eventFilter(QObject* watched, QEvent* event)
+{
+    // a window which was minimized or covered is brought up to date before
+    // it is repainted, rather than from within paintEvent()
+    if (event->type() == QEvent::Expose && watched == window()->windowHandle()) {
+        updatePendingImage();
+    }
+    return QWidget::eventFilter(watched, event);
+}
+
 void TerminalDisplay::contextMenuEvent(QContextMenuEvent* event)
 {
     // the logic for the mouse case is within MousePressEvent()
@@ -3661,6 +4104,7 @@ void TerminalDisplay::swapFGBGColors()
     _colorTable[DEFAULT_BACK_COLOR] = _colorTable[DEFAULT_FORE_COLOR];
     _colorTable[DEFAULT_FORE_COLOR] = color;
 
+    invalidateLineCache();
     update();
 }
 
@@ -23,6 +23,7 @@
 
 // Qt
 #include <QColor>
+#include <QPixmap>
 #include <QPointer>
 #include <QWidget>
 
@@ -32,6 +33,7 @@
 #include "ScreenWindow.h"
 #include "ColorScheme.h"
 #include "Enumeration.h"
+#include "GlyphCache.h"
 #include "ScrollState.h"
 
 class QDrag;
@@ -439,6 +441,7 @@ public:
     void setBoldIntense(bool value)
     {
         _boldIntense = value;
+        invalidateLineCache();
     }
 
     /**
@@ -457,6 +460,7 @@ public:
     void setUseFontLineCharacters(bool value)
     {
         _useFontLineCharacters = value;
+        invalidateLineCache();
     }
 
     /**
@@ -494,6 +498,7 @@ public:
     void setBidiEnabled(bool set)
     {
         _bidiEnabled = set;
+        invalidateLineCache();
     }
 
     /**
@@ -726,6 +731,8 @@ Q_SIGNALS:
 
 protected:
     bool event(QEvent *event) Q_DECL_OVERRIDE;
+    // watches the window for being exposed again, see updatePendingImage()
+    bool eventFilter(QObject *watched, QEvent *event) Q_DECL_OVERRIDE;
 
     void paintEvent(QPaintEvent *pe) Q_DECL_OVERRIDE;
 
@@ -803,6 +810,9 @@ private Q_SLOTS:
 
     void dismissOutputSuspendedMessage();
 
+    // drops the rendering caches, they are filled again as the display is painted
+    void releaseCaches();
+
 private:
     Q_DISABLE_COPY(TerminalDisplay)
 
@@ -813,8 +823,29 @@ private:
     // drawTextFragment() or drawPrinterFriendlyTextFragment()
     // to draw the fragments
     void drawContents(QPainter &painter, const QRect &rect);
+    // like drawContents(), but draws the lines from the line cache where
+    // possible, rendering them into it first if necessary
+    void drawCachedContents(QPainter &painter, const QRect &rect);
     // draw a transparent rectangle over the line of the current match
     void drawCurrentResultRect(QPainter &painter);
+    // a section of text with a common color and style, collected by
+    // drawContents() before it is drawn
+    struct TextFragment {
+        QRect area;
+        int textOffset;
+        int textLength;
+        const Character *style;
+        QColor foregroundColor;
+        QColor backgroundColor;
+        bool fixedFont;
+        bool invertCharacterColor;
+        bool blank; // contains nothing but spaces
+    };
+    // draws the fragments collected by drawContents(), whose text is stored
+    // in 'fragmentText'.  the backgrounds of all fragments are drawn first,
+    // then the cursor, then the text
+    void drawFragments(QPainter &painter, QVector<TextFragment> &fragments,
+                       const QString &fragmentText);
     // draws a section of text, all the text in this section
     // has a common color and style
     void drawTextFragment(QPainter &painter, const QRect &rect, const QString &text,
@@ -828,12 +859,25 @@ private:
     // will be drawn fully opaque
     void drawBackground(QPainter &painter, const QRect &rect, const QColor &backgroundColor,
                         bool useOpacitySetting);
+    // returns true if the background drawn with the opacity setting is
+    // copied from the background layer
+    bool usesBackgroundLayer() const;
+    // returns true if the background drawn with the opacity setting is a
+    // translucent color, which replaces what is behind the display
+    bool usesTranslucentBackground() const;
+    // returns the background of the whole display as drawn with the opacity
+    // setting, which is only rendered again when the display's size, scale
+    // or background changes
+    const QPixmap &backgroundLayer(const QColor &backgroundColor);
     // draws the cursor character
     void drawCursor(QPainter &painter, const QRect &rect, const QColor &foregroundColor,
                     const QColor &backgroundColor, bool &invertCharacterColor);
     // draws the characters or line graphics in a text fragment
     void drawCharacters(QPainter &painter, const QRect &rect, const QString &text,
                         const Character *style, bool invertCharacterColor);
+    // draws the characters of a text fragment into the cells they are in,
+    // also where their glyphs are wider or narrower than the cells
+    void drawTextInCells(QPainter &painter, const QRect &rect, const QString &text);
     // draws a string of line graphics
     void drawLineCharString(QPainter &painter, int x, int y, const QString &str,
                             const Character *attributes);
@@ -865,6 +909,26 @@ private:
     // the left and right are ignored.
     void scrollImage(int lines, const QRect &screenWindowRegion);
 
+    // returns true if the display is scrolled by repainting it from the line
+    // cache, rather than by moving its pixels.  this is the case when the
+    // background does not move along with the text
+    bool usesLineCache() const;
+    // returns true if a line can be drawn from the line cache
+    bool isLineCacheable(int line) const;
+    // renders a line of the image into the line cache
+    void updateCachedLine(int line);
+    // marks all lines in the line cache as out of date
+    void invalidateLineCache();
+    // drops the line cache
+    void clearLineCache();
+
+    // returns true if the display can be seen, false if it is hidden or
+    // its window is minimized or covered
+    bool isContentShown() const;
+    // brings the display up to date with its screen window after output was
+    // received while it could not be seen
+    void updatePendingImage();
+
     void calcGeometry();
     void propagateSize();
     void updateImageSize();
@@ -881,6 +945,8 @@ private:
 
     // redraws the cursor
     void updateCursor();
+    // returns the area of the display where there is blinking text
+    QRegion blinkingRegion() const;
 
     bool handleShortcutOverrideEvent(QKeyEvent *keyEvent);
 
@@ -966,6 +1032,9 @@ private:
     bool _textBlinking;   // text is blinking, hide it when drawing
     bool _cursorBlinking;     // cursor is blinking, hide it when drawing
     bool _hasTextBlinker; // has characters to blink
+    // the runs of blinking characters on each line of the image, as the
+    // first and the last column of each run
+    QVector<QVector<QPair<int, int> > > _blinkingRuns; // [lines]
     QTimer *_blinkTextTimer;
     QTimer *_blinkCursorTimer;
 
@@ -997,11 +1066,17 @@ private:
 
     ColorSchemeWallpaper::Ptr _wallpaper;
 
+    // the wallpaper, and the background color it was rendered for
+    QPixmap _backgroundLayer;
+    QRgb _backgroundLayerColor;
+
     // list of filters currently applied to the display.  used for links and
     // search highlight
     TerminalImageFilterChain *_filterChain;
     QRegion _mouseOverHotspotArea;
     bool _filterUpdateRequired;
+    // true if output was received while the display could not be seen
+    bool _imageUpdatePending;
 
     Enum::CursorShapeEnum _cursorShape;
 
@@ -1018,6 +1093,24 @@ private:
     bool _antialiasText;   // do we anti-alias or not
     bool _useFontLineCharacters;
 
+    GlyphCache _glyphCache;
+
+    // the lines of the image rendered for repainting the display when it is
+    // scrolled and its pixels cannot be moved along with the text
+    struct CachedLine {
+        CachedLine() :
+            pixmap(QPixmap()),
+            property(LINE_DEFAULT),
+            valid(false)
+        {
+        }
+
+        QPixmap pixmap;
+        LineProperty property;
+        bool valid;
+    };
+    QVector<CachedLine> _cachedLines; // [lines]
+
     bool _printerFriendly; // are we currently painting to a printer in black/white mode
 
     //the delay in milliseconds between redrawing blinking text
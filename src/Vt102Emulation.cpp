@@ -31,6 +31,7 @@
 #include <QEvent>
 #include <QTimer>
 #include <QKeyEvent>
+#include <QStringList>
 
 // KDE
 #include <KLocalizedString>
@@ -472,10 +473,35 @@ void Vt102Emulation::processWindowAttributeRequest()
       return;
   }
 
+  if (attribute == 133) {
+      processCommandMark(value);
+      return;
+  }
+
   _pendingTitleUpdates[attribute] = value;
   _titleUpdateTimer->start(20);
 }
 
+void Vt102Emulation::processCommandMark(const QString &value)
+{
+    // ESC ] 133 ; <mark> [; <exit code>] ST, see CommandIndex.  marks
+    // other terminals know are ignored
+    const QStringList parameters = value.split(QLatin1Char(';'));
+    const QString &mark = parameters.at(0);
+
+    if (mark == QLatin1String("A")) {
+        _currentScreen->setCommandMark(CommandIndex::PromptStart);
+    } else if (mark == QLatin1String("B")) {
+        _currentScreen->setCommandMark(CommandIndex::CommandStart);
+    } else if (mark == QLatin1String("C")) {
+        _currentScreen->setCommandMark(CommandIndex::OutputStart);
+    } else if (mark == QLatin1String("D")) {
+        bool ok = false;
+        const int exitCode = parameters.count() > 1 ? parameters.at(1).toInt(&ok) : -1;
+        _currentScreen->setCommandMark(CommandIndex::CommandEnd, ok ? exitCode : -1);
+    }
+}
+
 void Vt102Emulation::updateTitle()
 {
     QListIterator<int> iter( _pendingTitleUpdates.keys() );
@@ -151,6 +151,7 @@ private:
 
     void processToken(int code, int p, int q);
     void processWindowAttributeRequest();
+    void processCommandMark(const QString &value);
     void requestWindowAttribute(int);
 
     void reportTerminalType();
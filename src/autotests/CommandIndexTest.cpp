@@ -0,0 +1,165 @@
+/*
+    This file is part of Konsole, a terminal emulator for KDE.
+
+    Copyright 2018 by The Konsole Developers
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+// Own
+#include "CommandIndexTest.h"
+
+// KDE
+#include <qtest.h>
+
+// Konsole
+#include "../CommandIndex.h"
+
+using namespace Konsole;
+
+// three commands, the last one at its prompt:
+//   0  $ ls
+//   1  output
+//   2  output
+//   3  $ false
+//   4  output
+//   5  $
+static void addCommands(CommandIndex &index)
+{
+    index.addMark(CommandIndex::PromptStart, 0, 0);
+    index.addMark(CommandIndex::CommandStart, 0, 2);
+    index.addMark(CommandIndex::OutputStart, 1, 0);
+    index.addMark(CommandIndex::CommandEnd, 3, 0, 0);
+    index.addMark(CommandIndex::PromptStart, 3, 0);
+    index.addMark(CommandIndex::CommandStart, 3, 2);
+    index.addMark(CommandIndex::OutputStart, 4, 0);
+    index.addMark(CommandIndex::CommandEnd, 5, 0, 1);
+    index.addMark(CommandIndex::PromptStart, 5, 0);
+}
+
+void CommandIndexTest::testMarks()
+{
+    CommandIndex index;
+    addCommands(index);
+    QCOMPARE(index.commandCount(), 3);
+
+    const CommandIndex::Command command = index.command(0);
+    QCOMPARE(command.prompt.line, 0);
+    QCOMPARE(command.command.line, 0);
+    QCOMPARE(command.command.column, 2);
+    QCOMPARE(command.output.line, 1);
+    QCOMPARE(command.end.line, 3);
+    QCOMPARE(command.exitCode, 0);
+    QCOMPARE(index.command(1).exitCode, 1);
+    QCOMPARE(index.command(2).output.line, -1);
+
+    CommandIndex::Position start;
+    CommandIndex::Position end;
+    QVERIFY(index.commandOutput(1, start, end));
+    QCOMPARE(start.line, 4);
+    QCOMPARE(end.line, 5);
+    QVERIFY(!index.commandOutput(2, start, end));
+
+    // marks before the prompt of the last command are ignored
+    index.addMark(CommandIndex::OutputStart, 4, 0);
+    QCOMPARE(index.command(2).output.line, -1);
+
+    // without an end mark the output runs until the next prompt
+    index.addMark(CommandIndex::OutputStart, 6, 0);
+    index.addMark(CommandIndex::PromptStart, 8, 0);
+    QVERIFY(index.commandOutput(2, start, end));
+    QCOMPARE(start.line, 6);
+    QCOMPARE(end.line, 8);
+
+    // and while the command is running until the end of the output
+    index.addMark(CommandIndex::OutputStart, 9, 0);
+    QVERIFY(index.commandOutput(3, start, end));
+    QCOMPARE(end.line, -1);
+}
+
+void CommandIndexTest::testFindCommand()
+{
+    CommandIndex index;
+    QCOMPARE(index.findCommand(0), -1);
+    QCOMPARE(index.previousPrompt(10), -1);
+    QCOMPARE(index.nextPrompt(0), -1);
+
+    addCommands(index);
+    QCOMPARE(index.findCommand(0), 0);
+    QCOMPARE(index.findCommand(2), 0);
+    QCOMPARE(index.findCommand(3), 1);
+    QCOMPARE(index.findCommand(10), 2);
+
+    QCOMPARE(index.previousPrompt(0), -1);
+    QCOMPARE(index.previousPrompt(3), 0);
+    QCOMPARE(index.previousPrompt(4), 3);
+    QCOMPARE(index.nextPrompt(0), 3);
+    QCOMPARE(index.nextPrompt(3), 5);
+    QCOMPARE(index.nextPrompt(5), -1);
+}
+
+void CommandIndexTest::testDroppedLines()
+{
+    CommandIndex index;
+    addCommands(index);
+
+    // four lines move into the history, which keeps two of them
+    for (int i = 0; i < 4; i++) {
+        index.addLine();
+    }
+    index.setLineCount(2);
+
+    // the first command still has lines left, its dropped marks are
+    // moved to the first line
+    QCOMPARE(index.commandCount(), 3);
+    QCOMPARE(index.command(0).prompt.line, 0);
+    QCOMPARE(index.command(0).output.line, 0);
+    QCOMPARE(index.command(0).end.line, 1);
+    QCOMPARE(index.findCommand(1), 1);
+    QCOMPARE(index.previousPrompt(1), 0);
+    QCOMPARE(index.nextPrompt(1), 3);
+
+    index.setLineCount(1);
+    QCOMPARE(index.commandCount(), 2);
+    QCOMPARE(index.command(0).prompt.line, 0);
+    QCOMPARE(index.command(1).prompt.line, 2);
+
+    // lines inserted before the others, like restored lines
+    index.setLineCount(4);
+    QCOMPARE(index.command(0).prompt.line, 3);
+    QCOMPARE(index.command(1).prompt.line, 5);
+
+    index.setLineCount(0);
+    index.clear();
+    QCOMPARE(index.commandCount(), 0);
+}
+
+void CommandIndexTest::testRedrawnPrompt()
+{
+    CommandIndex index;
+    addCommands(index);
+
+    // a prompt drawn again replaces the commands at and after its line
+    index.addMark(CommandIndex::PromptStart, 5, 0);
+    QCOMPARE(index.commandCount(), 3);
+
+    // as does a prompt on a cleared screen
+    index.addMark(CommandIndex::PromptStart, 0, 0);
+    QCOMPARE(index.commandCount(), 1);
+    QCOMPARE(index.command(0).output.line, -1);
+}
+
+QTEST_GUILESS_MAIN(CommandIndexTest)
@@ -0,0 +1,234 @@
+/*
+    This file is part of Konsole, a terminal emulator for KDE.
+
+    Copyright 2018 by The Konsole Developers
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+// Own
+#include "GlyphCacheTest.h"
+
+// Qt
+#include <QFontDatabase>
+#include <QFontMetrics>
+#include <QImage>
+
+// KDE
+#include <qtest.h>
+
+// Konsole
+#include "../GlyphCache.h"
+#include "../LineBlockCharacters.h"
+
+using namespace Konsole;
+
+static QFont terminalFont()
+{
+    QFont font = QFontDatabase::systemFont(QFontDatabase::FixedFont);
+    font.setKerning(false);
+    font.setStyleStrategy(QFont::StyleStrategy(font.styleStrategy() | QFont::ForceIntegerMetrics));
+    return font;
+}
+
+static void setupCache(GlyphCache &cache, const QFont &font)
+{
+    const QFontMetrics metrics(font);
+    cache.setFont(font, QSize(metrics.width(QLatin1Char('x')), metrics.height()), metrics.ascent());
+}
+
+static QImage blankImage(const QFont &font, int columns)
+{
+    const QFontMetrics metrics(font);
+    QImage image(columns * metrics.width(QLatin1Char('x')), metrics.height(), QImage::Format_ARGB32_Premultiplied);
+    image.fill(Qt::white);
+    return image;
+}
+
+void GlyphCacheTest::testDrawText()
+{
+    const QFont font = terminalFont();
+    const QFontMetrics metrics(font);
+    const QString text = QStringLiteral("ls -la");
+
+    GlyphCache cache;
+    setupCache(cache, font);
+
+    // drawing the glyphs one per cell gives the same pixels as drawing the
+    // characters on their own
+    QImage cached = blankImage(font, text.length());
+    {
+        QPainter painter(&cached);
+        QVERIFY(cache.drawText(painter, QPoint(0, 0), text, GlyphCache::Style(), Qt::black, Qt::white));
+    }
+
+    QImage drawn = blankImage(font, text.length());
+    {
+        QPainter painter(&drawn);
+        painter.setFont(font);
+        painter.setPen(Qt::black);
+        for (int i = 0; i < text.length(); i++) {
+            const QRect cell(i * metrics.width(QLatin1Char('x')), 0, metrics.width(QLatin1Char('x')), metrics.height());
+            painter.setClipRect(cell);
+            painter.drawText(cell.x(), metrics.ascent(), QString(text.at(i)));
+        }
+    }
+
+    QCOMPARE(cached, drawn);
+}
+
+void GlyphCacheTest::testUncacheableText()
+{
+    const QFont font = terminalFont();
+
+    GlyphCache cache;
+    setupCache(cache, font);
+
+    const QImage blank = blankImage(font, 4);
+
+    // joining, combining and right-to-left characters are left to QPainter,
+    // and nothing is drawn if the text contains one of them
+    const QStringList texts = {
+        QStringLiteral("ab") + QChar(0x0628) + QChar(0x0628),
+        QStringLiteral("ae") + QChar(0x0301) + QStringLiteral("b"),
+        QStringLiteral("a") + QChar(0x05d0) + QStringLiteral("bc"),
+        QStringLiteral("a") + QChar(0x202e) + QStringLiteral("bc")
+    };
+    foreach (const QString &text, texts) {
+        QImage image = blank;
+        QPainter painter(&image);
+        QVERIFY(!cache.drawText(painter, QPoint(0, 0), text, GlyphCache::Style(), Qt::black, Qt::white));
+        painter.end();
+        QCOMPARE(image, blank);
+    }
+
+    // neither are transformed painters
+    QImage image = blank;
+    QPainter painter(&image);
+    painter.scale(2, 1);
+    QVERIFY(!cache.drawText(painter, QPoint(0, 0), QStringLiteral("ab"), GlyphCache::Style(), Qt::black, Qt::white));
+}
+
+void GlyphCacheTest::testAtlases()
+{
+    const QFont font = terminalFont();
+
+    GlyphCache cache;
+    setupCache(cache, font);
+    QCOMPARE(cache.glyphCount(), 0);
+
+    QImage image = blankImage(font, 1);
+    QPainter painter(&image);
+
+    // glyphs are rendered when they are first drawn
+    QVERIFY(cache.drawText(painter, QPoint(0, 0), QStringLiteral("a"), GlyphCache::Style(), Qt::black, Qt::white));
+    QCOMPARE(cache.glyphCount(), 1);
+    QVERIFY(cache.drawText(painter, QPoint(0, 0), QStringLiteral("a"), GlyphCache::Style(), Qt::black, Qt::white));
+    QCOMPARE(cache.glyphCount(), 1);
+    QVERIFY(cache.drawText(painter, QPoint(0, 0), QStringLiteral("b"), GlyphCache::Style(), Qt::black, Qt::white));
+    QCOMPARE(cache.glyphCount(), 2);
+
+    // other colors and styles have atlases of their own
+    QVERIFY(cache.drawText(painter, QPoint(0, 0), QStringLiteral("a"), GlyphCache::Style(), Qt::red, Qt::white));
+    QCOMPARE(cache.glyphCount(), 3);
+    QVERIFY(cache.drawText(painter, QPoint(0, 0), QStringLiteral("a"), GlyphCache::Underline, Qt::black, Qt::white));
+    QCOMPARE(cache.glyphCount(), 4);
+    QCOMPARE(cache.renderedGlyphCount(), 4);
+
+    cache.clear();
+    QCOMPARE(cache.glyphCount(), 0);
+}
+
+void GlyphCacheTest::testAtlasEviction()
+{
+    const QFont font = terminalFont();
+
+    GlyphCache cache;
+    setupCache(cache, font);
+
+    QImage image = blankImage(font, 2);
+    QPainter painter(&image);
+
+    QVERIFY(cache.drawText(painter, QPoint(0, 0), QStringLiteral("ab"), GlyphCache::Style(), Qt::black, Qt::white));
+    QCOMPARE(cache.renderedGlyphCount(), 2);
+
+    // with more colors than atlases, only the least recently used atlas is
+    // dropped for a new one.  The glyphs drawn in between are kept
+    const int colorCount = 2 * GlyphCache::MAX_ATLASES;
+    for (int i = 0; i < colorCount; i++) {
+        QVERIFY(cache.drawText(painter, QPoint(0, 0), QStringLiteral("a"), GlyphCache::Style(), QColor(i, 0, 255), Qt::white));
+        QVERIFY(cache.drawText(painter, QPoint(0, 0), QStringLiteral("ab"), GlyphCache::Style(), Qt::black, Qt::white));
+    }
+    QCOMPARE(cache.renderedGlyphCount(), 2 + colorCount);
+
+    // the most recently used colors are still cached
+    for (int i = colorCount - GlyphCache::MAX_ATLASES + 1; i < colorCount; i++) {
+        QVERIFY(cache.drawText(painter, QPoint(0, 0), QStringLiteral("a"), GlyphCache::Style(), QColor(i, 0, 255), Qt::white));
+    }
+    QCOMPARE(cache.renderedGlyphCount(), 2 + colorCount);
+    QCOMPARE(cache.glyphCount(), 2 + GlyphCache::MAX_ATLASES - 1);
+
+    // the first colors had to be rendered again
+    QVERIFY(cache.drawText(painter, QPoint(0, 0), QStringLiteral("a"), GlyphCache::Style(), QColor(0, 0, 255), Qt::white));
+    QCOMPARE(cache.renderedGlyphCount(), 2 + colorCount + 1);
+}
+
+void GlyphCacheTest::testLineCharacters()
+{
+    const QFont font = terminalFont();
+    const QFontMetrics metrics(font);
+    const QSize cellSize(metrics.width(QLatin1Char('x')), metrics.height());
+    const QString text = QString(QChar(0x250c)) + QChar(0x2500) + QChar(0x2584)
+                         + QChar(0x2592) + QChar(0x28ff) + QChar(0x2847);
+
+    GlyphCache cache;
+    setupCache(cache, font);
+
+    // box drawing, block element and braille characters are cached as drawn
+    // by LineBlockCharacters, in their normal and their bold form
+    for (int bold = 0; bold < 2; bold++) {
+        const GlyphCache::Style style = bold != 0 ? GlyphCache::LineCharacters | GlyphCache::Bold
+                                                  : GlyphCache::Style(GlyphCache::LineCharacters);
+
+        QImage cached = blankImage(font, text.length());
+        {
+            QPainter painter(&cached);
+            QVERIFY(cache.drawText(painter, QPoint(0, 0), text, style, Qt::black, Qt::white));
+        }
+
+        QImage drawn = blankImage(font, text.length());
+        {
+            QPainter painter(&drawn);
+            painter.setPen(Qt::black);
+            for (int i = 0; i < text.length(); i++) {
+                const QRect cell(QPoint(i * cellSize.width(), 0), cellSize);
+                painter.setClipRect(cell);
+                LineBlockCharacters::draw(painter, cell, text.at(i), bold != 0);
+            }
+        }
+
+        QCOMPARE(cached, drawn);
+    }
+    QCOMPARE(cache.glyphCount(), 2 * text.length());
+
+    // other characters are not drawn as line characters
+    QImage image = blankImage(font, 2);
+    QPainter painter(&image);
+    QVERIFY(!cache.drawText(painter, QPoint(0, 0), QStringLiteral("ab"),
+                            GlyphCache::LineCharacters, Qt::black, Qt::white));
+}
+
+QTEST_MAIN(GlyphCacheTest)
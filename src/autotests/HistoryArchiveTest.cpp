@@ -0,0 +1,206 @@
+/*
+    This file is part of Konsole, a terminal emulator for KDE.
+
+    Copyright 2018 by The Konsole Developers
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+// Own
+#include "HistoryArchiveTest.h"
+
+// Qt
+#include <QFile>
+#include <QTemporaryDir>
+
+// KDE
+#include <qtest.h>
+
+// Konsole
+#include "../HistoryArchive.h"
+#include "../Screen.h"
+
+using namespace Konsole;
+
+static void printLine(Screen &screen, const QString &text)
+{
+    for (int i = 0; i < text.length(); i++) {
+        screen.displayCharacter(text[i].unicode());
+    }
+    screen.nextLine();
+}
+
+// a screen of 4 lines of 10 columns with 20 lines of output, some of them
+// wrapped or with combined characters, and an empty line below the prompt
+static Screen *createScreen()
+{
+    auto screen = new Screen(4, 10);
+    screen->setScroll(CompactHistoryType(1000));
+
+    for (int i = 0; i < 20; i++) {
+        printLine(*screen, QStringLiteral("line %1").arg(i));
+        if (i % 5 == 0) {
+            printLine(*screen, QStringLiteral("a line which wraps twice"));
+        }
+        if (i % 7 == 0) {
+            // e followed by a combining acute accent
+            screen->displayCharacter('e');
+            screen->displayCharacter(0x301);
+            screen->nextLine();
+        }
+    }
+    printLine(*screen, QStringLiteral("$"));
+
+    return screen;
+}
+
+static void compareLines(const ScreenSnapshot *snapshot, int snapshotLine,
+                         const HistoryArchive *archive, int archiveLine)
+{
+    const int length = archive->getLineLen(archiveLine);
+    QVERIFY(length <= snapshot->getLineLen(snapshotLine));
+    QCOMPARE(archive->isWrappedLine(archiveLine), snapshot->isWrappedLine(snapshotLine));
+
+    QVector<Character> expected(length);
+    QVector<Character> actual(length);
+    snapshot->getCells(snapshotLine, 0, length, expected.data());
+    archive->getCells(archiveLine, 0, length, actual.data());
+
+    for (int i = 0; i < length; i++) {
+        QCOMPARE(actual[i].character, expected[i].character);
+        QCOMPARE(actual[i].rendition, expected[i].rendition);
+        QVERIFY(actual[i].foregroundColor == expected[i].foregroundColor);
+        QVERIFY(actual[i].backgroundColor == expected[i].backgroundColor);
+    }
+}
+
+void HistoryArchiveTest::testWriteAndOpen()
+{
+    QTemporaryDir dir;
+    const QString fileName = dir.path() + QStringLiteral("/session.history");
+
+    Screen *screen = createScreen();
+    ScreenSnapshot *snapshot = screen->createSnapshot();
+    QVERIFY(HistoryArchive::write(fileName, snapshot));
+    QCOMPARE(QFile::permissions(fileName) & (QFileDevice::ReadGroup | QFileDevice::ReadOther),
+             QFileDevice::Permissions());
+
+    QSharedPointer<HistoryArchive> archive = HistoryArchive::open(fileName);
+    QVERIFY(!archive.isNull());
+
+    // the empty line below the prompt is left out
+    QCOMPARE(archive->getLines(), snapshot->getLines() - 1);
+
+    for (int line = 0; line < archive->getLines(); line++) {
+        compareLines(snapshot, line, archive.data(), line);
+    }
+
+    // the archive stays readable without the file
+    QVERIFY(QFile::remove(fileName));
+    compareLines(snapshot, 0, archive.data(), 0);
+
+    delete snapshot;
+    delete screen;
+}
+
+void HistoryArchiveTest::testRestoredScroll()
+{
+    QTemporaryDir dir;
+    const QString fileName = dir.path() + QStringLiteral("/session.history");
+
+    Screen *screen = createScreen();
+    ScreenSnapshot *snapshot = screen->createSnapshot();
+    QVERIFY(HistoryArchive::write(fileName, snapshot));
+
+    QSharedPointer<HistoryArchive> archive = HistoryArchive::open(fileName);
+    QVERIFY(!archive.isNull());
+    const int archivedLines = archive->getLines();
+
+    const int maxLines = archivedLines + 5;
+    RestoredHistoryScroll scroll(archive, new CompactHistoryScroll(maxLines));
+    QCOMPARE(scroll.getLines(), archivedLines);
+    QCOMPARE(scroll.logicalLines().lineCount(), archivedLines);
+
+    // new lines follow the restored ones, which are dropped first once
+    // the history is full
+    Character line[3];
+    for (int i = 0; i < 10; i++) {
+        scroll.addCells(line, 3);
+        scroll.addLine(false);
+    }
+    QCOMPARE(scroll.getLines(), maxLines);
+    QCOMPARE(scroll.logicalLines().lineCount(), maxLines);
+    compareLines(snapshot, 5, archive.data(), 5);
+    for (int i = 0; i < archivedLines - 5; i++) {
+        QCOMPARE(scroll.getLineLen(i), archive->getLineLen(i + 5));
+        QCOMPARE(scroll.isWrappedLine(i), archive->isWrappedLine(i + 5));
+    }
+    QCOMPARE(scroll.getLineLen(maxLines - 1), 3);
+
+    // converting the scroll keeps the restored lines
+    scroll.setScroll(CompactHistoryType(maxLines - 2).scroll(scroll.takeScroll()));
+    QCOMPARE(scroll.getLines(), maxLines - 2);
+    QCOMPARE(scroll.getType().maximumLineCount(), maxLines - 2);
+    QCOMPARE(scroll.getLineLen(0), archive->getLineLen(7));
+
+    delete snapshot;
+    delete screen;
+}
+
+void HistoryArchiveTest::testInvalidArchive()
+{
+    QTemporaryDir dir;
+    const QString fileName = dir.path() + QStringLiteral("/session.history");
+
+    QVERIFY(HistoryArchive::open(fileName).isNull());
+
+    QFile file(fileName);
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    file.write(QByteArray(1000, 'x'));
+    file.close();
+    QVERIFY(HistoryArchive::open(fileName).isNull());
+
+    // a truncated archive does not have all its lines
+    Screen *screen = createScreen();
+    ScreenSnapshot *snapshot = screen->createSnapshot();
+    QVERIFY(HistoryArchive::write(fileName, snapshot));
+    QVERIFY(file.open(QIODevice::ReadWrite));
+    const qint64 size = file.size();
+    QByteArray data = file.readAll();
+    // cut the line offsets in half
+    QVERIFY(file.resize(size / 2));
+    file.close();
+    QVERIFY(HistoryArchive::open(fileName).isNull());
+
+    // damaged line offsets give empty lines
+    QVERIFY(file.open(QIODevice::WriteOnly));
+    data.replace(size - 200, 100, QByteArray(100, '\xff'));
+    file.write(data);
+    file.close();
+    QSharedPointer<HistoryArchive> archive = HistoryArchive::open(fileName);
+    if (!archive.isNull()) {
+        Character cells[10];
+        for (int line = 0; line < archive->getLines(); line++) {
+            const int length = qMin(archive->getLineLen(line), 10);
+            archive->getCells(line, 0, length, cells);
+        }
+    }
+
+    delete snapshot;
+    delete screen;
+}
+
+QTEST_GUILESS_MAIN(HistoryArchiveTest)
@@ -0,0 +1,182 @@
+/*
+    This file is part of Konsole, a terminal emulator for KDE.
+
+    Copyright 2018 by The Konsole Developers
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+// Own
+#include "HistoryIndexTest.h"
+
+// Qt
+#include <QVector>
+
+// KDE
+#include <qtest.h>
+
+// Konsole
+#include "../HistoryIndex.h"
+
+using namespace Konsole;
+
+static void addLine(HistoryIndex &index, const QString &text, bool wrapped = false)
+{
+    QVector<Character> line(text.length());
+    for (int i = 0; i < text.length(); i++) {
+        line[i] = Character(text[i].unicode());
+    }
+    index.addLine(line.constData(), line.count(), wrapped);
+}
+
+void HistoryIndexTest::testRequiredLiteral_data()
+{
+    QTest::addColumn<QString>("pattern");
+    QTest::addColumn<QString>("literal");
+
+    QTest::newRow("plain") << QStringLiteral("error") << QStringLiteral("error");
+    QTest::newRow("escaped") << QRegularExpression::escape(QStringLiteral("a.out: x"))
+                             << QStringLiteral("a.out: x");
+    QTest::newRow("too short") << QStringLiteral("ab") << QString();
+    QTest::newRow("longest run") << QStringLiteral("ab.*warning\\d+") << QStringLiteral("warning");
+    QTest::newRow("optional character") << QStringLiteral("colou?r") << QStringLiteral("colo");
+    QTest::newRow("repeated character") << QStringLiteral("fooo+bar") << QStringLiteral("fooo");
+    QTest::newRow("counted") << QStringLiteral("xyz{2,3}abcd") << QStringLiteral("abcd");
+    QTest::newRow("class") << QStringLiteral("[0-9]+ files") << QStringLiteral(" files");
+    QTest::newRow("group") << QStringLiteral("(optional)?text") << QStringLiteral("text");
+    QTest::newRow("alternation") << QStringLiteral("error|warning") << QString();
+    QTest::newRow("negated class") << QStringLiteral("error[^x]") << QString();
+    QTest::newRow("space class") << QStringLiteral("error\\sfound") << QString();
+    QTest::newRow("inline options") << QStringLiteral("(?x)e r r o r") << QString();
+}
+
+void HistoryIndexTest::testRequiredLiteral()
+{
+    QFETCH(QString, pattern);
+    QFETCH(QString, literal);
+
+    QCOMPARE(HistoryIndex::requiredLiteral(QRegularExpression(pattern)), literal);
+}
+
+void HistoryIndexTest::testFindCandidates()
+{
+    HistoryIndex index;
+    const int lineCount = 10 * HistoryIndex::LINES_PER_BUCKET;
+
+    for (int i = 0; i < lineCount; i++) {
+        addLine(index, i == 300 ? QStringLiteral("Segmentation Fault") : QStringLiteral("line %1").arg(i));
+    }
+    index.setLineCount(lineCount);
+
+    QVector<QPair<int, int> > lines;
+    QVERIFY(index.findCandidates(QRegularExpression(QStringLiteral("fault"),
+                                                    QRegularExpression::CaseInsensitiveOption), lines));
+    QCOMPARE(lines.count(), 1);
+    QVERIFY(lines[0].first <= 300 && lines[0].second >= 300);
+
+    QVERIFY(index.findCandidates(QRegularExpression(QStringLiteral("not there")), lines));
+    QVERIFY(lines.isEmpty());
+
+    // too short to use the index
+    QVERIFY(!index.findCandidates(QRegularExpression(QStringLiteral("li")), lines));
+
+    QVERIFY(index.memoryUsage() > 0);
+}
+
+void HistoryIndexTest::testWrappedLines()
+{
+    HistoryIndex index;
+
+    // the match spans the end of a bucket and a wrapped line
+    for (int i = 0; i < HistoryIndex::LINES_PER_BUCKET - 1; i++) {
+        addLine(index, QStringLiteral("filler"));
+    }
+    addLine(index, QStringLiteral("a long wrap"), true);
+    addLine(index, QStringLiteral("ped line"));
+    index.setLineCount(HistoryIndex::LINES_PER_BUCKET + 1);
+
+    QVector<QPair<int, int> > lines;
+    QVERIFY(index.findCandidates(QRegularExpression(QStringLiteral("wrapped")), lines));
+    QCOMPARE(lines.count(), 1);
+    QVERIFY(lines[0].first <= HistoryIndex::LINES_PER_BUCKET - 1);
+    QVERIFY(lines[0].second >= HistoryIndex::LINES_PER_BUCKET - 1);
+}
+
+void HistoryIndexTest::testDroppedLines()
+{
+    HistoryIndex index;
+    const int maxLines = 2 * HistoryIndex::LINES_PER_BUCKET;
+
+    // keep the last maxLines lines, like a compact history does
+    for (int i = 0; i < 200 * HistoryIndex::LINES_PER_BUCKET; i++) {
+        addLine(index, QStringLiteral("line %1").arg(i));
+        index.setLineCount(qMin(i + 1, maxLines));
+    }
+    QCOMPARE(index.lineCount(), maxLines);
+
+    // line 0 has been dropped
+    QVector<QPair<int, int> > lines;
+    QVERIFY(index.findCandidates(QRegularExpression(QStringLiteral("line 0$")), lines));
+    QVERIFY(lines.isEmpty());
+
+    // the line numbers of the remaining lines start at 0
+    const QString lastText = QStringLiteral("line %1").arg(200 * HistoryIndex::LINES_PER_BUCKET - 1);
+    QVERIFY(index.findCandidates(QRegularExpression(lastText), lines));
+    QCOMPARE(lines.count(), 1);
+    QCOMPARE(lines[0].second, maxLines - 1);
+
+    index.clear();
+    QCOMPARE(index.lineCount(), 0);
+    QVERIFY(index.findCandidates(QRegularExpression(lastText), lines));
+    QVERIFY(lines.isEmpty());
+}
+
+void HistoryIndexTest::testUnindexedLines()
+{
+    HistoryIndex index;
+    addLine(index, QStringLiteral("first indexed line"));
+    index.setLineCount(1);
+
+    // lines put before the indexed ones are candidates for every search,
+    // the indexed lines move down
+    index.prependUnindexedLines(10);
+    QCOMPARE(index.lineCount(), 11);
+
+    QVector<QPair<int, int> > lines;
+    QVERIFY(index.findCandidates(QRegularExpression(QStringLiteral("indexed")), lines));
+    QCOMPARE(lines.count(), 2);
+    QCOMPARE(lines[0], qMakePair(0, 9));
+    QCOMPARE(lines[1], qMakePair(10, 10));
+
+    QVERIFY(index.findCandidates(QRegularExpression(QStringLiteral("missing")), lines));
+    QCOMPARE(lines.count(), 1);
+    QCOMPARE(lines[0], qMakePair(0, 9));
+
+    // they are the oldest lines, and are dropped first
+    addLine(index, QStringLiteral("second indexed line"));
+    index.setLineCount(5);
+    QVERIFY(index.findCandidates(QRegularExpression(QStringLiteral("indexed")), lines));
+    QCOMPARE(lines.count(), 2);
+    QCOMPARE(lines[0], qMakePair(0, 2));
+    QCOMPARE(lines[1], qMakePair(3, 4));
+
+    index.setLineCount(1);
+    QVERIFY(index.findCandidates(QRegularExpression(QStringLiteral("second")), lines));
+    QCOMPARE(lines.count(), 1);
+    QCOMPARE(lines[0], qMakePair(0, 0));
+}
+
+QTEST_GUILESS_MAIN(HistoryIndexTest)
@@ -26,6 +26,9 @@
 #include "../Session.h"
 #include "../Emulation.h"
 #include "../History.h"
+#include "../HistoryMigration.h"
+#include "../Screen.h"
+#include "../TerminalCharacterDecoder.h"
 
 using namespace Konsole;
 
@@ -140,4 +143,427 @@ void HistoryTest::testHistoryScroll()
     delete historyScroll;
 }
 
+void HistoryTest::testHistoryReleaseMemory()
+{
+    const int lineCount = 20000;
+    const int lineLength = 80;
+
+    QList<HistoryScroll *> scrolls;
+    scrolls << new CompactHistoryScroll(lineCount) << new HistoryScrollFile(QStringLiteral("test.log"));
+
+    foreach (HistoryScroll *historyScroll, scrolls) {
+        Character line[lineLength];
+        for (int i = 0; i < lineCount; i++) {
+            for (int j = 0; j < lineLength; j++) {
+                line[j] = Character(QLatin1Char('a' + (i + j) % 26).unicode());
+            }
+            historyScroll->addCells(line, lineLength);
+            historyScroll->addLine(i % 2 == 0);
+        }
+
+        historyScroll->releaseMemory();
+
+        // the contents must survive giving memory back
+        QCOMPARE(historyScroll->getLines(), lineCount);
+        for (int i = 0; i < lineCount; i += 997) {
+            QCOMPARE(historyScroll->getLineLen(i), lineLength);
+            QCOMPARE(historyScroll->isWrappedLine(i), i % 2 == 0);
+            historyScroll->getCells(i, 0, lineLength, line);
+            for (int j = 0; j < lineLength; j++) {
+                QCOMPARE(line[j].character, QLatin1Char('a' + (i + j) % 26).unicode());
+            }
+        }
+
+        delete historyScroll;
+    }
+}
+
+void HistoryTest::testHistorySnapshot()
+{
+    const int lineCount = 5000;
+    const int lineLength = 80;
+
+    QList<HistoryScroll *> scrolls;
+    scrolls << new CompactHistoryScroll(lineCount) << new HistoryScrollFile(QStringLiteral("test.log"))
+            << new HistoryScrollNone();
+
+    foreach (HistoryScroll *historyScroll, scrolls) {
+        Character line[lineLength];
+        for (int i = 0; i < lineCount; i++) {
+            for (int j = 0; j < lineLength; j++) {
+                line[j] = Character(QLatin1Char('a' + (i + j) % 26).unicode());
+            }
+            historyScroll->addCells(line, lineLength);
+            historyScroll->addLine(i % 2 == 0);
+        }
+
+        const int snapshotLines = historyScroll->getLines();
+        HistorySnapshot *snapshot = historyScroll->createSnapshot();
+        QCOMPARE(snapshot->getLines(), snapshotLines);
+
+        // lines added later, which drop the compact history's old lines,
+        // do not change the snapshot, nor does deleting the scroll
+        for (int i = 0; i < lineCount; i++) {
+            for (int j = 0; j < lineLength; j++) {
+                line[j] = Character('-');
+            }
+            historyScroll->addCells(line, lineLength);
+            historyScroll->addLine(false);
+        }
+        delete historyScroll;
+
+        QCOMPARE(snapshot->getLines(), snapshotLines);
+        for (int i = 0; i < snapshotLines; i += 97) {
+            QCOMPARE(snapshot->getLineLen(i), lineLength);
+            QCOMPARE(snapshot->isWrappedLine(i), i % 2 == 0);
+            snapshot->getCells(i, 0, lineLength, line);
+            for (int j = 0; j < lineLength; j++) {
+                QCOMPARE(line[j].character, QLatin1Char('a' + (i + j) % 26).unicode());
+            }
+        }
+
+        delete snapshot;
+    }
+}
+
+void HistoryTest::testHistoryLineText()
+{
+    const int lineCount = 3000;
+    const QString text = QStringLiteral("  some text in the history  ");
+    const int length = text.length();
+
+    CompactHistoryScroll historyScroll(lineCount);
+    QVector<Character> line(length);
+
+    // alternate plain lines, lines with format changes, and lines with a
+    // double width character, enough of them to fill several blocks
+    for (int i = 0; i < lineCount; i++) {
+        for (int j = 0; j < length; j++) {
+            line[j] = Character(text[j].unicode());
+            if (i % 3 == 1 && j >= 5) {
+                line[j].foregroundColor = CharacterColor(COLOR_SPACE_SYSTEM, j % 8);
+            }
+        }
+        if (i % 3 == 2) {
+            line[7] = Character(0x4E2D);
+            line[8] = Character(0);
+        }
+        historyScroll.addCellsVector(line);
+        historyScroll.addLine(false);
+    }
+
+    PlainTextDecoder decoder;
+    for (int trimWhitespace = 0; trimWhitespace < 2; trimWhitespace++) {
+        decoder.setLeadingWhitespace(trimWhitespace == 0);
+        decoder.setTrailingWhitespace(trimWhitespace == 0);
+
+        for (int i = 0; i < lineCount; i++) {
+            int textLength = -1;
+            const QChar *lineText = historyScroll.getLineText(i, textLength);
+            QCOMPARE(lineText == nullptr, i % 3 == 2);
+            QCOMPARE(textLength, length);
+
+            // the formats are merged back in
+            historyScroll.getCells(i, 0, length, line.data());
+            for (int j = 0; j < length; j++) {
+                QCOMPARE(line[j].foregroundColor, i % 3 == 1 && j >= 5
+                         ? CharacterColor(COLOR_SPACE_SYSTEM, j % 8) : CharacterColor());
+            }
+            if (lineText == nullptr) {
+                continue;
+            }
+
+            QCOMPARE(QString(lineText, textLength), text);
+
+            // the text decodes the same way as the cells do
+            QString decodedCells;
+            QTextStream cellsStream(&decodedCells);
+            line.append(Character('\n'));
+            decoder.begin(&cellsStream);
+            decoder.decodeLine(line.constData(), line.size(), LINE_DEFAULT);
+            decoder.end();
+            line.removeLast();
+
+            QString decodedText;
+            QTextStream textStream(&decodedText);
+            decoder.begin(&textStream);
+            decoder.decodeText(lineText, textLength, QLatin1Char('\n'));
+            decoder.end();
+
+            QCOMPARE(decodedText, decodedCells);
+        }
+    }
+}
+
+void HistoryTest::testLogicalLines()
+{
+    const int maxLines = 10;
+    CompactHistoryScroll historyScroll(maxLines);
+    Character line[4];
+
+    // logical lines of 1, 2, 3, 1, 2, 3, ... lines
+    int added = 0;
+    for (int length = 1; added < 25; length = length % 3 + 1) {
+        for (int i = 0; i < length; i++, added++) {
+            historyScroll.addCells(line, 4);
+            historyScroll.addLine(i < length - 1);
+        }
+    }
+    // the last logical line continues on the screen
+    historyScroll.addCells(line, 4);
+    historyScroll.addLine(true);
+    added++;
+
+    // the lines left are 15-17 | 18 | 19-20 | 21-23 | 24 | 25...
+    const LogicalLineIndex &index = historyScroll.logicalLines();
+    QCOMPARE(historyScroll.getLines(), 11);
+    QCOMPARE(index.lineCount(), historyScroll.getLines());
+    QCOMPARE(index.logicalLineCount(), 6);
+    QVERIFY(index.isLastLineWrapped());
+
+    const int firstLines[] = {0, 3, 4, 6, 9, 10};
+    const int lastLines[] = {2, 3, 5, 8, 9, 10};
+    for (int logicalLine = 0; logicalLine < 6; logicalLine++) {
+        QCOMPARE(index.logicalLineStart(logicalLine), firstLines[logicalLine]);
+        QCOMPARE(index.logicalLineEnd(logicalLine), lastLines[logicalLine]);
+        for (int i = firstLines[logicalLine]; i <= lastLines[logicalLine]; i++) {
+            QCOMPARE(index.logicalLineOf(i), logicalLine);
+            QCOMPARE(historyScroll.isWrappedLine(i), i < lastLines[logicalLine] || logicalLine == 5);
+        }
+    }
+
+    // the first logical line is cut when its first lines are dropped
+    historyScroll.setMaxNbLines(10);
+    QCOMPARE(index.logicalLineCount(), 6);
+    QCOMPARE(index.logicalLineStart(0), 0);
+    QCOMPARE(index.logicalLineEnd(0), 1);
+    historyScroll.setMaxNbLines(8);
+    QCOMPARE(index.logicalLineCount(), 5);
+    QCOMPARE(index.logicalLineOf(0), 0);
+    QCOMPARE(index.logicalLineEnd(0), 0);
+    QCOMPARE(index.logicalLineStart(1), 1);
+    QCOMPARE(index.logicalLineEnd(1), 2);
+}
+
+void HistoryTest::testHistoryMigration()
+{
+    const int lineCount = 2 * MigratingHistoryScroll::MIN_LINES;
+    const int maxLines = lineCount + 10;
+    auto compactScroll = new CompactHistoryScroll(maxLines);
+
+    // lines of 1 to 10 characters, numbered by their first character
+    Character line[10];
+    for (int i = 0; i < lineCount; i++) {
+        line[0] = Character(i);
+        compactScroll->addCells(line, i % 10 + 1);
+        compactScroll->addLine(i % 3 == 0);
+    }
+
+    MigratingHistoryScroll migration(compactScroll, HistoryTypeFile().scroll(nullptr));
+    QVERIFY(migration.getType().isUnlimited());
+    migration.thread()->start();
+
+    // lines added during the conversion go to the previous history, which
+    // drops its first lines meanwhile
+    for (int i = lineCount; i < lineCount + 20; i++) {
+        line[0] = Character(i);
+        migration.addCells(line, i % 10 + 1);
+        migration.addLine(i % 3 == 0);
+    }
+    const int previousLines = migration.getLines();
+    QCOMPARE(previousLines, maxLines + 1);
+    QCOMPARE(migration.logicalLines().lineCount(), previousLines);
+    migration.getCells(0, 0, 1, line);
+    QCOMPARE(static_cast<int>(line[0].character), lineCount + 20 - previousLines);
+
+    QVERIFY(migration.thread()->wait(10000));
+    QVERIFY(migration.isFinished());
+
+    // the new history keeps all lines
+    QScopedPointer<HistoryScroll> fileScroll(migration.takeTarget());
+    QCOMPARE(fileScroll->getLines(), lineCount + 20);
+    QCOMPARE(fileScroll->logicalLines().lineCount(), lineCount + 20);
+    for (int i = 0; i < lineCount + 20; i++) {
+        QCOMPARE(fileScroll->getLineLen(i), i % 10 + 1);
+        QCOMPARE(fileScroll->isWrappedLine(i), i % 3 == 0);
+        fileScroll->getCells(i, 0, 1, line);
+        QCOMPARE(static_cast<int>(line[0].character), i);
+    }
+}
+
+void HistoryTest::testLongLines()
+{
+    // longer than 16 bit positions and than a block of the compact history
+    const int length = 200000;
+    CompactHistoryScroll historyScroll(10);
+
+    QVector<Character> line(length);
+    for (int i = 0; i < length; i++) {
+        line[i] = Character('a' + i % 26);
+        line[i].foregroundColor = CharacterColor(COLOR_SPACE_SYSTEM, (i / 1000) % 8);
+    }
+    historyScroll.addCellsVector(line);
+    historyScroll.addLine(false);
+    historyScroll.addCellsVector(line.mid(0, 10));
+    historyScroll.addLine(false);
+
+    QCOMPARE(historyScroll.getLineLen(0), length);
+    QCOMPARE(historyScroll.getLineLen(1), 10);
+
+    // the text of long lines is not in one piece
+    int textLength = -1;
+    QVERIFY(historyScroll.getLineText(0, textLength) == nullptr);
+    QVERIFY(historyScroll.getLineText(1, textLength) != nullptr);
+
+    // slices across segments and at the end of the line
+    const int starts[] = {0, CompactHistoryLine::SEGMENT_LENGTH - 5, 65530, length - 7};
+    for (int start : starts) {
+        const int count = qMin(3 * CompactHistoryLine::SEGMENT_LENGTH, length - start);
+        QVector<Character> cells(count);
+        historyScroll.getCells(0, start, count, cells.data());
+        for (int i = 0; i < count; i++) {
+            QCOMPARE(cells[i].character, line[start + i].character);
+            QCOMPARE(cells[i].foregroundColor, line[start + i].foregroundColor);
+        }
+    }
+
+    // the line is dropped like any other one
+    for (int i = 0; i < 20; i++) {
+        historyScroll.addCellsVector(line.mid(0, 10));
+        historyScroll.addLine(false);
+    }
+    QCOMPARE(historyScroll.getLineLen(0), 10);
+}
+
+void HistoryTest::testLineRange()
+{
+    HistoryScrollFile fileScroll(QStringLiteral("test.log"));
+    CompactHistoryScroll compactScroll(1000);
+    HistoryScroll *scrolls[] = {&fileScroll, &compactScroll};
+
+    // only the file history is faster to read in ranges
+    QVERIFY(fileScroll.readsLineRanges());
+    QVERIFY(!compactScroll.readsLineRanges());
+
+    // lines of 0 to 99 characters, numbered by their first character
+    Character line[100];
+    for (HistoryScroll *scroll : scrolls) {
+        for (int i = 0; i < 500; i++) {
+            line[0] = Character(i);
+            scroll->addCells(line, i % 100);
+            scroll->addLine(i % 7 == 0);
+        }
+    }
+
+    HistoryLineRange range;
+    for (HistoryScroll *scroll : scrolls) {
+        // ranges starting at the first line, within and at the end of the history
+        const int ranges[][2] = {{0, 10}, {0, 1}, {250, 100}, {499, 1}, {0, 500}};
+        for (const auto &r : ranges) {
+            scroll->getLineRange(r[0], r[1], range);
+            QCOMPARE(range.firstLine(), r[0]);
+            QCOMPARE(range.lineCount(), r[1]);
+            for (int i = r[0]; i < r[0] + r[1]; i++) {
+                QCOMPARE(range.lineLength(i), i % 100);
+                QCOMPARE(range.isWrappedLine(i), i % 7 == 0);
+                if (range.lineLength(i) > 0) {
+                    QCOMPARE(static_cast<int>(range.lineCells(i)[0].character), i);
+                }
+            }
+            QVERIFY(!range.contains(r[0] + r[1]));
+        }
+
+        // snapshots read their lines from memory
+        QScopedPointer<HistorySnapshot> snapshot(scroll->createSnapshot());
+        QVERIFY(!snapshot->readsLineRanges());
+    }
+
+    // lines read one by one backwards and forwards, while lines are added
+    for (int i = 499; i >= 0; i--) {
+        QCOMPARE(fileScroll.getLineLen(i), i % 100);
+    }
+    for (int i = 500; i < 600; i++) {
+        line[0] = Character(i);
+        fileScroll.addCells(line, i % 100);
+        fileScroll.addLine(false);
+        for (int j = i - 2; j <= i; j++) {
+            QCOMPARE(fileScroll.getLineLen(j), j % 100);
+            if (j % 100 > 0) {
+                fileScroll.getCells(j, 0, 1, line);
+                QCOMPARE(static_cast<int>(line[0].character), j);
+            }
+        }
+    }
+}
+
+void HistoryTest::testLineTimestamps()
+{
+    // lines added a few milliseconds apart, across several chunks
+    LineTimestamps timestamps;
+    const qint64 start = 1500000000000;
+    const int lineCount = 3 * LineTimestamps::LINES_PER_CHUNK + 10;
+    for (int i = 0; i < lineCount; i++) {
+        timestamps.addLine(start + 3 * i);
+    }
+    QCOMPARE(timestamps.lineCount(), lineCount);
+    QCOMPARE(timestamps.timestamp(0), start);
+    QCOMPARE(timestamps.timestamp(lineCount - 1), start + 3 * (lineCount - 1));
+
+    // about a byte per line, rather than the eight of a qint64
+    QVERIFY(timestamps.memoryUsage() < 4 * lineCount);
+
+    // dropping lines keeps the times of the remaining ones
+    timestamps.removeLines(LineTimestamps::LINES_PER_CHUNK + 5);
+    QCOMPARE(timestamps.lineCount(), lineCount - LineTimestamps::LINES_PER_CHUNK - 5);
+    QCOMPARE(timestamps.timestamp(0), start + 3 * (LineTimestamps::LINES_PER_CHUNK + 5));
+    QCOMPARE(timestamps.timestamp(5), start + 3 * (LineTimestamps::LINES_PER_CHUNK + 10));
+
+    // times never go backwards
+    timestamps.addLine(start);
+    QCOMPARE(timestamps.timestamp(timestamps.lineCount() - 1), start + 3 * (lineCount - 1));
+
+    // the scrolls record the times of their lines, and their snapshots too
+    HistoryScrollFile fileScroll(QStringLiteral("test.log"));
+    CompactHistoryScroll compactScroll(10);
+    HistoryScroll *scrolls[] = {&fileScroll, &compactScroll};
+    Character line[10];
+    for (HistoryScroll *scroll : scrolls) {
+        const qint64 before = LineTimestamps::currentTime();
+        scroll->addCells(line, 10);
+        scroll->addLine(false);
+        QVERIFY(scroll->getLineTimestamp(0) >= before - 100);
+
+        for (int i = 0; i < 20; i++) {
+            scroll->addCells(line, 10);
+            scroll->setNextLineTimestamp(start + i);
+            scroll->addLine(false);
+        }
+        const int lines = scroll->getLines();
+        QCOMPARE(scroll->getLineTimestamp(lines - 1), start + 19);
+        QCOMPARE(scroll->getLineTimestamp(lines), qint64(0));
+
+        QScopedPointer<HistorySnapshot> snapshot(scroll->createSnapshot());
+        QCOMPARE(snapshot->getLineTimestamp(lines - 10), start + 10);
+    }
+
+    // lines keep the time the screen wrote them, not the time they
+    // scrolled into the history
+    Screen screen(2, 10);
+    screen.setScroll(CompactHistoryType(10));
+    const qint64 written = LineTimestamps::currentTime();
+    screen.displayCharacter('a');
+    QScopedPointer<ScreenSnapshot> before(screen.createSnapshot());
+    const qint64 lineTime = before->getLineTimestamp(0);
+    QVERIFY(lineTime >= written - 100);
+    QCOMPARE(before->getLineTimestamp(1), qint64(0));
+
+    QTest::qSleep(300);
+    screen.nextLine();
+    screen.nextLine();
+    QScopedPointer<ScreenSnapshot> after(screen.createSnapshot());
+    QCOMPARE(after->getHistLines(), 1);
+    QCOMPARE(after->getLineTimestamp(0), lineTime);
+    QVERIFY(after->getLineTimestamp(1) >= lineTime + 200);
+}
+
 QTEST_MAIN(HistoryTest)
@@ -35,6 +35,14 @@ private Q_SLOTS:
     void testCompactHistory();
     void testEmulationHistory();
     void testHistoryScroll();
+    void testHistoryReleaseMemory();
+    void testHistorySnapshot();
+    void testHistoryLineText();
+    void testLogicalLines();
+    void testHistoryMigration();
+    void testLongLines();
+    void testLineRange();
+    void testLineTimestamps();
 
 private:
 };
@@ -0,0 +1,103 @@
+/*
+    This file is part of Konsole, a terminal emulator for KDE.
+
+    Copyright 2018 by The Konsole Developers
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+
+// Own
+#include "ScrollAllocationBenchmark.h"
+
+// Qt
+#include <QAtomicInt>
+
+// KDE
+#include <qtest.h>
+
+// Konsole
+#include "../Emulation.h"
+#include "../History.h"
+#include "../Session.h"
+
+using namespace Konsole;
+
+#if defined(__GLIBC__)
+// the allocations are counted by replacing malloc(), which the GNU C library
+// makes possible.  This affects the whole executable, so it is kept apart
+// from the other tests, and it is not built with sanitizers, which replace
+// malloc() themselves
+extern "C" {
+void *__libc_malloc(size_t size);
+void *__libc_calloc(size_t count, size_t size);
+void *__libc_realloc(void *pointer, size_t size);
+}
+
+static QAtomicInt allocationCount;
+
+extern "C" void *malloc(size_t size)
+{
+    allocationCount.ref();
+    return __libc_malloc(size);
+}
+
+extern "C" void *calloc(size_t count, size_t size)
+{
+    allocationCount.ref();
+    return __libc_calloc(count, size);
+}
+
+extern "C" void *realloc(void *pointer, size_t size)
+{
+    allocationCount.ref();
+    return __libc_realloc(pointer, size);
+}
+#endif
+
+void ScrollAllocationBenchmark::testScrollAllocations()
+{
+#if !defined(__GLIBC__)
+    QSKIP("Allocations are only counted with the GNU C library");
+#else
+    const int lineCount = 1000;
+
+    auto session = new Session();
+    Emulation *emulation = session->emulation();
+    emulation->setHistory(CompactHistoryType(lineCount));
+
+    QByteArray output;
+    for (int i = 0; i < lineCount; i++) {
+        output += QByteArray(emulation->imageSize().width() - 1, 'x') + "\r\n";
+    }
+
+    // the history is filled first, from then on each line added drops one.
+    // The second round makes sure the buffers have grown to their size
+    emulation->receiveData(output.constData(), output.size());
+    emulation->receiveData(output.constData(), output.size());
+
+    const int allocations = allocationCount.load();
+    emulation->receiveData(output.constData(), output.size());
+    const qreal allocationsPerLine = static_cast<qreal>(allocationCount.load() - allocations) / lineCount;
+
+    // the output is decoded once per block, the lines scroll without
+    // allocating anything but the occasional block of the history
+    QTest::setBenchmarkResult(allocationsPerLine, QTest::Events);
+    QVERIFY2(allocationsPerLine < 0.05, qPrintable(QStringLiteral("%1 allocations per scrolled line").arg(allocationsPerLine)));
+
+    delete session;
+#endif
+}
+
+QTEST_MAIN(ScrollAllocationBenchmark)
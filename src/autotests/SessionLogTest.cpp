@@ -0,0 +1,187 @@
+/*
+    This file is part of Konsole, a terminal emulator for KDE.
+
+    Copyright 2018 by The Konsole Developers
+
+    This program is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    This program is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this program; if not, write to the Free Software
+    Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA
+    02110-1301  USA.
+*/
+
+// Own
+#include "SessionLogTest.h"
+
+// Qt
+#include <QFile>
+#include <QFileInfo>
+#include <QTemporaryDir>
+#include <QTextCodec>
+
+// KDE
+#include <KCompressionDevice>
+#include <qtest.h>
+
+// Konsole
+#include "../SessionLog.h"
+
+using namespace Konsole;
+
+static QByteArray readFile(const QString &fileName)
+{
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return QByteArray();
+    }
+    return file.readAll();
+}
+
+static void writeLog(SessionLog &log, const QByteArray &data)
+{
+    log.start();
+    log.write(data.constData(), data.size());
+    log.stop();
+    log.wait();
+}
+
+void SessionLogTest::testRawOutput()
+{
+    QTemporaryDir dir;
+    const QString fileName = SessionLog::logFileName(dir.path() + QLatin1String("/logs"), QStringLiteral("a/b"), 1);
+    QVERIFY(QFileInfo(fileName).fileName().startsWith(QLatin1String("a_b-")));
+
+    const QByteArray output("$ ls\r\n\033[01;34mdir\033[0m  file\r\n");
+    SessionLog log(fileName, SessionLog::RawOutput, false);
+    writeLog(log, output);
+
+    QVERIFY(log.errorString().isEmpty());
+    QCOMPARE(readFile(fileName), output);
+}
+
+void SessionLogTest::testPlainText()
+{
+    QTemporaryDir dir;
+    const QString fileName = dir.path() + QLatin1String("/text.log");
+
+    // colors, a window title, a character set designation, backspaces,
+    // and text in UTF-8 and ISO 8859-1
+    SessionLog log(fileName, SessionLog::PlainText, false);
+    log.setCodec(QTextCodec::codecForName("UTF-8"));
+    writeLog(log, QByteArray("\033]0;title\007$ ls\r\n\033[01;34mdir\033[0m  f\033(Bile\r\n"
+                             "abd\bc \xc3\xa4\r\n\033P1$r0m\033\\done\n"));
+    QCOMPARE(readFile(fileName), QByteArray("$ ls\ndir  file\nabc \xc3\xa4\ndone\n"));
+
+    SessionLog latin1Log(fileName + QLatin1String(".latin1"), SessionLog::PlainText, false);
+    latin1Log.setCodec(QTextCodec::codecForName("ISO 8859-1"));
+    writeLog(latin1Log, QByteArray("\xe4\n"));
+    QCOMPARE(readFile(fileName + QLatin1String(".latin1")), QByteArray("\xc3\xa4\n"));
+}
+
+void SessionLogTest::testCompressed()
+{
+    QTemporaryDir dir;
+    const QString fileName = dir.path() + QLatin1String("/compressed.log");
+
+    QByteArray output;
+    for (int i = 0; i < 10000; i++) {
+        output += "line " + QByteArray::number(i) + "\r\n";
+    }
+
+    SessionLog log(fileName, SessionLog::RawOutput, true);
+    writeLog(log, output);
+
+    QVERIFY(!QFile::exists(fileName));
+    QVERIFY(QFileInfo(fileName + QLatin1String(".gz")).size() < output.size() / 4);
+
+    KCompressionDevice device(fileName + QLatin1String(".gz"), KCompressionDevice::GZip);
+    QVERIFY(device.open(QIODevice::ReadOnly));
+    QCOMPARE(device.readAll(), output);
+}
+
+void SessionLogTest::testParts()
+{
+    QTemporaryDir dir;
+    const QString fileName = dir.path() + QLatin1String("/parts.log");
+
+    SessionLog log(fileName, SessionLog::RawOutput, false);
+    log.setMaxFileSize(10);
+    log.start();
+
+    // the first part is full once this is written
+    log.write("first line\n", 11);
+    QTRY_COMPARE(QFileInfo(fileName).size(), qint64(11));
+
+    log.write("second\n", 7);
+    log.stop();
+    log.wait();
+
+    QCOMPARE(readFile(fileName), QByteArray("first line\n"));
+    QCOMPARE(readFile(fileName + QLatin1String(".2")), QByteArray("second\n"));
+
+    // only the user may read the log
+    QCOMPARE(QFile::permissions(fileName) & (QFileDevice::ReadGroup | QFileDevice::ReadOther),
+             QFileDevice::Permissions());
+}
+
+void SessionLogTest::testMaxParts()
+{
+    QTemporaryDir dir;
+    const QString fileName = dir.path() + QLatin1String("/parts.log");
+
+    SessionLog log(fileName, SessionLog::RawOutput, false);
+    log.setMaxFileSize(5);
+    log.setMaxParts(2);
+    log.start();
+
+    // each write fills a part
+    for (int part = 1; part <= 4; part++) {
+        log.write("12345", 5);
+        const QString partName = part > 1 ? fileName + QLatin1Char('.') + QString::number(part) : fileName;
+        QTRY_COMPARE(QFileInfo(partName).size(), qint64(5));
+    }
+    log.stop();
+    log.wait();
+
+    // the fourth part was full, the fifth one has been started
+    QVERIFY(!QFile::exists(fileName));
+    QVERIFY(!QFile::exists(fileName + QLatin1String(".2")));
+    QVERIFY(!QFile::exists(fileName + QLatin1String(".3")));
+    QCOMPARE(readFile(fileName + QLatin1String(".4")), QByteArray("12345"));
+    QCOMPARE(readFile(fileName + QLatin1String(".5")), QByteArray());
+}
+
+void SessionLogTest::testDroppedOutput()
+{
+    QTemporaryDir dir;
+    const QString fileName = dir.path() + QLatin1String("/dropped.log");
+
+    // the thread is not running, the queue fills up
+    SessionLog log(fileName, SessionLog::RawOutput, false);
+    const QByteArray output(SessionLog::MAX_QUEUED_BYTES - 10, 'x');
+    log.write(output.constData(), output.size());
+    log.write("0123456789abcdef", 16);
+    // fits, but follows dropped output
+    log.write("01234", 5);
+    QCOMPARE(log.droppedBytes(), qint64(21));
+
+    log.start();
+    log.stop();
+    log.wait();
+
+    // the queued output is followed by a note about the dropped output
+    const QByteArray written = readFile(fileName);
+    QVERIFY(written.startsWith(output));
+    QCOMPARE(written.mid(output.size()), QByteArray("\n[Konsole: 21 bytes of output were not logged]\n"));
+}
+
+QTEST_GUILESS_MAIN(SessionLogTest)
@@ -22,6 +22,7 @@
 #include "TerminalCharacterDecoderTest.h"
 
 // Qt
+#include <QDateTime>
 #include <QStringList>
 #include <QTextStream>
 
@@ -85,6 +86,38 @@ void TerminalCharacterDecoderTest::testPlainTextDecoder()
     delete decoder;
 }
 
+void TerminalCharacterDecoderTest::testPlainTextTimestamps()
+{
+    // a wrapped line, with the time of its first part, and a line at an
+    // unknown time, passed as text
+    const QStringList lines = QStringList() << QStringLiteral("one") << QStringLiteral("two\n");
+    const QList<qint64> timestamps = QList<qint64>() << 1514764800000 << 1514764801500;
+
+    PlainTextDecoder decoder;
+    QVERIFY(!decoder.usesLineTimestamps());
+    decoder.setWriteTimestamps(true);
+    QVERIFY(decoder.usesLineTimestamps());
+
+    QString outputString;
+    QTextStream outputStream(&outputString);
+    decoder.begin(&outputStream);
+    for (int i = 0; i < lines.count(); i++) {
+        auto testCharacters = convertToCharacter(lines.at(i), QVector<RenditionFlags>());
+        decoder.setLineTimestamp(timestamps.at(i));
+        decoder.decodeLine(testCharacters, lines.at(i).size(), i == 0 ? LINE_WRAPPED : LINE_DEFAULT);
+        delete[] testCharacters;
+    }
+    const QString three = QStringLiteral("three");
+    decoder.setLineTimestamp(0);
+    decoder.decodeText(three.constData(), three.length(), QLatin1Char('\n'));
+    decoder.end();
+
+    const QString format = QStringLiteral("yyyy-MM-dd hh:mm:ss.zzz");
+    QCOMPARE(outputString, QLatin1Char('[') + QDateTime::fromMSecsSinceEpoch(timestamps.at(0)).toString(format)
+                           + QStringLiteral("] onetwo\n") + QString(format.length() + 3, QLatin1Char(' '))
+                           + QStringLiteral("three\n"));
+}
+
 void TerminalCharacterDecoderTest::testHTMLDecoder_data()
 {
     QTest::addColumn<QString>("text");
@@ -120,4 +153,90 @@ void TerminalCharacterDecoderTest::testHTMLDecoder()
     delete decoder;
 }
 
+void TerminalCharacterDecoderTest::testAnsiDecoder_data()
+{
+    QTest::addColumn<QString>("text");
+    QTest::addColumn<QVector<RenditionFlags>>("renditions");
+    QTest::addColumn<QString>("result");
+
+    QTest::newRow("simple text with default rendition") << "hello" << QVector<RenditionFlags>(6).fill(DEFAULT_RENDITION) << "hello";
+    QTest::newRow("simple text with bold rendition") << "hello" << QVector<RenditionFlags>(6).fill(RE_BOLD) << "\033[1mhello\033[0m";
+    QTest::newRow("simple text with underline and italic rendition") << "hello" << QVector<RenditionFlags>(6).fill(RE_UNDERLINE|RE_ITALIC) << "\033[3;4mhello\033[0m";
+    QTest::newRow("text with changing renditions") << "hello" << (QVector<RenditionFlags>() << RE_BOLD << (RE_BOLD|RE_UNDERLINE) << RE_UNDERLINE << RE_FAINT << DEFAULT_RENDITION) << "\033[1mh\033[4me\033[22ml\033[2;24ml\033[0mo";
+    QTest::newRow("line end resets the attributes") << "hi\n" << QVector<RenditionFlags>(3).fill(RE_REVERSE) << "\033[7mhi\033[0m\n";
+}
+
+void TerminalCharacterDecoderTest::testAnsiDecoder()
+{
+    QFETCH(QString, text);
+    QFETCH(QVector<RenditionFlags>, renditions);
+    QFETCH(QString, result);
+
+    TerminalCharacterDecoder *decoder = new AnsiDecoder();
+    auto testCharacters = convertToCharacter(text, renditions);
+    QString outputString;
+    QTextStream outputStream(&outputString);
+    decoder->begin(&outputStream);
+    decoder->decodeLine(testCharacters, text.size(), /* ignored */ LINE_DEFAULT);
+    decoder->end();
+    QCOMPARE(outputString, result);
+    delete[] testCharacters;
+    delete decoder;
+}
+
+void TerminalCharacterDecoderTest::testJsonLinesDecoder_data()
+{
+    QTest::addColumn<QString>("text");
+    QTest::addColumn<QVector<RenditionFlags>>("renditions");
+    QTest::addColumn<QString>("result");
+
+    QTest::newRow("simple text with default rendition") << "hello" << QVector<RenditionFlags>(6).fill(DEFAULT_RENDITION) << "{\"text\":\"hello\"}\n";
+    QTest::newRow("simple text with bold rendition") << "hello" << QVector<RenditionFlags>(6).fill(RE_BOLD) << "{\"text\":\"hello\",\"runs\":[{\"start\":0,\"length\":5,\"bold\":true}]}\n";
+    QTest::newRow("text with two runs") << "hello" << (QVector<RenditionFlags>() << RE_ITALIC << RE_ITALIC << DEFAULT_RENDITION << RE_UNDERLINE << RE_UNDERLINE) << "{\"text\":\"hello\",\"runs\":[{\"start\":0,\"length\":2,\"italic\":true},{\"start\":3,\"length\":2,\"underline\":true}]}\n";
+    QTest::newRow("text with quotes") << "\"a\\b\"\n" << QVector<RenditionFlags>(6).fill(DEFAULT_RENDITION) << "{\"text\":\"\\\"a\\\\b\\\"\"}\n";
+}
+
+void TerminalCharacterDecoderTest::testJsonLinesDecoder()
+{
+    QFETCH(QString, text);
+    QFETCH(QVector<RenditionFlags>, renditions);
+    QFETCH(QString, result);
+
+    TerminalCharacterDecoder *decoder = new JsonLinesDecoder();
+    auto testCharacters = convertToCharacter(text, renditions);
+    QString outputString;
+    QTextStream outputStream(&outputString);
+    decoder->begin(&outputStream);
+    decoder->decodeLine(testCharacters, text.size(), LINE_DEFAULT);
+    decoder->end();
+    QCOMPARE(outputString, result);
+    delete[] testCharacters;
+    delete decoder;
+}
+
+void TerminalCharacterDecoderTest::testAsciicastDecoder()
+{
+    const QStringList lines = QStringList() << QStringLiteral("one\n") << QStringLiteral("two\n")
+                                            << QStringLiteral("three\n") << QStringLiteral("four\n");
+    const QList<qint64> timestamps = QList<qint64>() << 1514764800000 << 1514764800000 << 1514764801500 << 0;
+
+    AsciicastDecoder decoder(80, 24);
+    QVERIFY(decoder.usesLineTimestamps());
+
+    QString outputString;
+    QTextStream outputStream(&outputString);
+    decoder.begin(&outputStream);
+    for (int i = 0; i < lines.count(); i++) {
+        auto testCharacters = convertToCharacter(lines.at(i), QVector<RenditionFlags>());
+        decoder.setLineTimestamp(timestamps.at(i));
+        decoder.decodeLine(testCharacters, lines.at(i).size(), LINE_DEFAULT);
+        delete[] testCharacters;
+    }
+    decoder.end();
+
+    QCOMPARE(outputString, QStringLiteral("{\"version\": 2, \"width\": 80, \"height\": 24, \"timestamp\": 1514764800}\n"
+                                          "[0.000000, \"o\", \"one\\r\\ntwo\\r\\n\"]\n"
+                                          "[1.500000, \"o\", \"three\\r\\nfour\\r\\n\"]\n"));
+}
+
 QTEST_GUILESS_MAIN(TerminalCharacterDecoderTest)
@@ -36,8 +36,14 @@ private Q_SLOTS:
     Character* convertToCharacter(QString text, QVector<RenditionFlags> renditions);
     void testPlainTextDecoder();
     void testPlainTextDecoder_data();
+    void testPlainTextTimestamps();
     void testHTMLDecoder();
     void testHTMLDecoder_data();
+    void testAnsiDecoder();
+    void testAnsiDecoder_data();
+    void testJsonLinesDecoder();
+    void testJsonLinesDecoder_data();
+    void testAsciicastDecoder();
 };
 
 }
@@ -22,6 +22,7 @@
 #include "MainWindow.h"
 #include "config-konsole.h" //krazy:exclude=includes
 #include "KonsoleSettings.h"
+#include "SessionManager.h"
 
 // OS specific
 #include <qplatformdefs.h>
@@ -185,6 +186,9 @@ extern "C" int Q_DECL_EXPORT kdemain(int argc, char *argv[])
         }
     }
 
+    // the output of the restored sessions has been read by now
+    SessionManager::instance()->pruneScrollbackArchives();
+
     // Since we've allocated the QApplication on the heap for the KDBusService workaround,
     // we need to delete it manually before returning from main().
     int ret = app->exec();